@@ -311,6 +311,7 @@ static void abort_signal(int sig, siginfo_t *si, void *uc)
 {
   signal(sig, SIG_DFL);
   siginfo_debug(si);
+  vlog_flush();
   _exit(sig);
 }
 
@@ -429,6 +429,7 @@ void __leavedos(int code, int sig, const char *s, int num)
     if (in_leavedos)
       {
        error("leavedos called recursively, forgetting the graceful exit!\n");
+       vlog_flush();
        _exit(1);
       }
 
@@ -562,6 +563,7 @@ void __leavedos_main_wrp(int code, int sig, const char *s, int num)
 {
     if (in_leavedos) {
      error("leavedos_main() called recursively, forgetting the graceful exit!\n");
+     vlog_flush();
      _exit(1);
     }
     in_leavedos++;
@@ -121,9 +121,24 @@ void init_port_traceing(void)
   clear_port_traceing();
 }
 
+/* the trace is formatted by the log writer */
+struct port_trace {
+  unsigned short port;
+  char op;
+  unsigned val;
+};
+
+static int port_trace_decode(char *buf, size_t size, const void *rec,
+    size_t len)
+{
+  const struct port_trace *t = rec;
+  return snprintf(buf, size, "%hx %c %x\n", t->port, t->op, t->val);
+}
+
 #define TT_printf(p,f,v,m) ({ \
   if (debug_level('T') && (test_bit(p, portlog_map) || debug_level('T') >= 5)) { \
-    log_printf("%hx %c %x\n", (unsigned short)p, f, v & m); \
+    struct port_trace t = { p, f, v & m }; \
+    vlog_record(port_trace_decode, &t, sizeof(t)); \
   } \
 })
 
@@ -559,15 +574,48 @@ void pci_port_outd(ioport_t port, Bit32u dword)
  * SIDOC_END_REMARK
  */
 
+/* let the device move the whole buffer if it can, for DF=0 */
+static Bit32u rep_in_bulk(ioport_t port, void *dest, int size, int df,
+	Bit32u count)
+{
+	int i;
+
+	if (df || !EMU_HANDLER(port).read_port_rep)
+		return 0;
+	for (i = 1; i < size; i++)
+		if (EMU_HANDLER(port).read_portb != EMU_HANDLER(port + i).read_portb)
+			return 0;
+	return EMU_HANDLER(port).read_port_rep(port, dest, size, count,
+			EMU_HANDLER(port).arg);
+}
+
+static Bit32u rep_out_bulk(ioport_t port, const void *src, int size, int df,
+	Bit32u count)
+{
+	int i;
+
+	if (df || !EMU_HANDLER(port).write_port_rep)
+		return 0;
+	for (i = 1; i < size; i++)
+		if (EMU_HANDLER(port).write_portb != EMU_HANDLER(port + i).write_portb)
+			return 0;
+	return EMU_HANDLER(port).write_port_rep(port, src, size, count,
+			EMU_HANDLER(port).arg);
+}
+
 int port_rep_inb(ioport_t port, Bit8u *base, int df, Bit32u count)
 {
 	register int incr = df? -1: 1;
 	Bit8u *dest = base;
 	int count_ = count;
+	Bit32u done;
 
 	if (count==0) return 0;
 	i_printf("Doing REP insb(%#x) %d bytes at %p, DF %d\n", port,
 		count, base, df);
+	done = rep_in_bulk(port, dest, 1, df, count);
+	dest += done;
+	count -= done;
 	while (count--) {
 	    *dest = port_inb(port);
 	    dest += incr;
@@ -587,10 +635,14 @@ int port_rep_outb(ioport_t port, Bit8u *base, int df, Bit32u count)
 	register int incr = df? -1: 1;
 	Bit8u *dest = base;
 	int count_ = count;
+	Bit32u done;
 
 	if (count==0) return 0;
 	i_printf("Doing REP outsb(%#x) %d bytes at %p, DF %d\n", port,
 		count, base, df);
+	done = rep_out_bulk(port, dest, 1, df, count);
+	dest += done;
+	count -= done;
 	while (count--) {
 	    port_outb(port, *dest);
 	    dest += incr;
@@ -610,10 +662,14 @@ int port_rep_inw(ioport_t port, Bit16u *base, int df, Bit32u count)
 	register int incr = df? -1: 1;
 	Bit16u *dest = base;
 	int count_ = count;
+	Bit32u done;
 
 	if (count==0) return 0;
 	i_printf("Doing REP insw(%#x) %d words at %p, DF %d\n", port,
 		count, base, df);
+	done = rep_in_bulk(port, dest, 2, df, count);
+	dest += done;
+	count -= done;
 	if (EMU_HANDLER(port).read_portw == NULL) {
 	  Bit16u res;
 	  while (count--) {
@@ -643,10 +699,14 @@ int port_rep_outw(ioport_t port, Bit16u *base, int df, Bit32u count)
 	register int incr = df? -1: 1;
 	Bit16u *dest = base;
 	int count_ = count;
+	Bit32u done;
 
 	if (count==0) return 0;
 	i_printf("Doing REP outsw(%#x) %d words at %p, DF %d\n", port,
 		count, base, df);
+	done = rep_out_bulk(port, dest, 2, df, count);
+	dest += done;
+	count -= done;
 	if (EMU_HANDLER(port).write_portw == NULL) {
 	  Bit16u res;
 	  while (count--) {
@@ -675,8 +735,17 @@ int port_rep_ind(ioport_t port, Bit32u *base, int df, Bit32u count)
 {
 	register int incr = df? -1: 1;
 	Bit32u *dest = base;
+	Bit32u done;
 
 	if (count==0) return 0;
+	done = rep_in_bulk(port, dest, 4, df, count);
+	if (debug_level('T')) {
+		Bit32u i;
+		for (i = 0; i < done; i++)
+			(void)LOG_PORT_READ_D(port, dest[i]);
+	}
+	dest += done;
+	count -= done;
 	while (count--) {
 	  *dest = port_ind(port);
 	  (void)LOG_PORT_READ_D(port, *dest);
@@ -689,8 +758,17 @@ int port_rep_outd(ioport_t port, Bit32u *base, int df, Bit32u count)
 {
 	register int incr = df? -1: 1;
 	Bit32u *dest = base;
+	Bit32u done;
 
 	if (count==0) return 0;
+	done = rep_out_bulk(port, dest, 4, df, count);
+	if (debug_level('T')) {
+		Bit32u i;
+		for (i = 0; i < done; i++)
+			LOG_PORT_WRITE_D(port, dest[i]);
+	}
+	dest += done;
+	count -= done;
 	while (count--) {
 	  port_outd(port, *dest);
 	  LOG_PORT_WRITE_D(port, *dest);
@@ -814,6 +892,8 @@ int port_init(void)
 	  port_handler[i].write_portw  = NULL;
 	  port_handler[i].read_portd   = NULL;
 	  port_handler[i].write_portd  = NULL;
+	  port_handler[i].read_port_rep  = NULL;
+	  port_handler[i].write_port_rep = NULL;
 	}
 
   /* handle 0 maps to the unmapped IO device handler.  Basically any
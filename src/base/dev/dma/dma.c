@@ -124,11 +124,66 @@ static void dma_update_DRQ(int dma_idx, int chan_idx)
     }
 }
 
+/* moves len bytes between buf and the memory at pa, a page at a time */
+static void dma_copy(int op, unsigned pa, Bit8u *buf, int len)
+{
+    void *addr;
+    int todo;
+
+    if (op == WRITE)
+	e_invalidate_pa(pa, len);
+    while (len) {
+	todo = _min(len, PAGE_SIZE - (pa & (PAGE_SIZE - 1)));
+	addr = physaddr_to_unixaddr(pa);
+	if (addr == MAP_FAILED) {
+	    if (op == WRITE) {
+		error_once0("DMA: write to unmapped address\n");
+		q_printf("DMA: write to unmapped address %#x\n", pa);
+	    } else {
+		error_once0("DMA: read from unmapped address\n");
+		q_printf("DMA: read from unmapped address %#x\n", pa);
+		memset(buf, 0xff, todo);
+	    }
+	} else if (op == WRITE) {
+	    memcpy(addr, buf, todo);
+	} else {
+	    memcpy(buf, addr, todo);
+	}
+	pa += todo;
+	buf += todo;
+	len -= todo;
+    }
+}
+
+/* returns 1 if the channel reached TC */
+static int dma_advance_count(int dma_idx, int chan_idx, int n)
+{
+    struct dma_channel *chan = &dma[dma_idx].chans[chan_idx];
+
+    chan->cur_count.value -= n;
+    if (chan->cur_count.value != 0xffff)
+	return 0;
+    /* overflow */
+    if (DMA_AUTOINIT(chan->mode)) {
+	q_printf("DMA: controller %i, channel %i reinitialized\n",
+		 dma_idx, chan_idx);
+	chan->cur_addr.value = chan->base_addr.value;
+	chan->cur_count.value = chan->base_count.value;
+	return 0;
+    }
+    /* TC */
+    q_printf("DMA: controller %i, channel %i TC\n", dma_idx, chan_idx);
+    dma[dma_idx].status |= 1 << chan_idx;
+    dma[dma_idx].request &= ~(1 << chan_idx);
+    /* the datasheet says it gets automatically masked too */
+    dma[dma_idx].mask |= 1 << chan_idx;
+    return 1;
+}
+
 static void dma_process_channel(int dma_idx, int chan_idx)
 {
     struct dma_channel *chan = &dma[dma_idx].chans[chan_idx];
     unsigned pa = (chan->page << 16) | (chan->cur_addr.value << dma_idx);
-    void *addr = physaddr_to_unixaddr(pa);
 
     /* first, do the transfer */
     switch (DMA_TRANSFER_OP(chan->mode)) {
@@ -136,22 +191,9 @@ static void dma_process_channel(int dma_idx, int chan_idx)
 	q_printf("DMA: verify mode does nothing\n");
 	break;
     case WRITE:
-	if (addr != MAP_FAILED) {
-	    e_invalidate_pa(pa, 1 << dma_idx);
-	    memcpy(addr, dma_data_bus, 1 << dma_idx);
-	} else {
-	    error_once0("DMA: write to unmapped address\n");
-	    q_printf("DMA: write to unmapped address %#x\n", pa);
-	}
-	break;
     case READ:
-	if (addr != MAP_FAILED)
-	    memcpy(dma_data_bus, addr, 1 << dma_idx);
-	else {
-	    error_once0("DMA: read from unmapped address\n");
-	    q_printf("DMA: read from unmapped address %#x\n", pa);
-	    memset(dma_data_bus, 0xff, sizeof(dma_data_bus));
-	}
+	dma_copy(DMA_TRANSFER_OP(chan->mode), pa, dma_data_bus,
+		1 << dma_idx);
 	break;
     case INVALID:
 	q_printf("DMA: invalid mode does nothing\n");
@@ -163,22 +205,41 @@ static void dma_process_channel(int dma_idx, int chan_idx)
 	chan->cur_addr.value += (DMA_ADDR_DEC(chan->mode) ? -1 : 1);
 
     /* and the counter */
-    chan->cur_count.value--;
-    if (chan->cur_count.value == 0xffff) {	/* overflow */
-	if (DMA_AUTOINIT(chan->mode)) {
-	    q_printf("DMA: controller %i, channel %i reinitialized\n",
-		     dma_idx, chan_idx);
-	    chan->cur_addr.value = chan->base_addr.value;
-	    chan->cur_count.value = chan->base_count.value;
-	} else {		/* TC */
-	    q_printf("DMA: controller %i, channel %i TC\n", dma_idx,
-		     chan_idx);
-	    dma[dma_idx].status |= 1 << chan_idx;
-	    dma[dma_idx].request &= ~(1 << chan_idx);
-	    /* the datasheet says it gets automatically masked too */
-	    dma[dma_idx].mask |= 1 << chan_idx;
-	}
+    dma_advance_count(dma_idx, chan_idx, 1);
+}
+
+/*
+ * Does what count pulses would do when each of them moves one unit,
+ * but a whole run at a time: a run ends at TC, at the autoinit reload
+ * or where the address wraps in its 64K page.
+ */
+static int dma_burst_channel(int dma_idx, int chan_idx, Bit8u *buf,
+	int count)
+{
+    struct dma_channel *chan = &dma[dma_idx].chans[chan_idx];
+    int op = DMA_TRANSFER_OP(chan->mode);
+    int done = 0, n;
+    unsigned off;
+
+    if (op == VERIFY || op == INVALID)
+	q_printf("DMA: %s mode does nothing\n",
+		op == VERIFY ? "verify" : "invalid");
+    while (done < count) {
+	off = (chan->cur_addr.value << dma_idx) & 0xffff;
+	n = _min(count - done, chan->cur_count.value + 1);
+	n = _min(n, (0x10000 - off) >> dma_idx);
+	if (op == READ || op == WRITE)
+	    dma_copy(op, (chan->page << 16) |
+		    (chan->cur_addr.value << dma_idx),
+		    buf + (done << dma_idx), n << dma_idx);
+	chan->cur_addr.value += n;
+	done += n;
+	if (dma_advance_count(dma_idx, chan_idx, n))
+	    break;
     }
+    q_printf("DMA: burst of %i (left %u) on controller %i channel %i\n",
+	     done, chan->cur_count.value, dma_idx, chan_idx);
+    return done;
 }
 
 static void dma_run_channel(int dma_idx, int chan_idx)
@@ -216,19 +277,40 @@ static void dma_process(void)
     DMA_UNLOCK();
 }
 
-int dma_pulse_DRQ(int ch, Bit8u * buf)
+static int dma_can_DACK(int ch)
 {
-    int ret = DMA_DACK;
     if (MASKED(DI(ch), CI(ch))) {
 	q_printf("DMA: channel %i masked, DRQ ignored\n", ch);
-	ret = DMA_NO_DACK;
+	return 0;
     }
     if ((dma[DI(ch)].status & 0xf0) || dma[DI(ch)].request) {
 	error("DMA: channel %i already active! (m=%#x s=%#x r=%#x)\n",
 	      ch, dma[DI(ch)].chans[CI(ch)].mode, dma[DI(ch)].status,
 	      dma[DI(ch)].request);
-	ret = DMA_NO_DACK;
+	return 0;
     }
+    return 1;
+}
+
+/* true if every pulse on the channel moves exactly one unit up */
+static int dma_can_burst(int dma_idx, int chan_idx)
+{
+    struct dma_channel *chan = &dma[dma_idx].chans[chan_idx];
+
+    switch (DMA_TRANSFER_MODE(chan->mode)) {
+    case SINGLE:
+    case DEMAND:
+	break;
+    default:
+	return 0;
+    }
+    return !DMA_ADDR_DEC(chan->mode) && !REACHED_TC(dma_idx, chan_idx) &&
+	    !(dma[dma_idx].command & 4) && (dma[dma_idx].command & 3) != 3;
+}
+
+int dma_pulse_DRQ(int ch, Bit8u * buf)
+{
+    int ret = dma_can_DACK(ch) ? DMA_DACK : DMA_NO_DACK;
 #if 0
     q_printf("DMA: pulse DRQ on channel %d\n", ch);
 #endif
@@ -245,6 +327,30 @@ int dma_pulse_DRQ(int ch, Bit8u * buf)
     return ret;
 }
 
+/*
+ * Same as count dma_pulse_DRQ() calls on consecutive units of buf
+ * (bytes on the first controller, words on the second). Returns the
+ * number of units DACKed, which is less than count after TC.
+ */
+int dma_burst_DRQ(int ch, Bit8u *buf, int count)
+{
+    int done;
+
+    if (!dma_can_burst(DI(ch), CI(ch))) {
+	for (done = 0; done < count; done++) {
+	    if (dma_pulse_DRQ(ch, buf + (done << DI(ch))) != DMA_DACK)
+		break;
+	}
+	return done;
+    }
+    if (!dma_can_DACK(ch))
+	return 0;
+    DMA_LOCK();
+    done = dma_burst_channel(DI(ch), CI(ch), buf, count);
+    DMA_UNLOCK();
+    return done;
+}
+
 
 /* lets ride on the cpp ass */
 #define d(x) (x-1)
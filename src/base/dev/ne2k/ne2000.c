@@ -33,6 +33,7 @@
 #include "port.h"
 #include "libpacket.h"
 #include "ne2000.h"
+#include "utilities.h"
 
 #define DEBUG_NE2000
 
@@ -172,6 +173,10 @@ static NE2000State ne2000state;
 // For io_device
 Bit16u ne2000_io_read16(ioport_t port, void *arg);
 void ne2000_io_write16(ioport_t port, Bit16u value, void *arg);
+static Bit32u ne2000_io_read_rep(ioport_t port, void *dest, int size,
+                                 Bit32u count, void *arg);
+static Bit32u ne2000_io_write_rep(ioport_t port, const void *src, int size,
+                                  Bit32u count, void *arg);
 Bit8u ne2000_io_read8(ioport_t port, void *arg);
 void ne2000_io_write8(ioport_t port, Bit8u value, void *arg);
 static void ne2000_irq_activate(int);
@@ -213,6 +218,8 @@ void ne2000_init(void)
     io_device.write_portb = ne2000_io_write8;
     io_device.read_portw = ne2000_io_read16;
     io_device.write_portw = ne2000_io_write16;
+    io_device.read_port_rep = ne2000_io_read_rep;
+    io_device.write_port_rep = ne2000_io_write_rep;
     io_device.read_portd = NULL;
     io_device.write_portd = NULL;
     io_device.handler_name = "NE2000 Emulation";
@@ -897,6 +904,69 @@ void ne2000_io_write16(ioport_t port, Bit16u value, void *arg)
         ne2000_write(s, addr, (uint8_t)value, 1); /* default to 8 bit */
 }
 
+/* --------------------------------- */
+/* REP INS/OUTS on the data port: copy the remote DMA run at once */
+
+/* how many items can be copied before the next one needs
+   ne2000_dma_update(): the last of the transfer raises RDC */
+static Bit32u ne2000_dma_run(NE2000State *s, int size, Bit32u count)
+{
+    Bit32u n;
+
+    if (size != ((s->dcfg & 0x01) ? 2 : 1) || s->rcnt <= size)
+        return 0;
+    if (size == 2 && (s->rsar & 1))
+        return 0;
+    n = _min(count, (s->rcnt - 1) / size);
+    if (s->rsar < s->stop && (s->stop - s->rsar) % size == 0)
+        n = _min(n, (s->stop - s->rsar) / size);
+    if (s->rsar < NE2000_PMEM_START || s->rsar + n * size > NE2000_MEM_SIZE)
+        return 0;
+    return n;
+}
+
+static void ne2000_dma_advance(NE2000State *s, Bit32u len)
+{
+    s->rsar += len;
+    if (s->rsar == s->stop)
+        s->rsar = s->start;
+    s->rcnt -= len;
+}
+
+static Bit32u ne2000_io_read_rep(ioport_t port, void *dest, int size,
+                                 Bit32u count, void *arg)
+{
+    NE2000State *s = &ne2000state;
+    Bit32u n, done = 0;
+
+    if (port - NE2000_IOBASE != 0x10)
+        return 0;
+    while ((n = ne2000_dma_run(s, size, count - done))) {
+        memcpy((uint8_t *)dest + done * size, s->mem + s->rsar, n * size);
+        ne2000_dma_advance(s, n * size);
+        done += n;
+    }
+    N_printf("NE2000: rep read of %u/%u items\n", done, count);
+    return done;
+}
+
+static Bit32u ne2000_io_write_rep(ioport_t port, const void *src, int size,
+                                  Bit32u count, void *arg)
+{
+    NE2000State *s = &ne2000state;
+    Bit32u n, done = 0;
+
+    if (port - NE2000_IOBASE != 0x10)
+        return 0;
+    while ((n = ne2000_dma_run(s, size, count - done))) {
+        memcpy(s->mem + s->rsar, (const uint8_t *)src + done * size, n * size);
+        ne2000_dma_advance(s, n * size);
+        done += n;
+    }
+    N_printf("NE2000: rep write of %u/%u items\n", done, count);
+    return done;
+}
+
 /* --------------------------------- */
 
 /* handle io reads from ne2000 */
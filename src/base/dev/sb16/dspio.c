@@ -33,6 +33,7 @@
 #include "emu.h"
 #include "timers.h"
 #include "sig.h"
+#include "utilities.h"
 #include "sound/sound.h"
 #include "sound/midi.h"
 #include "sound.h"
@@ -52,6 +53,8 @@ struct dspio_dma {
     unsigned int running:1;
     int num;
     int broken_hdma;
+    int hdma_carry;
+    Bit8u hdma_byte;
     int rate;
     int is16bit;
     int stereo;
@@ -310,6 +313,7 @@ void dspio_clear_fifos(struct dspio_state *dspio)
     rng_clear(&dspio->fifo_in);
     rng_clear(&dspio->fifo_out);
     dspio->dma.dsp_fifo_enabled = 1;
+    dspio->dma.hdma_carry = 0;
 }
 
 static void dspio_i_start(void *arg)
@@ -508,25 +512,56 @@ int dspio_input_disable(struct dspio_state *dspio, enum MixChan mc)
     return 1;
 }
 
-static int do_run_dma(struct dspio_state *state)
+/*
+ * Broken HDMA moves 16bit samples over an 8bit channel. TC may come
+ * between the two bytes of a sample, then the byte that is left over is
+ * carried to the next burst, so that the stream does not get out of step.
+ */
+static int broken_hdma_burst(struct dspio_dma *dma, Bit8u *buf, int n)
 {
-    Bit8u dma_buf[2];
+    int done, carry = dma->hdma_carry;
+
+    if (carry) {
+	if (dma->input) {
+	    /* the low byte of the sample went before TC */
+	    if (!dma_burst_DRQ(dma->num, &dma->hdma_byte, 1))
+		return 0;
+	    dma->hdma_carry = 0;
+	    return 1;
+	}
+	buf[0] = dma->hdma_byte;
+    }
+    done = carry + dma_burst_DRQ(dma->num, buf + carry, n * 2 - carry);
+    dma->hdma_carry = done & 1;
+    if (dma->hdma_carry)
+	dma->hdma_byte = dma->input ? buf[done] : buf[done - 1];
+    return done / 2;
+}
+
+/*
+ * Moves up to max samples with one DMA burst. The input is still
+ * sampled one at a time, as it is read from the input FIFO.
+ */
+static int do_run_dma(struct dspio_state *state, int max)
+{
+    Bit8u dma_buf[DSP_FIFO_SIZE * 2];
     struct dspio_dma *dma = &state->dma;
+    int i, n, unit = dma->is16bit ? 2 : 1;
 
-    dma_get_silence(dma->samp_signed, dma->is16bit, dma_buf);
+    n = dma->input ? 1 : max;
+    for (i = 0; i < n; i++)
+	dma_get_silence(dma->samp_signed, dma->is16bit, dma_buf + i * unit);
     if (!dma->silence) {
-	if (dma->input)
+	if (dma->input && !dma->hdma_carry)
 	    dspio_get_dma_data(state, dma_buf, dma->is16bit);
-	if (dma_pulse_DRQ(dma->num, dma_buf) != DMA_DACK) {
+	if (dma->broken_hdma)
+	    n = broken_hdma_burst(dma, dma_buf, n);
+	else
+	    n = dma_burst_DRQ(dma->num, dma_buf, n);
+	if (!n) {
 	    S_printf("SB: DMA %i doesn't DACK!\n", dma->num);
 	    return 0;
 	}
-	if (dma->broken_hdma) {
-	    if (dma_pulse_DRQ(dma->num, dma_buf + 1) != DMA_DACK) {
-		S_printf("SB: DMA (broken) %i doesn't DACK!\n", dma->num);
-		return 0;
-	    }
-	}
     }
     if (!dma->input) {
 	if (dma->adpcm && dma->adpcm_need_ref) {
@@ -534,20 +569,24 @@ static int do_run_dma(struct dspio_state *state)
 	    dma->adpcm_step = 0;
 	    dma->adpcm_need_ref = 0;
 	}
-	dspio_put_dma_data(state, dma_buf, dma->is16bit);
+	for (i = 0; i < n; i++)
+	    dspio_put_dma_data(state, dma_buf + i * unit, dma->is16bit);
     }
-    return 1;
+    return n;
 }
 
-static int dspio_run_dma(struct dspio_state *state)
+/* returns the number of samples moved, 0 if there was no DACK */
+static int dspio_run_dma(struct dspio_state *state, int max)
 {
 #define DMA_TIMEOUT_US 100000
-    int ret;
+    int i, ret;
     struct dspio_dma *dma = &state->dma;
     hitimer_t now = GETusTIME(0);
-    ret = do_run_dma(state);
+    /* the end of the block may raise an IRQ or stop the DMA */
+    ret = do_run_dma(state, _min(max, sb_dma_block_left()));
     if (ret) {
-	sb_handle_dma();
+	for (i = 0; i < ret; i++)
+	    sb_handle_dma();
 	dma->time_cur = now;
     } else {
 	sb_dma_nack();
@@ -574,6 +613,8 @@ static void get_dma_params(struct dspio_dma *dma)
     dma->num = dma_num;
     dma->is16bit = dma_16bit;
     dma->broken_hdma = broken_hdma;
+    if (!broken_hdma)
+	dma->hdma_carry = 0;
     dma->rate = sb_get_dma_sampling_rate();
     dma->stereo = sb_dma_samp_stereo();
     dma->samp_signed = sb_dma_samp_signed();
@@ -584,14 +625,22 @@ static void get_dma_params(struct dspio_dma *dma)
     dma->adpcm_need_ref = sb_dma_adpcm_ref();
 }
 
-static int dspio_fill_output(struct dspio_state *state)
+static int dspio_refill_output(struct dspio_state *state)
 {
-    int dma_cnt = 0;
+    int n, dma_cnt = 0;
     while (state->dma.running && !dspio_output_fifo_filled(state)) {
-	if (!dspio_run_dma(state))
+	n = dspio_run_dma(state, dspio_out_fifo_len(&state->dma) -
+		rng_count(&state->fifo_out));
+	if (!n)
 	    break;
-	dma_cnt++;
+	dma_cnt += n;
     }
+    return dma_cnt;
+}
+
+static int dspio_fill_output(struct dspio_state *state)
+{
+    int dma_cnt = dspio_refill_output(state);
 #if 0
     if (!state->output_running && !sb_output_fifo_empty())
 #else
@@ -607,7 +656,7 @@ static int dspio_drain_input(struct dspio_state *state)
 {
     int dma_cnt = 0;
     while (state->dma.running && !dspio_input_fifo_empty(state)) {
-	if (!dspio_run_dma(state))
+	if (!dspio_run_dma(state, 1))
 	    break;
 	dma_cnt++;
     }
@@ -694,11 +743,10 @@ static void dspio_process_dma(struct dspio_state *state)
     for (i = 0; i < nfr;) {
 	memset(n, 0, sizeof(n));
 	for (j = 0; j < state->dma.stereo + 1; j++) {
-	    if (state->dma.running && !dspio_output_fifo_filled(state)) {
-		if (!dspio_run_dma(state))
-		    break;
-		dma_cnt++;
-	    }
+	    /* refill in fragments rather than a sample at a time */
+	    if (state->dma.running && rng_count(&state->fifo_out) <
+		    dspio_out_fifo_len(&state->dma) / 2)
+		dma_cnt += dspio_refill_output(state);
 	    n[j] = dspio_get_output_sample(state, buf, i, j);
 	    if (!n[j]) {
 		if (out_fifo_cnt && debug_level('S') >= 5)
@@ -788,7 +836,7 @@ static void dspio_process_dma(struct dspio_state *state)
 	    in_fifo_cnt++;
 	for (j = 0; j < state->dma.stereo + 1; j++) {
 	    if (state->dma.running) {
-		if (!dspio_run_dma(state))
+		if (!dspio_run_dma(state, 1))
 		    break;
 		dma_cnt++;
 	    }
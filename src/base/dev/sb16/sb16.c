@@ -537,6 +537,12 @@ void sb_handle_dma(void)
 	sb.busy = 1;
 }
 
+/* units left till the end of the current block */
+int sb_dma_block_left(void)
+{
+    return sb.dma_count + 1;
+}
+
 void sb_dma_nack(void)
 {
     /* speedy reprograms DSP without exiting auto-init
@@ -0,0 +1,371 @@
+/*
+ * All modifications in this file to the original code are
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * DANG_BEGIN_MODULE
+ *
+ * REMARK
+ * Dirty tracking of the VGA memory without write faults.
+ *
+ * By default VGAEmu write-protects the video memory after every update
+ * and marks a page dirty when the guest faults on it. That is one
+ * SIGSEGV per page and frame, which adds up quickly in modes where the
+ * whole screen is redrawn all the time. The backends here let the
+ * kernel record the writes instead, and the pages stay writable:
+ *
+ *  uffd      - userfaultfd asynchronous write-protection, collected and
+ *              re-armed atomically with the PAGEMAP_SCAN ioctl.
+ *  softdirty - the soft-dirty bits of /proc/self/pagemap. Lossy: the
+ *              bits can't be read and cleared atomically, so a write
+ *              racing with the clear is missed. Clearing is also
+ *              process wide: it write-protects every page of dosemu,
+ *              and the first write to each of them faults again.
+ *
+ * The backend is selected with $_X_vga_dirty; "auto" only picks uffd,
+ * softdirty has to be asked for. With KVM the dirty log of the VM is
+ * used and none of this applies.
+ * /REMARK
+ *
+ * DANG_END_MODULE
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include "emu.h"
+#include "memory.h"
+#include "vgaemu.h"
+
+#if defined(UFFD_FEATURE_WP_ASYNC) && defined(PAGEMAP_SCAN)
+#define HAVE_UFFD_WP_ASYNC 1
+#endif
+
+#define PM_SOFT_DIRTY (1ULL << 55)
+
+static int pagemap_fd = -1;
+
+static int bitmap_size(void)
+{
+  return (vga.mem.pages + CHAR_BIT - 1) / CHAR_BIT;
+}
+
+static void mark_page(unsigned char *map, int page)
+{
+  map[page / CHAR_BIT] |= 1 << (page % CHAR_BIT);
+}
+
+static void *mapping_addr(int idx)
+{
+  return MEM_BASE32(vga.mem.map[idx].base_page * HOST_PAGE_SIZE);
+}
+
+/*
+ * soft-dirty backend
+ */
+
+static int clear_refs_fd = -1;
+/* writes collected but not yet handed out, per mapping */
+static unsigned char *sd_pending[VGAEMU_MAX_MAPPINGS];
+/* mappings that were handed out since the last clear */
+static unsigned sd_taken;
+/* mappings whose last map had dirty pages */
+static unsigned sd_active;
+
+static int sd_clear(void)
+{
+  return pwrite(clear_refs_fd, "4", 1, 0) == 1 ? 0 : -1;
+}
+
+static int sd_read(void *addr, int pages, uint64_t *ent)
+{
+  off_t off = (uintptr_t)addr / HOST_PAGE_SIZE * sizeof(*ent);
+  ssize_t len = pages * sizeof(*ent);
+
+  return pread(pagemap_fd, ent, len, off) == len ? 0 : -1;
+}
+
+static void sd_collect(int idx)
+{
+  int i, pages = vga.mem.map[idx].pages;
+  uint64_t ent[pages];
+
+  if (!pages)
+    return;
+  if (sd_read(mapping_addr(idx), pages, ent) == -1) {
+    /* can't tell, so everything is dirty */
+    memset(sd_pending[idx], 0xff, bitmap_size());
+    return;
+  }
+  for (i = 0; i < pages; i++)
+    if (ent[i] & PM_SOFT_DIRTY)
+      mark_page(sd_pending[idx], i);
+}
+
+/*
+ * A mapping is handed out once per clearing period. If it is asked
+ * for again, all mappings are collected and a new period is started.
+ * Otherwise its bits are read again without clearing, which catches
+ * the writes since the last clear; they are reported a second time
+ * after the next clear, which is harmless. That also covers the
+ * remapping in vga_emu_map(), where the old PTEs go away.
+ * A write that lands between the collection and the clear is lost.
+ * To not leave a stale frame behind at least when the screen settles,
+ * the first map without dirty pages after some that had them has all
+ * pages dirty; the line hashing of the renderer keeps that cheap.
+ * A page that is missed while other pages keep changing stays stale
+ * until then.
+ */
+static int sd_get_dirty_map(int idx, unsigned char *map)
+{
+  int i, dirty = 0;
+
+  if (sd_taken & (1 << idx)) {
+    for (i = 0; i < VGAEMU_MAX_MAPPINGS; i++)
+      sd_collect(i);
+    sd_clear();
+    sd_taken = 0;
+  } else {
+    sd_collect(idx);
+  }
+  for (i = 0; i < bitmap_size() && !dirty; i++)
+    dirty = sd_pending[idx][i];
+  if (dirty) {
+    memcpy(map, sd_pending[idx], bitmap_size());
+    sd_active |= 1 << idx;
+  } else if (sd_active & (1 << idx)) {
+    memset(map, 0xff, bitmap_size());
+    sd_active &= ~(1 << idx);
+  } else {
+    memset(map, 0, bitmap_size());
+  }
+  memset(sd_pending[idx], 0, bitmap_size());
+  sd_taken |= 1 << idx;
+  return 0;
+}
+
+/*
+ * The soft-dirty bits need CONFIG_MEM_SOFT_DIRTY, which not every
+ * kernel has; the files exist either way. Check that a write to a
+ * fresh page is actually seen.
+ */
+static int sd_probe(void)
+{
+  uint64_t ent;
+  unsigned char *p;
+  int ret = -1;
+
+  p = mmap(NULL, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return -1;
+  *(volatile unsigned char *)p = 1;
+  if (sd_clear() == 0 && sd_read(p, 1, &ent) == 0 &&
+      !(ent & PM_SOFT_DIRTY)) {
+    *(volatile unsigned char *)p = 2;
+    if (sd_read(p, 1, &ent) == 0 && (ent & PM_SOFT_DIRTY))
+      ret = 0;
+  }
+  munmap(p, HOST_PAGE_SIZE);
+  return ret;
+}
+
+static int sd_init(void)
+{
+  int i;
+
+  pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (pagemap_fd == -1 || clear_refs_fd == -1 || sd_probe() == -1)
+    goto err;
+  for (i = 0; i < VGAEMU_MAX_MAPPINGS; i++) {
+    sd_pending[i] = calloc(1, bitmap_size());
+    if (!sd_pending[i])
+      goto err;
+  }
+  /* the first request of every mapping starts a new period */
+  sd_taken = ~0;
+  return 0;
+
+err:
+  for (i = 0; i < VGAEMU_MAX_MAPPINGS; i++) {
+    free(sd_pending[i]);
+    sd_pending[i] = NULL;
+  }
+  if (pagemap_fd != -1)
+    close(pagemap_fd);
+  if (clear_refs_fd != -1)
+    close(clear_refs_fd);
+  pagemap_fd = clear_refs_fd = -1;
+  return -1;
+}
+
+static const struct vga_dirty_tracker sd_tracker = {
+  .name = "softdirty",
+  .get_dirty_map = sd_get_dirty_map,
+};
+
+/*
+ * uffd backend
+ */
+
+#ifdef HAVE_UFFD_WP_ASYNC
+static int uffd_fd = -1;
+/* the currently registered range of every mapping */
+static struct {
+  void *addr;
+  size_t len;
+} uffd_reg[VGAEMU_MAX_MAPPINGS];
+
+static int uffd_register(int idx)
+{
+  struct uffdio_register reg;
+  struct uffdio_writeprotect wp;
+  struct uffdio_range rng;
+
+  if (uffd_reg[idx].len) {
+    /* fails with ENOENT etc if the old vma is gone, that's fine */
+    rng.start = (uintptr_t)uffd_reg[idx].addr;
+    rng.len = uffd_reg[idx].len;
+    ioctl(uffd_fd, UFFDIO_UNREGISTER, &rng);
+    uffd_reg[idx].len = 0;
+  }
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+  reg.range.start = (uintptr_t)mapping_addr(idx);
+  reg.range.len = vga.mem.map[idx].pages * HOST_PAGE_SIZE;
+  if (ioctl(uffd_fd, UFFDIO_REGISTER, &reg) == -1) {
+    error("VGA: UFFDIO_REGISTER failed: %s\n", strerror(errno));
+    return -1;
+  }
+  wp.range = reg.range;
+  wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+  if (ioctl(uffd_fd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+    error("VGA: UFFDIO_WRITEPROTECT failed: %s\n", strerror(errno));
+    return -1;
+  }
+  uffd_reg[idx].addr = mapping_addr(idx);
+  uffd_reg[idx].len = reg.range.len;
+  return 0;
+}
+
+static int uffd_get_dirty_map(int idx, unsigned char *map)
+{
+  int pages = vga.mem.map[idx].pages;
+  struct page_region rgns[pages ?: 1];
+  struct pm_scan_arg arg = {};
+  uintptr_t start = (uintptr_t)mapping_addr(idx);
+  int i, j, ret;
+
+  memset(map, 0, bitmap_size());
+  if (!pages)
+    return 0;
+  if (uffd_reg[idx].addr != mapping_addr(idx) ||
+      uffd_reg[idx].len != pages * HOST_PAGE_SIZE) {
+    /* writes before the registration are unknown */
+    memset(map, 0xff, bitmap_size());
+    return uffd_register(idx);
+  }
+
+  arg.size = sizeof(arg);
+  arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+  arg.start = start;
+  arg.end = start + pages * HOST_PAGE_SIZE;
+  arg.vec = (uintptr_t)rgns;
+  arg.vec_len = pages;
+  arg.category_mask = PAGE_IS_WRITTEN;
+  arg.return_mask = PAGE_IS_WRITTEN;
+  ret = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+  if (ret == -1) {
+    memset(map, 0xff, bitmap_size());
+    return -1;
+  }
+  for (i = 0; i < ret; i++) {
+    int first = (rgns[i].start - start) / HOST_PAGE_SIZE;
+    int last = (rgns[i].end - start) / HOST_PAGE_SIZE;
+    for (j = first; j < last; j++)
+      mark_page(map, j);
+  }
+  return ret;
+}
+
+/* alias_mapping() replaced the vma, the registration went with it */
+static void uffd_remapped(int idx)
+{
+  uffd_reg[idx].len = 0;
+}
+
+static int uffd_init(void)
+{
+  struct uffdio_api api = {};
+
+  uffd_fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK |
+      UFFD_USER_MODE_ONLY);
+  if (uffd_fd == -1)
+    return -1;
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_HUGETLBFS_SHMEM;
+#ifdef UFFD_FEATURE_WP_UNPOPULATED
+  api.features |= UFFD_FEATURE_WP_UNPOPULATED;
+#endif
+  if (ioctl(uffd_fd, UFFDIO_API, &api) == -1)
+    goto err;
+  pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap_fd == -1)
+    goto err;
+  return 0;
+
+err:
+  close(uffd_fd);
+  uffd_fd = -1;
+  return -1;
+}
+
+static const struct vga_dirty_tracker uffd_tracker = {
+  .name = "uffd",
+  .get_dirty_map = uffd_get_dirty_map,
+  .remapped = uffd_remapped,
+};
+#endif
+
+/*
+ * Select the dirty tracking backend. Falls back to write faults if
+ * the requested one is not available.
+ */
+void vga_dirty_init(void)
+{
+  const char *b = config.X_vga_dirty;
+
+  if (!b || !b[0] || strcmp(b, "mprotect") == 0)
+    return;
+  /* KVM has its dirty log, remote DPMI writes elsewhere */
+  if (config.cpu_vm == CPUVM_KVM || config.cpu_vm_dpmi == CPUVM_KVM ||
+      config.dpmi_remote) {
+    v_printf("VGAEmu: vga_dirty_init: %s not used, keeping default tracking\n", b);
+    return;
+  }
+#ifdef HAVE_UFFD_WP_ASYNC
+  if ((strcmp(b, "auto") == 0 || strcmp(b, "uffd") == 0) &&
+      uffd_init() == 0) {
+    vgaemu_register_dirty_tracker(&uffd_tracker);
+    return;
+  }
+#endif
+  /* lossy, so only on request */
+  if (strcmp(b, "softdirty") == 0 && sd_init() == 0) {
+    vgaemu_register_dirty_tracker(&sd_tracker);
+    return;
+  }
+  warn("VGA: dirty tracking \"%s\" not available, using write faults\n", b);
+}
@@ -309,6 +309,8 @@ static void vgaemu_adjust_instremu(int value);
 static Bit32u rasterop(Bit32u value);
 static pthread_mutex_t prot_mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_rwlock_t mode_mtx = PTHREAD_RWLOCK_INITIALIZER;
+static int (*dirty_hook)(int, unsigned char *);
+static const struct vga_dirty_tracker *dirty_tracker;
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /*
@@ -1223,6 +1225,9 @@ int vga_emu_protect_page(unsigned page, int prot, int instremu)
   /* don't call mprotect at all on LFB with KVM */
   if (config.cpu_vm_dpmi == CPUVM_KVM && page >= vga.mem.lfb_base_page)
     return 0;
+  /* the dirty tracker sees the writes, RO is only needed for inst_emu */
+  if (dirty_tracker && !dirty_hook && !vga.inst_emu && prot == RO)
+    prot = RW;
 
   sys_prot = prot == RW ? VGA_EMU_RW_PROT : prot == RO ? VGA_EMU_RO_PROT : VGA_EMU_NONE_PROT;
 
@@ -1427,14 +1432,31 @@ static void _vga_kvm_sync_dirty_map(unsigned mapping)
   kvm_get_dirty_map(base, vga.mem.dirty_bitmap);
 }
 
-static int (*dirty_hook)(int, unsigned char *);
-
 void vgaemu_register_dirty_hook(int (*hook)(int, unsigned char *))
 {
   assert(!dirty_hook);
   dirty_hook = hook;
 }
 
+void vgaemu_register_dirty_tracker(const struct vga_dirty_tracker *tracker)
+{
+  assert(!dirty_tracker);
+  dirty_tracker = tracker;
+  vga_msg("vgaemu_register_dirty_tracker: %s\n", tracker->name);
+}
+
+/* prot_mtx should be locked by caller */
+static void get_dirty_map(int mapping)
+{
+  if (dirty_hook)
+    dirty_hook(mapping, vga.mem.dirty_bitmap);
+  else if (dirty_tracker)
+    dirty_tracker->get_dirty_map(mapping, vga.mem.dirty_bitmap);
+  else
+    _vga_kvm_sync_dirty_map(mapping);
+  sync_dirty_map(mapping);
+}
+
 /*
  * Map the VGA memory.
  *
@@ -1475,13 +1497,8 @@ static int vga_emu_map(unsigned mapping, unsigned first_page)
 
   i = 0;
   pthread_mutex_lock(&prot_mtx);
-  if (vga.mode_class == GRAPH && !vga.inst_emu) {
-    if (dirty_hook)
-      dirty_hook(mapping, vga.mem.dirty_bitmap);
-    else
-      _vga_kvm_sync_dirty_map(mapping);
-    sync_dirty_map(mapping);
-  }
+  if (vga.mode_class == GRAPH && !vga.inst_emu)
+    get_dirty_map(mapping);
   if (mapping == VGAEMU_MAP_BANK_MODE) {
     int cap = MAPPING_VGAEMU;
     if (vga.inst_emu && interp_inst_emu_count)
@@ -1489,6 +1506,8 @@ static int vga_emu_map(unsigned mapping, unsigned first_page)
     i = alias_mapping(cap,
       vmt->base_page * HOST_PAGE_SIZE, vmt->pages * HOST_PAGE_SIZE,
       prot, vga.mem.base + (first_page * HOST_PAGE_SIZE));
+    if (i != -1 && dirty_tracker && dirty_tracker->remapped)
+      dirty_tracker->remapped(mapping);
   }
 
   if(i == -1) {
@@ -1753,6 +1772,7 @@ static int vga_emu_post_init(void)
     vga.mem.map[VGAEMU_MAP_LFB_MODE].pages = vga.mem.pages;
   }
   vga_emu_setup_mode_table();
+  vga_dirty_init();
 
   vgaemu_register_ports();
 
@@ -2493,13 +2513,8 @@ static int _is_dirty(void)
   int i, ret = 0;
 
   if (vga.mode_class == GRAPH && !vga.inst_emu) {
-    for (i = 0; i < VGAEMU_MAX_MAPPINGS; i++) {
-      if (dirty_hook)
-        dirty_hook(i, vga.mem.dirty_bitmap);
-      else
-        _vga_kvm_sync_dirty_map(i);
-      sync_dirty_map(i);
-    }
+    for (i = 0; i < VGAEMU_MAX_MAPPINGS; i++)
+      get_dirty_map(i);
   }
 
   if (vga.mem.dirty_map) {
@@ -2642,6 +2657,7 @@ void dirty_all_video_pages(void)
   pthread_mutex_lock(&prot_mtx);
   if (vga.mem.dirty_map)
     memset(vga.mem.dirty_map, 1, vga.mem.pages);
+  vga.mem.redraw_gen++;
   pthread_mutex_unlock(&prot_mtx);
 }
 
@@ -42,6 +42,7 @@
 #include "dos2linux.h"
 #include "mapping.h"
 #include "sig.h"
+#include "timers.h"
 
 #ifndef X86_EFLAGS_FIXED
 #define X86_EFLAGS_FIXED 2
@@ -159,6 +160,15 @@ static struct kvm_cpuid2 *cpuid;
 static struct kvm_run *run;
 static int kvmfd, vmfd, vcpufd;
 static struct kvm_sregs sregs;
+/* with KVM_CAP_SYNC_REGS the registers are exchanged through
+   run->s.regs instead of the GET/SET ioctls */
+static int sync_regs;
+static struct {
+  hitimer_t start;
+  unsigned runs;
+  unsigned reg_ioctls;
+  unsigned reg_syncs;
+} kvm_stats;
 
 #if USE_CMMIO
 static int cmi_offs;
@@ -495,6 +505,15 @@ static int init_kvm_vcpu(void)
     return 0;
   }
   run->exit_reason = KVM_EXIT_INTR;
+#ifdef KVM_SYNC_X86_SREGS
+  ret = ioctl(kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_SYNC_REGS);
+  if (ret > 0 && (ret & (KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS)) ==
+      (KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS)) {
+    /* the kernel stores them on every exit */
+    run->kvm_valid_regs = KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS;
+    sync_regs = 1;
+  }
+#endif
   return 1;
 }
 
@@ -1061,9 +1080,19 @@ void kvm_leave(int pm)
   }
 }
 
-static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
+static void kvm_get_regs(struct kvm_regs *kregs)
 {
-  int ret = ioctl(vcpufd, KVM_GET_REGS, kregs);
+  int ret;
+
+#ifdef KVM_SYNC_X86_SREGS
+  if (sync_regs) {
+    *kregs = run->s.regs.regs;
+    sregs = run->s.regs.sregs;
+    kvm_stats.reg_syncs++;
+    return;
+  }
+#endif
+  ret = ioctl(vcpufd, KVM_GET_REGS, kregs);
   if (ret == -1) {
     perror("KVM: KVM_GET_REGS");
     leavedos_main(99);
@@ -1073,6 +1102,58 @@ static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
     perror("KVM: KVM_GET_SREGS");
     leavedos_main(99);
   }
+  kvm_stats.reg_ioctls += 2;
+}
+
+static void kvm_set_regs(const struct kvm_regs *kregs)
+{
+  int ret;
+
+#ifdef KVM_SYNC_X86_SREGS
+  if (sync_regs) {
+    /* picked up by the next KVM_RUN */
+    run->s.regs.regs = *kregs;
+    run->s.regs.sregs = sregs;
+    run->kvm_dirty_regs = KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS;
+    kvm_stats.reg_syncs++;
+    return;
+  }
+#endif
+  ret = ioctl(vcpufd, KVM_SET_REGS, kregs);
+  if (ret == -1) {
+    perror("KVM: KVM_SET_REGS");
+    leavedos_main(99);
+  }
+  ret = ioctl(vcpufd, KVM_SET_SREGS, &sregs);
+  if (ret == -1) {
+    perror("KVM: KVM_SET_SREGS");
+    leavedos_main(99);
+  }
+  kvm_stats.reg_ioctls += 2;
+}
+
+/* once a second with -Dg */
+static void kvm_print_stats(void)
+{
+  hitimer_t now;
+
+  if (!debug_level('g'))
+    return;
+  now = GETusTIME(0);
+  if (!kvm_stats.start)
+    kvm_stats.start = now;
+  if (now - kvm_stats.start < 1000000)
+    return;
+  g_printf("KVM: %u KVM_RUN, %u register ioctls, %u register syncs in %llums\n",
+	   kvm_stats.runs, kvm_stats.reg_ioctls, kvm_stats.reg_syncs,
+	   (unsigned long long)(now - kvm_stats.start) / 1000);
+  memset(&kvm_stats, 0, sizeof(kvm_stats));
+  kvm_stats.start = now;
+}
+
+static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
+{
+  kvm_get_regs(kregs);
   /* don't interrupt GDT code */
   if (!(kregs->rflags & X86_EFLAGS_VM) && !(sregs.cs.selector & 4)) {
     g_printf("KVM: interrupt in GDT code, resuming\n");
@@ -1164,6 +1245,7 @@ static void do_exit_mmio(void)
   do {
     do_mmio();
     ret = ioctl(vcpufd, KVM_RUN, NULL);
+    kvm_stats.runs++;
     /* read-modify-write instructions give two KVM_EXIT_MMIO
        exits in a row before the signal exit */
   } while (ret == 0 && run->exit_reason == KVM_EXIT_MMIO);
@@ -1185,8 +1267,6 @@ static unsigned int kvm_run(void)
     /* Only set registers if changes happened, usually
        this means a hardware interrupt or sometimes
        a callback, and also for the very first call to boot */
-    int ret;
-
     kregs.rax = regs->eax;
     kregs.rbx = regs->ebx;
     kregs.rcx = regs->ecx;
@@ -1197,11 +1277,6 @@ static unsigned int kvm_run(void)
     kregs.rsp = regs->esp;
     kregs.rip = regs->eip;
     kregs.rflags = regs->eflags;
-    ret = ioctl(vcpufd, KVM_SET_REGS, &kregs);
-    if (ret == -1) {
-      perror("KVM: KVM_SET_REGS");
-      leavedos_main(99);
-    }
 
     if (regs->eflags & X86_EFLAGS_VM) {
       set_vm86_seg(&sregs.cs, regs->cs);
@@ -1218,17 +1293,15 @@ static unsigned int kvm_run(void)
       set_ldt_seg(&sregs.gs, regs->__null_gs);
       set_ldt_seg(&sregs.ss, regs->ss);
     }
-    ret = ioctl(vcpufd, KVM_SET_SREGS, &sregs);
-    if (ret == -1) {
-      perror("KVM: KVM_SET_SREGS");
-      leavedos_main(99);
-    }
+    kvm_set_regs(&kregs);
   }
 
   while (!exit_reason) {
     int ret = ioctl(vcpufd, KVM_RUN, NULL);
     int errn = errno;
 
+    kvm_stats.runs++;
+
     /* KVM should only exit for four reasons:
        1. KVM_EXIT_HLT: at the hlt in kvmmon.S following an exception.
           In this case the registers are pushed on and popped from the stack.
@@ -1307,6 +1380,7 @@ static unsigned int kvm_run(void)
       break;
     }
   }
+  kvm_print_stats();
   return exit_reason;
 }
 
@@ -55,6 +55,13 @@
  * Both functions use a variable parameter approach, just to make them
  *	hard to follow ;-)
  *
+ * The ops issued by the front-end for runs of the most common
+ * instructions are also recorded, with their parameters already decoded,
+ * into threaded sequences indexed by PC. Every recorded op carries its
+ * handler. When the same PC is met again, SimExec() checks the source
+ * bytes of the sequence once and calls the handlers in a row, without
+ * decoding anything.
+ *
  */
 
 #include <stddef.h>
@@ -82,7 +89,82 @@ static unsigned int P0 = (unsigned)-1;
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define	Offs_From_Arg()		(signed char)(va_arg(ap,int))
+#define SIMOP_ARGS	6	/* max parameters of a Gen/AddrGen call */
+#define SIMSEQ_OPS	128	/* max ops of a sequence */
+#define SIMSEQ_INSNS	32	/* max instructions of a sequence */
+#define SIMSEQ_SRC	128	/* max source bytes of a sequence */
+#define SIMINSN_SRC	24	/* source read for an instruction: 15 bytes,
+				 * plus a jmp following a Jcc */
+#define SIMHASH_BITS	12
+#define SIMHASH_SIZE	(1 << SIMHASH_BITS)
+#define SIMHASH(pc)	(((pc) ^ ((pc) >> SIMHASH_BITS)) & (SIMHASH_SIZE-1))
+#define SIMSEQ_MAX	0x8000	/* the cache is flushed when full */
+
+struct simop;
+typedef int (*SimFn)(const struct simop *o);
+
+typedef struct simop {
+	SimFn fn;			/* handler, returns nonzero to bail out */
+	unsigned char kind, nargs;
+	int op, mode;
+	int a[SIMOP_ARGS];
+} SimOp;
+
+#define SIMI_STORE	1	/* the instruction writes to memory */
+
+typedef struct {
+	unsigned char ofs, nops;	/* offset in the sequence, ops */
+	unsigned char flags;
+	signed char ovds, ovss;		/* segment overrides */
+} SimInsn;
+
+typedef struct simseq {
+	struct simseq *next;		/* hash chain */
+	unsigned int pc, csbase;	/* key, together with */
+	int basemode, v86;		/* the mode at entry */
+	int mode, cpumode;		/* _mode and TheCPU.mode at the end */
+	unsigned int npc;		/* next PC when not ending with a jump, */
+	unsigned int cpc;		/* else the parameters of its */
+	int cmode;			/* CloseAndExec */
+	unsigned char len, nops, ninsns, jump;
+	SimInsn *insn;
+	unsigned char *src;		/* source bytes of the sequence */
+	SimOp ops[];
+} SimSeq;
+
+SimSeq *SimRec;			/* sequence an instruction is recorded into */
+static SimSeq *SimOpen;		/* sequence under recording, if any */
+static SimSeq *SimRecBuf;
+static SimInsn SimRecInsns[SIMSEQ_INSNS];
+static unsigned char SimRecSrc[SIMSEQ_SRC];
+static int SimRecN;		/* ops recorded, with the current instruction */
+static int SimRecSrcN;		/* source bytes read for it */
+static unsigned char SimRecJump;	/* and its kind, see SimOpOk */
+static SimSeq *SimHash[SIMHASH_SIZE];
+static int SimSeqs;
+int SimHits, SimMisses;
+
+static inline int SimRecArg(int v)
+{
+	if (SimRec) {
+		SimOp *o = &SimRec->ops[SimRecN-1];
+		if (o->nargs < SIMOP_ARGS)
+			o->a[o->nargs++] = v;
+		else
+			SimRec = NULL;
+	}
+	return v;
+}
+
+static void _AddrGen_sim(int op, int mode, va_list *ap, const int *a);
+static void _Gen_sim(int op, int mode, va_list *ap, const int *a);
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* parameters come either from the va_list of a Gen/AddrGen call, while
+ * being copied to the block under recording, or from a recorded op */
+#define GARG(t)			(a ? (t)*a++ : (t)SimRecArg(va_arg(*ap, t)))
+#define	Offs_From_Arg()		(signed char)(GARG(int))
 
 /* WARNING - these are signed char offsets, NOT pointers! */
 char OVERR_DS=Ofs_XDS, OVERR_SS=Ofs_XSS;
@@ -147,12 +229,28 @@ static inline int is_of_set(void)
 	return ((RFL.cout >> 31) ^ (RFL.cout >> 30)) & 1;
 }
 
-#define SET_CF(c)	CPUBYTE(Ofs_FLAGS)=((CPUBYTE(Ofs_FLAGS)&0xfe)|(c))
+/* CF is lazy, too: after an add or sub it is only kept in bit 31 of
+ * RFL.cout (RFL.cfp set) and goes to the real flags when it is read,
+ * when RFL.cout is about to be reused, or at FlagSync_All time.
+ * The real CF is valid only when RFL.cfp is zero. */
+static inline int is_cf_set(void)
+{
+	if (RFL.cfp)
+	    return (RFL.cout >> 31) & 1;
+	return CPUBYTE(Ofs_FLAGS) & 1;
+}
+
+#define SET_CF(c)	(RFL.cfp=0, CPUBYTE(Ofs_FLAGS)=((CPUBYTE(Ofs_FLAGS)&0xfe)|(c)))
+
+static inline void FlagSync_C (void)
+{
+	if (RFL.cfp) SET_CF((RFL.cout >> 31) & 1);
+}
 
 /* add/sub rule for carry using MSB:
  * the carry-out expressions from Bochs 2.6 are used here.
  * RFL.cout is a cheap-to-compute 32-bit word that encodes the following flags:
- * CF is bit 31
+ * CF is bit 31 (not copied to the real flags until needed, see is_cf_set)
  * OF is bit 31 xor bit 30
  * AF is bit 3
  *
@@ -173,8 +271,7 @@ static inline void FlagHandleAdd(unsigned src1, unsigned src2, unsigned res,
 	if (wordsize == 32) RFL.cout = cout;
 	if (wordsize == 16) RFL.cout = ((cout >> 14) << 30) | (cout & 8);
 	if (wordsize == 8)  RFL.cout = ((cout >> 6) << 30) | (cout & 8);
-	int cy = cout >> (wordsize - 1);
-	SET_CF(cy & 1);
+	RFL.cfp = 1;
 }
 
 static inline void FlagHandleSub(unsigned src1, unsigned src2, unsigned res,
@@ -184,13 +281,13 @@ static inline void FlagHandleSub(unsigned src1, unsigned src2, unsigned res,
 	if (wordsize == 32) RFL.cout = cout;
 	if (wordsize == 16) RFL.cout = ((cout >> 14) << 30) | (cout & 8);
 	if (wordsize == 8)  RFL.cout = ((cout >> 6) << 30) | (cout & 8);
-	int cy = cout >> (wordsize - 1);
-	SET_CF(cy & 1);
+	RFL.cfp = 1;
 }
 
 static inline void FlagHandleIncDec(unsigned low, unsigned high, int wordsize)
 {
 	unsigned int cout = low & ~high;
+	FlagSync_C();	/* CF is unaffected and may still live in RFL.cout */
 	if (wordsize == 32) RFL.cout = cout;
 	if (wordsize == 16) RFL.cout = ((cout >> 14) << 30) | (cout & 8);
 	if (wordsize == 8)  RFL.cout = ((cout >> 6) << 30) | (cout & 8);
@@ -325,6 +422,7 @@ void FlagSync_AP (void)
 void FlagSync_All (void)
 {
 	int nf,mk;
+	FlagSync_C();
 	if (RFL.valid==V_INVALID) return;
 	nf = FlagSync_AP_() | FlagSync_NZ();
 	if (RFL.mode & IGNOVF)
@@ -348,33 +446,33 @@ void InitGen_sim(void)
 	CloseAndExec = CloseAndExec_sim;
 	RFL.cout = RFL.RES.d = 0;
 	RFL.valid = V_INVALID;
+	RFL.cfp = 0;
 }
 
 /*
  * address generator unit
  * careful - do not use eax, and NEVER change any flag!
  */
-void AddrGen_sim(int op, int mode, ...)
+static void _AddrGen_sim(int op, int mode, va_list *ap, const int *a)
 {
-	va_list	ap;
 #if PROFILE
 	hitimer_t t0 = 0;
 	if (debug_level('e')) t0 = GETTSC();
 #endif
 
-	va_start(ap, mode);
+	if (SimRec && !a) SimRecOp(SOP_ADDR, op, mode);
 	switch(op) {
 	case A_DI_0:			// base(32), imm
 	case A_DI_1: {			// base(32), {imm}, reg, {shift}
 			long idsp=0;
 			signed char ofs;
-			ofs = va_arg(ap,int);
+			ofs = GARG(int);
 			if (mode & MLEA) {		// discard base	reg
 				AR1.d = 0;	// ofs = Ofs_RZERO;
 			}
 			else AR1.d = CPULONG(ofs);
 
-			idsp = va_arg(ap,int);
+			idsp = GARG(int);
 			if (op==A_DI_0) {
 				GTRACE3("A_DI_0",0xff,0xff,idsp);
 				TR1.d = idsp;
@@ -396,13 +494,13 @@ void AddrGen_sim(int op, int mode, ...)
 	case A_DI_2: {			// base(32), {imm}, reg, reg, {shift}
 			long idsp=0;
 			signed char ofs;
-			ofs = va_arg(ap,int);
+			ofs = GARG(int);
 			if (mode & MLEA) {		// discard base	reg
 				AR1.d = 0;	// ofs = Ofs_RZERO;
 			}
 			else AR1.d = CPULONG(ofs);
 
-			idsp = va_arg(ap,int);
+			idsp = GARG(int);
 			if (mode & ADDR16) {
 				signed char o1 = Offs_From_Arg();
 				signed char o2 = Offs_From_Arg();
@@ -414,7 +512,7 @@ void AddrGen_sim(int op, int mode, ...)
 				signed char o1 = Offs_From_Arg();
 				signed char o2 = Offs_From_Arg();
 				unsigned char sh;
-				sh = (unsigned char)(va_arg(ap,int));
+				sh = (unsigned char)(GARG(int));
 				GTRACE5("A_DI_2",o1,ofs,o2,idsp,sh);
 				TR1.d = CPULONG(o1) +
 				  (CPULONG(o2) << (sh & 0x1f)) + idsp;
@@ -432,9 +530,9 @@ void AddrGen_sim(int op, int mode, ...)
 			else {
 				AR1.d = CPULONG(OVERR_DS);
 			}
-			idsp = va_arg(ap,int);
+			idsp = GARG(int);
 			o = Offs_From_Arg();
-			sh = (unsigned char)(va_arg(ap,int));
+			sh = (unsigned char)(GARG(int));
 			GTRACE4("A_DI_2D",o,0xff,idsp,sh);
 			TR1.d = (CPULONG(o) << (sh & 0x1f)) + idsp;
 			AR1.d += TR1.d;
@@ -449,23 +547,30 @@ void AddrGen_sim(int op, int mode, ...)
 		}
 		break;
 	}
-	va_end(ap);
 #if PROFILE
 	if (debug_level('e')) GenTime += (GETTSC() - t0);
 #endif
 }
 
-void Gen_sim(int op, int mode, ...)
+void AddrGen_sim(int op, int mode, ...)
+{
+	va_list	ap;
+
+	va_start(ap, mode);
+	_AddrGen_sim(op, mode, &ap, NULL);
+	va_end(ap);
+}
+
+static void _Gen_sim(int op, int mode, va_list *ap, const int *a)
 {
-	va_list ap;
 	uint32_t S1, S2;
 #if PROFILE
 	hitimer_t t0 = 0;
 	if (debug_level('e')) t0 = GETTSC();
 #endif
 
+	if (SimRec && !a) SimRecOp(SOP_GEN, op, mode);
 	P0 = (unsigned)-1;
-	va_start(ap, mode);
 	switch(op) {
 	case L_NOP:
 		GTRACE0("L_NOP");
@@ -477,8 +582,8 @@ void Gen_sim(int op, int mode, ...)
 		break;
 
 	case O_FOP: {
-		unsigned char exop = (unsigned char)va_arg(ap,int);
-		int reg = va_arg(ap,int);
+		unsigned char exop = (unsigned char)GARG(int);
+		int reg = GARG(int);
 		GTRACE2("O_FPOP",exop,reg);
 		if (Fp87_op(exop, reg))
 		    TheCPU.err = -96;
@@ -531,7 +636,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case S_DI_IMM: {
-		int v = va_arg(ap,int);
+		int v = GARG(int);
 		dosaddr_t addr = AR1.d;
 		if (mode&MBYTE) {
 			GTRACE3("S_DI_IMM_B",0xff,0xff,v);
@@ -545,7 +650,7 @@ void Gen_sim(int op, int mode, ...)
 
 	case L_IMM: {
 		signed char o = Offs_From_Arg();
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		GTRACE3("L_IMM",o,0xff,v);
 		if (mode & MBYTE) {
 			CPUBYTE(o) = (signed char)v;
@@ -558,7 +663,7 @@ void Gen_sim(int op, int mode, ...)
 		} }
 		break;
 	case L_IMM_R1: {
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		GTRACE3("L_IMM_R1",0xff,0xff,v);
 		if (mode & MBYTE) {
 			DR1.b.bl = (signed char)v;
@@ -572,7 +677,7 @@ void Gen_sim(int op, int mode, ...)
 		break;
 	case L_MOVZS: {
 		signed char o;
-		int rcod = va_arg(ap,int)&1;	// 0=z 1=s
+		int rcod = GARG(int)&1;	// 0=z 1=s
 		o = Offs_From_Arg();
 		GTRACE3("L_MOVZS",o,0xff,rcod);
 		if (mode & MBYTX) {
@@ -654,7 +759,7 @@ void Gen_sim(int op, int mode, ...)
 
 	case O_ADD_R: {		// OSZAPC
 		register wkreg v;
-		v.d = va_arg(ap, int);
+		v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_ADD;
 		if (mode & IMMED) {GTRACE3("O_ADD_R",0xff,0xff,v.d);}
@@ -684,7 +789,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_OR_R: {		// O=0 SZP C=0
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_OR_R",0xff,0xff,v);}
@@ -706,7 +811,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_AND_R: {		// O=0 SZP C=0
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_AND_R",0xff,0xff,v);}
@@ -728,7 +833,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_XOR_R: {		// O=0 SZP C=0
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_XOR_R",0xff,0xff,v);}
@@ -751,7 +856,7 @@ void Gen_sim(int op, int mode, ...)
 		break;
 	case O_SUB_R: {		// OSZAPC
 		register wkreg v;
-		v.d = va_arg(ap, int);
+		v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_SUB;
 		if (mode & IMMED) {GTRACE3("O_SUB_R",0xff,0xff,v.d);}
@@ -782,7 +887,7 @@ void Gen_sim(int op, int mode, ...)
 		break;
 	case O_CMP_R: {		// OSZAPC
 		register wkreg v;
-		v.d = va_arg(ap, int);
+		v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_SUB;
 		if (mode & IMMED) {GTRACE3("O_CMP_R",0xff,0xff,v.d);}
@@ -813,8 +918,8 @@ void Gen_sim(int op, int mode, ...)
 	case O_ADC_R: {		// OSZAPC
 		register wkreg v;
 		int cy;
-		v.d = va_arg(ap, int);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		v.d = GARG(int);
+		cy = is_cf_set();
 		RFL.mode = mode;
 		RFL.valid = (cy? V_ADC:V_ADD);
 		if (mode & IMMED) {GTRACE3("O_ADC_R",0xff,0xff,v.d);}
@@ -846,8 +951,8 @@ void Gen_sim(int op, int mode, ...)
 	case O_SBB_R: {		// OSZAPC
 		register wkreg v;
 		int cy;
-		v.d = va_arg(ap, int);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		v.d = GARG(int);
+		cy = is_cf_set();
 		RFL.mode = mode;
 		RFL.valid = V_SBB;
 		if (mode & IMMED) {GTRACE3("O_SBB_R",0xff,0xff,v.d);}
@@ -891,6 +996,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		CPUWORD(Ofs_FLAGS) = (CPUWORD(Ofs_FLAGS) & 0x7700) | 0x46;
 		RFL.valid = V_INVALID;
+		RFL.cfp = 0;
 		}
 		break;
 	case O_TEST: {		// == OR r,r
@@ -915,7 +1021,7 @@ void Gen_sim(int op, int mode, ...)
 		GTRACE1("O_SBBSELF",o);
 		// if CY=0 -> reg=0,  flag=xx46, OF=0
 		// if CY=1 -> reg=-1, flag=xx97, OF=0
-		if (CPUBYTE(Ofs_FLAGS)&1) {
+		if (is_cf_set()) {
 		    RFL.RES.d = 0xffffffff;
 		    CPUWORD(Ofs_FLAGS) = (CPUWORD(Ofs_FLAGS) & 0x7700) | 0x97;
 		}
@@ -933,6 +1039,7 @@ void Gen_sim(int op, int mode, ...)
 		    CPULONG(o) = RFL.RES.d;
 		}
 		RFL.valid = V_INVALID;
+		RFL.cfp = 0;
 		}
 		break;
 	case O_INC_R: {		// OSZAP
@@ -983,7 +1090,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_ADD;
 		if (mode & IMMED) {GTRACE3("O_ADD_FR",0xff,0xff,v.d);}
@@ -1016,7 +1123,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_OR_FR",0xff,0xff,v.d);}
@@ -1039,8 +1146,8 @@ void Gen_sim(int op, int mode, ...)
 		signed char o = Offs_From_Arg();
 		int cy;
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		if (mode & IMMED) v.d = GARG(int);
+		cy = is_cf_set();
 		RFL.mode = mode;
 		RFL.valid = (cy? V_ADC:V_ADD);
 		if (mode & IMMED) {GTRACE3("O_ADC_FR",0xff,0xff,v.d);}
@@ -1074,8 +1181,8 @@ void Gen_sim(int op, int mode, ...)
 		signed char o = Offs_From_Arg();
 		int cy;
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		if (mode & IMMED) v.d = GARG(int);
+		cy = is_cf_set();
 		RFL.mode = mode;
 		RFL.valid = V_SBB;
 		if (mode & IMMED) {GTRACE3("O_SBB_FR",0xff,0xff,v.d);}
@@ -1109,7 +1216,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_AND_FR",0xff,0xff,v.d);}
@@ -1131,7 +1238,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_SUB;
 		if (mode & IMMED) {GTRACE3("O_SUB_FR",0xff,0xff,v.d);}
@@ -1164,7 +1271,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode | CLROVF;
 		RFL.valid = V_GEN;
 		if (mode & IMMED) {GTRACE3("O_XOR_FR",0xff,0xff,v.d);}
@@ -1186,7 +1293,7 @@ void Gen_sim(int op, int mode, ...)
 		register wkreg v;
 		signed char o = Offs_From_Arg();
 		v.d = 0;
-		if (mode & IMMED) v.d = va_arg(ap,int);
+		if (mode & IMMED) v.d = GARG(int);
 		RFL.mode = mode;
 		RFL.valid = V_SUB;
 		if (mode & IMMED) {GTRACE3("O_CMP_FR",0xff,0xff,v.d);}
@@ -1400,7 +1507,7 @@ void Gen_sim(int op, int mode, ...)
 		RFL.valid = V_GEN;
 		if (mode & MBYTE) {
 		    if ((mode&(IMMED|DATA16))==(IMMED|DATA16)) {
-			int b = va_arg(ap, int);
+			int b = GARG(int);
 			signed char o = Offs_From_Arg();
 			GTRACE3("O_IMUL",o,0xff,b);
 			DR1.ds = (int)DR1.ws.l * b;
@@ -1409,7 +1516,7 @@ void Gen_sim(int op, int mode, ...)
 			of = ((DR1.ds!=0) && (DR1.ds!=-1));
 		    }
 		    else if ((mode&(IMMED|DATA16))==IMMED) {
-			int b = va_arg(ap, int);
+			int b = GARG(int);
 			signed char o = Offs_From_Arg();
 			int64_t v;
 			GTRACE3("O_IMUL",o,0xff,b);
@@ -1429,7 +1536,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		else if (mode&DATA16) {
 		    if (mode&IMMED) {
-			int b = va_arg(ap, int);
+			int b = GARG(int);
 			signed char o = Offs_From_Arg();
 			GTRACE3("O_IMUL",o,0xff,b);
 		    	DR1.ds = (int)DR1.ws.l * b;
@@ -1454,7 +1561,7 @@ void Gen_sim(int op, int mode, ...)
 		else {
 		    int64_t v;
 		    if (mode&IMMED) {
-			int b = va_arg(ap, int);
+			int b = GARG(int);
 			signed char o = Offs_From_Arg();
 			GTRACE3("O_IMUL",o,0xff,b);
 			v = (int64_t)DR1.ds * b;
@@ -1679,7 +1786,7 @@ void Gen_sim(int op, int mode, ...)
 		signed char o = Offs_From_Arg();
 		unsigned int sh, rbef, raft, cy, ov;
 		GTRACE1("O_RCL",o);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		cy = is_cf_set();
 		if (mode & IMMED) sh = o;
 		  else sh = CPUBYTE(Ofs_CL);
 		sh &= 31;
@@ -1817,7 +1924,7 @@ void Gen_sim(int op, int mode, ...)
 		signed char o = Offs_From_Arg();
 		unsigned int sh, rbef, raft, cy, ov;
 		GTRACE3("O_RCR",0xff,0xff,o);
-		cy = CPUBYTE(Ofs_FLAGS) & 1;
+		cy = is_cf_set();
 		if (mode & IMMED) sh = o;
 		  else sh = CPUBYTE(Ofs_CL);
 		sh &= 31;
@@ -1946,7 +2053,7 @@ void Gen_sim(int op, int mode, ...)
 		break;
 
 	case O_OPAX: {	/* used by DAA..AAD */
-		int n =	va_arg(ap,int);
+		int n =	GARG(int);
 		// get n bytes from parameter stack
 		unsigned char subop = Offs_From_Arg();
 		GTRACE3("O_OPAX",0xff,0xff,n);
@@ -1954,6 +2061,7 @@ void Gen_sim(int op, int mode, ...)
 		/* sync AF *before* changing RFL.valid */
 		if (subop != AAM && subop != AAD)
 			FlagSync_AP();
+		FlagSync_C();
 		RFL.valid = V_ADD;
 		RFL.cout = 0; /* clears overflow & auxiliary carry flag */
 		DR1.d = CPULONG(Ofs_EAX);
@@ -1963,10 +2071,10 @@ void Gen_sim(int op, int mode, ...)
 				unsigned char altmp = DR1.b.bl;
 				if (((DR1.b.bl & 0x0f) > 9 ) || (IS_AF_SET)) {
 					DR1.b.bl += 6;
-					cyaf = ((CPUBYTE(Ofs_FLAGS)&1) ||
+					cyaf = (is_cf_set() ||
 					  (altmp > 0xf9)) | 8;
 				}
-				if ((altmp > 0x99) || (IS_CF_SET)) {
+				if ((altmp > 0x99) || (is_cf_set())) {
 					DR1.b.bl += 0x60;
 					cyaf |= 1;
 				}
@@ -1980,10 +2088,10 @@ void Gen_sim(int op, int mode, ...)
 				unsigned char altmp = DR1.b.bl;
 				if (((altmp & 0x0f) > 9) || (IS_AF_SET)) {
 					DR1.b.bl -= 6;
-					cyaf = ((CPUBYTE(Ofs_FLAGS)&1) ||
+					cyaf = (is_cf_set() ||
 						(altmp < 6)) | 8;
 				}
-				if ((altmp > 0x99) || (IS_CF_SET)) {
+				if ((altmp > 0x99) || (is_cf_set())) {
 					DR1.b.bl -= 0x60;
 					cyaf |= 1;
 				}
@@ -2128,7 +2236,7 @@ void Gen_sim(int op, int mode, ...)
 		} break;
 
 	case O_PUSHI: {
-		int v = va_arg(ap, int);
+		int v = GARG(int);
 		unsigned long stackm = CPULONG(Ofs_STACKM);
 		GTRACE3("O_PUSHI",0xff,0xff,v);
 		if (mode & DATA16) {
@@ -2251,10 +2359,10 @@ void Gen_sim(int op, int mode, ...)
 		break;
 
 	case O_INT: {
-		unsigned char intno = va_arg(ap, int);
+		unsigned char intno = GARG(int);
 		// Check bitmap, GPF if revectored
 		if (test_bit(intno, &TheCPU.int_revectored)) {
-			P0 = va_arg(ap, dosaddr_t);
+			P0 = GARG(dosaddr_t);
 			TheCPU.err = EXCP0D_GPF;
 		}
 		else {
@@ -2616,7 +2724,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_SLAHF: {
-		int rcod = va_arg(ap,int)&1;	// 0=LAHF 1=SAHF
+		int rcod = GARG(int)&1;	// 0=LAHF 1=SAHF
 		if (rcod==0) {		/* LAHF */
 			GTRACE0("O_LAHF");
 			FlagSync_All();
@@ -2626,13 +2734,15 @@ void Gen_sim(int op, int mode, ...)
 			GTRACE0("O_SAHF");
 			CPUBYTE(Ofs_FLAGS) = (CPUBYTE(Ofs_AH)&0xd5)|0x02;
 			RFL.valid = V_INVALID;
+			RFL.cfp = 0;
 		} }
 		break;
 	case O_SETFL: {
-		unsigned char o1 = (unsigned char)va_arg(ap,int);
+		unsigned char o1 = (unsigned char)GARG(int);
 		switch(o1) {	// these are direct on x86
 		case CMC:
 			GTRACE0("O_CMC");
+			FlagSync_C();
 			CPUBYTE(Ofs_FLAGS) ^= 1;
 			break;
 		case CLC:
@@ -2663,7 +2773,7 @@ void Gen_sim(int op, int mode, ...)
 		} }
 		break;
 	case O_BSWAP: {
-		unsigned char o1 = (unsigned char)va_arg(ap,int);
+		unsigned char o1 = (unsigned char)GARG(int);
 		register long v;
 		GTRACE1("O_BSWAP",o1);
 		v = CPULONG(o1);
@@ -2673,18 +2783,18 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_SETCC: {
-		unsigned char o1 = (unsigned char)va_arg(ap,int);
+		unsigned char o1 = (unsigned char)GARG(int);
 		GTRACE3("O_SETCC",0xff,0xff,o1);
 		FlagSync_All();
 		switch(o1) {
 			case 0x00: DR1.b.bl = IS_OF_SET; break;
 			case 0x01: DR1.b.bl = !IS_OF_SET; break;
-			case 0x02: DR1.b.bl = IS_CF_SET; break;
-			case 0x03: DR1.b.bl = !IS_CF_SET; break;
+			case 0x02: DR1.b.bl = is_cf_set(); break;
+			case 0x03: DR1.b.bl = !is_cf_set(); break;
 			case 0x04: DR1.b.bl = IS_ZF_SET; break;
 			case 0x05: DR1.b.bl = !IS_ZF_SET; break;
-			case 0x06: DR1.b.bl = IS_CF_SET || IS_ZF_SET; break;
-			case 0x07: DR1.b.bl = !IS_CF_SET && !IS_ZF_SET; break;
+			case 0x06: DR1.b.bl = is_cf_set() || IS_ZF_SET; break;
+			case 0x07: DR1.b.bl = !is_cf_set() && !IS_ZF_SET; break;
 			case 0x08: DR1.b.bl = IS_SF_SET; break;
 			case 0x09: DR1.b.bl = !IS_SF_SET; break;
 			case 0x0a:
@@ -2701,7 +2811,7 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case O_BITOP: {
-		unsigned char o1 = (unsigned char)va_arg(ap,int);
+		unsigned char o1 = (unsigned char)GARG(int);
 		signed char o2 = Offs_From_Arg();
 		register int flg;
 		GTRACE3("O_BITOP",o2,0xff,o1);
@@ -2751,12 +2861,12 @@ void Gen_sim(int op, int mode, ...)
 		}
 		} break;
 	case O_SHFD: {
-		unsigned char l_r = (unsigned char)va_arg(ap,int)&8;
+		unsigned char l_r = (unsigned char)GARG(int)&8;
 		signed char o = Offs_From_Arg();
 		unsigned char shc;
 		int cy;
 		if (mode & IMMED) {
-			shc = (unsigned char)va_arg(ap,int)&0x1f;
+			shc = (unsigned char)GARG(int)&0x1f;
 			GTRACE4("O_SHFD",o,0xff,l_r,shc);
 		}
 		else {
@@ -2866,9 +2976,9 @@ void Gen_sim(int op, int mode, ...)
 		break;
 
 	case JMP_LINK: {	// opc, dspt, retaddr, link
-		int opc = va_arg(ap,int);
-		P0 = va_arg(ap,unsigned int);
-		unsigned int d_nt = va_arg(ap,unsigned int);
+		int opc = GARG(int);
+		P0 = GARG(unsigned int);
+		unsigned int d_nt = GARG(unsigned int);
 		if (opc == CALLd || opc == CALLl)
 			PUSH(mode, d_nt);
 		if (debug_level('e')>2) {
@@ -2880,20 +2990,20 @@ void Gen_sim(int op, int mode, ...)
 
 	case JF_LINK:
 	case JB_LINK: {		// opc, PC, dspt, dspnt, link
-		int opc = va_arg(ap,int);
-		unsigned int PC = va_arg(ap,unsigned int);
-		unsigned int j_t = va_arg(ap,unsigned int);
-		unsigned int j_nt = va_arg(ap,unsigned int);
+		int opc = GARG(int);
+		unsigned int PC = GARG(unsigned int);
+		unsigned int j_t = GARG(unsigned int);
+		unsigned int j_nt = GARG(unsigned int);
 		(void)PC;
 		switch(opc) {
 		case JO:      P0 = is_of_set() ? j_t : j_nt; break;
 		case JNO:     P0 = !is_of_set() ? j_t : j_nt; break;
-		case JB_JNAE: P0 = IS_CF_SET ? j_t : j_nt; break;
-		case JNB_JAE: P0 = !IS_CF_SET ? j_t : j_nt; break;
+		case JB_JNAE: P0 = is_cf_set() ? j_t : j_nt; break;
+		case JNB_JAE: P0 = !is_cf_set() ? j_t : j_nt; break;
 		case JE_JZ:   P0 = is_zf_set() ? j_t : j_nt; break;
 		case JNE_JNZ: P0 = !is_zf_set() ? j_t : j_nt; break;
-		case JBE_JNA: P0 = IS_CF_SET || is_zf_set() ? j_t : j_nt; break;
-		case JNBE_JA: P0 = !IS_CF_SET && !is_zf_set() ? j_t : j_nt; break;
+		case JBE_JNA: P0 = is_cf_set() || is_zf_set() ? j_t : j_nt; break;
+		case JNBE_JA: P0 = !is_cf_set() && !is_zf_set() ? j_t : j_nt; break;
 		case JS:      P0 = is_sf_set() ? j_t : j_nt; break;
 		case JNS:     P0 = !is_sf_set() ? j_t : j_nt; break;
 		case JP_JPE:
@@ -2919,9 +3029,9 @@ void Gen_sim(int op, int mode, ...)
 		}
 		break;
 	case JLOOP_LINK: {	// opc, dspt, dspnt, link
-		int opc = va_arg(ap,int);
-		unsigned int j_t = va_arg(ap,unsigned int);
-		unsigned int j_nt = va_arg(ap,unsigned int);
+		int opc = GARG(int);
+		unsigned int j_t = GARG(unsigned int);
+		unsigned int j_nt = GARG(unsigned int);
 		int cxv = (mode&ADDR16? --rCX : --rECX);
 		switch(opc) {
 		case LOOP:
@@ -2940,7 +3050,6 @@ void Gen_sim(int op, int mode, ...)
 
 	}
 
-	va_end(ap);
 #ifdef DEBUG_MORE
 	if (debug_level('e')>3) {
 #else
@@ -2978,9 +3087,24 @@ void Gen_sim(int op, int mode, ...)
 /////////////////////////////////////////////////////////////////////////////
 
 
+void Gen_sim(int op, int mode, ...)
+{
+	va_list ap;
+
+	va_start(ap, mode);
+	_Gen_sim(op, mode, &ap, NULL);
+	va_end(ap);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+
 static unsigned int CloseAndExec_sim(unsigned int PC, int mode)
 {
 	unsigned int ret;
+
+	if (SimRec) SimRecOp(SOP_CLOSE, PC, mode);
 	if (debug_level('e')>1) {
 	    if (sigalrm_pending()>0) e_printf("** SIGALRM is pending\n");
 	    if (debug_level('e')>2) {
@@ -3018,3 +3142,797 @@ static unsigned int CloseAndExec_sim(unsigned int PC, int mode)
 
 /////////////////////////////////////////////////////////////////////////////
 
+
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Threaded sequences
+ *
+ * Runs of instructions whose front-end code consists only of Gen/AddrGen
+ * calls (plus the V86 limit check in ModRM and, for the jump that ends
+ * a run, CloseAndExec) are recorded while they are interpreted. The op
+ * list only depends on the source bytes, the CS base and the mode, which
+ * form the key of the cache; the source bytes of the whole sequence are
+ * compared once every time it is entered.
+ *
+ * Each op gets a handler when the sequence is stored. The hot ops have
+ * handlers of their own, with the operand size and the kind of operand
+ * already resolved, the others go through the op switch of Gen_sim.
+ */
+
+/* 1=plain 2=jump 3=jump followed by a check for jmp 4=prefix 5=0f
+ * 6=jmp that JumpGen turns into a new PC */
+static const unsigned char SimOpOk[256] = {
+	[0x00 ... 0x05] = 1, [0x08 ... 0x0d] = 1, [0x0f] = 5,
+	[0x10 ... 0x15] = 1, [0x18 ... 0x1d] = 1,
+	[0x20 ... 0x25] = 1, [0x26] = 4, [0x28 ... 0x2d] = 1, [0x2e] = 4,
+	[0x30 ... 0x35] = 1, [0x36] = 4, [0x38 ... 0x3d] = 1, [0x3e] = 4,
+	[0x40 ... 0x5f] = 1,
+	[0x64 ... 0x67] = 4, [0x69] = 1, [0x6b] = 1,
+	[0x70 ... 0x7f] = 3,
+	[0x80 ... 0x8b] = 1, [0x8d] = 1, [0x90 ... 0x97] = 1,
+	[0xa0 ... 0xa3] = 1, [0xa8 ... 0xa9] = 1, [0xb0 ... 0xbf] = 1,
+	[0xc0 ... 0xc1] = 1, [0xc2 ... 0xc3] = 2, [0xc6 ... 0xc7] = 1,
+	[0xd0 ... 0xd3] = 1,
+	[0xe0 ... 0xe2] = 2, [0xe3] = 3, [0xe8] = 2, [0xe9] = 6, [0xeb] = 6,
+};
+
+#define SIMFN(name)	static int name(const SimOp *o)
+#define SIMREG(i)	((signed char)o->a[i])
+
+SIMFN(SimGen)
+{
+	_Gen_sim(o->op, o->mode, NULL, o->a);
+	return 0;
+}
+
+SIMFN(SimAddr)
+{
+	_AddrGen_sim(o->op, o->mode, NULL, o->a);
+	return 0;
+}
+
+/* only address generation happened so far in the instruction, let
+ * the interpreter raise the fault */
+SIMFN(SimV86Chk)
+{
+	return TR1.d > 0xffff;
+}
+
+/* A_DI_0, A_DI_1, A_DI_2: base, imm, {reg, {reg, {shift}}} */
+SIMFN(SimAddr0)
+{
+	AR1.d = (o->mode & MLEA) ? 0 : CPULONG(SIMREG(0));
+	TR1.d = o->a[1];
+	AR1.d += TR1.d;
+	return 0;
+}
+
+SIMFN(SimAddr1_16)
+{
+	AR1.d = (o->mode & MLEA) ? 0 : CPULONG(SIMREG(0));
+	TR1.d = CPUWORD(SIMREG(2));
+	TR1.w.l += o->a[1];
+	AR1.d += TR1.d;
+	return 0;
+}
+
+SIMFN(SimAddr1_32)
+{
+	AR1.d = (o->mode & MLEA) ? 0 : CPULONG(SIMREG(0));
+	TR1.d = CPULONG(SIMREG(2)) + o->a[1];
+	AR1.d += TR1.d;
+	return 0;
+}
+
+SIMFN(SimAddr2_16)
+{
+	AR1.d = (o->mode & MLEA) ? 0 : CPULONG(SIMREG(0));
+	TR1.d = CPUWORD(SIMREG(2)) + CPUWORD(SIMREG(3)) + o->a[1];
+	AR1.d += TR1.w.l;
+	return 0;
+}
+
+/* moves, loads and stores; the front-end only passes MBYTX to the
+ * loads */
+#define SIM_MOVES(s, bits, CPU, R, RD, WR) \
+SIMFN(SimLReg_##s) { DR1.R = CPU(SIMREG(0)); return 0; } \
+SIMFN(SimSReg_##s) { CPU(SIMREG(0)) = DR1.R; return 0; } \
+SIMFN(SimRegReg_##s) { CPU(SIMREG(1)) = CPU(SIMREG(0)); return 0; } \
+SIMFN(SimLImm_##s) { CPU(SIMREG(0)) = o->a[1]; return 0; } \
+SIMFN(SimLImmR1_##s) { DR1.R = o->a[0]; return 0; } \
+SIMFN(SimLDi_##s) { DR1.R = RD(AR1.d); return 0; } \
+SIMFN(SimSDi_##s) { WR(AR1.d, DR1.R); return 0; } \
+SIMFN(SimSDiImm_##s) { WR(AR1.d, o->a[0]); return 0; }
+
+SIMFN(SimNop)
+{
+	return 0;
+}
+
+/* O_xxx_FR: reg = reg op (immediate or DR1). The _nf handlers are
+ * used where the flags are dead, see SimFlagsLive() */
+#define SIM_ALU_FR(s, bits, CPU, R, k, S2) \
+SIMFN(SimAddFR##k##_##s##_nf) { CPU(SIMREG(0)) += S2; return 0; } \
+SIMFN(SimSubFR##k##_##s##_nf) { CPU(SIMREG(0)) -= S2; return 0; } \
+SIMFN(SimAndFR##k##_##s##_nf) { CPU(SIMREG(0)) &= S2; return 0; } \
+SIMFN(SimOrFR##k##_##s##_nf) { CPU(SIMREG(0)) |= S2; return 0; } \
+SIMFN(SimXorFR##k##_##s##_nf) { CPU(SIMREG(0)) ^= S2; return 0; } \
+SIMFN(SimAddFR##k##_##s) { \
+	uint32_t s1 = CPU(SIMREG(0)), s2 = S2; \
+	RFL.mode = o->mode; \
+	RFL.valid = V_ADD; \
+	CPU(SIMREG(0)) = RFL.RES.d = s1 + s2; \
+	FlagHandleAdd(s1, s2, RFL.RES.d, bits); \
+	return 0; \
+} \
+SIMFN(SimSubFR##k##_##s) { \
+	uint32_t s1 = CPU(SIMREG(0)), s2 = S2; \
+	RFL.mode = o->mode; \
+	RFL.valid = V_SUB; \
+	CPU(SIMREG(0)) = RFL.RES.d = s1 - s2; \
+	FlagHandleSub(s1, s2, RFL.RES.d, bits); \
+	return 0; \
+} \
+SIMFN(SimCmpFR##k##_##s) { \
+	uint32_t s1 = CPU(SIMREG(0)), s2 = S2; \
+	RFL.mode = o->mode; \
+	RFL.valid = V_SUB; \
+	RFL.RES.d = s1 - s2; \
+	FlagHandleSub(s1, s2, RFL.RES.d, bits); \
+	return 0; \
+} \
+SIMFN(SimAndFR##k##_##s) { \
+	RFL.mode = o->mode | CLROVF; \
+	RFL.valid = V_GEN; \
+	RFL.RES.d = CPU(SIMREG(0)) &= S2; \
+	SET_CF(0); \
+	return 0; \
+} \
+SIMFN(SimOrFR##k##_##s) { \
+	RFL.mode = o->mode | CLROVF; \
+	RFL.valid = V_GEN; \
+	RFL.RES.d = CPU(SIMREG(0)) |= S2; \
+	SET_CF(0); \
+	return 0; \
+} \
+SIMFN(SimXorFR##k##_##s) { \
+	RFL.mode = o->mode | CLROVF; \
+	RFL.valid = V_GEN; \
+	RFL.RES.d = CPU(SIMREG(0)) ^= S2; \
+	SET_CF(0); \
+	return 0; \
+}
+
+#define SIM_ALU(s, bits, CPU, R, RD, WR) \
+SIM_ALU_FR(s, bits, CPU, R, i, (uint##bits##_t)o->a[1]) \
+SIM_ALU_FR(s, bits, CPU, R, r, DR1.R) \
+SIMFN(SimInc_##s##_nf) { CPU(SIMREG(0))++; return 0; } \
+SIMFN(SimDec_##s##_nf) { CPU(SIMREG(0))--; return 0; } \
+SIMFN(SimInc_##s) { \
+	uint32_t s1 = CPU(SIMREG(0)); \
+	RFL.mode = o->mode; \
+	RFL.valid = V_ADD; \
+	CPU(SIMREG(0)) = RFL.RES.d = s1 + 1; \
+	FlagHandleIncDec(s1, RFL.RES.d, bits); \
+	return 0; \
+} \
+SIMFN(SimDec_##s) { \
+	uint32_t s1 = CPU(SIMREG(0)); \
+	RFL.mode = o->mode; \
+	RFL.valid = V_SUB; \
+	CPU(SIMREG(0)) = RFL.RES.d = s1 - 1; \
+	FlagHandleIncDec(RFL.RES.d, s1, bits); \
+	return 0; \
+} \
+SIMFN(SimTest_##s) { \
+	RFL.mode = o->mode | CLROVF; \
+	RFL.valid = V_GEN; \
+	RFL.RES.d = CPU(SIMREG(0)); \
+	SET_CF(0); \
+	return 0; \
+}
+
+#define SIM_SIZES(X) \
+	X(b, 8, CPUBYTE, b.bl, read_byte, write_byte) \
+	X(w, 16, CPUWORD, w.l, read_word, write_word) \
+	X(d, 32, CPULONG, d, read_dword, write_dword)
+
+SIM_SIZES(SIM_MOVES)
+SIM_SIZES(SIM_ALU)
+
+#define SIM_TAB(name)	{ name##_b, name##_w, name##_d }
+
+static const SimFn SimLReg[] = SIM_TAB(SimLReg);
+static const SimFn SimSReg[] = SIM_TAB(SimSReg);
+static const SimFn SimRegReg[] = SIM_TAB(SimRegReg);
+static const SimFn SimLImm[] = SIM_TAB(SimLImm);
+static const SimFn SimLImmR1[] = SIM_TAB(SimLImmR1);
+static const SimFn SimLDi[] = SIM_TAB(SimLDi);
+static const SimFn SimSDi[] = SIM_TAB(SimSDi);
+static const SimFn SimSDiImm[] = SIM_TAB(SimSDiImm);
+static const SimFn SimInc[] = SIM_TAB(SimInc);
+static const SimFn SimDec[] = SIM_TAB(SimDec);
+static const SimFn SimTest[] = SIM_TAB(SimTest);
+/* [op][immediate] */
+static const SimFn SimAluFR[][2][3] = {
+	{ SIM_TAB(SimAddFRr), SIM_TAB(SimAddFRi) },
+	{ SIM_TAB(SimSubFRr), SIM_TAB(SimSubFRi) },
+	{ SIM_TAB(SimCmpFRr), SIM_TAB(SimCmpFRi) },
+	{ SIM_TAB(SimAndFRr), SIM_TAB(SimAndFRi) },
+	{ SIM_TAB(SimOrFRr), SIM_TAB(SimOrFRi) },
+	{ SIM_TAB(SimXorFRr), SIM_TAB(SimXorFRi) },
+};
+
+/* the 16-bit stack ops of push, pop, call and ret */
+SIMFN(SimPush_w)
+{
+	SR1.d = (CPULONG(Ofs_ESP) - 2) & CPULONG(Ofs_STACKM);
+	AR2.d = CPULONG(Ofs_XSS);
+	write_word(AR2.d + SR1.d, DR1.w.l);
+#ifdef KEEP_ESP
+	SR1.d |= (CPULONG(Ofs_ESP) & ~CPULONG(Ofs_STACKM));
+#endif
+	CPULONG(Ofs_ESP) = SR1.d;
+	return 0;
+}
+
+SIMFN(SimPop_w)
+{
+	long stackm = CPULONG(Ofs_STACKM);
+
+	AR2.d = CPULONG(Ofs_XSS);
+	SR1.d = CPULONG(Ofs_ESP) & stackm;
+	DR1.w.l = read_word(AR2.d + SR1.d);
+	SR1.d += 2;
+#ifdef STACK_WRAP_MP
+	SR1.d &= stackm;
+#endif
+#ifdef KEEP_ESP
+	SR1.d |= (CPULONG(Ofs_ESP) & ~stackm);
+#endif
+	CPULONG(Ofs_ESP) = SR1.d;
+	return 0;
+}
+
+/* JF_LINK, JB_LINK: opc, PC, j_t, j_nt */
+#define SIM_JCC(name, cond) \
+SIMFN(SimJ##name) { P0 = (cond) ? (unsigned)o->a[2] : (unsigned)o->a[3]; \
+	return 0; }
+
+SIM_JCC(o, is_of_set())
+SIM_JCC(no, !is_of_set())
+SIM_JCC(b, is_cf_set())
+SIM_JCC(nb, !is_cf_set())
+SIM_JCC(z, is_zf_set())
+SIM_JCC(nz, !is_zf_set())
+SIM_JCC(be, is_cf_set() || is_zf_set())
+SIM_JCC(a, !is_cf_set() && !is_zf_set())
+SIM_JCC(s, is_sf_set())
+SIM_JCC(ns, !is_sf_set())
+SIM_JCC(l, is_sf_set() ^ is_of_set())
+SIM_JCC(nl, !(is_sf_set() ^ is_of_set()))
+SIM_JCC(le, (is_sf_set() ^ is_of_set()) || is_zf_set())
+SIM_JCC(g, !(is_sf_set() ^ is_of_set()) && !is_zf_set())
+
+/* JP and JNP stay with Gen_sim, which syncs PF */
+static const SimFn SimJcc[16] = {
+	SimJo, SimJno, SimJb, SimJnb, SimJz, SimJnz, SimJbe, SimJa,
+	SimJs, SimJns, NULL, NULL, SimJl, SimJnl, SimJle, SimJg,
+};
+
+/* JLOOP_LINK LOOP: opc, j_t, j_nt */
+SIMFN(SimLoop_16)
+{
+	P0 = --rCX != 0 ? (unsigned)o->a[1] : (unsigned)o->a[2];
+	return 0;
+}
+
+SIMFN(SimLoop_32)
+{
+	P0 = --rECX != 0 ? (unsigned)o->a[1] : (unsigned)o->a[2];
+	return 0;
+}
+
+/* handler of a recorded op, Gen_sim or AddrGen_sim if it has none */
+static SimFn SimPick(const SimOp *o)
+{
+	int m = o->mode, n = o->nargs;
+	int sz = (m & MBYTE) ? 0 : (m & DATA16) ? 1 : 2;
+	int szx = (m & MBYTX) ? 0 : sz;
+	int alu = -1;
+
+	if (o->kind == SOP_V86CHK)
+		return SimV86Chk;
+	if (o->kind == SOP_ADDR) {
+		if (o->op == A_DI_0 && n == 2)
+			return SimAddr0;
+		if (o->op == A_DI_1 && n == 3)
+			return (m & ADDR16) ? SimAddr1_16 : SimAddr1_32;
+		if (o->op == A_DI_2 && n == 4 && (m & ADDR16))
+			return SimAddr2_16;
+		return SimAddr;
+	}
+	switch (o->op) {
+	case L_REG:
+		return n == 1 ? SimLReg[szx] : SimGen;
+	case S_REG:
+		return n == 1 ? SimSReg[sz] : SimGen;
+	case L_REG2REG:
+		return n == 2 ? SimRegReg[sz] : SimGen;
+	case L_IMM:
+		return n == 2 ? SimLImm[sz] : SimGen;
+	case L_IMM_R1:
+		return n == 1 ? SimLImmR1[sz] : SimGen;
+	case L_DI_R1:
+		return n == 0 ? SimLDi[szx] : SimGen;
+	case S_DI:
+		return n == 0 ? SimSDi[sz] : SimGen;
+	case S_DI_IMM:
+		return n == 1 ? SimSDiImm[sz] : SimGen;
+	case O_INC_R:
+		return n == 1 ? SimInc[sz] : SimGen;
+	case O_DEC_R:
+		return n == 1 ? SimDec[sz] : SimGen;
+	case O_TEST:
+		return n == 1 ? SimTest[sz] : SimGen;
+	case O_ADD_FR: alu = 0; break;
+	case O_SUB_FR: alu = 1; break;
+	case O_CMP_FR: alu = 2; break;
+	case O_AND_FR: alu = 3; break;
+	case O_OR_FR: alu = 4; break;
+	case O_XOR_FR: alu = 5; break;
+	case O_PUSH:
+		return n == 0 && (m & DATA16) ? SimPush_w : SimGen;
+	case O_POP:
+		return n == 0 && (m & (DATA16|MRETISP)) == DATA16 ?
+			SimPop_w : SimGen;
+	case JF_LINK:
+	case JB_LINK:
+		if (n == 4 && o->a[0] >= JO && o->a[0] <= JNLE_JG &&
+		    SimJcc[o->a[0] - JO])
+			return SimJcc[o->a[0] - JO];
+		return SimGen;
+	case JLOOP_LINK:
+		if (n == 3 && o->a[0] == LOOP)
+			return (m & ADDR16) ? SimLoop_16 : SimLoop_32;
+		return SimGen;
+	}
+	if (alu >= 0 && n == ((m & IMMED) ? 2 : 1))
+		return SimAluFR[alu][!!(m & IMMED)][sz];
+	return SimGen;
+}
+
+/* what the handlers do with the flags; the ones not listed here read
+ * them, or may leave the sequence through a fault */
+enum {
+	SIMF_NONE,	/* neither read nor written */
+	SIMF_DEF,	/* all of OSZAPC written */
+	SIMF_CF,	/* all but CF written */
+};
+
+#define SIM_FLAGS_FR(s, k) \
+	{ SimAddFR##k##_##s, SimAddFR##k##_##s##_nf, SIMF_DEF }, \
+	{ SimSubFR##k##_##s, SimSubFR##k##_##s##_nf, SIMF_DEF }, \
+	{ SimCmpFR##k##_##s, SimNop, SIMF_DEF }, \
+	{ SimAndFR##k##_##s, SimAndFR##k##_##s##_nf, SIMF_DEF }, \
+	{ SimOrFR##k##_##s, SimOrFR##k##_##s##_nf, SIMF_DEF }, \
+	{ SimXorFR##k##_##s, SimXorFR##k##_##s##_nf, SIMF_DEF },
+
+#define SIM_FLAGS(s, bits, CPU, R, RD, WR) \
+	SIM_FLAGS_FR(s, i) \
+	SIM_FLAGS_FR(s, r) \
+	{ SimTest_##s, SimNop, SIMF_DEF }, \
+	{ SimInc_##s, SimInc_##s##_nf, SIMF_CF }, \
+	{ SimDec_##s, SimDec_##s##_nf, SIMF_CF }, \
+	{ SimLReg_##s, NULL, SIMF_NONE }, \
+	{ SimSReg_##s, NULL, SIMF_NONE }, \
+	{ SimRegReg_##s, NULL, SIMF_NONE }, \
+	{ SimLImm_##s, NULL, SIMF_NONE }, \
+	{ SimLImmR1_##s, NULL, SIMF_NONE },
+
+static const struct {
+	SimFn fn, nf;		/* handler, and without flags */
+	unsigned char use;
+} SimFlagUse[] = {
+	SIM_SIZES(SIM_FLAGS)
+	{ SimAddr0, NULL, SIMF_NONE },
+	{ SimAddr1_16, NULL, SIMF_NONE },
+	{ SimAddr1_32, NULL, SIMF_NONE },
+	{ SimAddr2_16, NULL, SIMF_NONE },
+	{ SimLoop_16, NULL, SIMF_NONE },
+	{ SimLoop_32, NULL, SIMF_NONE },
+};
+
+/* Flags liveness: going back from the end of the sequence, where the
+ * flags are live, a flag writer whose flags are written again before
+ * anything reads them gets the handler that does not compute them.
+ * The sequence may also stop after an instruction that stores to
+ * memory, where the flags are live as well. */
+static void SimFlagsLive(SimSeq *B)
+{
+	SimOp *o = &B->ops[B->nops];
+	int n = sizeof(SimFlagUse) / sizeof(SimFlagUse[0]);
+	int i, k, j, live = 1;
+
+	for (i = B->ninsns - 1; i >= 0; i--) {
+		if (B->insn[i].flags & SIMI_STORE)
+			live = 1;
+		for (k = 0; k < B->insn[i].nops; k++) {
+			o--;
+			for (j = 0; j < n; j++)
+				if (SimFlagUse[j].fn == o->fn)
+					break;
+			if (j == n) {
+				live = 1;
+				continue;
+			}
+			switch (SimFlagUse[j].use) {
+			case SIMF_DEF:
+				if (!live)
+					o->fn = SimFlagUse[j].nf;
+				live = 0;
+				break;
+			case SIMF_CF:
+				if (!live)
+					o->fn = SimFlagUse[j].nf;
+				break;
+			}
+		}
+	}
+}
+
+static int SimOpStores(const SimOp *o)
+{
+	if (o->kind != SOP_GEN)
+		return 0;
+	switch (o->op) {
+	case S_DI: case S_DI_IMM: case O_PUSH: case O_PUSH2: case O_PUSH2F:
+	case O_PUSHI: case JMP_LINK:
+		return 1;
+	}
+	return 0;
+}
+
+static void SimDrop(SimSeq *B)
+{
+	SimSeq **pp = &SimHash[SIMHASH(B->pc)];
+
+	while (*pp != B)
+		pp = &(*pp)->next;
+	*pp = B->next;
+	free(B);
+	SimSeqs--;
+}
+
+static void SimFlush(void)
+{
+	int i;
+
+	for (i = 0; i < SIMHASH_SIZE; i++) {
+		while (SimHash[i]) {
+			SimSeq *B = SimHash[i];
+			SimHash[i] = B->next;
+			free(B);
+		}
+	}
+	SimSeqs = 0;
+}
+
+static SimSeq *SimFind(unsigned int pc, unsigned int csbase, int basemode,
+		       int v86)
+{
+	SimSeq *B;
+
+	for (B = SimHash[SIMHASH(pc)]; B; B = B->next)
+		if (B->pc == pc && B->csbase == csbase &&
+		    B->basemode == basemode && B->v86 == v86)
+			return B;
+	return NULL;
+}
+
+/* stores the sequence under recording, which ends with a jump if npc
+ * is -1 */
+static void SimSeqEnd(unsigned int npc)
+{
+	SimSeq *B = SimOpen, *O;
+	size_t size;
+	int i;
+
+	SimOpen = NULL;
+	if (B->ninsns == 0)
+		return;
+	B->npc = npc;
+	B->jump = npc == (unsigned)-1;
+	for (i = 0; i < B->nops; i++)
+		B->ops[i].fn = SimPick(&B->ops[i]);
+	SimFlagsLive(B);
+
+	if ((O = SimFind(B->pc, B->csbase, B->basemode, B->v86)) != NULL)
+		SimDrop(O);
+	if (SimSeqs >= SIMSEQ_MAX)
+		SimFlush();
+	size = sizeof(SimSeq) + B->nops*sizeof(SimOp);
+	O = malloc(size + B->ninsns*sizeof(SimInsn) + B->len);
+	memcpy(O, B, size);
+	O->insn = (SimInsn *)&O->ops[B->nops];
+	memcpy(O->insn, B->insn, B->ninsns*sizeof(SimInsn));
+	O->src = (unsigned char *)&O->insn[B->ninsns];
+	memcpy(O->src, B->src, B->len);
+	O->next = SimHash[SIMHASH(O->pc)];
+	SimHash[SIMHASH(O->pc)] = O;
+	SimSeqs++;
+}
+
+/* a sequence that is not ended by a jump goes on after its last
+ * instruction */
+static void SimSeqClose(void)
+{
+	if (SimOpen)
+		SimSeqEnd(SimOpen->pc + SimOpen->len);
+}
+
+void SimRecOp(int kind, int op, int mode)
+{
+	SimOp *o;
+
+	if (SimRecN == SIMSEQ_OPS) {
+		SimRec = NULL;
+		return;
+	}
+	o = &SimRec->ops[SimRecN++];
+	o->kind = kind;
+	o->nargs = 0;
+	o->op = op;
+	o->mode = mode;
+}
+
+/* the instruction at PC is about to be interpreted: record it into
+ * the open sequence, or start a new one with it */
+void SimRecBegin(unsigned int PC, int basemode)
+{
+	SimSeq *B = SimOpen;
+	unsigned char src[SIMINSN_SRC], opc, jump;
+	int i, n, v86 = V86MODE() != 0;
+
+	SimRec = NULL;
+	if (B && (PC != B->pc + B->len || LONG_CS != B->csbase ||
+		  basemode != B->basemode || v86 != B->v86))
+		SimSeqClose();
+	if ((EFLAGS & TF) || debug_level('e')>1 ||
+	    (CEmuStat & (CeS_MOVSS|CeS_INSTREMU)) || vga_read_access(PC)) {
+		SimSeqClose();
+		return;
+	}
+	/* the source is read up to the end of its page, the decoder
+	 * will not go further for the instructions cached here */
+	n = PAGE_SIZE - (PC & (PAGE_SIZE-1));
+	if (n > SIMINSN_SRC)
+		n = SIMINSN_SRC;
+	for (i = 0; i < n; i++)
+		src[i] = Fetch(PC+i);
+	for (i = 0; i < n && SimOpOk[src[i]] == 4; i++)
+		;
+	jump = i < n ? SimOpOk[src[i]] : 0;
+	if (jump == 5) {
+		opc = i+1 < n ? src[i+1] : 0;
+		if (opc >= 0x80 && opc <= 0x8f)
+			jump = 3;
+		else if (opc == 0xb6 || opc == 0xb7 || opc == 0xbe || opc == 0xbf)
+			jump = 1;
+		else
+			jump = 0;
+	}
+	if (jump == 0) {
+		SimSeqClose();
+		return;
+	}
+
+	B = SimOpen;
+	if (B && (B->ninsns == SIMSEQ_INSNS || B->len + n > SIMSEQ_SRC)) {
+		SimSeqClose();
+		B = NULL;
+	}
+	if (B == NULL) {
+		if (SimRecBuf == NULL)
+			SimRecBuf = malloc(sizeof(SimSeq) +
+					   SIMSEQ_OPS*sizeof(SimOp));
+		B = SimOpen = SimRecBuf;
+		B->pc = PC;
+		B->csbase = LONG_CS;
+		B->basemode = basemode;
+		B->v86 = v86;
+		B->len = B->nops = B->ninsns = 0;
+		B->insn = SimRecInsns;
+		B->src = SimRecSrc;
+	}
+	memcpy(B->src + B->len, src, n);
+	SimRecSrcN = n;
+	SimRecJump = jump;
+	SimRecN = B->nops;
+	SimRec = B;
+}
+
+/* the instruction has been interpreted and goes on at PC: add it to
+ * the sequence, or store the sequence without it if it can't be
+ * replayed */
+void SimRecEnd(unsigned int PC, int mode, int NewNode)
+{
+	SimSeq *B = SimOpen;
+	SimInsn *I;
+	unsigned int P1, len;
+	unsigned char *p;
+	int i, ok = SimRec != NULL;
+
+	SimRec = NULL;
+	if (B == NULL)
+		return;
+	P1 = B->pc + B->len;
+	p = B->src + B->len;
+	for (i = 0; SimOpOk[p[i]] == 4; i++)
+		;
+	if (!ok || TheCPU.err) {
+		SimSeqClose();
+		return;
+	}
+	if (SimRecJump == 6) {
+		/* jmp, JumpGen only set a new PC */
+		if (!(TheCPU.mode & SKIPOP) || SimRecN != B->nops || PC == P1) {
+			SimSeqClose();
+			return;
+		}
+		len = i + (p[i] == 0xeb ? 2 : 1 + BT24(BitDATA16, mode));
+	}
+	else if (TheCPU.mode & SKIPOP) {
+		SimSeqClose();
+		return;
+	}
+	else if (SimRecJump >= 2) {
+		/* a jump must have gone through JumpGen and CloseAndExec;
+		 * its length is found again from the source */
+		if (SimRecN == B->nops || NewNode ||
+		    B->ops[SimRecN-1].kind != SOP_CLOSE) {
+			SimSeqClose();
+			return;
+		}
+		if (p[i] == 0x0f)
+			len = i + 2 + BT24(BitDATA16, mode);
+		else if (p[i] == 0xe8)
+			len = i + 1 + BT24(BitDATA16, mode);
+		else if (p[i] == 0xc2)
+			len = i + 3;
+		else if (p[i] == 0xc3)
+			len = i + 1;
+		else
+			len = i + 2;
+		/* Jcc also looks at a jmp following it */
+		if (SimRecJump == 3) {
+			if (len >= SimRecSrcN) {
+				SimSeqClose();
+				return;
+			}
+			if (p[len] == 0xeb)
+				len += 2;
+			else if (p[len] == 0xe9)
+				len += 1 + BT24(BitDATA16, mode);
+			else
+				len++;
+		}
+		SimRecN--;
+		B->cpc = B->ops[SimRecN].op;
+		B->cmode = B->ops[SimRecN].mode;
+	}
+	else
+		len = PC - P1;
+	for (i = B->nops; i < SimRecN; i++)
+		if (B->ops[i].kind == SOP_CLOSE)
+			break;
+	if (i < SimRecN || len == 0 || len > SimRecSrcN) {
+		SimSeqClose();
+		return;
+	}
+
+	I = &B->insn[B->ninsns++];
+	I->ofs = B->len;
+	I->nops = SimRecN - B->nops;
+	I->flags = 0;
+	for (i = B->nops; i < SimRecN; i++)
+		if (SimOpStores(&B->ops[i]))
+			I->flags |= SIMI_STORE;
+	I->ovds = OVERR_DS;
+	I->ovss = OVERR_SS;
+	B->len += len;
+	B->nops = SimRecN;
+	B->mode = mode;
+	B->cpumode = TheCPU.mode;
+	if (SimRecJump == 6)
+		SimSeqEnd(PC);
+	else if (SimRecJump >= 2)
+		SimSeqEnd((unsigned)-1);
+}
+
+/* stores the sequence under recording without the instruction being
+ * recorded, if any, when the interpreter loop is left */
+void SimRecClose(void)
+{
+	SimRec = NULL;
+	SimSeqClose();
+}
+
+static int SimSrcMatch(unsigned int PC, const unsigned char *src, int len)
+{
+	int i = 0;
+
+	for (; i + 4 <= len; i += 4) {
+		uint32_t v;
+		memcpy(&v, src + i, 4);
+		if (FetchL(PC + i) != v)
+			return 0;
+	}
+	for (; i < len; i++)
+		if (Fetch(PC + i) != src[i])
+			return 0;
+	return 1;
+}
+
+/* run the sequence at PC if it is in the cache. Returns the next PC,
+ * or -1 if the instruction at PC has to go through the interpreter.
+ * *P1 follows the start of the instruction being run */
+unsigned int SimExec(unsigned int PC, int basemode, int *mode, int *NewNode,
+		     unsigned int *P1)
+{
+	SimSeq *B;
+	const SimInsn *I, *IE;
+	const SimOp *o, *oe;
+	unsigned int npc;
+
+	if (SimOpen || (EFLAGS & TF) || debug_level('e')>1 ||
+	    (CEmuStat & (CeS_MOVSS|CeS_INSTREMU)))
+		return (unsigned)-1;
+	B = SimFind(PC, LONG_CS, basemode, V86MODE() != 0);
+	if (B == NULL) {
+		SimMisses++;
+		return (unsigned)-1;
+	}
+	if (!SimSrcMatch(PC, B->src, B->len)) {
+		SimDrop(B);
+		SimMisses++;
+		return (unsigned)-1;
+	}
+	SimHits++;
+	o = B->ops;
+	for (I = B->insn, IE = I + B->ninsns; I < IE; I++) {
+		*P1 = PC + I->ofs;
+		OVERR_DS = I->ovds;
+		OVERR_SS = I->ovss;
+		for (oe = o + I->nops; o < oe; o++)
+			if (o->fn(o))
+				return I == B->insn ? (unsigned)-1 : *P1;
+		/* a store into the rest of the sequence ends it here */
+		if ((I->flags & SIMI_STORE) && I + 1 < IE &&
+		    !SimSrcMatch(PC + I[1].ofs, B->src + I[1].ofs,
+				 B->len - I[1].ofs)) {
+			npc = PC + I[1].ofs;
+			SimDrop(B);
+			return npc;
+		}
+	}
+	*mode = B->mode;
+	TheCPU.mode = B->cpumode;
+	if (!B->jump)
+		return B->npc;
+	npc = CloseAndExec_sim(B->cpc, B->cmode);
+	/* as in JumpGen() */
+	if (sigalrm_pending())
+		CEmuStat |= CeS_SIGPEND;
+	*NewNode = 0;
+	return npc;
+}
+
+void EndGen_sim(void)
+{
+	SimRec = NULL;
+	SimOpen = NULL;
+	SimFlush();
+	free(SimRecBuf);
+	SimRecBuf = NULL;
+}
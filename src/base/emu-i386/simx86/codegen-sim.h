@@ -50,6 +50,7 @@ typedef union {
 
 typedef struct {
 	int valid, mode, cout;
+	int cfp;		// CF pending in bit 31 of cout
 	wkreg RES;
 } flgtmp;
 
@@ -85,6 +86,27 @@ extern void FlagSync_All (void);
 extern void Gen_sim(int op, int mode, ...);
 extern void AddrGen_sim(int op, int mode, ...);
 extern void InitGen_sim(void);
+extern void EndGen_sim(void);
+
+/* threaded sequences, see codegen-sim.c */
+enum { SOP_GEN, SOP_ADDR, SOP_V86CHK, SOP_CLOSE };
+extern struct simseq *SimRec;
+extern int SimHits, SimMisses;
+extern void SimRecOp(int kind, int op, int mode);
+extern void SimRecBegin(unsigned int PC, int basemode);
+extern void SimRecEnd(unsigned int PC, int mode, int NewNode);
+extern void SimRecClose(void);
+extern unsigned int SimExec(unsigned int PC, int basemode, int *mode,
+			    int *NewNode, unsigned int *P1);
+
+/* V86 address limit check of ModRM(), recorded to be repeated
+ * when the sequence is run */
+static inline int SimV86Limit(void)
+{
+	if (SimRec)
+		SimRecOp(SOP_V86CHK, 0, 0);
+	return TR1.d > 0xffff;
+}
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -2210,14 +2210,44 @@ shrot0:
 
 	case JMP_INDIRECT: {	// input: %%{e}ax = %%{e}ip
 		linkdesc *lt = IG->lt;
-		lt->t_type = JMP_INDIRECT;
 		if (mode&DATA16)
 			// movz{wl} %%ax,%%eax
 			G3M(0x0f,0xb7,0xc0,Cp);
 		// addl Ofs_XCS(%%ebx),%%eax
 		G3M(0x03,0x43,Ofs_XCS,Cp);
-		// pop %%edx; ret
+		if (!IG->p0) {
+			// far transfer, CS can change: no inline cache
+			lt->t_type = 0;
+			// pop %%edx; ret
+			G2M(0x5a,0xc3,Cp);
+			break;
+		}
+		/* near ret/jmp/call: inline cache, see ICLinker()
+		 *	movzwl Ofs_SIGAPEND(%%ebx),%%ecx
+		 *	jecxz 1f
+		 *	pop %%edx; ret
+		 * 1:	cmpl $ic_target,%%eax
+		 *	jne 2f
+		 *	incl Ofs_ICHITS(%%ebx)
+		 *	jmp {ic_target code, or 2f if unlinked}
+		 * 2:	movl $key,Ofs_ICKEY(%%ebx)
+		 *	pop %%edx; ret
+		 */
+		lt->t_type = JMP_INDIRECT;
+		G4M(0x0f,0xb7,0x4b,Ofs_SIGAPEND,Cp);
+		G2M(0xe3,0x02,Cp);
+		G2M(0x5a,0xc3,Cp);
+		G1(0x3d,Cp);
+		/* t_link = offset from codebuf start to cmp immed value */
+		lt->t_link.rel = Cp-BaseGenBuf;
+		G4(IC_UNLINKED,Cp);
+		G2M(0x75,0x08,Cp);
+		G3M(0xff,0x43,Ofs_ICHITS,Cp);
+		G1(0xe9,Cp); G4(0,Cp);
+		G3M(0xc7,0x43,Ofs_ICKEY,Cp); G4(InstrMeta[0].npc,Cp);
 		G2M(0x5a,0xc3,Cp);
+		if (debug_level('e')>2) e_printf("JMP_Indirect IC lk=%08x\n",
+			lt->t_link.rel);
 		}
 		break;
 
@@ -2535,6 +2565,27 @@ static void AddrGen_x86(int op, int mode, ...)
 }
 
 
+/* the ops which write to guest memory */
+static int GenStores(int op, IGen *IG)
+{
+	switch(op) {
+	case S_DI:
+	case S_DI_IMM:
+	case O_PUSH:
+	case O_PUSHI:
+	case O_PUSH1:
+	case O_PUSH2:
+	case O_PUSH2F:
+	case O_PUSH3:
+	case O_MOVS_MovD:
+	case O_MOVS_StoD:
+		return 1;
+	case O_FOP:	// memory forms, FST & co among them
+		return IG->p0 < 0x40;
+	}
+	return 0;
+}
+
 static void Gen_x86(int op, int mode, ...)
 {
 	int rcod=0;
@@ -2759,6 +2810,7 @@ static void Gen_x86(int op, int mode, ...)
 
 	case JMP_INDIRECT:
 		IG->lt = va_arg(ap,linkdesc *);	// lt
+		IG->p0 = va_arg(ap,int);	// near
 		break;
 
 	case JMP_LINK:		// opc, dspt, retaddr, link
@@ -2785,6 +2837,8 @@ static void Gen_x86(int op, int mode, ...)
 	}
 
 	va_end(ap);
+	if (GenStores(op, IG))
+		I->flags |= F_MSTO;
 	I->ngen++;
 #if PROFILE
 	if (debug_level('e')) GenTime += (GETTSC() - t0);
@@ -2980,6 +3034,9 @@ static void NodeLinker(TNode *LG, TNode *G)
 	if (debug_level('e')) t0 = GETTSC();
 #endif
 	if (debug_level('e')>8 && LG) e_printf("NodeLinker: %08x->%08x\n",LG->key,G->key);
+	/* checked nodes must always be entered through FindTree */
+	if (G->flags & F_SMCCHK)
+		return;
 
 	if (LG && (LG->alive>0)) {
 	    int ra;
@@ -3095,6 +3152,119 @@ static void NodeLinker(TNode *LG, TNode *G)
 }
 
 
+/*
+ * Inline caches.
+ *
+ * A near RET/JMP/CALL through a register or memory ends its node with
+ * a compare of the computed target against the last target seen there:
+ *
+ *	cmpl $ic_target,%eax
+ *	jne miss
+ *	jmp ic_target_code
+ * miss:
+ *	movl $key,Ofs_ICKEY(%ebx)
+ *	ret
+ *
+ * A miss leaves the key of the node in TheCPU.ic_key; once the node for
+ * the new target is found the cache is (re)pointed to it. The t_ref,
+ * t_target pair of the linkdesc is used for the cached node, with an
+ * 'I' back-reference, so that it is undone by NodeUnlinker() as any
+ * other link.
+ */
+int ICMisses = 0;
+static int ICSite = 0;
+static unsigned int ICMissPC;
+
+static void _icunlink_fwd(TNode *LG)
+{
+	linkdesc *L = &LG->clink;
+	unsigned int *lp = L->t_link.abs;
+	TNode *Gt = *L->t_ref;
+	backref *Btq = &Gt->clink.bkr;
+	backref *Bt  = Gt->clink.bkr.next;
+
+	while (Bt) {
+		if (*Bt->ref==LG && Bt->branch=='I') {
+			Btq->next = Bt->next;
+			Gt->clink.nrefs--;
+			free(Bt);
+			break;
+		}
+		Btq = Bt;
+		Bt = Bt->next;
+	}
+	if (Bt==NULL) {	// not found...
+		dbug_printf("ICLinker: FW I ref error\n");
+		leavedos_main(0x8113);
+	}
+	*lp = IC_UNLINKED;
+	*(int *)((char *)lp+IC_JMP_OFS) = 0;
+	L->t_ref = NULL;
+	L->t_target = IC_UNLINKED;
+}
+
+static void ICLinker(TNode *LG, TNode *G)
+{
+	linkdesc *L = &LG->clink;
+	unsigned int *lp = L->t_link.abs;
+	backref *B;
+	int ra;
+
+	if (!UseLinker || LG->alive<=0 || G->alive<=0 ||
+	    L->t_type != JMP_INDIRECT || (G->flags & F_SMCCHK))
+	    return;
+	/* near transfers only, so no CS or mode change is allowed */
+	if (G->cs != LG->cs || G->mode != LG->mode)
+	    return;
+	if (L->t_ref) {
+	    if (*L->t_ref == G)
+		return;
+	    _icunlink_fwd(LG);
+	}
+	if (debug_level('e')>1)
+	    e_printf("ICLinker: node (%p:%08x:%p) IC to (%p:%08x:%p)\n",
+		LG,LG->key,LG->addr,G,G->key,G->addr);
+	/* cmp imm32 is followed by jne rel8, incl disp8, jmp rel32 */
+	ra = G->addr - ((unsigned char *)lp + IC_END_OFS);
+	*(int *)((char *)lp+IC_JMP_OFS) = ra;
+	*lp = G->key;
+	L->t_target = G->key;
+	L->t_ref = &G->mblock->bkptr;
+	B = calloc(1,sizeof(backref));
+	B->next = G->clink.bkr.next;
+	G->clink.bkr.next = B;
+	B->ref = &LG->mblock->bkptr;
+	B->branch = 'I';
+	G->clink.nrefs++;
+	if (G==LG)
+	    G->flags |= F_SLFL;
+	_nodeflagbackrefs(LG, G->flags);
+}
+
+/* called after generated code returns */
+static void ICCollect(unsigned int ePC)
+{
+	if (TheCPU.ic_key) {
+	    ICSite = TheCPU.ic_key;
+	    ICMissPC = ePC;
+	    TheCPU.ic_key = 0;
+	    ICMisses++;
+	}
+}
+
+/* called before G is executed: G may be the target of the last miss */
+static void ICLinkPending(TNode *G)
+{
+	TNode *LG;
+
+	if (!ICSite)
+	    return;
+	if (G->key == ICMissPC && (LG = FindNode(ICSite)) != NULL)
+	    ICLinker(LG, G);
+	ICSite = 0;
+}
+
+
 void NodeUnlinker(TNode *G)
 {
 	unsigned int *lp;
@@ -3149,6 +3319,22 @@ void NodeUnlinker(TNode *G)
 		L->nt_ref = NULL; L->unlinked_jmp_targets |= TARGET_NT;
 		T->nrefs--;
 	    }
+	    else if (B->branch=='I') {
+		TNode *H = *B->ref;
+		linkdesc *L = &H->clink;
+		if (debug_level('e')>2) e_printf("Unlinking I ref from node %p(%08x) to %08x\n",
+			H, L->t_target, G->key);
+		if (L->t_target != G->key) {
+		    dbug_printf("Unlinker: BK ref error i=%08x k=%08x\n",
+			L->t_target, G->key);
+		    leavedos_main(0x8110);
+		}
+		lp = L->t_link.abs;
+		*lp = IC_UNLINKED;
+		*(int *)((char *)lp+IC_JMP_OFS) = 0;
+		L->t_ref = NULL; L->t_target = IC_UNLINKED;
+		T->nrefs--;
+	    }
 	    else {
 		e_printf("Invalid unlink [%c] ref %p from node ?(?) to %08x\n",
 			B->branch, B->ref, G->key);
@@ -3218,6 +3404,26 @@ void NodeUnlinker(TNode *G)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+/* enter a new code block, just produced or read back from the
+ * persistent cache, into the tree */
+TNode *InstallNode(IMeta *I0, CodeBuf *GenCodeBuf, int mode)
+{
+	TNode *G;
+
+	G = Move2Tree(I0, GenCodeBuf);		/* when is G==NULL? */
+	/* InstrMeta will be zeroed at this point */
+	/* mprotect the page here; a page fault will be triggered
+	 * if some other code tries to write over the page including
+	 * this node */
+	e_markpage(G->seqbase, G->seqlen);
+	e_mprotect(G->seqbase, G->seqlen);
+	G->cs = LONG_CS;
+	G->mode = mode;
+	return G;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 /*
  * These are the functions which actually executes the generated code.
@@ -3268,15 +3474,8 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode)
 #if PROFILE
 	if (debug_level('e')) TotalNodesParsed++;
 #endif
-	G = Move2Tree(I0, GenCodeBuf);		/* when is G==NULL? */
-	/* InstrMeta will be zeroed at this point */
-	/* mprotect the page here; a page fault will be triggered
-	 * if some other code tries to write over the page including
-	 * this node */
-	e_markpage(G->seqbase, G->seqlen);
-	e_mprotect(G->seqbase, G->seqlen);
-	G->cs = LONG_CS;
-	G->mode = mode;
+	G = InstallNode(I0, GenCodeBuf, mode);
+	JitCacheStore(G);
 	/* check links INSIDE current node */
 	if (0 == (EFLAGS & EFLAGS_TF) ) {
 		NodeLinker(G, G);
@@ -3412,6 +3611,7 @@ unsigned int Exec_x86(TNode *G)
 		asm ("fldcw	%0" :: "m"(fpuc));
 	}
 
+	ICLinkPending(G);
 	flg = Exec_x86_pre(ecpu);
 #if PROFILE
 	__asm__ __volatile__ (
@@ -3420,6 +3620,7 @@ unsigned int Exec_x86(TNode *G)
 	);
 #endif
 	ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, SeqStart);
+	ICCollect(ePC);
 #if PROFILE
 	__asm__ __volatile__ (
 		"rdtsc\n"
@@ -3518,7 +3719,9 @@ unsigned int Exec_x86_fast(TNode *G)
 	unsigned mode = G->mode;
 
 	do {
+		ICLinkPending(G);
 		ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, G->addr);
+		ICCollect(ePC);
 		if (G->alive > 0) {
 			if (LastXNode->clink.unlinked_jmp_targets &&
 			    (LastXNode->clink.t_target == G->key ||
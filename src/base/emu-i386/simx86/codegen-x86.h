@@ -47,6 +47,8 @@
 extern unsigned int VgaAbsBankBase;
 extern unsigned int Exec_x86(TNode *G);
 extern unsigned int Exec_x86_fast(TNode *G);
+extern TNode *InstallNode(IMeta *I0, CodeBuf *GenCodeBuf, int mode);
+extern hitimer_u TimeStartExec;
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -123,6 +125,12 @@ void NodeUnlinker(TNode *G);
 
 extern unsigned char TailCode[];
 
+/* cmp immediate of an inline cache not pointing to any node */
+#define IC_UNLINKED	0xffffffff
+/* offsets from the cmp immediate to the jmp displacement and past it */
+#define IC_JMP_OFS	10
+#define IC_END_OFS	14
+
 static __inline__ int GoodNode(TNode *G, int mode)
 {
 	if (G->cs != LONG_CS) {
@@ -192,6 +192,8 @@
 #define F_HITC	0x0002
 #define F_SLFL	0x0004
 #define F_INHI	0x0008
+#define F_SMCCHK	0x0010	// source bytes are checked on entry
+#define F_MSTO	0x0020	// writes to memory
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -847,6 +847,13 @@ void enter_cpu_emu(void)
 		dbug_printf("EMU86: delta alrm=%d speed=%d\n",
 			    realdelta,config.CPUSpeedInMhz);
 	}
+	SimHits = SimMisses = 0;
+#ifdef X86_JIT
+	TheCPU.ic_hits = TheCPU.ic_key = 0;
+	ICMisses = 0;
+	SMCDirty = 0;
+	JitCacheLoads = JitCacheStores = 0;
+#endif
 	e_sigpa_count = 0;
 
 #ifdef DEBUG_TREE
@@ -864,6 +871,21 @@ static void print_statistics(void)
 {
 	dbug_printf("Total cpuemu time %16lld us (incl.trace)\n",
 		    (long long)TotalTime/config.CPUSpeedInMhz);
+#ifdef X86_JIT
+	if (!config.cpusim) {
+		dbug_printf("IC hits           %16u\n",TheCPU.ic_hits);
+		dbug_printf("IC misses         %16d\n",ICMisses);
+		dbug_printf("Soft SMC pages    %16d\n",SoftPages);
+		dbug_printf("SMC checks failed %16d\n",SMCDirty);
+		dbug_printf("JIT cache loads   %16d\n",JitCacheLoads);
+		dbug_printf("JIT cache stores  %16d\n",JitCacheStores);
+		dbug_printf("Code bytes        %16d\n",CodeBytes);
+		dbug_printf("Nodes evicted     %16d\n",NodesEvicted);
+		dbug_printf("Nodes retranslated%16d\n",NodesRetranslated);
+	}
+#endif
+	dbug_printf("Sim cache hits    %16d\n",SimHits);
+	dbug_printf("Sim cache misses  %16d\n",SimMisses);
 #if PROFILE
 	dbug_printf("Total codgen time %16lld us\n",
 		    (long long)GenTime/config.CPUSpeedInMhz);
@@ -910,6 +932,7 @@ void leave_cpu_emu(void)
 #ifdef X86_JIT
 		EndGen();
 #endif
+		EndGen_sim();
 #ifdef DEBUG_TREE
 		fclose(tLog); tLog = NULL;
 #endif
@@ -992,6 +1015,7 @@ int e_vm86(void)
     Reg2Cpu(mode);
     if (CONFIG_CPUSIM) {
       RFL.valid = V_INVALID;
+      RFL.cfp = 0;
     }
     /* ---- INNER LOOP: exit with error or code>0 (vm86 fault) ---- */
     do {
@@ -1098,8 +1122,10 @@ int e_dpmi(cpuctx_t *scp)
   do {
     TheCPU.err = 0;
     mode = Scp2CpuD (scp);
-    if (CONFIG_CPUSIM)
+    if (CONFIG_CPUSIM) {
       RFL.valid = V_INVALID;
+      RFL.cfp = 0;
+    }
     if (TheCPU.err) {
         error("DPM86: segment error %d\n", TheCPU.err);
         leavedos_main(0);
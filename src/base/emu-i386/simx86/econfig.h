@@ -67,8 +67,9 @@
 
 #define NODES_IN_POOL	100000
 #define NODELIFE(n)	200
-#define CLEAN_SPEED(n)	(((n)<<2)+1)
-#define AGENODE		CreationIndex
+#define NODE_COLD	1		/* alive value of a node not hit since the last sweep */
+#define CLOCK_STEPS	64		/* nodes visited per eviction/reaping round */
+#define CODE_BUDGET	(16<<20)	/* default size of the translated code */
 
 #undef	TRAP_RETRACE
 
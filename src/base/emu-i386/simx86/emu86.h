@@ -690,6 +690,9 @@ extern int Running;		/* into interpreter loop */
 extern unsigned int mMaxMem;
 extern int UseLinker;
 extern int PageFaults;
+extern int ICMisses;
+extern int SoftPages;
+extern int SMCDirty;
 
 extern volatile int CEmuStat;
 extern volatile int InCompiledCode;
@@ -704,7 +707,7 @@ int _ModRM(unsigned char opc, unsigned int PC, int mode);
         CODE_FLUSH(); \
         goto illegal_op; \
     } \
-    if (CONFIG_CPUSIM && V86MODE() && !((m) & (ADDR16 | MLEA)) && TR1.d > 0xffff) { \
+    if (CONFIG_CPUSIM && V86MODE() && !((m) & (ADDR16 | MLEA)) && SimV86Limit()) { \
         CODE_FLUSH(); \
         goto not_permitted; \
     } \
@@ -728,6 +731,8 @@ int e_markpage(unsigned int addr, size_t len);
 int e_unmarkpage(unsigned int addr, size_t len);
 int e_querymark(unsigned int addr, size_t len);
 int e_querymark_all(unsigned int addr, size_t len);
+int e_querysoft(unsigned int addr, size_t len);
+int e_soft_check(unsigned int addr, size_t len);
 void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip);
 void mprot_init(void);
 void mprot_end(void);
@@ -363,7 +363,9 @@ static unsigned int _JumpGen(unsigned int P2, int mode, int opc,
 			Gen(JMP_INDIRECT, mode);
 #ifdef X86_JIT
 		else
-			Gen(JMP_INDIRECT, mode, &InstrMeta[0].clink);
+			Gen(JMP_INDIRECT, mode, &InstrMeta[0].clink,
+			    opc == RET || opc == RETisp || opc == JMPi ||
+			    opc == CALLi);
 #endif
 		break;
 	default: dbug_printf("JumpGen: unknown condition\n");
@@ -525,6 +527,10 @@ static unsigned int interp_pre(unsigned int PC, const int mode, int *_NewNode,
 			}
 		}
 #ifdef X86_JIT
+		/* a block translated in an earlier run can be used as is */
+		if (JitCacheOn && !CONFIG_CPUSIM && !NewNode &&
+		    !e_querymark(PC, 1))
+			JitCacheLoad(PC, mode);
 		if (!CONFIG_CPUSIM && e_querymark(PC, 1)) {
 			unsigned int P2 = PC;
 			if (NewNode) {
@@ -592,6 +598,19 @@ static unsigned int interp_post(unsigned int PC, const int mode,
 		}
 #endif
 
+#ifdef X86_JIT
+		/* code on a soft page is not protected, a store to it is
+		 * only noticed when its node is entered. So the sequence
+		 * ends after a store once it touches a soft page, and
+		 * the code that follows is entered through the check */
+		if (!CONFIG_CPUSIM && NewNode && CurrIMeta > 0 &&
+		    (InstrMeta[0].flags & F_MSTO) &&
+		    e_querysoft(P0, PC + 15 - P0)) {
+			P0 = PC;
+			CODE_FLUSH2(mode);
+		}
+#endif
+
 #ifdef SINGLEBLOCK
 		if (!CONFIG_CPUSIM && NewNode && CurrIMeta > 0) {
 			P0 = PC;
@@ -647,8 +666,12 @@ static unsigned int _Interp86(unsigned int PC, int basemode)
 
 	if (PROTMODE() && setjmp(jmp_env)) {
 		/* long jump to here from simulated page fault */
+		if (CONFIG_CPUSIM)
+			SimRecClose();
 		return P0;
 	}
+	if (CONFIG_CPUSIM)
+		SimRecClose();
 
 	NewNode = 0;
 	TheCPU.err = 0;
@@ -663,7 +686,20 @@ static unsigned int _Interp86(unsigned int PC, int basemode)
 		PC = interp_pre(PC, mode, &NewNode, &P0);
 		if (TheCPU.err)
 			return PC;
-		PC = InterpOne(PC, &basemode, &mode, &NewNode);
+		if (CONFIG_CPUSIM) {
+			/* run the sequence starting at PC if it was already
+			 * recorded, else interpret the instruction and try to
+			 * add its ops to the sequence under recording */
+			unsigned int P2 = SimExec(PC, basemode, &mode, &NewNode,
+						  &P0);
+			if (P2 == (unsigned)-1) {
+				SimRecBegin(PC, basemode);
+				P2 = InterpOne(PC, &basemode, &mode, &NewNode);
+				SimRecEnd(P2, mode, NewNode);
+			}
+			PC = P2;
+		} else
+			PC = InterpOne(PC, &basemode, &mode, &NewNode);
 		if (TheCPU.err)
 			return PC;
 		PC = interp_post(PC, mode, &NewNode, &P0);
@@ -897,6 +933,7 @@ intop3b:		{ int op = ArOpsFR[D_MO(opc)];
 /*d6*/	case 0xd6:	/* Undocumented */
 			CODE_FLUSH();
 			e_printf("Undocumented op 0xd6\n");
+			if (CONFIG_CPUSIM) FlagSync_All();
 			rAL = (EFLAGS & EFLAGS_CF? 0xff:0x00);
 			PC++; break;
 /*62*/	case BOUND:    {
@@ -2023,7 +2060,7 @@ intop3b:		{ int op = ArOpsFR[D_MO(opc)];
 				e_printf("IRET: ret=%04x:%08x\n",sv,TheCPU.eip);
 			}
 			temp=0; POP(m, &temp);
-			if (CONFIG_CPUSIM) RFL.valid = V_INVALID;
+			if (CONFIG_CPUSIM) FlagSync_All();
 			if (REALMODE())
 			    FLAGS = temp;
 			else if (V86MODE()) {
@@ -2049,7 +2086,7 @@ intop3b:		{ int op = ArOpsFR[D_MO(opc)];
 /*9d*/	case POPF: {
 			CODE_FLUSH();
 			temp=0; POP(_mode, &temp);
-			if (CONFIG_CPUSIM) RFL.valid = V_INVALID;
+			if (CONFIG_CPUSIM) FlagSync_All();
 			if (V86MODE()) {
 			    int is_tf;
 stack_return_from_vm86:
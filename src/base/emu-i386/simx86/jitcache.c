@@ -0,0 +1,487 @@
+/***************************************************************************
+ *
+ * All modifications in this file to the original code are
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ *
+ *
+ *  SIMX86 a Intel 80x86 cpu emulator
+ *  Copyright (C) 1997,2001 Alberto Vignani, FIAT Research Center
+ *				a.vignani@crf.it
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***************************************************************************/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emu86.h"
+#include "dlmalloc.h"
+#include "codegen-arch.h"
+
+#ifdef X86_JIT
+
+/*
+ * Persistent translation cache.
+ *
+ * Every code block produced by ProduceCode() is appended to a file
+ * which stays mapped in memory. Before a block is parsed, the
+ * interpreter asks for a block with the same start address, code
+ * segment base and mode; if the guest bytes it was translated from
+ * hash to the same value, its code is copied back and entered into
+ * the tree as if it had just been generated.
+ *
+ * The generated code only addresses the host through TheCPU (%ebx)
+ * and the memory base (%ebp), so it can be reused by another run of
+ * the same binary. The file header keeps a signature of the binary
+ * and of the layout the code depends on; a file written by anything
+ * else is started over. Blocks are stored right after translation,
+ * before they are linked or patched by cpatch.
+ *
+ * Only one dosemu at a time can write to the file, the others use it
+ * read-only. Such a reader indexes the records again when it sees
+ * that the writer has added some or started over, but only within the
+ * size of the file when the reader mapped it. The writer may rewrite a
+ * record while a reader looks at it, so a reader copies the record
+ * out first and checks the copy, header included, against its sum.
+ */
+
+#define JC_MAGIC	"SIMX86C2"
+#define JC_SIZE		(64 << 20)	/* max size of the file */
+#define JC_HASH		16384		/* index buckets */
+#define JC_HASHMASK	(JC_HASH-1)
+#define JC_NOLINK	0xffffffff
+#define JC_FNV_INIT	0xcbf29ce484222325ULL
+
+struct jc_header {
+	char magic[8];
+	uint64_t sign;		/* signature of the binary */
+	uint32_t used;		/* bytes in use, header included */
+	uint32_t count;		/* number of blocks */
+};
+
+struct jc_rec {
+	uint32_t size;		/* whole record, 8-byte aligned */
+	uint32_t key, cs, mode, env;
+	uint32_t seqbase;
+	uint16_t seqlen, seqnum, len, flags;
+	uint32_t t_type, t_off, nt_off;
+	uint64_t srchash;	/* hash of the guest bytes */
+	uint64_t sum;		/* hash of the above, offset table and code */
+	Addr2Pc meta[0];	/* seqnum+1 of these, followed by the code */
+};
+
+struct jc_ent {
+	uint32_t off;
+	int next;
+};
+
+int JitCacheOn = 0;
+int JitCacheLoads = 0;
+int JitCacheStores = 0;
+
+static int jc_fd = -1;
+static int jc_writable;
+static size_t jc_mapsize;
+static unsigned char *jc_map;
+static struct jc_header *jc_hdr;
+static struct jc_ent *jc_ent;
+static int jc_nent, jc_maxent;
+static uint32_t jc_indexed;	/* end of the records in the index */
+static int jc_bucket[JC_HASH];
+
+static uint64_t jc_fnv(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+
+	while (n--) {
+		h ^= *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static inline int jc_bucketof(unsigned int key, unsigned int cs,
+			      unsigned int mode)
+{
+	return (key ^ (key >> 14) ^ (cs * 0x9e3779b1u) ^ mode) & JC_HASHMASK;
+}
+
+/* CPU state the code of a block depends on besides its mode */
+static inline unsigned int jc_env(void)
+{
+	return (EFLAGS & (EFLAGS_VM|EFLAGS_IOPL_MASK)) | (TheCPU.cr[0] & CR0_PE);
+}
+
+static uint64_t jc_sign(void)
+{
+	struct {
+		long long size, mtime, ino;
+		int cpusize, tsofs, realcpu, fxsr, sse;
+		unsigned char tail[TAILSIZE];
+	} s;
+	struct stat st;
+
+	memset(&s, 0, sizeof(s));
+	if (stat("/proc/self/exe", &st) == 0) {
+		s.size = st.st_size;
+		s.mtime = st.st_mtime;
+		s.ino = st.st_ino;
+	}
+	s.cpusize = sizeof(TheCPU);
+	s.tsofs = (unsigned char *)&TimeStartExec - CPUOFFS(0);
+	s.realcpu = config.realcpu;
+	s.fxsr = config.cpufxsr;
+	s.sse = config.cpusse;
+	memcpy(s.tail, TailCode, TAILSIZE);
+	return jc_fnv(JC_FNV_INIT, &s, sizeof(s));
+}
+
+/* the source of a block must be readable whenever its start is: keep
+ * it on one page, or in the always mapped first megabyte + HMA */
+static int jc_srcok(unsigned int base, unsigned int len, unsigned int key)
+{
+	if (len == 0)
+		return 0;
+	if (base + len <= LOWMEM_SIZE + HMASIZE)
+		return 1;
+	return (base >> PAGE_SHIFT) == (key >> PAGE_SHIFT) &&
+		((base + len - 1) >> PAGE_SHIFT) == (key >> PAGE_SHIFT);
+}
+
+static void jc_index(uint32_t off)
+{
+	struct jc_rec *r = (struct jc_rec *)(jc_map + off);
+	int b = jc_bucketof(r->key, r->cs, r->mode);
+
+	if (jc_nent == jc_maxent) {
+		jc_maxent = jc_maxent ? jc_maxent * 2 : 4096;
+		jc_ent = realloc(jc_ent, jc_maxent * sizeof(*jc_ent));
+	}
+	jc_ent[jc_nent].off = off;
+	jc_ent[jc_nent].next = jc_bucket[b];
+	jc_bucket[b] = jc_nent++;
+}
+
+/* check the header of a record at off before anything of it is used */
+static int jc_recok(const struct jc_rec *r, uint32_t off, uint32_t limit)
+{
+	if (off + sizeof(*r) > limit || r->size < sizeof(*r) ||
+	    (r->size & 7) || r->size > limit - off)
+		return 0;
+	return sizeof(*r) + (r->seqnum + 1) * sizeof(Addr2Pc) + r->len
+		<= r->size;
+}
+
+static uint64_t jc_sum(const struct jc_rec *r, const void *meta)
+{
+	uint64_t h = jc_fnv(JC_FNV_INIT, r, offsetof(struct jc_rec, sum));
+
+	return jc_fnv(h, meta, (r->seqnum + 1) * sizeof(Addr2Pc) + r->len);
+}
+
+static uint32_t jc_used(void)
+{
+	return __atomic_load_n(&jc_hdr->used, __ATOMIC_ACQUIRE);
+}
+
+/* index the records from jc_indexed up to used */
+static void jc_scan(uint32_t used)
+{
+	struct jc_rec rec;
+	uint32_t off;
+
+	for (off = jc_indexed; off < used; off += rec.size) {
+		/* a reader may see the writer starting over */
+		memcpy(&rec, jc_map + off,
+		       used - off < sizeof(rec) ? used - off : sizeof(rec));
+		if (!jc_recok(&rec, off, used)) {
+			/* cut off a damaged tail */
+			if (jc_writable)
+				jc_hdr->used = used = off;
+			break;
+		}
+		jc_index(off);
+	}
+	jc_indexed = off < used ? off : used;
+}
+
+static void jc_clearindex(void)
+{
+	memset(jc_bucket, 0xff, sizeof(jc_bucket));
+	jc_nent = 0;
+	jc_indexed = sizeof(*jc_hdr);
+}
+
+/* a reader follows what the writer has done since the last look */
+static void jc_rescan(void)
+{
+	uint32_t used = jc_used();
+
+	if (used == jc_indexed || used > jc_mapsize)
+		return;
+	if (used < jc_indexed)		/* started over */
+		jc_clearindex();
+	jc_scan(used);
+}
+
+static void jc_reset(void)
+{
+	memcpy(jc_hdr->magic, JC_MAGIC, sizeof(jc_hdr->magic));
+	jc_hdr->sign = jc_sign();
+	jc_hdr->used = sizeof(*jc_hdr);
+	jc_hdr->count = 0;
+}
+
+void JitCacheInit(void)
+{
+	struct stat st;
+
+	if (!config.jit_cache || !config.jit_cache[0] || JitCacheOn)
+		return;
+	jc_fd = open(config.jit_cache, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (jc_fd == -1) {
+		error("JIT cache: cannot open %s: %s\n", config.jit_cache,
+		      strerror(errno));
+		return;
+	}
+	jc_writable = (flock(jc_fd, LOCK_EX | LOCK_NB) == 0);
+	if (fstat(jc_fd, &st) == -1)
+		goto fail;
+	if (jc_writable) {
+		if (st.st_size < JC_SIZE && ftruncate(jc_fd, JC_SIZE) == -1)
+			goto fail;
+		jc_mapsize = JC_SIZE;
+	} else {
+		/* another dosemu owns the file, use what it has so far */
+		if (st.st_size < sizeof(struct jc_header))
+			goto fail;
+		jc_mapsize = st.st_size < JC_SIZE ? st.st_size : JC_SIZE;
+	}
+	jc_map = mmap(NULL, jc_mapsize,
+		      PROT_READ | (jc_writable ? PROT_WRITE : 0),
+		      MAP_SHARED, jc_fd, 0);
+	if (jc_map == MAP_FAILED) {
+		jc_map = NULL;
+		goto fail;
+	}
+	jc_hdr = (struct jc_header *)jc_map;
+	if (memcmp(jc_hdr->magic, JC_MAGIC, sizeof(jc_hdr->magic)) != 0 ||
+	    jc_hdr->sign != jc_sign() || jc_hdr->used < sizeof(*jc_hdr) ||
+	    jc_hdr->used > jc_mapsize) {
+		if (!jc_writable)
+			goto fail;
+		e_printf("JIT cache: %s is stale, starting over\n",
+			 config.jit_cache);
+		jc_reset();
+	}
+
+	jc_clearindex();
+	jc_scan(jc_used());
+	JitCacheOn = 1;
+	g_printf("JIT cache: %s, %d blocks, %u bytes%s\n", config.jit_cache,
+		 jc_nent, jc_hdr->used, jc_writable ? "" : " (read-only)");
+	return;
+
+fail:
+	error("JIT cache: cannot use %s\n", config.jit_cache);
+	if (jc_map)
+		munmap(jc_map, jc_mapsize);
+	jc_map = NULL;
+	close(jc_fd);
+	jc_fd = -1;
+}
+
+void JitCacheEnd(void)
+{
+	if (!JitCacheOn)
+		return;
+	JitCacheOn = 0;
+	munmap(jc_map, jc_mapsize);
+	jc_map = NULL;
+	jc_hdr = NULL;
+	close(jc_fd);
+	jc_fd = -1;
+	free(jc_ent);
+	jc_ent = NULL;
+	jc_nent = jc_maxent = 0;
+}
+
+/* first block for key/cs/mode whose source is still the same; the
+ * checks are made on a copy of its header, left in *r */
+static struct jc_rec *jc_find(unsigned int key, unsigned int cs,
+			      unsigned int mode, struct jc_rec *r)
+{
+	unsigned int env = jc_env();
+	unsigned int hbase = 0, hlen = 0;
+	uint64_t h = 0;
+	int i;
+
+	for (i = jc_bucket[jc_bucketof(key, cs, mode)]; i >= 0;
+	     i = jc_ent[i].next) {
+		uint32_t off = jc_ent[i].off;
+
+		memcpy(r, jc_map + off, sizeof(*r));
+		/* the owner of the file may have started it over */
+		if (!jc_recok(r, off, jc_mapsize))
+			continue;
+		if (r->key != key || r->cs != cs || r->mode != mode ||
+		    r->env != env || !jc_srcok(r->seqbase, r->seqlen, key))
+			continue;
+		if (r->seqbase != hbase || r->seqlen != hlen) {
+			hbase = r->seqbase;
+			hlen = r->seqlen;
+			h = jc_fnv(JC_FNV_INIT, LINEAR2UNIX(hbase), hlen);
+		}
+		if (r->srchash == h)
+			return (struct jc_rec *)(jc_map + off);
+	}
+	return NULL;
+}
+
+TNode *JitCacheLoad(unsigned int PC, int mode)
+{
+	struct jc_rec rec, *r = &rec, *sr;
+	IMeta *I0 = &InstrMeta[0];
+	CodeBuf *cb;
+	unsigned char *code;
+	size_t msz;
+	int i, nap;
+
+	if (CurrIMeta >= 0 || (EFLAGS & TF) || debug_level('e'))
+		return NULL;
+	if (!jc_writable)
+		jc_rescan();
+	/* only the private copies are trusted, the shared record can change
+	 * under us until the sum of the copies says they are whole */
+	sr = jc_find(PC, LONG_CS, mode, r);
+	if (sr == NULL)
+		return NULL;
+	nap = r->seqnum + 1;
+	msz = nap * sizeof(Addr2Pc) + r->len;
+	cb = dlmalloc(offsetof(CodeBuf, meta) + msz);
+	memcpy(cb->meta, sr->meta, msz);
+	if (jc_sum(r, cb->meta) != r->sum) {
+		e_printf("JIT cache: bad block at %08x\n", PC);
+		dlfree(cb);
+		return NULL;
+	}
+	/* blocks on soft pages have to end after their stores */
+	if (e_querysoft(r->seqbase, r->seqlen)) {
+		dlfree(cb);
+		return NULL;
+	}
+
+	/* rebuild what Move2Tree() wants from the instruction list */
+	code = (unsigned char *)&cb->meta[nap];
+	memset(I0, 0, sizeof(IMeta));
+	for (i = 0; i < r->seqnum; i++) {
+		InstrMeta[i].npc = PC + cb->meta[i].dnpc;
+		InstrMeta[i].daddr = cb->meta[i].daddr;
+		InstrMeta[i].len = cb->meta[i+1].daddr - cb->meta[i].daddr;
+	}
+	I0->ncount = r->seqnum;
+	I0->seqbase = r->seqbase;
+	I0->seqlen = r->seqlen;
+	I0->totlen = r->len;
+	I0->flags = r->flags;
+	I0->clink.t_type = r->t_type;
+	if (r->t_type >= JMP_INDIRECT)
+		I0->clink.t_link.rel = r->t_off;
+	else
+		I0->clink.t_link.abs = r->t_off == JC_NOLINK ? NULL :
+			(unsigned int *)(code + r->t_off);
+	if (r->t_type > JMP_LINK)
+		I0->clink.nt_link.rel = r->nt_off;
+	else
+		I0->clink.nt_link.abs = r->nt_off == JC_NOLINK ? NULL :
+			(unsigned int *)(code + r->nt_off);
+
+	JitCacheLoads++;
+	if (debug_level('e')>2)
+		e_printf("JIT cache: block %08x:%08x from disk\n", PC, r->seqlen);
+	return InstallNode(I0, cb, mode);
+}
+
+static uint32_t jc_linkoff(TNode *G, unsigned int *p)
+{
+	unsigned char *a = (unsigned char *)p;
+
+	if (a < G->addr || a >= G->addr + G->len)
+		return JC_NOLINK;
+	return a - G->addr;
+}
+
+void JitCacheStore(TNode *G)
+{
+	struct jc_rec *r, rec;
+	uint64_t srchash;
+	size_t sz, msz;
+
+	if (!JitCacheOn || !jc_writable || (G->flags & F_SMCCHK) ||
+	    (EFLAGS & TF) || debug_level('e') ||
+	    !jc_srcok(G->seqbase, G->seqlen, G->key))
+		return;
+	msz = (G->seqnum + 1) * sizeof(Addr2Pc) + G->len;
+	sz = (sizeof(*r) + msz + 7) & ~7;
+	if (jc_hdr->used + sz > jc_mapsize)
+		return;
+	/* a node dropped by the cleaner comes back the same */
+	if (jc_find(G->key, G->cs, G->mode, &rec) &&
+	    rec.seqbase == G->seqbase && rec.seqlen == G->seqlen)
+		return;
+	srchash = jc_fnv(JC_FNV_INIT, LINEAR2UNIX(G->seqbase), G->seqlen);
+
+	r = (struct jc_rec *)(jc_map + jc_hdr->used);
+	r->size = sz;
+	r->key = G->key;
+	r->cs = G->cs;
+	r->mode = G->mode;
+	r->env = jc_env();
+	r->seqbase = G->seqbase;
+	r->seqlen = G->seqlen;
+	r->seqnum = G->seqnum;
+	r->len = G->len;
+	r->flags = G->flags;
+	r->t_type = G->clink.t_type;
+	if (G->clink.t_type >= JMP_INDIRECT)
+		r->t_off = (unsigned char *)G->clink.t_link.abs - G->addr;
+	else
+		r->t_off = jc_linkoff(G, G->clink.t_link.abs);
+	if (G->clink.t_type > JMP_LINK)
+		r->nt_off = (unsigned char *)G->clink.nt_link.abs - G->addr;
+	else
+		r->nt_off = jc_linkoff(G, G->clink.nt_link.abs);
+	r->srchash = srchash;
+	/* the offset table is followed by the code in a CodeBuf, too */
+	memcpy(r->meta, G->pmeta, msz);
+	r->sum = jc_sum(r, r->meta);
+	/* make the record visible to the readers only once it is complete */
+	jc_index(jc_hdr->used);
+	__atomic_store_n(&jc_hdr->used, jc_hdr->used + sz, __ATOMIC_RELEASE);
+	jc_indexed = jc_hdr->used;
+	jc_hdr->count++;
+	JitCacheStores++;
+}
+
+#endif	// X86_JIT
@@ -55,16 +55,34 @@
 #endif
 
 typedef struct _mpmap {
-	struct _mpmap *next;
 	int mega;
 	unsigned char pagemap[32];	/* (32*8)=256 pages *4096 = 1M */
 	uint64_t subpage[(0x100000>>CGRAN)/UINT64_WIDTH];	/* 2^CGRAN-byte granularity, 1M/2^CGRAN bits */
+	unsigned char softmap[32];	/* pages whose code is checked, not protected */
+	unsigned char faults[256];	/* data write faults per protected page */
+	unsigned char backoff[256];	/* soft mode trial reverts per page */
+	unsigned int checks[256];	/* checked node entries per soft page */
 } tMpMap;
 
-static tMpMap *MpH = NULL;
+/* Pages which keep faulting on data writes while holding little code
+ * are switched to "soft" mode: they are left writable and the nodes
+ * translated from them verify their source bytes on entry instead.
+ * After SMC_RETRY<<backoff checked entries the page is tried again
+ * in protected mode. */
+#define SMC_FAULTS	8		/* data faults before going soft */
+#define SMC_DENSITY	(PAGE_SIZE/8)	/* max code bytes in a soft page */
+#define SMC_RETRY	0x10000
+#define SMC_MAXBACKOFF	6
+
+/* Radix table over the whole 4G linear space: the first level has one
+ * entry per megabyte, the tMpMap leaves are allocated when first used */
+#define MPMAP_SHIFT	(PAGE_SHIFT+8)
+#define MPMAP_SIZE	(1 << (32 - MPMAP_SHIFT))
+
+static tMpMap *MpMap[MPMAP_SIZE];
 unsigned int mMaxMem = 0;
 int PageFaults = 0;
-static tMpMap *LastMp = NULL;
+int SoftPages = 0;
 
 static int e_munprotect(unsigned int addr, size_t len);
 
@@ -72,16 +90,17 @@ static int e_munprotect(unsigned int addr, size_t len);
 
 static inline tMpMap *FindM(unsigned int addr)
 {
-	register int a2l = addr >> (PAGE_SHIFT+8);
-	register tMpMap *M = LastMp;
-
-	if (M && (M->mega==a2l)) return M;
-	M = MpH;
-	while (M) {
-		if (M->mega==a2l) {
-		    LastMp = M; break;
-		}
-		M = M->next;
+	return MpMap[addr >> MPMAP_SHIFT];
+}
+
+static tMpMap *GetM(unsigned int addr)
+{
+	tMpMap *M = FindM(addr);
+
+	if (M == NULL) {
+		M = (tMpMap *)calloc(1,sizeof(tMpMap));
+		M->mega = addr >> MPMAP_SHIFT;
+		MpMap[M->mega] = M;
 	}
 	return M;
 }
@@ -95,16 +114,7 @@ static int AddMpMap(unsigned int addr, unsigned int aend, int onoff)
 
 	do {
 	    page = addr >> PAGE_SHIFT;
-	    M = MpH;
-	    while (M) {
-		if (M->mega==(page>>8)) break;
-		M = M->next;
-	    }
-	    if (M==NULL) {
-		M = (tMpMap *)calloc(1,sizeof(tMpMap));
-		M->next = MpH; MpH = M;
-		M->mega = (page>>8);
-	    }
+	    M = GetM(addr);
 	    if (bp < 32) {
 		bs |= (((unsigned)(onoff? test_and_set_bit(page&255, M->pagemap) :
 			    test_and_clear_bit(page&255, M->pagemap)) & 1) << bp);
@@ -140,12 +150,12 @@ int e_querymprotrange(unsigned int addr, size_t len)
 	a2l = addr >> PAGE_SHIFT;
 	a2h = (addr+len-1) >> PAGE_SHIFT;
 
-	while (M && a2l <= a2h) {
-		if (test_bit(a2l&255, M->pagemap))
+	while (a2l <= a2h) {
+		if (M && test_bit(a2l&255, M->pagemap))
 			return 1;
 		a2l++;
 		if ((a2l&255)==0)
-			M = M->next;
+			M = FindM(a2l << PAGE_SHIFT);
 	}
 	return 0;
 }
@@ -157,9 +167,10 @@ int e_querymprotrange(unsigned int addr, size_t len)
 int e_markpage(unsigned int addr, size_t len)
 {
 	unsigned int abeg, aend;
-	tMpMap *M = FindM(addr);
+	tMpMap *M;
 
-	if (M == NULL || len == 0) return 0;
+	if (len == 0) return 0;
+	M = GetM(addr);
 
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
@@ -167,12 +178,12 @@ int e_markpage(unsigned int addr, size_t len)
 	if (debug_level('e')>1)
 		dbug_printf("MARK from %08x to %08x for %08x\n",
 			    abeg<<CGRAN,((aend+1)<<CGRAN)-1,addr);
-	while (M && abeg <= aend) {
+	while (abeg <= aend) {
 		assert(!test_bit(abeg&CGRMASK, M->subpage));
 		set_bit(abeg&CGRMASK, M->subpage);
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = GetM(abeg << CGRAN);
 	}
 	return 1;
 }
@@ -182,7 +193,7 @@ int e_unmarkpage(unsigned int addr, size_t len)
 	unsigned int abeg, aend;
 	tMpMap *M = FindM(addr);
 
-	if (M == NULL || len == 0) return 0;
+	if (len == 0) return 0;
 
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
@@ -190,11 +201,12 @@ int e_unmarkpage(unsigned int addr, size_t len)
 	if (debug_level('e')>1)
 		dbug_printf("UNMARK from %08x to %08x for %08x\n",
 			    abeg<<CGRAN,((aend+1)<<CGRAN)-1,addr);
-	while (M && abeg <= aend) {
-		clear_bit(abeg&CGRMASK, M->subpage);
+	while (abeg <= aend) {
+		if (M)
+			clear_bit(abeg&CGRMASK, M->subpage);
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = FindM(abeg << CGRAN);
 	}
 
 	/* check if unmarked pages have no more code, and if so, unprotect */
@@ -219,8 +231,6 @@ int e_querymark(unsigned int addr, size_t len)
 	tMpMap *M = FindM(addr);
 	uint64_t mask;
 
-	if (M == NULL) return 0;
-
 	abeg = addr >> CGRAN;
 	aend = ((addr+len-1) >> CGRAN) + 1;
 
@@ -229,7 +239,7 @@ int e_querymark(unsigned int addr, size_t len)
 			    abeg<<CGRAN,((aend+1)<<CGRAN)-1,addr);
 	if (len == 1) {
 		// common case, fast path
-		if (test_bit(abeg&CGRMASK, M->subpage))
+		if (M && test_bit(abeg&CGRMASK, M->subpage))
 			goto found;
 		return 0;
 	}
@@ -238,22 +248,30 @@ int e_querymark(unsigned int addr, size_t len)
 	// mask for first partial longword
 	mask = ~0ULL << (abeg & (UINT64_WIDTH-1));
 	while (abeg < (aend & ~(UINT64_WIDTH-1))) {
+		if (M == NULL) {
+			// nothing marked in this megabyte, skip it
+			abeg = (abeg | CGRMASK) + 1;
+			if (abeg == 0 || abeg >= aend)
+				return 0;
+			M = FindM(abeg << CGRAN);
+			idx = 0;
+			mask = ~0ULL;
+			continue;
+		}
 		if (M->subpage[idx] & mask)
 			goto found;
 		abeg = (abeg + UINT64_WIDTH) & ~(UINT64_WIDTH-1);
 		idx++;
 		mask = ~0ULL;
 		if (idx == sizeof(M->subpage)/sizeof(M->subpage[0])) {
-			M = M->next;
-			if (!M)
-				return 0;
+			M = FindM(abeg << CGRAN);
 			idx = 0;
 		}
 	}
 	if (aend & (UINT64_WIDTH-1)) {
 		// mask for last partial longword
 		mask &= ~0ULL >> (UINT64_WIDTH - (aend & (UINT64_WIDTH-1)));
-		if (M->subpage[idx] & mask)
+		if (M && (M->subpage[idx] & mask))
 			goto found;
 	}
 	return 0;
@@ -279,13 +297,66 @@ int e_querymark_all(unsigned int addr, size_t len)
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
 
-	while (M && abeg <= aend) {
-		if (!test_bit(abeg&CGRMASK, M->subpage))
+	while (abeg <= aend) {
+		if (M == NULL || !test_bit(abeg&CGRMASK, M->subpage))
 			return 0;
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = FindM(abeg << CGRAN);
+	}
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+int e_querysoft(unsigned int addr, size_t len)
+{
+	int a2l, a2h;
+	tMpMap *M = FindM(addr);
+
+	if (len == 0) return 0;
+	a2l = addr >> PAGE_SHIFT;
+	a2h = (addr+len-1) >> PAGE_SHIFT;
+
+	while (a2l <= a2h) {
+		if (M && test_bit(a2l&255, M->softmap))
+			return 1;
+		a2l++;
+		if ((a2l&255)==0)
+			M = FindM(a2l << PAGE_SHIFT);
 	}
+	return 0;
+}
+
+/* count a checked entry into a node on soft pages. Returns 1 if a
+ * page goes back to protected mode; the caller has to invalidate the
+ * nodes there, so they are translated again without checks */
+int e_soft_check(unsigned int addr, size_t len)
+{
+	int a2l, a2h;
+	tMpMap *M = FindM(addr);
+
+	if (len == 0) return 0;
+	a2l = addr >> PAGE_SHIFT;
+	a2h = (addr+len-1) >> PAGE_SHIFT;
+
+	while (a2l <= a2h) {
+		if (M && test_bit(a2l&255, M->softmap))
+			break;
+		a2l++;
+		if ((a2l&255)==0)
+			M = FindM(a2l << PAGE_SHIFT);
+	}
+	if (a2l > a2h)
+		return 0;
+	if (++M->checks[a2l&255] < (SMC_RETRY << M->backoff[a2l&255]))
+		return 0;
+	if (debug_level('e')>1)
+		dbug_printf("MPMAP: retry protection for page=%08x\n",
+			    a2l << PAGE_SHIFT);
+	clear_bit(a2l&255, M->softmap);
+	if (M->backoff[a2l&255] < SMC_MAXBACKOFF)
+		M->backoff[a2l&255]++;
 	return 1;
 }
 
@@ -307,9 +378,10 @@ int e_mprotect(unsigned int addr, size_t len)
 	else {
 	    aend = (addr+len-1) & _PAGE_MASK;
 	}
-	/* only protect ranges that were not already protected by e_mprotect */
+	/* only protect ranges that were not already protected by e_mprotect,
+	 * soft pages are left writable */
 	for (a = abeg; a <= aend; a += PAGE_SIZE) {
-	    int qp = e_querymprot(a);
+	    int qp = e_querymprot(a) || e_querysoft(a, 1);
 	    if (!qp) {
 		if (abeg1 == (unsigned)-1)
 		    abeg1 = a;
@@ -367,6 +439,41 @@ static int e_munprotect(unsigned int addr, size_t len)
 }
 
 #ifdef X86_JIT
+/* number of code bytes marked in a page */
+static int e_pagedensity(tMpMap *M, int page)
+{
+	int i, n = 0;
+	int idx = ((page&255) << PAGE_SHIFT >> CGRAN) / UINT64_WIDTH;
+
+	for (i = 0; i < (PAGE_SIZE >> CGRAN) / UINT64_WIDTH; i++)
+		n += __builtin_popcountll(M->subpage[idx + i]);
+	return n << CGRAN;
+}
+
+/* account a write fault on data in a protected page; a page which
+ * keeps faulting and holds little code goes soft */
+static void e_soft_fault(unsigned int addr)
+{
+	int page = addr >> PAGE_SHIFT;
+	tMpMap *M = FindM(addr);
+	int n;
+
+	if (M == NULL || test_bit(page&255, M->softmap))
+		return;
+	if (++M->faults[page&255] < SMC_FAULTS)
+		return;
+	M->faults[page&255] = 0;
+	n = e_pagedensity(M, page);
+	if (n > SMC_DENSITY)
+		return;
+	if (debug_level('e')>1)
+		dbug_printf("MPMAP: soft page=%08x code=%d backoff=%d\n",
+			    addr & _PAGE_MASK, n, M->backoff[page&255]);
+	set_bit(page&255, M->softmap);
+	M->checks[page&255] = 0;
+	SoftPages++;
+}
+
 int e_handle_pagefault(dosaddr_t addr, unsigned err, sigcontext_t *scp)
 {
 	register int v;
@@ -451,6 +558,9 @@ int e_handle_pagefault(dosaddr_t addr, unsigned err, sigcontext_t *scp)
 	if (InCompiledCode && Cpatch(scp))
 		return 1;
 #endif
+	/* data hit: maybe stop protecting this page */
+	if (!e_querymark(addr, 1))
+		e_soft_fault(addr);
 	/* We HAVE to invalidate all the code in the page
 	 * if the page is going to be unprotected */
 	addr &= _PAGE_MASK;
@@ -490,19 +600,20 @@ int e_handle_fault(sigcontext_t *scp)
 
 void mprot_init(void)
 {
-	MpH = NULL;
-	AddMpMap(0,0,0);	/* first mega in first entry */
+	memset(MpMap, 0, sizeof(MpMap));
 	PageFaults = 0;
+	SoftPages = 0;
 }
 
 void mprot_end(void)
 {
-	tMpMap *M = MpH;
-	int i;
+	tMpMap *M;
+	int i, m;
 	unsigned char b;
 
-	while (M) {
-	    tMpMap *M2 = M;
+	for (m = 0; m < MPMAP_SIZE; m++) {
+	    if ((M = MpMap[m]) == NULL)
+		continue;
 	    for (i=0; i<32; i++) if ((b=M->pagemap[i])) {
 		unsigned int addr = (M->mega<<20) | (i<<15);
 		while (b) {
@@ -515,10 +626,9 @@ void mprot_end(void)
 	 	    b >>= 1;
 		}
 	    }
-	    M = M->next;
-	    free(M2);
+	    free(M);
+	    MpMap[m] = NULL;
 	}
-	MpH = LastMp = NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -54,7 +54,8 @@ typedef struct {
 /* ------------------------------------------------ */
 /*80*/  long double   *fpregs;
 /*84*/  PADDING32BIT(1)
-/*88*/	unsigned long long reserve;
+/*88*/	unsigned int ic_hits;	/* inline cache hits, counted by jit code */
+/*8c*/	unsigned int ic_key;	/* key of the node taking an inline cache miss */
 /*90*/	SDTR gs_cache;
 /*9c*/	SDTR fs_cache;
 /*a8*/	SDTR es_cache;
@@ -213,6 +214,8 @@ extern union _SynCPU TheCPU_union;
 #define Ofs_SIGAPEND	(unsigned char)(offsetof(SynCPU,sigalrm_pending)-SCBASE)
 #define Ofs_SIGFPEND	(unsigned char)(offsetof(SynCPU,sigprof_pending)-SCBASE)
 #define Ofs_DF_INCREMENTS (unsigned char)(offsetof(SynCPU,df_increments)-SCBASE)
+#define Ofs_ICHITS	(unsigned char)(offsetof(SynCPU,ic_hits)-SCBASE)
+#define Ofs_ICKEY	(unsigned char)(offsetof(SynCPU,ic_key)-SCBASE)
 
 #define Ofs_FPR		(unsigned char)(offsetof(SynCPU,fpregs)-SCBASE)
 #define Ofs_FPSTT	(unsigned char)(offsetof(SynCPU,fpstt)-SCBASE)
@@ -61,8 +61,15 @@ int ninodes = 0;
 int NodesCleaned = 0;
 int NodesParsed = 0;
 int NodesExecd = 0;
-int CleanFreq = 8;
-int CreationIndex = 0;
+int IndexHits = 0;
+int IndexMisses = 0;
+int SMCDirty = 0;
+/* bytes of translated code (CodeBuf headers included) held by the tree,
+ * and the budget the clock sweep keeps it within */
+int CodeBytes = 0;
+int CodeBudget = CODE_BUDGET;
+int NodesEvicted = 0;
+int NodesRetranslated = 0;
 
 #if PROFILE
 int MaxDepth = 0;
@@ -84,6 +91,13 @@ static TNode *findtree_cache[FINDTREE_CACHE_HASH_MASK+1];
 TNode *TNodePool;
 int NodeLimit = 10000;
 
+/* recently evicted keys, to count how many come back */
+#define EVICTED_MASK	0xfff
+static int EvictedKeys[EVICTED_MASK+1];
+
+#define NODEBYTES(G)	(offsetof(CodeBuf,meta) + \
+			 ((G)->seqnum+1)*sizeof(Addr2Pc) + (G)->len)
+
 #define RANGE_IN_RANGE(al,ah,l,h)	({int _l2=(al);\
 	int _h2=(ah); ((_h2 >= (l)) && (_l2 < (h))); })
 #define ADDR_IN_RANGE(a,l,h)		({typeof(a) _a2=(a);	\
@@ -106,6 +120,15 @@ static inline TNode *Tmalloc(void)
   return G;
 }
 
+static inline void FreeCode(TNode *G)
+{
+  if (G->mblock) {
+    CodeBytes -= NODEBYTES(G);
+    dlfree(G->mblock);
+  }
+  free(G->smcbuf);
+}
+
 static inline void Tfree(TNode *G)
 {
   G->key = G->alive = 0;
@@ -114,6 +137,101 @@ static inline void Tfree(TNode *G)
   TNodePool->link[0] = G;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Block index: a two-level direct-mapped table from guest PC to tree
+ * node. The first level is indexed by the top bits of the PC, the
+ * second one by the 4k page number inside it; each page then keeps a
+ * small hash of the nodes whose key lies in that page. Leaves are
+ * allocated on demand, so the whole 4G linear space costs only the
+ * first level until code is found somewhere.
+ * The AVL tree is still kept for the ordered walks (cleaner, FindPC);
+ * the index replaces it for lookups and for range invalidation.
+ */
+#define BIDX_L2_BITS	10
+#define BIDX_L1_SHIFT	(PAGE_SHIFT + BIDX_L2_BITS)
+#define BIDX_L1_SIZE	(1 << (32 - BIDX_L1_SHIFT))
+#define BIDX_L2_SIZE	(1 << BIDX_L2_BITS)
+#define BIDX_HASH_BITS	6
+#define BIDX_HASH(k)	((((k) >> BIDX_HASH_BITS) ^ (k)) & ((1<<BIDX_HASH_BITS)-1))
+
+typedef struct _bidxpage {
+	int count;			/* nodes in this page */
+	TNode *hash[1 << BIDX_HASH_BITS];
+} BIdxPage;
+
+static BIdxPage **BIdx[BIDX_L1_SIZE];
+/* longest code sequence in the index, bounds the pages to look at
+ * when invalidating a range */
+static unsigned BIdxMaxSpan = 0;
+
+static inline BIdxPage *bidx_page(unsigned int key, int create)
+{
+  BIdxPage **L2 = BIdx[key >> BIDX_L1_SHIFT];
+  unsigned int pg = (key >> PAGE_SHIFT) & (BIDX_L2_SIZE - 1);
+
+  if (L2 == NULL) {
+      if (!create) return NULL;
+      L2 = BIdx[key >> BIDX_L1_SHIFT] = calloc(BIDX_L2_SIZE, sizeof(*L2));
+  }
+  if (L2[pg] == NULL && create)
+      L2[pg] = calloc(1, sizeof(BIdxPage));
+  return L2[pg];
+}
+
+static void bidx_insert(TNode *G)
+{
+  unsigned int key = G->key;
+  BIdxPage *P = bidx_page(key, 1);
+  TNode **H = &P->hash[BIDX_HASH(key)];
+
+  G->inext = *H;
+  *H = G;
+  P->count++;
+}
+
+static void bidx_remove(TNode *G)
+{
+  unsigned int key = G->key;
+  BIdxPage *P = bidx_page(key, 0);
+  TNode **H;
+
+  if (P == NULL) return;
+  for (H = &P->hash[BIDX_HASH(key)]; *H; H = &(*H)->inext) {
+      if (*H == G) {
+	  *H = G->inext;
+	  G->inext = NULL;
+	  P->count--;
+	  return;
+      }
+  }
+}
+
+static inline TNode *bidx_find(unsigned int key)
+{
+  BIdxPage *P = bidx_page(key, 0);
+  TNode *G;
+
+  if (P == NULL) return NULL;
+  for (G = P->hash[BIDX_HASH(key)]; G; G = G->inext)
+      if ((unsigned)G->key == key) return G;
+  return NULL;
+}
+
+static void bidx_reset(void)
+{
+  int i, j;
+
+  for (i = 0; i < BIDX_L1_SIZE; i++) {
+      if (BIdx[i] == NULL) continue;
+      for (j = 0; j < BIDX_L2_SIZE; j++)
+	  free(BIdx[i][j]);
+      free(BIdx[i]);
+      BIdx[i] = NULL;
+  }
+  BIdxMaxSpan = 0;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 static inline void datacopy(TNode *nd, TNode *ns)
@@ -323,6 +441,7 @@ void avltr_delete (const int key)
   if (debug_level('e')>2)
 	e_printf("Found node to delete at %p(%08x)\n",p,p->key);
 #endif
+  bidx_remove(p);
   tree->count--;
   ninodes = tree->count;
 
@@ -377,14 +496,17 @@ void avltr_delete (const int key)
 		pa[k++] = r;
 	    }
 
-	    if (t->mblock) dlfree(t->mblock);
+	    FreeCode(t);
 /* e_printf("<03 node exchange %p->%p>\n",s,t); */
+	    bidx_remove(s);
 	    datacopy(t, s);
+	    bidx_insert(t);
 /**/	    if (t->addr==NULL) leavedos_main(0x8130);
 	    /* keep the node reference to itself */
 	    t->mblock->bkptr = t;
 	    s->addr = NULL;
 	    s->mblock = NULL;
+	    s->smcbuf = NULL;
 	    memset(&s->clink, 0, sizeof(linkdesc));
 	    s->key = 0;
 
@@ -413,7 +535,7 @@ void avltr_delete (const int key)
 	    leavedos_main(0x9142);
 	}
 #endif
-  if (p->mblock) dlfree(p->mblock);
+  FreeCode(p);
   Tfree(p);
 
   while (--k) {
@@ -611,11 +733,14 @@ void avltr_destroy(void)
 		  B = B->next;
 		  free(B2);
 	      }
-	      if (p->mblock) dlfree(p->mblock);
+	      FreeCode(p);
 	  }
       }
   }
 quit:
+  bidx_reset();
+  CodeBytes = 0;
+  memset(EvictedKeys, 0, sizeof(EvictedKeys));
   free(InstrMeta);
 #if PROFILE
   if (debug_level('e')) {
@@ -862,7 +987,15 @@ void DumpTree (FILE *fd)
 
 #endif // DEBUG_TREE
 
-static int TraverseAndClean(void)
+/*
+ * Clock sweep over the tree. Every lookup hit refreshes the node's
+ * alive counter, which works as the reference bit: a node found with
+ * alive>NODE_COLD gets a second chance and is just marked cold, a node
+ * still cold when the hand comes back is evicted. Nodes already
+ * invalidated (addr==NULL or alive<=0) are always reaped.
+ * With evict==0 only the reaping is done.
+ */
+static int ClockStep(int evict)
 {
   int cnt = 0;
   TNode *G;
@@ -887,12 +1020,17 @@ static int TraverseAndClean(void)
           return 0;
   }
 
-  if ((G->addr != NULL) && (G->alive>0)) {
-      G->alive -= AGENODE;
-      if (G->alive <= 0) {
-	if (debug_level('e')>2) e_printf("TraverseAndClean: node at %08x decayed\n",G->key);
+  if (evict && (G->addr != NULL) && (G->alive>0)) {
+      if (G->alive > NODE_COLD) {
+	G->alive = NODE_COLD;
+      }
+      else {
+	if (debug_level('e')>2) e_printf("ClockStep: evict node at %08x\n",G->key);
 	e_unmarkpage(G->seqbase, G->seqlen);
 	NodeUnlinker(G);
+	G->alive = 0;
+	EvictedKeys[G->key & EVICTED_MASK] = G->key;
+	NodesEvicted++;
       }
   }
   if ((G->addr == NULL) || (G->alive<=0)) {
@@ -902,7 +1040,7 @@ static int TraverseAndClean(void)
   }
   else {
       if (debug_level('e')>3)
-	e_printf("TraverseAndClean: node at %08x of %d life=%d\n",
+	e_printf("ClockStep: node at %08x of %d life=%d\n",
 		G->key,ninodes,G->alive);
       Traverser.p = G;
   }
@@ -912,6 +1050,21 @@ static int TraverseAndClean(void)
   return cnt;
 }
 
+/*
+ * Make room for a new node of 'need' bytes: advance the clock hand a
+ * bounded number of steps at a time until both the code size and the
+ * node count are back under their limits.
+ */
+static void CodeEvict(int need)
+{
+  int i;
+
+  while ((ninodes > 0) &&
+	 ((CodeBytes + need > CodeBudget) || (ninodes > NodeLimit))) {
+	for (i=0; i<CLOCK_STEPS && ninodes>0; i++) (void)ClockStep(1);
+  }
+}
+
 /*
  * Add a node to the collector tree.
  * The code is linearly stored in the CodeBuf and its associated structures
@@ -936,11 +1089,11 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   CodeBuf *mallmb;
   void **cp;
 
-  /* try to keep a limit to the number of nodes in the tree. 3000-4000
-   * nodes are probably enough before performance starts to suffer */
-  if (ninodes > NodeLimit) {
-	for (i=0; i<CreationIndex; i++) TraverseAndClean();
-  }
+  /* keep the translated code inside its budget, and the number of
+   * nodes in the tree to a limit: 3000-4000 nodes are probably enough
+   * before performance starts to suffer */
+  CodeEvict(offsetof(CodeBuf,meta) + (I0->ncount+1)*sizeof(Addr2Pc) +
+	    I0->totlen);
 
   key = I0->npc;
 
@@ -956,9 +1109,14 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 	/* ->REPLACE the code of the node found with the latest
 	   compiled version */
 	NodeUnlinker(nG);
-	if (nG->mblock) dlfree(nG->mblock);
+	FreeCode(nG);
+	nG->smcbuf = NULL;
   }
   else {
+	if (EvictedKeys[key & EVICTED_MASK] == key) {
+		NodesRetranslated++;
+		EvictedKeys[key & EVICTED_MASK] = 0;
+	}
 #if !defined(SINGLESTEP)&&!defined(SINGLEBLOCK)
 	if (debug_level('e')>2) {
 		e_printf("New TNode %d at=%p key=%08x\n",
@@ -981,7 +1139,17 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   nG->len = len = I0->totlen;
   nG->flags = I0->flags;
   nG->alive = NODELIFE(nG);
+  /* code from a soft (unprotected) page is compared to a copy of
+   * its source every time the node is entered via FindTree */
+  if (e_querysoft(nG->seqbase, nG->seqlen)) {
+	nG->flags |= F_SMCCHK;
+	nG->smcbuf = malloc(nG->seqlen);
+	memcpy(nG->smcbuf, LINEAR2UNIX(nG->seqbase), nG->seqlen);
+  }
   findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = nG;
+  if (!found) bidx_insert(nG);
+  if (nG->seqlen + abs(key - nG->seqbase) > BIdxMaxSpan)
+	BIdxMaxSpan = nG->seqlen + abs(key - nG->seqbase);
 
   /* allocate the extra memory used by the node. This includes the
    * translated code plus the table of correspondences between source
@@ -1002,6 +1170,7 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   nG->pmeta = mallmb->meta;
   if (nG->pmeta==NULL) leavedos_main(0x504d45);
   nG->addr = (unsigned char *)&mallmb->meta[nap];
+  CodeBytes += NODEBYTES(nG);
 
   /* setup structures for inter-node linking */
   nG->clink.t_type  = I0->clink.t_type;
@@ -1011,6 +1180,11 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
     nG->clink.t_target = *nG->clink.t_link.abs;
     nG->clink.unlinked_jmp_targets |= TARGET_T;
   }
+  else if (I0->clink.t_type == JMP_INDIRECT) {
+    /* inline cache, starts unlinked */
+    nG->clink.t_link.abs  = (unsigned int *)(nG->addr + I0->clink.t_link.rel);
+    nG->clink.t_target = IC_UNLINKED;
+  }
   else
     nG->clink.t_link.abs  = I0->clink.t_link.abs;
   if (I0->clink.t_type > JMP_LINK) {
@@ -1052,10 +1226,32 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 }
 
 
+/* Verify a node translated from a soft page. Returns 0 if its source
+ * was modified or its page goes back to protected mode; in both cases
+ * the node is invalidated and has to be translated again */
+static int SMCCheck(TNode *G)
+{
+  if (G->alive<=0)
+	return 1;
+  if (memcmp(G->smcbuf, LINEAR2UNIX(G->seqbase), G->seqlen) != 0) {
+	if (debug_level('e')>1)
+	    e_printf("SMC detected in node %08x\n",G->key);
+	SMCDirty++;
+	InvalidateNodeRange(G->seqbase, G->seqlen, NULL);
+	return 0;
+  }
+  if (e_soft_check(G->seqbase, G->seqlen)) {
+	int al = G->seqbase & _PAGE_MASK;
+	InvalidateNodeRange(al, PAGE_ALIGN(G->seqbase + G->seqlen) - al, NULL);
+	return 0;
+  }
+  return 1;
+}
+
 TNode *FindTree(int key)
 {
   TNode *I;
-  static int tccount=0;
+  int n;
 #if PROFILE
   hitimer_t t0 = 0;
 #endif
@@ -1076,36 +1272,23 @@ TNode *FindTree(int key)
 	    NodesFastFound++;
 #endif
 	}
+	if ((I->flags & F_SMCCHK) && !SMCCheck(I))
+	    return NULL;
 	I->alive = NODELIFE(I);
 	return I;
   }
-  if (!e_querymark(key, 1))
-	return NULL;
-
 #if PROFILE
   if (debug_level('e')) t0 = GETTSC();
 #endif
-  I = CollectTree.root.link[0];
-  if (I == NULL) return NULL;	/* always NULL the first time! */
-
-  for (;;) {
-      int diff = (key - I->key);
-
-      if (diff < 0) {
-	  I = I->link[0];
-	  if (I == NULL) goto endsrch;
-      }
-      else if (diff > 0) {
-	  if (I->rtag == MINUS) goto endsrch;
-	  I = I->link[1];
-      }
-      else break;
-  }
-
+  /* slow path: direct lookup in the block index */
+  I = bidx_find(key);
+  if (I && (I->flags & F_SMCCHK) && !SMCCheck(I))
+	I = NULL;
   if (I && I->addr && (I->alive>0)) {
 	if (debug_level('e')>3) e_printf("Found key %08x\n",key);
 	I->alive = NODELIFE(I);
 	findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = I;
+	IndexHits++;
 #if PROFILE
 	if (debug_level('e')) {
 	    NodesFound++;
@@ -1114,17 +1297,15 @@ TNode *FindTree(int key)
 #endif
 	return I;
   }
+  IndexMisses++;
 
-endsrch:
 #if PROFILE
   if (debug_level('e')) SearchTime += (GETTSC() - t0);
 #endif
-  if ((ninodes>500) && (((++tccount) >= CleanFreq) || NodesCleaned)) {
-	while (NodesCleaned > 0) {
-	    (void)TraverseAndClean();
-	    if (NodesCleaned) NodesCleaned--;
-	}
-	tccount=0;
+  /* reap a few of the invalidated nodes on every miss */
+  for (n = CLOCK_STEPS; (NodesCleaned > 0) && n; n--) {
+	(void)ClockStep(0);
+	NodesCleaned--;
   }
 
   if (debug_level('e')) {
@@ -1137,6 +1318,17 @@ endsrch:
 }
 
 
+/* plain lookup of a live node, without touching caches or statistics */
+TNode *FindNode(int key)
+{
+  TNode *G = bidx_find(key);
+
+  if (G && G->addr && (G->alive>0))
+	return G;
+  return NULL;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 /*
  * We come here:
@@ -1180,17 +1372,39 @@ static void BreakNode(TNode *G, unsigned char *eip)
   e_printf("============ Node %08x break failed\n",G->key);
 }
 
-static TNode *DoDelNode(TNode *G)
+static int InvalidateNode(TNode *G, int al, int ah, unsigned char *eip)
 {
-  if (Traverser.p == G)
-    Traverser.p = NEXTNODE(G);
-  avltr_delete(G->key);
-  return CollectTree.root.link[0];
+  int ahG = G->seqbase + G->seqlen;
+  unsigned char *ahE;
+
+  if (!G->addr || (G->alive<=0) || !RANGE_IN_RANGE(G->seqbase,ahG,al,ah))
+    return 0;
+  ahE = G->addr + G->len;
+  if (debug_level('e')>1)
+    dbug_printf("Invalidated node %p at %08x\n",G,G->key);
+  G->alive = 0;
+  e_unmarkpage(G->seqbase, G->seqlen);
+  NodeUnlinker(G);
+  NodesCleaned++;
+  /* if the current eip is in *any* chunk of code that is deleted
+      (not just the one written to)
+     then we need to break the node immediately to go back to
+     the interpreter; otherwise the remaining chunk (that does
+     not officially exist anymore) that the SIGSEGV or patched
+     call returns to may write to the current unprotected page.
+  */
+  if (eip && ADDR_IN_RANGE(eip,G->addr,ahE)) {
+    if (debug_level('e')>1)
+      e_printf("### Node self hit %p->%p..%p\n",
+	       eip,G->addr,ahE);
+    BreakNode(G, eip);
+  }
+  return 1;
 }
 
 int InvalidateNodeRange(int al, int len, unsigned char *eip)
 {
-  TNode *G;
+  uint64_t pg, pgl, pgh;
   int ah;
   int cleaned = 0;
 #if PROFILE
@@ -1201,72 +1415,33 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
   ah = al + len;
   if (debug_level('e')>1) dbug_printf("Invalidate area %08x..%08x\n",al,ah);
 
-  G = CollectTree.root.link[0];
-  if (G == NULL) goto quit;
-  /* find nearest (lesser than) node */
-  for (;;) {
-      if (G == NULL) goto quit;
-      if (G->key > al) {
-	/* no need to check for dead node here as the left-most
-	 * node will not be overlapped by anything from left */
-	if (G->link[0]==NULL) break;
-	G = G->link[0];
-      }
-      else if (G->key < al) {
-        TNode *G2;
-	G2 = G->link[1];
-	if (G2 == &CollectTree.root || G2->key > al) {
-	  if (G->alive <= 0) {
-	    /* remove dead node as it may be overlapped by good one */
-	    G = DoDelNode(G);
-	    continue;
-	  }
-	  break;
-	} else G = G2;
+  /* nodes are filed under the page of their key, but their code
+   * can extend up to BIdxMaxSpan bytes around it */
+  pgl = (unsigned)al;
+  pgl = (pgl > BIdxMaxSpan ? pgl - BIdxMaxSpan : 0) >> PAGE_SHIFT;
+  pgh = ((uint64_t)(unsigned)al + len + BIdxMaxSpan) >> PAGE_SHIFT;
+  if (pgh > (0xffffffffULL >> PAGE_SHIFT))
+    pgh = 0xffffffffULL >> PAGE_SHIFT;
+
+  for (pg = pgl; pg <= pgh; pg++) {
+      BIdxPage *P;
+      int i;
+
+      if (BIdx[pg >> BIDX_L2_BITS] == NULL) {
+	/* skip the whole unpopulated first-level slot */
+	pg |= BIDX_L2_SIZE - 1;
+	continue;
       }
-      else {
-	if (G->alive <= 0) {
-	  G = DoDelNode(G);
-	  continue;
-	}
-	break;
+      P = bidx_page(pg << PAGE_SHIFT, 0);
+      if (P == NULL || P->count == 0)
+	continue;
+      for (i = 0; i < (1 << BIDX_HASH_BITS); i++) {
+	TNode *G;
+	for (G = P->hash[i]; G; G = G->inext)
+	  cleaned += InvalidateNode(G, al, ah, eip);
       }
   }
-  if (debug_level('e')>1) e_printf("Invalidate from node %08x on\n",G->key);
 
-  /* walk tree in ascending, hopefully sorted, address order */
-  for (;;) {
-      if (G == &CollectTree.root || G->key >= ah)
-        break;
-      if (G->addr && (G->alive>0)) {
-	int ahG = G->seqbase + G->seqlen;
-	if (RANGE_IN_RANGE(G->seqbase,ahG,al,ah)) {
-	    unsigned char *ahE = G->addr + G->len;
-	    if (debug_level('e')>1)
-		dbug_printf("Invalidated node %p at %08x\n",G,G->key);
-	    G->alive = 0;
-	    e_unmarkpage(G->seqbase, G->seqlen);
-	    NodeUnlinker(G);
-	    cleaned++;
-	    NodesCleaned++;
-	    /* if the current eip is in *any* chunk of code that is deleted
-	        (not just the one written to)
-	       then we need to break the node immediately to go back to
-	       the interpreter; otherwise the remaining chunk (that does
-	       not officially exist anymore) that the SIGSEGV or patched
-	       call returns to may write to the current unprotected page.
-	    */
-	    if (eip && ADDR_IN_RANGE(eip,G->addr,ahE)) {
-		if (debug_level('e')>1)
-		    e_printf("### Node self hit %p->%p..%p\n",
-			     eip,G->addr,ahE);
-		BreakNode(G, eip);
-	    }
-	}
-      }
-      G = NEXTNODE(G);
-  }
-quit:
   if (debug_level('e') && e_querymark(al, len))
     error("simx86: InvalidateNodeRange did not clear all code for %#08x, len=%x\n",
 	  al, len);
@@ -1440,9 +1615,6 @@ static struct {
 	long long a;
 	int b,c,m,d,s;
 } xCST[CST_SIZE];
-#else
-#define CST_SIZE	4
-static int xCST[CST_SIZE];
 #endif
 
 static int cstx = 0;
@@ -1450,8 +1622,8 @@ static int xCS1 = 0;
 
 void CollectStat (void)
 {
-	int i, m = 0;
 #ifdef SHOW_STAT
+	int i, m = 0;
 	int csm = config.CPUSpeedInMhz*1000;
 //	xCST[cstx].a = TheCPU.EMUtime;
 	xCST[cstx].s = TheCPU.sigprof_pending;
@@ -1463,7 +1635,7 @@ void CollectStat (void)
 		m += xCST[i].c;
 	}
 	m >>= 2;
-	xCST[cstx].m = CLEAN_SPEED(FastLog2(m));
+	xCST[cstx].m = FastLog2(m);
 	i = cstx;
 	if (debug_level('e')>1)
 		e_printf("SIGPROF %04d %8d %8d(%3d) %8d %d\n",i,
@@ -1478,25 +1650,15 @@ void CollectStat (void)
 	    cstx=0;
 	}
 #else
-	xCST[cstx++] = NodesParsed;
-	if (cstx==CST_SIZE) {
-	    if (!xCS1) xCS1=1;
-	    cstx=0;
-	}
-	if (xCS1) {
-	    for (i=0; i<CST_SIZE; i++) m += xCST[i];	/* moving average */
-	    m /= CST_SIZE;
-	    m = FastLog2(m);	/* take leftmost bit index */
-	    CreationIndex = CLEAN_SPEED(m);
-	    CleanFreq = (8-m); if (CleanFreq<1) CleanFreq=1;
-	}
 	if (debug_level('e')>1)
-		e_printf("SIGPROF %d n=%8d p=%8d x=%8d ix=%3d cln=%2d\n",
+		e_printf("SIGPROF %d n=%8d p=%8d x=%8d code=%d/%d"
+			" ev=%d/%d idx=%d/%d\n",
 			TheCPU.sigprof_pending,
-			ninodes,NodesParsed,NodesExecd,CreationIndex,
-			CleanFreq);
+			ninodes,NodesParsed,NodesExecd,CodeBytes,CodeBudget,
+			NodesEvicted,NodesRetranslated,IndexHits,IndexMisses);
 #endif
 	NodesParsed = NodesExecd = 0;
+	IndexHits = IndexMisses = 0;
 }
 
 
@@ -1506,8 +1668,10 @@ void InitTrees(void)
 {
 	g_printf("InitTrees\n");
 #ifdef X86_JIT
-	if (!config.cpusim)
+	if (!config.cpusim) {
 	    TNodePool = calloc(NODES_IN_POOL, sizeof(TNode));
+	    JitCacheInit();
+	}
 #endif
 
 	avltr_init();
@@ -1519,9 +1683,11 @@ void InitTrees(void)
 	}
 #endif
 	NodesParsed = NodesExecd = 0;
-	CleanFreq = 8;
+	IndexHits = IndexMisses = 0;
 	cstx = xCS1 = 0;
-	CreationIndex = 0;
+	CodeBytes = NodesEvicted = NodesRetranslated = 0;
+	CodeBudget = (config.jit_code_size > 0 ?
+		config.jit_code_size << 10 : CODE_BUDGET);
 #if PROFILE
 	if (debug_level('e')) {
 	    MaxDepth = MaxNodes = MaxNodeSize = 0;
@@ -1547,6 +1713,7 @@ void EndGen(void)
 	if (!config.cpusim) {
 	    avltr_destroy();
 	    free(TNodePool); TNodePool=NULL;
+	    JitCacheEnd();
 	}
 #endif
 #ifdef SHOW_STAT
@@ -115,6 +115,12 @@ extern int NodesFastFound;
 extern int EmuSignals;
 extern int NodesFound;
 extern int TreeCleanups;
+extern int CodeBytes;
+extern int CodeBudget;
+extern int NodesEvicted;
+extern int NodesRetranslated;
+extern int IndexHits;
+extern int IndexMisses;
 
 typedef struct avltr_node
 {
@@ -136,6 +142,8 @@ typedef struct avltr_node
 	linkdesc clink;
 	unsigned cs;
 	unsigned mode;
+	struct avltr_node *inext;	/* next node in the same index bucket */
+	unsigned char *smcbuf;	/* copy of the source for F_SMCCHK nodes */
 } TNode;
 
 /* Used for traversing a right-threaded AVL tree. */
@@ -162,6 +170,7 @@ extern avltr_tree CollectTree;
 void avltr_delete (const int key);
 //
 TNode *FindTree(int key);
+TNode *FindNode(int key);
 TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf);
 //
 #endif
@@ -171,6 +180,15 @@ void InitTrees(void);
 #ifdef X86_JIT
 unsigned int FindPC(unsigned char *addr);
 int InvalidateNodeRange(int addr, int len, unsigned char *eip);
+
+/* persistent translation cache, see jitcache.c */
+extern int JitCacheOn;
+extern int JitCacheLoads;
+extern int JitCacheStores;
+void JitCacheInit(void);
+void JitCacheEnd(void);
+TNode *JitCacheLoad(unsigned int PC, int mode);
+void JitCacheStore(TNode *G);
 #endif
 
 #endif
@@ -216,6 +216,7 @@ void dump_config_status(void (*printfunc)(const char *, ...))
     (*print)("X_winsize_y %d\nX_gamma %d\nX_fullscreen %d\nvgaemu_memsize 0x%x\n",
         config.X_winsize_y, config.X_gamma, config.X_fullscreen,
 	     config.vgaemu_memsize);
+    (*print)("X_render_threads %d\n", config.X_render_threads);
     (*print)("SDL_hwrend %d\nSDL_fonts \"%s\"\n",
         config.sdl_hwrend, config.sdl_fonts);
     (*print)("SDL_clip_native %d\n",
@@ -225,6 +226,7 @@ void dump_config_status(void (*printfunc)(const char *, ...))
     (*print)("X_font \"%s\"\n", config.X_font);
     (*print)("vga_fonts %i\n", config.vga_fonts);
     (*print)("X_mgrab_key \"%s\"\n",  config.X_mgrab_key);
+    (*print)("X_vga_dirty \"%s\"\n",  config.X_vga_dirty);
     (*print)("X_background_pause %d\n", config.X_background_pause);
     (*print)("X_noclose %d\n", config.X_noclose);
 
@@ -261,8 +263,9 @@ void dump_config_status(void (*printfunc)(const char *, ...))
         config.update, config.freq);
     (*print)("tty_lockdir \"%s\"\ntty_lockfile \"%s\"\nconfig.tty_lockbinary %d\n",
         config.tty_lockdir, config.tty_lockfile, config.tty_lockbinary);
-    (*print)("num_ser %d\nnum_lpt %d\nfastfloppy %d\nfile_lock_limit %d\n",
-        config.num_ser, config.num_lpt, config.fastfloppy, config.file_lock_limit);
+    (*print)("num_ser %d\nnum_lpt %d\nfastfloppy %d\ndisk_cache %d\nfile_lock_limit %d\n",
+        config.num_ser, config.num_lpt, config.fastfloppy, config.disk_cache,
+        config.file_lock_limit);
     (*print)("emusys \"%s\"\n",
         (config.emusys ? config.emusys : ""));
     (*print)("vbios_post %d\ndetach %d\n",
@@ -317,8 +320,8 @@ void dump_config_status(void (*printfunc)(const char *, ...))
 	"mpu401_base 0x%x\nmpu401_irq %i\nsound_driver \"%s\"\n",
         config.sound, config.sb_base, config.sb_dma, config.sb_hdma, config.sb_irq,
 	config.mpu401_base, config.mpu401_irq, config.sound_driver);
-    (*print)("pcm_hpf %i\nmidi_file %s\nwav_file %s\n",
-	config.pcm_hpf, config.midi_file, config.wav_file);
+    (*print)("pcm_hpf %i\npcm_resample %i\nmidi_file %s\nwav_file %s\n",
+	config.pcm_hpf, config.pcm_resample, config.midi_file, config.wav_file);
     (*print)("\ncli_timeout %d\n", config.cli_timeout);
     (*print)("\ntimer_tweaks %d\n", config.timer_tweaks);
     (*print)("\nJOYSTICK:\njoy_device0 \"%s\"\njoy_device1 \"%s\"\njoy_dos_min %i\njoy_dos_max %i\njoy_granularity %i\njoy_latency %i\n",
@@ -1777,6 +1780,7 @@ void dp_init(struct disk *dptr)
   dptr->rdonly = 0;
   dptr->header = 0;
   dptr->floppy = 0;
+  dptr->overlay = NULL;
 }
 
 static void assign_floppy(int fnum, const char *name)
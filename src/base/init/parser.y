@@ -230,7 +230,7 @@ enum {
 %token CHECKUSERVAR
 
 	/* main options */
-%token FASTFLOPPY HOGTHRESH SPEAKER IPXSUPPORT IPXNETWORK NOVELLHACK
+%token FASTFLOPPY DISK_CACHE HOGTHRESH SPEAKER IPXSUPPORT IPXNETWORK NOVELLHACK
 %token ETHDEV TAPDEV VDESWITCH SLIRPARGS NETSOCK VNET
 %token DEBUG MOUSE SERIAL COM KEYBOARD TERMINAL VIDEO EMURETRACE TIMER
 %token MATHCO CPU CPUSPEED BOOTDRIVE SWAP_BOOTDRIVE
@@ -246,7 +246,7 @@ enum {
 	/* speaker */
 %token EMULATED NATIVE
 	/* cpuemu/dpmi */
-%token CPUEMU CPU_VM CPU_VM_DPMI VM86 KVM REMOTE
+%token CPUEMU CPU_VM CPU_VM_DPMI VM86 KVM REMOTE JIT_CACHE JIT_CODE_SIZE
 	/* keyboard */
 %token RAWKEYBOARD
 %token PRESTROKE
@@ -264,9 +264,9 @@ enum {
 %token INTERNALDRIVER EMULATE3BUTTONS CLEARDTR UNGRAB_TWEAK
 	/* x-windows */
 %token L_DISPLAY L_TITLE X_TITLE_SHOW_APPNAME ICON_NAME X_BLINKRATE X_SHARECMAP X_MITSHM X_FONT
-%token X_FIXED_ASPECT X_ASPECT_43 X_LIN_FILT X_BILIN_FILT X_MODE13FACT
+%token X_FIXED_ASPECT X_ASPECT_43 X_LIN_FILT X_BILIN_FILT X_MODE13FACT X_RENDER_THREADS
 %token X_WINSIZE X_NOCLOSE X_NORESIZE
-%token X_GAMMA X_FULLSCREEN VGAEMU_MEMSIZE VESAMODE X_LFB X_PM_INTERFACE X_MGRAB_KEY X_BACKGROUND_PAUSE
+%token X_GAMMA X_FULLSCREEN VGAEMU_MEMSIZE VESAMODE X_LFB X_PM_INTERFACE X_MGRAB_KEY X_BACKGROUND_PAUSE X_VGA_DIRTY
 	/* sdl */
 %token SDL_HWREND SDL_FONTS SDL_WCONTROLS SDL_CLIP_NATIVE
 	/* video */
@@ -288,7 +288,7 @@ enum {
 	/* printer */
 %token LPT COMMAND TIMEOUT L_FILE
 	/* disk */
-%token L_PARTITION WHOLEDISK
+%token L_PARTITION WHOLEDISK OVERLAY
 %token SECTORS CYLINDERS TRACKS HEADS OFFSET HDIMAGE HDTYPE1 HDTYPE2 HDTYPE9 DISKCYL4096
 	/* floppy */
 %token THREEINCH THREEINCH_720 THREEINCH_2880 FIVEINCH FIVEINCH_360 READONLY BOOT
@@ -304,7 +304,7 @@ enum {
 %token MPU_IRQ MPU_IRQ_MT32 MIDI_SYNTH
 %token SOUND_DRIVER MIDI_DRIVER FLUID_SFONT FLUID_VOLUME
 %token MUNT_ROMS OPL2LPT_DEV OPL2LPT_TYPE
-%token SND_PLUGIN_PARAMS PCM_HPF MIDI_FILE WAV_FILE
+%token SND_PLUGIN_PARAMS PCM_HPF PCM_RESAMPLE MIDI_FILE WAV_FILE
 	/* CD-ROM */
 %token CDROM
 	/* ASPI driver */
@@ -459,6 +459,11 @@ line:		CHARSET '{' charset_flags '}' {}
 			config.fastfloppy = ($2!=0);
 			c_printf("CONF: fastfloppy = %d\n", config.fastfloppy);
 			}
+		| DISK_CACHE expression
+			{
+			config.disk_cache = $2;
+			c_printf("CONF: disk_cache = %d\n", config.disk_cache);
+			}
 		| CPU expression
 			{
 			int cpu = cpu_override (($2%100)==86?($2/100)%10:0);
@@ -486,6 +491,23 @@ line:		CHARSET '{' charset_flags '}' {}
 			config.cpusim = $2;
 			c_printf("CONF: CPUEMU set to %s\n",
 				config.cpusim ? "sim" : "jit");
+#endif
+			}
+		| JIT_CACHE string_expr
+			{
+#ifdef X86_EMULATOR
+			free(config.jit_cache);
+			config.jit_cache = $2;
+			c_printf("CONF: JIT cache file %s\n", config.jit_cache);
+#else
+			free($2);
+#endif
+			}
+		| JIT_CODE_SIZE expression
+			{
+#ifdef X86_EMULATOR
+			config.jit_code_size = $2;
+			c_printf("CONF: JIT code size %dK\n", config.jit_code_size);
 #endif
 			}
 		| CPUSPEED real_expression
@@ -1083,6 +1105,7 @@ x_flag		: L_DISPLAY string_expr	{ free(config.X_display); config.X_display = $2;
 		| X_LIN_FILT            { config.X_lin_filt = 1; }
 		| X_BILIN_FILT          { config.X_bilin_filt = 1; }
 		| X_MODE13FACT expression  { config.X_mode13fact = $2; }
+		| X_RENDER_THREADS expression  { config.X_render_threads = $2; }
 		| X_WINSIZE INTEGER INTEGER
                    {
                      config.X_winsize_x = $2;
@@ -1098,6 +1121,7 @@ x_flag		: L_DISPLAY string_expr	{ free(config.X_display); config.X_display = $2;
 		| X_NOCLOSE bool      { config.X_noclose = ($2!=0); }
 		| X_NORESIZE bool     { config.X_noresize = ($2!=0); }
 		| VGAEMU_MEMSIZE expression	{ config.vgaemu_memsize = $2; }
+		| X_VGA_DIRTY string_expr { free(config.X_vga_dirty); config.X_vga_dirty = $2; }
 		| VESAMODE INTEGER INTEGER { set_vesamodes($2,$3,0);}
 		| VESAMODE INTEGER INTEGER INTEGER { set_vesamodes($2,$3,$4);}
 		| VESAMODE expression ',' expression { set_vesamodes($2,$4,0);}
@@ -1161,6 +1185,20 @@ sound_flag	: SB_BASE expression	{ config.sb_base = $2; }
 			}
 		| SND_PLUGIN_PARAMS string_expr	{ free(config.snd_plugin_params); config.snd_plugin_params = $2; }
 		| PCM_HPF bool		{ config.pcm_hpf = ($2!=0); }
+		| PCM_RESAMPLE string_expr
+			{
+				if (!strcmp($2, "linear"))
+					config.pcm_resample = 0;
+				else if (!strcmp($2, "low"))
+					config.pcm_resample = 1;
+				else if (!strcmp($2, "medium"))
+					config.pcm_resample = 2;
+				else if (!strcmp($2, "high"))
+					config.pcm_resample = 3;
+				else
+					yyerror("invalid value %s\n", $2);
+				free($2);
+			}
 		| MIDI_FILE string_expr	{ free(config.midi_file); config.midi_file = $2; }
 		| WAV_FILE string_expr	{ free(config.wav_file); config.wav_file = $2; }
 		;
@@ -1565,6 +1603,7 @@ disk_flag	: READONLY		{ dptr->rdonly = 1; }
 		| HEADS expression		{ dptr->heads = $2; }
 		| OFFSET expression	{ dptr->header = $2; }
 		| L_PARTITION		{ dptr->part_image = 1; }
+		| OVERLAY string_expr	{ free(dptr->overlay); dptr->overlay = $2; }
 		| STRING
 		    { yyerror("unrecognized disk flag '%s'\n", $1); free($1); }
 		| error
@@ -16,19 +16,82 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include "dosemu_debug.h"
 
+/*
+ * When the log is a regular file, the messages are not written by the
+ * threads that log them. Each thread appends them to its own ring that
+ * only it writes and only the drainer reads, so this takes no lock and
+ * no syscall. The "dosemu: log" thread drains all rings every
+ * LOG_DRAIN_MS, or sooner when one of them gets half full, and writes
+ * them out in large chunks. A thread that finds its ring full, or has
+ * a message too large for it, drains the rings itself.
+ *
+ * vlog_record() queues a binary record with the function that turns it
+ * into text, so for the port traces the formatting is done by the log
+ * thread too.
+ *
+ * The messages of a thread stay in order, the ones of different threads
+ * are ordered only as far as they were drained together.
+ * A signal handler that logs while its thread is inside the log code
+ * finds in_log set. It must not touch the ring, which has a single
+ * producer, nor wait for drain_mtx, which the thread may hold, so it
+ * writes its message synchronously and only if drain_mtx is free.
+ * Other logs (stderr, pipes) are written synchronously, as before.
+ */
+
 #define EARLY_LOG_SIZE 16384
 // 256Mb
 #define LOG_SIZE (1024 * 1024 * 256)
+#define RING_SIZE (128 * 1024)		/* per thread, power of 2 */
+#define OUT_BUF_SIZE (64 * 1024)
+#define DECODE_MAX 256			/* text of a vlog_record() */
+#define LOG_DRAIN_MS 50
+
+struct rec_hdr {
+    vlog_decode_t decode;		/* NULL for text */
+    uint32_t len;
+} __attribute__((aligned(16)));
+#define REC_WRAP 0xffffffff		/* the rest of the ring is unused */
+#define REC_SIZE(l) ((sizeof(struct rec_hdr) + (l) + 15) & ~15)
+
+struct log_ring {
+    unsigned head;			/* moved by the owner */
+    unsigned tail;			/* moved by the drainer */
+    int dead;				/* the owner exited */
+    struct log_ring *next;
+    char data[RING_SIZE] __attribute__((aligned(16)));
+};
+
 static char early_log[EARLY_LOG_SIZE];
 static int early_pos;
+static pthread_mutex_t early_mtx = PTHREAD_MUTEX_INITIALIZER;
 static int log_fd = -1;
+static int log_async;
+static unsigned long long log_written;	/* since the last rotation */
+
+/* drain_mtx protects the ring list, out_buf and the writes */
+static pthread_mutex_t drain_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *rings;
+static char out_buf[OUT_BUF_SIZE];
+static int out_pos;
+static pthread_key_t ring_key;
+static __thread struct log_ring *my_ring;
+static __thread int in_log;		/* the thread is in the code below */
+static pthread_t log_thr;
+static pthread_mutex_t wait_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cnd = PTHREAD_COND_INITIALIZER;
 
 static int early_printf(const char *fmt, va_list args)
 {
@@ -53,46 +116,369 @@ static int early_write(const char *buf, size_t size)
 
 static void check_log_size(void)
 {
-    if (lseek(log_fd, 0, SEEK_END) > LOG_SIZE) {
+    if (log_written > LOG_SIZE) {
         int err;
         lseek(log_fd, 0, SEEK_SET);
         err = ftruncate(log_fd, 0);
         assert(!err);
+        log_written = 0;
+    }
+}
+
+/* the writers below are called with drain_mtx held */
+static void log_out(const char *buf, size_t size)
+{
+    ssize_t wr = write(log_fd, buf, size);
+    if (wr > 0)
+        log_written += wr;
+    check_log_size();
+}
+
+static void out_flush(void)
+{
+    if (out_pos) {
+        log_out(out_buf, out_pos);
+        out_pos = 0;
+    }
+}
+
+static void out_append(const char *buf, size_t size)
+{
+    if (size > OUT_BUF_SIZE - out_pos)
+        out_flush();
+    if (size > OUT_BUF_SIZE) {
+        log_out(buf, size);
+        return;
+    }
+    memcpy(out_buf + out_pos, buf, size);
+    out_pos += size;
+}
+
+static int do_decode(vlog_decode_t decode, char *buf, const void *rec,
+        size_t len)
+{
+    int n = decode(buf, DECODE_MAX, rec, len);
+    if (n < 0)
+        return 0;
+    if (n >= DECODE_MAX)
+        n = DECODE_MAX - 1;  // truncated
+    return n;
+}
+
+static void out_decode(vlog_decode_t decode, const void *rec, size_t len)
+{
+    if (OUT_BUF_SIZE - out_pos < DECODE_MAX)
+        out_flush();
+    out_pos += do_decode(decode, out_buf + out_pos, rec, len);
+}
+
+static void drain_ring(struct log_ring *r)
+{
+    unsigned tail = r->tail;
+    unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        unsigned off = tail & (RING_SIZE - 1);
+        struct rec_hdr *h = (struct rec_hdr *)(r->data + off);
+
+        if (h->len == REC_WRAP) {
+            tail += RING_SIZE - off;
+            continue;
+        }
+        if (h->decode)
+            out_decode(h->decode, h + 1, h->len);
+        else
+            out_append((const char *)(h + 1), h->len);
+        tail += REC_SIZE(h->len);
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void drain_all(void)
+{
+    struct log_ring **p = &rings;
+
+    while (*p) {
+        struct log_ring *r = *p;
+        /* read dead first, its owner may still add to the ring */
+        int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+
+        drain_ring(r);
+        if (dead) {
+            *p = r->next;
+            free(r);
+        } else {
+            p = &r->next;
+        }
     }
+    out_flush();
+}
+
+static void *log_thread(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&wait_mtx);
+    while (1) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_DRAIN_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&wait_cnd, &wait_mtx, &ts);
+        pthread_mutex_lock(&drain_mtx);
+        drain_all();
+        pthread_mutex_unlock(&drain_mtx);
+    }
+    return NULL;
+}
+
+static void ring_gone(void *arg)
+{
+    struct log_ring *r = arg;
+    my_ring = NULL;
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *get_ring(void)
+{
+    struct log_ring *r = my_ring;
+
+    if (r)
+        return r;
+    r = malloc(sizeof(*r));
+    if (!r)
+        return NULL;
+    r->head = r->tail = 0;
+    r->dead = 0;
+    pthread_mutex_lock(&drain_mtx);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&drain_mtx);
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+/* returns 0 if the record has to be written synchronously */
+static int ring_put(vlog_decode_t decode, const void *buf, size_t len)
+{
+    struct log_ring *r;
+    struct rec_hdr *h;
+    unsigned need = REC_SIZE(len), head, off, contig, used;
+
+    if (need > RING_SIZE / 4 || !(r = get_ring()))
+        return 0;
+    head = r->head;
+    off = head & (RING_SIZE - 1);
+    contig = RING_SIZE - off;
+    used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (used + need + (contig < need ? contig : 0) > RING_SIZE) {
+        pthread_mutex_lock(&drain_mtx);
+        drain_all();
+        pthread_mutex_unlock(&drain_mtx);
+        used = 0;
+    }
+    if (contig < need) {
+        h = (struct rec_hdr *)(r->data + off);
+        h->len = REC_WRAP;
+        head += contig;
+        used += contig;
+        off = 0;
+    }
+    h = (struct rec_hdr *)(r->data + off);
+    h->decode = decode;
+    h->len = len;
+    memcpy(h + 1, buf, len);
+    __atomic_store_n(&r->head, head + need, __ATOMIC_RELEASE);
+    if (used < RING_SIZE / 2 && used + need >= RING_SIZE / 2)
+        pthread_cond_signal(&wait_cnd);
+    return 1;
+}
+
+static void log_sync(vlog_decode_t decode, const void *buf, size_t len)
+{
+    drain_all();  // keep the order of this thread
+    if (decode)
+        out_decode(decode, buf, len);
+    else
+        out_append(buf, len);
+    out_flush();
+}
+
+/* a signal handler interrupted the log code of its thread */
+static void log_reentered(vlog_decode_t decode, const void *buf, size_t len)
+{
+    char text[DECODE_MAX];
+
+    if (pthread_mutex_trylock(&drain_mtx) == 0) {
+        log_sync(decode, buf, len);
+        pthread_mutex_unlock(&drain_mtx);
+        return;
+    }
+    /* out_buf is in use, write past it, out of order */
+    if (decode) {
+        len = do_decode(decode, text, buf, len);
+        buf = text;
+    }
+    write(log_fd, buf, len);
+}
+
+static void log_queue(vlog_decode_t decode, const void *buf, size_t len)
+{
+    if (in_log) {
+        log_reentered(decode, buf, len);
+        return;
+    }
+    in_log = 1;
+    if (!ring_put(decode, buf, len)) {
+        pthread_mutex_lock(&drain_mtx);
+        log_sync(decode, buf, len);
+        pthread_mutex_unlock(&drain_mtx);
+    }
+    in_log = 0;
 }
 
 int vlog_printf(const char *fmt, va_list args)
 {
+    char buf[1024], *p = buf;
+    va_list copy;
     int wr;
-    if (log_fd == -1)
-        return early_printf(fmt, args);
-    wr = vdprintf(log_fd, fmt, args);
-    check_log_size();
+
+    if (log_fd == -1) {
+        if (in_log)
+            return 0;  // dropped, early_mtx is held by this thread
+        pthread_mutex_lock(&early_mtx);
+        in_log = 1;
+        wr = early_printf(fmt, args);
+        in_log = 0;
+        pthread_mutex_unlock(&early_mtx);
+        return wr;
+    }
+    if (!log_async)
+        return vdprintf(log_fd, fmt, args);
+    va_copy(copy, args);
+    wr = vsnprintf(buf, sizeof(buf), fmt, args);
+    if (wr >= (int)sizeof(buf))
+        wr = vasprintf(&p, fmt, copy);
+    va_end(copy);
+    if (wr <= 0)
+        return wr;
+    log_queue(NULL, p, wr);
+    if (p != buf)
+        free(p);
     return wr;
 }
 
 int vlog_write(const char *buf, size_t size)
 {
     int wr;
-    if (log_fd == -1)
-        return early_write(buf, size);
-    wr = write(log_fd, buf, size);
-    check_log_size();
-    return wr;
+
+    if (log_fd == -1) {
+        if (in_log)
+            return 0;  // dropped, early_mtx is held by this thread
+        pthread_mutex_lock(&early_mtx);
+        in_log = 1;
+        wr = early_write(buf, size);
+        in_log = 0;
+        pthread_mutex_unlock(&early_mtx);
+        return wr;
+    }
+    if (!log_async)
+        return write(log_fd, buf, size);
+    log_queue(NULL, buf, size);
+    return size;
+}
+
+int vlog_record(vlog_decode_t decode, const void *rec, size_t len)
+{
+    char buf[DECODE_MAX];
+
+    if (log_fd != -1 && log_async) {
+        log_queue(decode, rec, len);
+        return len;
+    }
+    return vlog_write(buf, do_decode(decode, buf, rec, len));
+}
+
+/*
+ * Can be called from a signal handler, so it does not wait for the
+ * rings forever if the interrupted thread holds drain_mtx, and does
+ * not wait at all if that is the thread of the handler.
+ */
+void vlog_flush(void)
+{
+    int i, tries = in_log ? 1 : 100;
+    int old = in_log;
+
+    if (!log_async)
+        return;
+    in_log = 1;
+    for (i = 0; i < tries; i++) {
+        if (pthread_mutex_trylock(&drain_mtx) == 0) {
+            drain_all();
+            pthread_mutex_unlock(&drain_mtx);
+            break;
+        }
+        if (i + 1 < tries)
+            usleep(1000);
+    }
+    in_log = old;
+}
+
+static void log_atfork_child(void)
+{
+    /* the rings and the log thread are the parent's */
+    log_async = 0;
+}
+
+static void start_log_thread(void)
+{
+    struct stat st;
+    sigset_t set, oset;
+    int err;
+
+    if (fstat(log_fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return;
+    log_written = st.st_size;
+    if (pthread_key_create(&ring_key, ring_gone))
+        return;
+    /* the signals are for the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+    err = pthread_create(&log_thr, NULL, log_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if (err) {
+        pthread_key_delete(ring_key);
+        return;
+    }
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+    pthread_setname_np(log_thr, "dosemu: log");
+#endif
+    pthread_atfork(NULL, NULL, log_atfork_child);
+    atexit(vlog_flush);
+    log_async = 1;
 }
 
 int vlog_init(const char *file)
 {
+    int fd;
+
     if (strcmp(file, "-") == 0)
-        log_fd = STDERR_FILENO;
+        fd = STDERR_FILENO;
     else
-        log_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
-    if (log_fd == -1)
+        fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
         return -1;
+    pthread_mutex_lock(&early_mtx);
     if (early_pos) {
-        write(log_fd, early_log, early_pos);
+        write(fd, early_log, early_pos);
         early_pos = 0;
     }
+    log_fd = fd;
+    pthread_mutex_unlock(&early_mtx);
+    start_log_thread();
     return 0;
 }
 
@@ -102,5 +488,7 @@ int vlog_get_fd(void)
         error("log file not opened\n");
         return STDERR_FILENO;
     }
+    /* the caller writes to it directly */
+    vlog_flush();
     return log_fd;
 }
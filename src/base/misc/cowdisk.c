@@ -0,0 +1,324 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Purpose: copy-on-write overlay for the hdimage files
+ *
+ * With "overlay" in the disk config the image is opened read-only and
+ * the writes go to a delta file instead. The delta is a sparse file:
+ *
+ *   header | allocation bitmap | block 0 | block 1 | ...
+ *
+ * Block i holds bytes i * COW_BLOCK_SIZE... of the image, at a fixed
+ * place, so a block that was never written is a hole and costs no
+ * space. Both files are mmap()ed; the image is mapped shared and
+ * read-only, so all sessions on the same image share its page cache.
+ * A block is copied from the image to the delta on its first write.
+ *
+ * The delta records the size and mtime of the image and is refused if
+ * the image changed since. It is locked while in use, so two sessions
+ * can't write to the same delta. It is not crash safe: the bitmap and
+ * the blocks are written back by the kernel in no particular order.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emu.h"
+#include "disks.h"
+#include "dos2linux.h"
+#include "utilities.h"
+
+#define COW_MAGIC	"DOSEMUOV"
+#define COW_VERSION	1
+#define COW_BLOCK_SIZE	4096		/* must be a multiple of the page size */
+#define COW_ALIGN(x)	(((x) + COW_BLOCK_SIZE - 1) & ~(uint64_t)(COW_BLOCK_SIZE - 1))
+
+struct cow_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t base_size;			/* of the image this delta is for */
+  int64_t base_mtime;			/* in ns */
+  uint64_t blocks;
+  uint64_t bitmap_off;
+  uint64_t data_off;
+};
+
+struct cow_disk {
+  const char *name;
+  int fd;
+  uint64_t size;			/* of the image */
+  unsigned char *base;			/* mapped read-only */
+  unsigned char *map;			/* the whole delta */
+  size_t map_len;
+  struct cow_header *hdr;
+  unsigned char *bitmap;
+  unsigned char *data;
+  uint64_t copied;			/* blocks copied this session */
+};
+
+static int test_blk(struct cow_disk *c, uint64_t blk)
+{
+  return c->bitmap[blk / CHAR_BIT] & (1 << (blk % CHAR_BIT));
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+  return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* FNV-1a of the full path, so images with the same name don't clash */
+static uint64_t path_hash(const char *image)
+{
+  char *full = realpath(image, NULL);
+  const char *p;
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (p = full ?: image; *p; p++)
+    h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+  free(full);
+  return h;
+}
+
+/*
+ * An empty name is a temporary delta that is gone with the session,
+ * a directory gets <image name>.<path hash>.cow in it.
+ */
+static int open_delta(const char *image, const char *name)
+{
+  const char *tmpdir, *base;
+  char *path;
+  struct stat st;
+  int fd;
+
+  if (!name[0]) {
+    tmpdir = getenv("TMPDIR") ?: "/tmp";
+    fd = open(tmpdir, O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+    if (fd != -1 || errno != EOPNOTSUPP)
+      return fd;
+    if (asprintf(&path, "%s/dosemu_cow_XXXXXX", tmpdir) == -1)
+      return -1;
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd != -1)
+      unlink(path);
+    free(path);
+    return fd;
+  }
+
+  if (stat(name, &st) == 0 && S_ISDIR(st.st_mode)) {
+    base = strrchr(image, '/');
+    base = base ? base + 1 : image;
+    if (asprintf(&path, "%s/%s.%016"PRIx64".cow", name, base,
+        path_hash(image)) == -1)
+      return -1;
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(path);
+    return fd;
+  }
+  return open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+}
+
+struct cow_disk *cow_open(struct disk *dp)
+{
+  struct cow_disk *c;
+  struct cow_header h;
+  struct stat st, dst;
+  uint64_t blocks, bitmap_off, data_off;
+
+  if (fstat(dp->fdesc, &st) == -1 || !S_ISREG(st.st_mode)) {
+    error("overlay: %s is not an image file\n", dp->dev_name);
+    return NULL;
+  }
+  c = calloc(1, sizeof(*c));
+  if (!c)
+    return NULL;
+  c->name = dp->dev_name;
+  c->size = st.st_size;
+  c->fd = open_delta(dp->dev_name, dp->overlay);
+  if (c->fd == -1) {
+    error("overlay: can't open the delta of %s: %s\n", dp->dev_name,
+        strerror(errno));
+    goto err;
+  }
+  if (flock(c->fd, LOCK_EX | LOCK_NB) == -1) {
+    if (errno == EWOULDBLOCK)
+      error("overlay: the delta of %s is used by another dosemu\n",
+          dp->dev_name);
+    else
+      error("overlay: can't lock the delta of %s: %s\n", dp->dev_name,
+          strerror(errno));
+    goto err;
+  }
+
+  blocks = COW_ALIGN(c->size) / COW_BLOCK_SIZE;
+  bitmap_off = COW_BLOCK_SIZE;
+  data_off = bitmap_off + COW_ALIGN((blocks + CHAR_BIT - 1) / CHAR_BIT);
+
+  if (fstat(c->fd, &dst) == -1)
+    goto err_io;
+  if (dst.st_size == 0) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, COW_MAGIC, sizeof(h.magic));
+    h.version = COW_VERSION;
+    h.block_size = COW_BLOCK_SIZE;
+    h.base_size = c->size;
+    h.base_mtime = mtime_ns(&st);
+    h.blocks = blocks;
+    h.bitmap_off = bitmap_off;
+    h.data_off = data_off;
+    if (pwrite(c->fd, &h, sizeof(h), 0) != sizeof(h) ||
+        ftruncate(c->fd, data_off + blocks * COW_BLOCK_SIZE) == -1)
+      goto err_io;
+  } else {
+    if (pread(c->fd, &h, sizeof(h), 0) != sizeof(h))
+      goto err_io;
+    if (memcmp(h.magic, COW_MAGIC, sizeof(h.magic)) ||
+        h.version != COW_VERSION || h.block_size != COW_BLOCK_SIZE ||
+        h.blocks != blocks || h.bitmap_off != bitmap_off ||
+        h.data_off != data_off ||
+        dst.st_size < data_off + blocks * COW_BLOCK_SIZE) {
+      error("overlay: the delta of %s is not valid\n", dp->dev_name);
+      goto err;
+    }
+    if (h.base_size != c->size || h.base_mtime != mtime_ns(&st)) {
+      error("overlay: %s changed since its delta was created\n",
+          dp->dev_name);
+      goto err;
+    }
+  }
+
+  c->map_len = data_off + blocks * COW_BLOCK_SIZE;
+  c->map = mmap(NULL, c->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+      c->fd, 0);
+  if (c->map == MAP_FAILED)
+    goto err_io;
+  c->base = mmap(NULL, c->size ?: 1, PROT_READ, MAP_SHARED, dp->fdesc, 0);
+  if (c->base == MAP_FAILED) {
+    munmap(c->map, c->map_len);
+    goto err_io;
+  }
+  c->hdr = (struct cow_header *)c->map;
+  c->bitmap = c->map + bitmap_off;
+  c->data = c->map + data_off;
+  d_printf("DISK: %s: overlay with %"PRIu64" blocks\n", dp->dev_name, blocks);
+  return c;
+
+err_io:
+  error("overlay: %s: %s\n", dp->dev_name, strerror(errno));
+err:
+  if (c->fd != -1)
+    close(c->fd);
+  free(c);
+  return NULL;
+}
+
+void cow_sync(struct cow_disk *c, int wait)
+{
+  if (c)
+    msync(c->map, c->map_len, wait ? MS_SYNC : MS_ASYNC);
+}
+
+void cow_close(struct cow_disk *c)
+{
+  if (!c)
+    return;
+  d_printf("DISK: %s: overlay closed, %"PRIu64" blocks copied\n", c->name,
+      c->copied);
+  cow_sync(c, 1);
+  munmap(c->map, c->map_len);
+  munmap(c->base, c->size ?: 1);
+  close(c->fd);
+  free(c);
+}
+
+/*
+ * Returns the image data at pos and sets *len to how much of it is
+ * contiguous, NULL at the end of the image. For a write the block is
+ * copied to the delta first, NULL if there is no space for it.
+ */
+static void *cow_map(struct cow_disk *c, off_t pos, int *len, int write)
+{
+  uint64_t blk = pos / COW_BLOCK_SIZE;
+  off_t blk_pos = blk * COW_BLOCK_SIZE;
+  int n;
+
+  if (pos < 0 || pos >= c->size)
+    return NULL;
+  n = _min(COW_BLOCK_SIZE - (pos - blk_pos), c->size - pos);
+  if (*len > n)
+    *len = n;
+  if (test_blk(c, blk))
+    return c->data + pos;
+  if (!write)
+    return c->base + pos;
+
+  /* a store to a hole that can't be filled would be SIGBUS */
+  if (fallocate(c->fd, 0, c->hdr->data_off + blk_pos, COW_BLOCK_SIZE) &&
+      errno != EOPNOTSUPP) {
+    error("overlay: no space for the delta of %s: %s\n", c->name,
+        strerror(errno));
+    return NULL;
+  }
+  memcpy(c->data + blk_pos, c->base + blk_pos,
+      _min(COW_BLOCK_SIZE, c->size - blk_pos));
+  c->bitmap[blk / CHAR_BIT] |= 1 << (blk % CHAR_BIT);
+  c->copied++;
+  return c->data + pos;
+}
+
+ssize_t cow_pread(struct cow_disk *c, void *buf, size_t len, off_t pos)
+{
+  size_t done = 0;
+  void *p;
+  int n;
+
+  while (done < len) {
+    n = _min(len - done, COW_BLOCK_SIZE);
+    if (!(p = cow_map(c, pos + done, &n, 0)))
+      break;
+    memcpy((char *)buf + done, p, n);
+    done += n;
+  }
+  return done;
+}
+
+int cow_read(struct cow_disk *c, unsigned buffer, off_t pos, int len)
+{
+  int done = 0, n;
+  void *p;
+
+  while (done < len) {
+    n = len - done;
+    if (!(p = cow_map(c, pos + done, &n, 0)))
+      break;
+    memcpy_2dos(buffer + done, p, n);
+    done += n;
+  }
+  return done;
+}
+
+int cow_write(struct cow_disk *c, unsigned buffer, off_t pos, int len)
+{
+  int done = 0, n;
+  void *p;
+
+  while (done < len) {
+    n = len - done;
+    if (!(p = cow_map(c, pos + done, &n, 1)))
+      break;
+    memcpy_2unix(p, buffer + done, n);
+    done += n;
+  }
+  return done || !len ? done : -1;
+}
@@ -0,0 +1,555 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Purpose: block cache for the disk images and partitions
+ *
+ * read_sectors() and write_sectors() went to the image file with one
+ * syscall per INT13 call, which is a few sectors at a time. Here the
+ * disk is cached in blocks of 64K:
+ * - A read that continues the previous one queues the following blocks
+ *   to a worker thread, which reads them ahead.
+ * - Writes stay in the cache until disk_cache_flush(). The dirty sectors
+ *   of a block are then written out in runs, in block order.
+ * The cache size is $_disk_cache in Kb; 0 disables it. Removable disks
+ * are never cached.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <pthread.h>
+#include "emu.h"
+#include "disks.h"
+#include "timers.h"
+#include "dos2linux.h"
+#include "utilities.h"
+
+#define DC_BLOCK_SECS	128		/* sectors per block */
+#define DC_BLOCK_SIZE	(DC_BLOCK_SECS * SECTOR_SIZE)
+#define DC_MAP_WORDS	(DC_BLOCK_SECS / 64)
+#define DC_MAX_BLOCKS	1024
+#define DC_READ_AHEAD	2		/* blocks ahead of a sequential read */
+#define DC_QUEUE	16		/* read-ahead requests of all disks */
+#define DC_STAT_PERIOD	4096		/* requests between the statistics */
+
+enum { DCB_FREE, DCB_LOADING, DCB_READY };
+
+struct dc_block {
+  uint64_t blk;
+  int state;
+  int ahead;				/* read ahead and not used yet */
+  unsigned lru;
+  uint64_t valid[DC_MAP_WORDS];
+  uint64_t dirty[DC_MAP_WORDS];
+  unsigned char *data;
+};
+
+struct disk_cache {
+  const char *name;
+  int fd;
+  off_t base;				/* file offset of sector 0 */
+  uint64_t secs;
+  int nblocks;
+  struct dc_block *blk;
+  unsigned char *mem;
+  unsigned char *tmp;			/* to merge reads into dirty blocks */
+  unsigned lru_clock;
+  int ndirty;
+  uint64_t next_sec;			/* where a sequential read goes on */
+
+  unsigned reqs;
+  uint64_t hits, misses, ra_blocks, ra_used;
+  uint64_t dos_bytes, host_bytes;
+  hitimer_t stat_time;
+};
+
+/* protects all caches, the worker only touches DCB_LOADING blocks */
+static pthread_mutex_t dc_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dc_work_cnd = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dc_done_cnd = PTHREAD_COND_INITIALIZER;
+static struct {
+  struct disk_cache *c;
+  struct dc_block *b;
+} dc_queue[DC_QUEUE];
+static unsigned dc_head, dc_tail;
+static int dc_caches, dc_quit;
+static pthread_t dc_thr;
+
+static int test_sec(const uint64_t *map, int i)
+{
+  return !!(map[i / 64] & (1ULL << (i % 64)));
+}
+
+static void set_secs(uint64_t *map, int i, int n)
+{
+  for (; n; i++, n--)
+    map[i / 64] |= 1ULL << (i % 64);
+}
+
+static int is_dirty(const struct dc_block *b)
+{
+  int i;
+
+  for (i = 0; i < DC_MAP_WORDS; i++)
+    if (b->dirty[i])
+      return 1;
+  return 0;
+}
+
+static off_t block_pos(struct disk_cache *c, uint64_t blk)
+{
+  return c->base + blk * DC_BLOCK_SIZE;
+}
+
+static int block_len(struct disk_cache *c, uint64_t blk)
+{
+  uint64_t left = c->secs - blk * DC_BLOCK_SECS;
+
+  return (left < DC_BLOCK_SECS ? left : DC_BLOCK_SECS) * SECTOR_SIZE;
+}
+
+/* called with dc_mtx held after a read of the block to buf */
+static void loaded(struct disk_cache *c, struct dc_block *b,
+    const unsigned char *buf, ssize_t n)
+{
+  int i;
+
+  if (n <= 0)
+    return;
+  c->host_bytes += n;
+  for (i = 0; i < n / SECTOR_SIZE; i++) {
+    if (test_sec(b->dirty, i))
+      continue;
+    if (buf != b->data)
+      memcpy(b->data + i * SECTOR_SIZE, buf + i * SECTOR_SIZE, SECTOR_SIZE);
+    set_secs(b->valid, i, 1);
+  }
+}
+
+static void *dc_thread(void *arg)
+{
+  struct disk_cache *c;
+  struct dc_block *b;
+  ssize_t n;
+
+  pthread_mutex_lock(&dc_mtx);
+  while (1) {
+    while (!dc_quit && dc_head == dc_tail)
+      pthread_cond_wait(&dc_work_cnd, &dc_mtx);
+    if (dc_quit)
+      break;
+    c = dc_queue[dc_head % DC_QUEUE].c;
+    b = dc_queue[dc_head % DC_QUEUE].b;
+    dc_head++;
+    pthread_mutex_unlock(&dc_mtx);
+    n = pread(c->fd, b->data, block_len(c, b->blk), block_pos(c, b->blk));
+    pthread_mutex_lock(&dc_mtx);
+    loaded(c, b, b->data, n);
+    b->state = n > 0 ? DCB_READY : DCB_FREE;
+    pthread_cond_broadcast(&dc_done_cnd);
+  }
+  pthread_mutex_unlock(&dc_mtx);
+  return NULL;
+}
+
+static struct dc_block *find_block(struct disk_cache *c, uint64_t blk)
+{
+  int i;
+
+  for (i = 0; i < c->nblocks; i++) {
+    if (c->blk[i].state != DCB_FREE && c->blk[i].blk == blk)
+      return &c->blk[i];
+  }
+  return NULL;
+}
+
+/* waits for a read-ahead of the block to finish */
+static struct dc_block *wait_block(struct disk_cache *c, uint64_t blk)
+{
+  struct dc_block *b;
+
+  while ((b = find_block(c, blk)) && b->state == DCB_LOADING)
+    pthread_cond_wait(&dc_done_cnd, &dc_mtx);
+  return b;
+}
+
+static int flush_block(struct disk_cache *c, struct dc_block *b)
+{
+  int i, j, len, ret = 0;
+
+  for (i = 0; i < DC_BLOCK_SECS; i = j) {
+    for (; i < DC_BLOCK_SECS && !test_sec(b->dirty, i); i++);
+    for (j = i; j < DC_BLOCK_SECS && test_sec(b->dirty, j); j++);
+    if (i == j)
+      break;
+    len = (j - i) * SECTOR_SIZE;
+    if (pwrite(c->fd, b->data + i * SECTOR_SIZE, len,
+        block_pos(c, b->blk) + i * SECTOR_SIZE) != len) {
+      error("DISK: write-back to %s failed: %s\n", c->name, strerror(errno));
+      ret = -1;
+    }
+  }
+  memset(b->dirty, 0, sizeof(b->dirty));
+  c->ndirty--;
+  return ret;
+}
+
+static int blk_cmp(const void *p1, const void *p2)
+{
+  const struct dc_block *b1 = *(struct dc_block * const *)p1;
+  const struct dc_block *b2 = *(struct dc_block * const *)p2;
+
+  return (b1->blk > b2->blk) - (b1->blk < b2->blk);
+}
+
+static int flush_all(struct disk_cache *c)
+{
+  struct dc_block *list[c->nblocks];
+  int i, n = 0, ret = 0;
+
+  for (i = 0; i < c->nblocks; i++) {
+    if (c->blk[i].state == DCB_READY && is_dirty(&c->blk[i]))
+      list[n++] = &c->blk[i];
+  }
+  qsort(list, n, sizeof(*list), blk_cmp);
+  for (i = 0; i < n; i++) {
+    if (flush_block(c, list[i]))
+      ret = -1;
+  }
+  return ret;
+}
+
+static void evict(struct disk_cache *c, struct dc_block *b)
+{
+  if (b->state == DCB_READY && is_dirty(b))
+    flush_block(c, b);
+  memset(b->valid, 0, sizeof(b->valid));
+  b->state = DCB_FREE;
+  b->ahead = 0;
+}
+
+/* least recently used block, clean ones only if asked to */
+static struct dc_block *victim(struct disk_cache *c, int clean)
+{
+  struct dc_block *b, *v = NULL;
+  int i;
+
+  for (i = 0; i < c->nblocks; i++) {
+    b = &c->blk[i];
+    if (b->state == DCB_FREE)
+      return b;
+    if (b->state == DCB_LOADING || (clean && is_dirty(b)))
+      continue;
+    if (!v || (int)(b->lru - v->lru) < 0)
+      v = b;
+  }
+  return v;
+}
+
+static struct dc_block *get_block(struct disk_cache *c, uint64_t blk)
+{
+  struct dc_block *b;
+
+  while (!(b = wait_block(c, blk))) {
+    if ((b = victim(c, 0))) {
+      evict(c, b);
+      b->blk = blk;
+      b->state = DCB_READY;
+      break;
+    }
+    /* everything is being read ahead */
+    pthread_cond_wait(&dc_done_cnd, &dc_mtx);
+  }
+  return b;
+}
+
+static int fill_block(struct disk_cache *c, struct dc_block *b)
+{
+  unsigned char *buf = is_dirty(b) ? c->tmp : b->data;
+  ssize_t n;
+
+  n = pread(c->fd, buf, block_len(c, b->blk), block_pos(c, b->blk));
+  if (n == -1) {
+    d_printf("DISK: read of %s failed: %s\n", c->name, strerror(errno));
+    return -1;
+  }
+  loaded(c, b, buf, n);
+  return 0;
+}
+
+static void read_ahead(struct disk_cache *c, uint64_t blk)
+{
+  struct dc_block *b;
+  unsigned cur = c->lru_clock;
+  int i;
+
+  for (i = 0; i < DC_READ_AHEAD; i++, blk++) {
+    if (blk * DC_BLOCK_SECS >= c->secs || dc_tail - dc_head >= DC_QUEUE)
+      break;
+    if (find_block(c, blk))
+      continue;
+    b = victim(c, 1);
+    /* don't throw out what the current request just used */
+    if (!b || (b->state != DCB_FREE && (int)(b->lru - cur) >= 0))
+      break;
+    evict(c, b);
+    b->blk = blk;
+    b->state = DCB_LOADING;
+    b->ahead = 1;
+    b->lru = ++c->lru_clock;
+    dc_queue[dc_tail % DC_QUEUE].c = c;
+    dc_queue[dc_tail % DC_QUEUE].b = b;
+    dc_tail++;
+    c->ra_blocks++;
+    pthread_cond_signal(&dc_work_cnd);
+  }
+}
+
+static void stats(struct disk_cache *c, int force)
+{
+  hitimer_t now;
+  uint64_t dt, total;
+
+  if (!force && ++c->reqs < DC_STAT_PERIOD)
+    return;
+  now = GETusTIME(0);
+  dt = now - c->stat_time ?: 1;
+  total = c->hits + c->misses;
+  d_printf("DISK: cache %s: %"PRIu64" hits, %"PRIu64" misses (%"PRIu64"%% hit), "
+      "%"PRIu64" of %"PRIu64" blocks read ahead used, "
+      "%"PRIu64" Kb/s to DOS, %"PRIu64" Kb/s from host\n", c->name,
+      c->hits, c->misses, total ? c->hits * 100 / total : 0,
+      c->ra_used, c->ra_blocks,
+      c->dos_bytes * 1000000 / dt / 1024, c->host_bytes * 1000000 / dt / 1024);
+  c->reqs = 0;
+  c->hits = c->misses = c->ra_blocks = c->ra_used = 0;
+  c->dos_bytes = c->host_bytes = 0;
+  c->stat_time = now;
+}
+
+/* a request not on a sector boundary of the cache bypasses it */
+static int unaligned(struct disk_cache *c, off_t pos, int len)
+{
+  int i;
+
+  if ((pos - c->base) % SECTOR_SIZE == 0 && len % SECTOR_SIZE == 0 &&
+      pos >= c->base)
+    return 0;
+  flush_all(c);
+  for (i = 0; i < c->nblocks; i++) {
+    if (c->blk[i].state == DCB_READY)
+      evict(c, &c->blk[i]);
+  }
+  return 1;
+}
+
+int disk_cache_read(const struct disk *dp, unsigned buffer, off_t pos, int len)
+{
+  struct disk_cache *c = dp->cache;
+  struct dc_block *b;
+  uint64_t sec, s;
+  int done = 0, err = 0, off, n, i;
+
+  pthread_mutex_lock(&dc_mtx);
+  if (unaligned(c, pos, len)) {
+    pthread_mutex_unlock(&dc_mtx);
+    if (pos != lseek(c->fd, pos, SEEK_SET))
+      return -1;
+    return dos_read(c->fd, buffer, len);
+  }
+
+  sec = (pos - c->base) / SECTOR_SIZE;
+  while (done < len) {
+    s = sec + done / SECTOR_SIZE;
+    off = s % DC_BLOCK_SECS;
+    n = _min(DC_BLOCK_SECS - off, (len - done) / SECTOR_SIZE);
+    b = get_block(c, s / DC_BLOCK_SECS);
+    for (i = 0; i < n && test_sec(b->valid, off + i); i++);
+    if (i == n) {
+      c->hits++;
+      if (b->ahead)
+        c->ra_used++;
+    } else {
+      c->misses++;
+      err = fill_block(c, b);
+      for (i = 0; i < n && test_sec(b->valid, off + i); i++);
+    }
+    b->ahead = 0;
+    b->lru = ++c->lru_clock;
+    memcpy_2dos(buffer + done, b->data + off * SECTOR_SIZE, i * SECTOR_SIZE);
+    done += i * SECTOR_SIZE;
+    /* past the end of the image */
+    if (i < n)
+      break;
+  }
+
+  if (sec == c->next_sec && done)
+    read_ahead(c, (sec + done / SECTOR_SIZE - 1) / DC_BLOCK_SECS + 1);
+  c->next_sec = sec + done / SECTOR_SIZE;
+  c->dos_bytes += done;
+  stats(c, 0);
+  pthread_mutex_unlock(&dc_mtx);
+
+  return done || !err ? done : -1;
+}
+
+int disk_cache_write(struct disk *dp, unsigned buffer, off_t pos, int len)
+{
+  struct disk_cache *c = dp->cache;
+  struct dc_block *b;
+  uint64_t sec, s;
+  int done = 0, off, n;
+
+  pthread_mutex_lock(&dc_mtx);
+  if (unaligned(c, pos, len)) {
+    pthread_mutex_unlock(&dc_mtx);
+    if (pos != lseek(c->fd, pos, SEEK_SET))
+      return -1;
+    return dos_write(c->fd, buffer, len);
+  }
+
+  sec = (pos - c->base) / SECTOR_SIZE;
+  while (done < len) {
+    s = sec + done / SECTOR_SIZE;
+    off = s % DC_BLOCK_SECS;
+    n = _min(DC_BLOCK_SECS - off, (len - done) / SECTOR_SIZE);
+    b = get_block(c, s / DC_BLOCK_SECS);
+    memcpy_2unix(b->data + off * SECTOR_SIZE, buffer + done, n * SECTOR_SIZE);
+    if (!is_dirty(b))
+      c->ndirty++;
+    set_secs(b->valid, off, n);
+    set_secs(b->dirty, off, n);
+    b->ahead = 0;
+    b->lru = ++c->lru_clock;
+    done += n * SECTOR_SIZE;
+  }
+
+  /* keep room for the reads */
+  if (c->ndirty > c->nblocks / 2)
+    flush_all(c);
+  stats(c, 0);
+  pthread_mutex_unlock(&dc_mtx);
+
+  return done;
+}
+
+int disk_cache_flush(struct disk *dp)
+{
+  int ret;
+
+  if (!dp->cache)
+    return 0;
+  pthread_mutex_lock(&dc_mtx);
+  ret = flush_all(dp->cache);
+  pthread_mutex_unlock(&dc_mtx);
+  return ret;
+}
+
+void disk_cache_init(struct disk *dp)
+{
+  struct disk_cache *c;
+  sigset_t set, oset;
+  int i, nblocks, err = 0;
+
+  /* the overlay is mapped, nothing to gain */
+  if (dp->cache || dp->cow || config.disk_cache <= 0 || dp->fdesc < 0 ||
+      dp->removable || !(dp->type == IMAGE || dp->type == HDISK ||
+      dp->type == PARTITION))
+    return;
+
+  nblocks = config.disk_cache / (DC_BLOCK_SIZE / 1024);
+  if (nblocks < DC_READ_AHEAD + 2)
+    nblocks = DC_READ_AHEAD + 2;
+  if (nblocks > DC_MAX_BLOCKS)
+    nblocks = DC_MAX_BLOCKS;
+
+  c = calloc(1, sizeof(*c));
+  if (!c)
+    return;
+  c->blk = calloc(nblocks, sizeof(*c->blk));
+  c->mem = malloc((size_t)(nblocks + 1) * DC_BLOCK_SIZE);
+  if (!c->blk || !c->mem) {
+    error("DISK: no memory for the cache of %s\n", dp->dev_name);
+    free(c->blk);
+    free(c->mem);
+    free(c);
+    return;
+  }
+  for (i = 0; i < nblocks; i++)
+    c->blk[i].data = c->mem + (size_t)i * DC_BLOCK_SIZE;
+  c->tmp = c->mem + (size_t)nblocks * DC_BLOCK_SIZE;
+  c->nblocks = nblocks;
+  c->name = dp->dev_name;
+  c->fd = dp->fdesc;
+  c->base = dp->header;
+  c->secs = dp->num_secs;
+  if (dp->type == PARTITION)
+    c->secs -= dp->start;
+  c->next_sec = -1;
+  c->stat_time = GETusTIME(0);
+
+  pthread_mutex_lock(&dc_mtx);
+  if (!dc_caches++) {
+    dc_quit = 0;
+    /* the signals are for the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &oset);
+    err = pthread_create(&dc_thr, NULL, dc_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &oset, NULL);
+    if (err)
+      dc_caches--;
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+    else
+      pthread_setname_np(dc_thr, "dosemu: dcache");
+#endif
+  }
+  pthread_mutex_unlock(&dc_mtx);
+  if (err) {
+    error("DISK: can't start the cache thread: %s\n", strerror(err));
+    free(c->blk);
+    free(c->mem);
+    free(c);
+    return;
+  }
+
+  dp->cache = c;
+  d_printf("DISK: %s cached in %d blocks of %dK\n", dp->dev_name, nblocks,
+      DC_BLOCK_SIZE / 1024);
+}
+
+void disk_cache_done(struct disk *dp)
+{
+  struct disk_cache *c = dp->cache;
+  int i, last;
+
+  if (!c)
+    return;
+
+  pthread_mutex_lock(&dc_mtx);
+  for (i = 0; i < c->nblocks; i++) {
+    while (c->blk[i].state == DCB_LOADING)
+      pthread_cond_wait(&dc_done_cnd, &dc_mtx);
+  }
+  flush_all(c);
+  stats(c, 1);
+  last = !--dc_caches;
+  if (last) {
+    dc_quit = 1;
+    pthread_cond_signal(&dc_work_cnd);
+  }
+  pthread_mutex_unlock(&dc_mtx);
+  if (last)
+    pthread_join(dc_thr, NULL);
+
+  dp->cache = NULL;
+  free(c->blk);
+  free(c->mem);
+  free(c);
+}
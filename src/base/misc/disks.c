@@ -87,6 +87,10 @@ static void disk_reset2(void);
 
 static void flush_disk(struct disk *dp)
 {
+  if (dp) {
+    disk_cache_flush(dp);
+    cow_sync(dp->cow, 0);
+  }
   if (dp && dp->removable && dp->fdesc >= 0) {
     if (dp->type == IMAGE || (dp->type == FLOPPY && !config.fastfloppy)) {
       close(dp->fdesc);
@@ -118,6 +122,14 @@ static void dir_setup(struct disk *);
 static void MBR_setup(struct disk *);
 static void VBR_setup(struct disk *);
 
+/* the image as seen by the guest, through the overlay if there is one */
+static ssize_t image_pread(struct disk *dp, void *buf, size_t len, off_t pos)
+{
+  if (dp->cow)
+    return cow_pread(dp->cow, buf, len, pos);
+  return RPT_SYSCALL(pread(dp->fdesc, buf, len, pos));
+}
+
 static struct disk_fptr disk_fptrs[NUM_DTYPES] =
 {
   {image_auto, MBR_setup},
@@ -317,6 +329,12 @@ read_sectors(const struct disk *dp, unsigned buffer, uint64_t sector,
     if(tmpread == -2) return -DERR_ECCERR;
     tmpread *= SECTOR_SIZE;
   }
+  else if (dp->cow) {
+    tmpread = cow_read(dp->cow, buffer, pos, count * SECTOR_SIZE - already);
+  }
+  else if (dp->cache) {
+    tmpread = disk_cache_read(dp, buffer, pos, count * SECTOR_SIZE - already);
+  }
   else {
     if(pos != lseek(dp->fdesc, pos, SEEK_SET)) {
       error("Sector not found in read_sector, error = %s!\n", strerror(errno));
@@ -398,6 +416,13 @@ write_sectors(struct disk *dp, unsigned buffer, uint64_t sector,
     if(tmpwrite == -1) return -DERR_WRITEFLT;
     tmpwrite *= SECTOR_SIZE;
   }
+  else if (dp->cow) {
+    tmpwrite = cow_write(dp->cow, buffer, pos, count * SECTOR_SIZE - already);
+    if (tmpwrite == -1) return -DERR_WRITEFLT;
+  }
+  else if (dp->cache) {
+    tmpwrite = disk_cache_write(dp, buffer, pos, count * SECTOR_SIZE - already);
+  }
   else {
     if(pos != lseek(dp->fdesc, pos, SEEK_SET)) {
       error("Sector not found in write_sector!\n");
@@ -831,8 +856,7 @@ static void image_auto(struct disk *dp)
 
   // Hard disk image
 
-  lseek(dp->fdesc, 0, SEEK_SET);
-  if (RPT_SYSCALL(read(dp->fdesc, &sect0.buf, sizeof(sect0))) != sizeof(sect0)) {
+  if (image_pread(dp, &sect0.buf, sizeof(sect0), 0) != sizeof(sect0)) {
     error("could not read sector 0 in image_init\n");
     leavedos(19);
   }
@@ -908,7 +932,7 @@ static void image_auto(struct disk *dp)
 static void MBR_setup(struct disk *dp)
 {
   ssize_t rd;
-  int ret, i;
+  int i;
 
   if (dp->floppy) {
     return;
@@ -916,12 +940,8 @@ static void MBR_setup(struct disk *dp)
 
   /* Disk / Image already has MBR */
   dp->part_info.number = 1;
-  ret = lseek(dp->fdesc, dp->header, SEEK_SET);
-  if (ret == -1) {
-    error("MBR_setup: Can't seek '%s'\n", dp->dev_name);
-    leavedos(35);
-  }
-  rd = read(dp->fdesc, &dp->part_info.mbr, sizeof(dp->part_info.mbr));
+  rd = image_pread(dp, &dp->part_info.mbr, sizeof(dp->part_info.mbr),
+      dp->header);
   if (rd != sizeof(dp->part_info.mbr)) {
     error("MBR_setup: Can't read MBR from '%s'\n", dp->dev_name);
     leavedos(35);
@@ -964,8 +984,7 @@ static void partition_auto(struct disk *dp)
     dp->num_secs = sb.st_size / SECTOR_SIZE;
   }
 
-  lseek(dp->fdesc, 0, SEEK_SET);
-  if (RPT_SYSCALL(read(dp->fdesc, &vbr, sizeof(vbr))) != sizeof(vbr)) {
+  if (image_pread(dp, &vbr, sizeof(vbr), 0) != sizeof(vbr)) {
     error("could not read first sector PARTITION %s\n", dp->dev_name);
     leavedos(22);
   }
@@ -1011,8 +1030,7 @@ static void VBR_setup(struct disk *dp)
     return;
   }
 
-  lseek(dp->fdesc, 0, SEEK_SET);
-  if (RPT_SYSCALL(read(dp->fdesc, &vbr, sizeof(vbr))) != sizeof(vbr)) {
+  if (image_pread(dp, &vbr, sizeof(vbr), 0) != sizeof(vbr)) {
     d_printf("  BPB could not be read\n");
   } else {
     if (vbr.u.bpb7.num_sectors_small == 0 && (
@@ -1048,6 +1066,18 @@ disk_close(void)
   }
 }
 
+/* write back what the disk caches hold */
+static void hdisk_sync(void)
+{
+  int i;
+
+  if (!disks_initiated) return;  /* just to be safe */
+  FOR_EACH_HDISK(i, {
+    disk_cache_flush(&hdisktab[i]);
+    cow_sync(hdisktab[i].cow, 0);
+  });
+}
+
 static void disk_sync(void)
 {
   struct disk *dp;
@@ -1059,6 +1089,7 @@ static void disk_sync(void)
       (void) fsync(dp->fdesc);
     }
   }
+  hdisk_sync();
 }
 
 
@@ -1162,6 +1193,9 @@ disk_close_all(void)
   }
   FOR_EACH_HDISK(i, {
     if(hdisktab[i].type == DIR_TYPE) fatfs_done(&hdisktab[i]);
+    disk_cache_done(&hdisktab[i]);
+    cow_close(hdisktab[i].cow);
+    hdisktab[i].cow = NULL;
     if (hdisktab[i].fdesc >= 0) {
       d_printf("Hard disk Closing %x\n", hdisktab[i].fdesc);
       (void) close(hdisktab[i].fdesc);
@@ -1262,10 +1296,14 @@ static void disk_reset2(void)
    */
   FOR_EACH_HDISK(i, {
     dp = &hdisktab[i];
+    disk_cache_done(dp);
+    cow_close(dp->cow);
+    dp->cow = NULL;
     if (dp->fdesc != -1)
       close(dp->fdesc);
+    /* with an overlay the image itself is never written */
     dp->fdesc = open(dp->type == DIR_TYPE ? "/dev/null" : dp->dev_name,
-        (dp->rdonly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+        (dp->rdonly || dp->overlay ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (dp->fdesc < 0) {
       if (errno == EROFS || errno == EACCES) {
         dp->fdesc = open(dp->dev_name, O_RDONLY | O_CLOEXEC);
@@ -1283,6 +1321,9 @@ static void disk_reset2(void)
     }
     dp->removable = 0;
 
+    if (dp->overlay && dp->fdesc >= 0 && !(dp->cow = cow_open(dp)))
+      config.exitearly = 1;
+
     /* HACK: if unspecified geometry (-1) then try to get it from kernel.
        May only work on WD compatible disks (MFM/RLL/ESDI/IDE). */
     if (dp->sectors == -1)
@@ -1292,6 +1333,7 @@ static void disk_reset2(void)
      * (mostly for the partition type)
      */
     disk_fptrs[dp->type].setup(dp);
+    disk_cache_init(dp);
   });
 }
 
@@ -2100,6 +2142,8 @@ floppy_tick(void)
     if (debug_level('d') > 2)
       d_printf("FLOPPY: flushing after %d ticks\n", ticks);
     ticks = 0;
+  } else {
+    hdisk_sync();
   }
 }
 
@@ -281,6 +281,9 @@ void fatfs_init(struct disk *dp)
 
   f->obj = NULL;
   f->objs = f->alloc_objs = 0;
+  f->assign_obj = 1;
+  f->clu_obj = NULL;
+  f->clu_objs = f->alloc_clu_objs = 0;
 
   f->fd = -1;
   f->fd_obj = 0;
@@ -336,6 +339,7 @@ void fatfs_done(struct disk *dp)
   if(f->ffn) free(f->ffn);
   if(f->boot_sec) free(f->boot_sec);
   if(f->obj) free(f->obj);
+  if(f->clu_obj) free(f->clu_obj);
 
   free(dp->fatfs); dp->fatfs = NULL;
 }
@@ -1408,23 +1412,55 @@ unsigned make_dos_entry(fatfs_t *f, const obj_t *o, unsigned char **e)
 }
 
 
+/*
+ * Clusters are handed out in ascending order, so clu_obj[] is sorted
+ * by start cluster and a binary search finds the object.
+ */
 unsigned find_obj(fatfs_t *f, unsigned clu)
 {
-  unsigned u;
+  unsigned lo = 0, hi = f->clu_objs, mid;
+  obj_t *o;
 
   if(clu >= f->first_free_cluster) return 0;
 
-  for(u = 0; u < f->objs; u++) {
-    if(
-      !f->obj[u].is.not_real &&
-      clu >= f->obj[u].start &&
-      clu < f->obj[u].start + f->obj[u].len
-    ) break;
+  while(lo < hi) {
+    mid = (lo + hi) / 2;
+    if(f->obj[f->clu_obj[mid]].start <= clu)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if(lo == 0) return 0;
+  o = f->obj + f->clu_obj[lo - 1];
+  if(clu >= o->start + o->len) return 0;
+
+  return f->clu_obj[lo - 1];
+}
+
+
+/*
+ * Remember an object that got its clusters. Zero if something failed.
+ */
+static int add_clu_obj(fatfs_t *f, unsigned oi)
+{
+  void *p;
+  unsigned new_objs;
+
+  if(f->clu_objs >= f->alloc_clu_objs) {
+    new_objs = f->alloc_clu_objs ? f->alloc_clu_objs : 64;
+    p = realloc(f->clu_obj, (f->alloc_clu_objs + new_objs) * sizeof *f->clu_obj);
+    if(p == NULL) {
+      fatfs_msg("add_clu_obj: out of memory (%u objs)\n", f->alloc_clu_objs);
+      return 0;
+    }
+    f->clu_obj = p;
+    f->alloc_clu_objs += new_objs;
   }
 
-  if(u == f->objs) return 0;
+  f->clu_obj[f->clu_objs++] = oi;
 
-  return u;
+  return 1;
 }
 
 
@@ -1436,7 +1472,8 @@ void assign_clusters(fatfs_t *f, unsigned max_clu, unsigned max_obj)
 
   if(max_clu == 0 && max_obj == 0) return;
 
-  for(u = 1; u < f->objs; u++) {
+  /* everything below assign_obj already has its clusters */
+  for(u = f->assign_obj; u < f->objs; u++) {
     if(f->got_all_objs) break;
     if(f->first_free_cluster > max_clu && u > max_obj) break;
     if(f->obj[u].is.not_real) continue;
@@ -1444,7 +1481,7 @@ void assign_clusters(fatfs_t *f, unsigned max_clu, unsigned max_obj)
     if(f->obj[u].is.dir && !f->obj[u].is.scanned) scan_dir(f, u);
     f->obj[u].start = f->first_free_cluster;
     f->first_free_cluster += f->obj[u].len;
-    if(f->first_free_cluster > f->last_cluster) {
+    if(f->first_free_cluster > f->last_cluster || !add_clu_obj(f, u)) {
       f->obj[u].start = 0;
       f->obj[u].is.not_real = 1;
       f->first_free_cluster -= f->obj[u].len;
@@ -1459,6 +1496,7 @@ void assign_clusters(fatfs_t *f, unsigned max_clu, unsigned max_obj)
           free(f->obj[k].full_name);
       }
       f->objs = u;
+      f->rd_idx = 0;
       /* do not overflow the root of a boot drive */
       if (f->obj[u].parent == 0 && f->sys_type)
         leavedos(20);
@@ -1467,6 +1505,8 @@ void assign_clusters(fatfs_t *f, unsigned max_clu, unsigned max_obj)
 	u, f->obj[u].start, f->obj[u].len, f->obj[u].name);
   }
 
+  f->assign_obj = u;
+
   if(u == f->objs) {
     fatfs_deb("assign_clusters: got everything\n");
     f->got_all_objs = 1;
@@ -1568,7 +1608,16 @@ int read_dir(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
   if(pos >= o->size) return 0;
   if(o->first_child == 0) return 0;
 
-  for(i = o->first_child, j = 0; i < f->objs && f->obj[i].parent == oi; i++) {
+  /* sequential reads of a big directory go on from the last position */
+  if(f->rd_idx && f->rd_obj == oi && f->rd_pos <= pos) {
+    i = f->rd_idx;
+    j = f->rd_ofs;
+  } else {
+    i = o->first_child;
+    j = 0;
+  }
+
+  for(; i < f->objs && f->obj[i].parent == oi; i++) {
     if(j + f->obj[i].dos_dir_size >= pos) break;
     j += f->obj[i].dos_dir_size;
   }
@@ -1576,6 +1625,11 @@ int read_dir(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
   /* should never happen... */
   if(i == f->objs || f->obj[i].parent != oi) return -1;
 
+  f->rd_obj = oi;
+  f->rd_idx = i;
+  f->rd_ofs = j;
+  f->rd_pos = pos;
+
   if(f->obj[i].start == 0 && !f->obj[i].is.not_real) {
     assign_clusters(f, 0, i);
     o = f->obj + oi;
@@ -1611,7 +1665,6 @@ int read_dir(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
 
 unsigned next_cluster(fatfs_t *f, unsigned clu)
 {
-  static unsigned last_start = 0, last_end = 0;
   unsigned u = 0;
 
   if(clu < 2) {
@@ -1620,15 +1673,16 @@ unsigned next_cluster(fatfs_t *f, unsigned clu)
     return u;
   }
 
-  if(!(clu >= last_start && clu < last_end)) {
+  /* the run is per drive, read_fat() walks one drive at a time */
+  if(!(clu >= f->last_start && clu < f->last_end)) {
     if(!f->got_all_objs && clu >= f->first_free_cluster) assign_clusters(f, clu, 0);
     if(!(u = find_obj(f, clu))) return 0;
-    last_start = f->obj[u].start;
-    last_end = last_start + f->obj[u].len;
-    if(clu >= last_end) return 0;
+    f->last_start = f->obj[u].start;
+    f->last_end = f->last_start + f->obj[u].len;
+    if(clu >= f->last_end) return 0;
   }
 
-  if(clu == last_end - 1) return 0xffff;
+  if(clu == f->last_end - 1) return 0xffff;
 
   return clu + 1;
 }
@@ -59,6 +59,13 @@ struct fatfs_s {
   unsigned objs, alloc_objs;
   unsigned sys_objs;
   obj_t *obj;
+  unsigned assign_obj;			/* first obj assign_clusters() looks at */
+
+  unsigned *clu_obj;			/* objs with clusters, by start cluster */
+  unsigned clu_objs, alloc_clu_objs;
+  unsigned last_start, last_end;	/* cluster run of the last next_cluster() */
+
+  unsigned rd_obj, rd_idx, rd_ofs, rd_pos;	/* last read_dir() position */
 
   char *ffn, *ffn_ptr;			/* buffer for file names */
   unsigned ffn_obj;
@@ -55,6 +55,10 @@
 #include "utilities.h"
 #endif
 #include "ioselect.h"
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 #ifdef USE_MHPDBG
   #include "mhpdbg.h"
@@ -72,11 +76,27 @@ struct io_callback_s {
   int fd;
   unsigned flags;
 };
+
+/* per-fd record, allocated once and kept for the session */
+struct io_fd_s {
+  struct io_callback_s cb;
+  struct io_callback_s stash;
+  struct io_callback_s pend;	/* handed to the main thread */
+  int masked;
+  int polled;
+  int always;			/* can't be polled, always ready */
+  unsigned long events;
+};
+
+#define IOFD_CHUNK 1024
+#define IOFD_CHUNKS 1024
+static struct io_fd_s *io_fds[IOFD_CHUNKS];
+#ifdef HAVE_EPOLL_CREATE1
+#define MAX_FD (IOFD_CHUNK * IOFD_CHUNKS)
+#else
 #define MAX_FD FD_SETSIZE
-static struct io_callback_s io_callback_func[MAX_FD];
-static struct io_callback_s io_callback_stash[MAX_FD];
-static fd_set fds_sigio;
-static fd_set fds_masked;
+static fd_set fds_armed;
+#endif
 
 #if defined(SIG)
 static inline int process_interrupt(SillyG_t *sg)
@@ -117,37 +137,227 @@ void irq_select(void)
 /*  */
 /* io_select @@@  24576 MOVED_CODE_BEGIN @@@ 01/23/96, ./src/base/misc/dosio.c --> src/base/misc/ioctl.c  */
 
+#ifdef HAVE_EPOLL_CREATE1
+static int epfd;
+static int wakefd;
+/* epoll refuses regular files and the like. select() reported them
+ * as always ready, so they are dispatched on every pass instead. */
+static int *always_fds;
+static int num_always;
+#else
 static int max_fd;
 static int syncpipe[2];
+static pthread_mutex_t fds_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
 static pthread_t io_thr;
 static pthread_mutex_t fun_mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t blk_mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t fds_mtx = PTHREAD_MUTEX_INITIALIZER;
 static int num_cbks;
 
+static struct io_fd_s *get_io_fd(int fd)
+{
+  struct io_fd_s *chunk;
+
+  if (fd < 0 || fd >= MAX_FD)
+    return NULL;
+  chunk = __atomic_load_n(&io_fds[fd / IOFD_CHUNK], __ATOMIC_ACQUIRE);
+  return chunk ? &chunk[fd % IOFD_CHUNK] : NULL;
+}
+
+static struct io_fd_s *alloc_io_fd(int fd)
+{
+  struct io_fd_s *chunk = get_io_fd(fd);
+
+  if (chunk || fd < 0 || fd >= MAX_FD)
+    return chunk;
+  chunk = calloc(IOFD_CHUNK, sizeof(*chunk));
+  if (!chunk)
+    return NULL;
+  __atomic_store_n(&io_fds[fd / IOFD_CHUNK], chunk, __ATOMIC_RELEASE);
+  return &chunk[fd % IOFD_CHUNK];
+}
+
+#ifdef HAVE_EPOLL_CREATE1
+static void always_add(struct io_fd_s *f, int fd)
+{
+  int *p = realloc(always_fds, (num_always + 1) * sizeof(*always_fds));
+
+  if (!p) {
+    error("GEN: no memory for fd %d\n", fd);
+    return;
+  }
+  always_fds = p;
+  always_fds[num_always++] = fd;
+  f->always = 1;
+}
+
+static void always_del(struct io_fd_s *f, int fd)
+{
+  int i;
+
+  for (i = 0; i < num_always; i++) {
+    if (always_fds[i] == fd) {
+      always_fds[i] = always_fds[--num_always];
+      break;
+    }
+  }
+  f->always = 0;
+}
+
+/* the io thread may be sleeping with only this fd to serve */
+static void io_wake(void)
+{
+  uint64_t one = 1;
+
+  write(wakefd, &one, sizeof(one));
+}
+#endif
+
+/*
+ * Sync the poller with the state of the fd, under blk_mtx.
+ * Everything except the unmasked IOFLG_IMMED fds is one-shot: the fd
+ * is masked when its event is dispatched, and armed again by
+ * ioselect_complete().
+ */
+static void io_poll_update(struct io_fd_s *f, int fd)
+{
+#ifdef HAVE_EPOLL_CREATE1
+  struct epoll_event ev = { .data.fd = fd };
+  int op;
+
+  if (!f->cb.func) {
+    if (f->polled)
+      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+    f->polled = 0;
+    if (f->always)
+      always_del(f, fd);
+    return;
+  }
+  if (f->always) {
+    if (!f->masked)
+      io_wake();
+    return;
+  }
+  /* a masked fd stays registered with no events; one-shot so that
+     a hangup is not reported over and over */
+  ev.events = EPOLLONESHOT;
+  if (!f->masked) {
+    ev.events |= EPOLLIN;
+    if ((f->cb.flags & (IOFLG_IMMED | IOFLG_MASKED)) == IOFLG_IMMED)
+      ev.events &= ~EPOLLONESHOT;
+  }
+  op = f->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(epfd, op, fd, &ev) == 0) {
+    f->polled = 1;
+  } else if (errno == EPERM && op == EPOLL_CTL_ADD) {
+    g_printf("GEN: fd %d for %s can't be polled, always ready\n", fd,
+	     f->cb.name);
+    always_add(f, fd);
+    if (!f->masked)
+      io_wake();
+  } else {
+    error("GEN: epoll_ctl on fd %d for %s: %s\n", fd, f->cb.name,
+	  strerror(errno));
+  }
+#else
+  pthread_mutex_lock(&fds_mtx);
+  if (f->cb.func && !f->masked) {
+    if (fd > max_fd)
+      max_fd = fd;
+    FD_SET(fd, &fds_armed);
+  } else {
+    FD_CLR(fd, &fds_armed);
+  }
+  pthread_mutex_unlock(&fds_mtx);
+  write(syncpipe[1], "=", 1);
+#endif
+}
+
 static void ioselect_demux(void *arg)
 {
-    struct io_callback_s *p = arg;
+    struct io_fd_s *p = arg;
     struct io_callback_s f;
     int isset, num;
 
-    f = *p;
-    free(p);
+    f = p->pend;
     num = __atomic_sub_fetch(&num_cbks, 1, __ATOMIC_RELAXED);
-    pthread_mutex_lock(&fds_mtx);
-    isset = FD_ISSET(f.fd, &fds_sigio);
-    pthread_mutex_unlock(&fds_mtx);
+    pthread_mutex_lock(&fun_mtx);
+    isset = !!p->cb.func;
+    pthread_mutex_unlock(&fun_mtx);
     if (!isset) {
         /* already removed, complete event and exit */
         ioselect_complete(f.fd);
         return;
     }
     assert(f.func);
-    g_printf("GEN: fd %i has data for %s, %i pending\n", f.fd, f.name, num);
+    g_printf("GEN: fd %i has data for %s, %i pending, %lu events\n", f.fd,
+	     f.name, num, p->events);
     f.func(f.fd, f.arg);
     reset_idle(0);
 }
 
+static void io_dispatch(int fd)
+{
+  struct io_fd_s *f = get_io_fd(fd);
+
+  if (!f || !f->cb.func || f->masked)
+    return;
+  f->events++;
+  if (f->cb.flags & IOFLG_IMMED) {
+    if (f->cb.flags & IOFLG_MASKED)
+      f->masked = 1;
+    f->cb.func(fd, f->cb.arg);
+  } else {
+    f->pend = f->cb;
+    __atomic_fetch_add(&num_cbks, 1, __ATOMIC_RELAXED);
+    f->masked = 1;
+    add_thread_callback(ioselect_demux, f, "ioselect");
+  }
+#ifndef HAVE_EPOLL_CREATE1
+  if (f->masked)
+    io_poll_update(f, fd);
+#endif
+}
+
+#ifdef HAVE_EPOLL_CREATE1
+static void io_select(void)
+{
+  struct epoll_event evs[16];
+  struct io_fd_s *f;
+  uint64_t cnt;
+  int n, i, timeout = -1;
+
+  pthread_mutex_lock(&blk_mtx);
+  for (i = 0; i < num_always; i++) {
+    f = get_io_fd(always_fds[i]);
+    if (f->cb.func && !f->masked) {
+      timeout = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&blk_mtx);
+
+  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  n = epoll_wait(epfd, evs, sizeof(evs) / sizeof(evs[0]), timeout);
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  if (n == -1) {
+    if (errno != EINTR)
+      error("bad io_select: %s\n", strerror(errno));
+    return;
+  }
+
+  pthread_mutex_lock(&blk_mtx);
+  for (i = 0; i < n; i++) {
+    if (evs[i].data.fd == wakefd)
+      read(wakefd, &cnt, sizeof(cnt));
+    else
+      io_dispatch(evs[i].data.fd);
+  }
+  for (i = 0; i < num_always; i++)
+    io_dispatch(always_fds[i]);
+  pthread_mutex_unlock(&blk_mtx);
+}
+#else
 static void io_select(void)
 {
   int selrtn, i;
@@ -155,16 +365,12 @@ static void io_select(void)
   int nfds;
 
   pthread_mutex_lock(&fds_mtx);
-  fds = fds_sigio;
+  fds = fds_armed;
   nfds = max_fd + 1;
   pthread_mutex_unlock(&fds_mtx);
-
-  pthread_mutex_lock(&blk_mtx);
-  for (i = 0; i < nfds; i++) {
-    if (FD_ISSET(i, &fds_masked))
-      FD_CLR(i, &fds);
-  }
-  pthread_mutex_unlock(&blk_mtx);
+  FD_SET(syncpipe[0], &fds);
+  if (syncpipe[0] >= nfds)
+    nfds = syncpipe[0] + 1;
 
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
   selrtn = RPT_SYSCALL(select(nfds, &fds, NULL, NULL, NULL));
@@ -179,28 +385,21 @@ static void io_select(void)
       break;
 
     default:			/* has at least 1 descriptor ready */
+      if (FD_ISSET(syncpipe[0], &fds)) {
+        char buf[4096];
+        read(syncpipe[0], buf, sizeof(buf));
+        FD_CLR(syncpipe[0], &fds);
+      }
       pthread_mutex_lock(&blk_mtx);
       for (i = 0; i < nfds; i++) {
-        if (FD_ISSET(i, &fds_masked))
-          continue;
-        if (FD_ISSET(i, &fds)) {
-          if (io_callback_func[i].flags & IOFLG_IMMED) {
-            if (io_callback_func[i].flags & IOFLG_MASKED)
-              FD_SET(i, &fds_masked);
-            io_callback_func[i].func(i, io_callback_func[i].arg);
-          } else {
-            struct io_callback_s *f = malloc(sizeof(*f));
-            *f = io_callback_func[i];
-            __atomic_fetch_add(&num_cbks, 1, __ATOMIC_RELAXED);
-            FD_SET(i, &fds_masked);
-            add_thread_callback(ioselect_demux, f, "ioselect");
-          }
-        }
+        if (FD_ISSET(i, &fds))
+          io_dispatch(i);
       }
       pthread_mutex_unlock(&blk_mtx);
       break;
   }
 }
+#endif
 
 /*
  * DANG_BEGIN_FUNCTION add_to_io_select
@@ -219,32 +418,30 @@ void
 add_to_io_select_new(int new_fd, void (*func)(int, void *), void *arg,
 	unsigned flags, const char *name)
 {
-    struct io_callback_s *f = &io_callback_func[new_fd];
+    struct io_fd_s *f = alloc_io_fd(new_fd);
 
-    if (new_fd >= MAX_FD) {
+    if (!f) {
 	error("Too many IO fds used.\n");
 	leavedos(76);
+	return;
     }
 
-    io_callback_stash[new_fd] = *f;
+    f->stash = f->cb;
 
     g_printf("GEN: fd=%d gets SIGIO for %s\n", new_fd, name);
     pthread_mutex_lock(&fun_mtx);
-    f->func = func;
-    f->arg = arg;
-    f->name = name;
-    f->fd = new_fd;
-    f->flags = flags;
+    f->cb.func = func;
+    f->cb.arg = arg;
+    f->cb.name = name;
+    f->cb.fd = new_fd;
+    f->cb.flags = flags;
     pthread_mutex_unlock(&fun_mtx);
+    if (!f->stash.func)
+	f->events = 0;
 
-    pthread_mutex_lock(&fds_mtx);
-    if (new_fd > max_fd)
-        max_fd = new_fd;
-    FD_SET(new_fd, &fds_sigio);
-    pthread_mutex_unlock(&fds_mtx);
-
-    if (!io_callback_stash[new_fd].func)
-	write(syncpipe[1], "+", 1);
+    pthread_mutex_lock(&blk_mtx);
+    io_poll_update(f, new_fd);
+    pthread_mutex_unlock(&blk_mtx);
 }
 
 /*
@@ -262,51 +459,57 @@ add_to_io_select_new(int new_fd, void (*func)(int, void *), void *arg,
  */
 void remove_from_io_select(int fd)
 {
-    if (fd < 0 || !io_callback_func[fd].func) {
+    struct io_fd_s *f = get_io_fd(fd);
+
+    if (!f || !f->cb.func) {
 	error("GEN: removing bogus fd %d (ignoring)\n", fd);
 	return;
     }
 
     pthread_mutex_lock(&fun_mtx);
-    io_callback_func[fd] = io_callback_stash[fd];
+    f->cb = f->stash;
     pthread_mutex_unlock(&fun_mtx);
-    io_callback_stash[fd].func = NULL;
-
-    if (!io_callback_func[fd].func) {
-	pthread_mutex_lock(&fds_mtx);
-	FD_CLR(fd, &fds_sigio);
-	pthread_mutex_unlock(&fds_mtx);
-	write(syncpipe[1], "-", 1);
-	g_printf("GEN: fd=%d removed from select SIGIO\n", fd);
-    }
+    f->stash.func = NULL;
+
+    pthread_mutex_lock(&blk_mtx);
+    io_poll_update(f, fd);
+    pthread_mutex_unlock(&blk_mtx);
+    if (!f->cb.func)
+	g_printf("GEN: fd=%d removed from select SIGIO after %lu events\n",
+		 fd, f->events);
 }
 
 static void do_unmask(int fd)
 {
+    struct io_fd_s *f = get_io_fd(fd);
+
     pthread_mutex_lock(&blk_mtx);
-    FD_CLR(fd, &fds_masked);
+    f->masked = 0;
+    io_poll_update(f, fd);
     pthread_mutex_unlock(&blk_mtx);
-    write(syncpipe[1], "=", 1);
 }
 
 void ioselect_complete(int fd)
 {
-    assert(!(io_callback_func[fd].flags & IOFLG_IMMED) ||
-            (io_callback_func[fd].flags & IOFLG_MASKED));
+    assert(!(get_io_fd(fd)->cb.flags & IOFLG_IMMED) ||
+            (get_io_fd(fd)->cb.flags & IOFLG_MASKED));
     do_unmask(fd);
 }
 
 void ioselect_block(int fd)
 {
-    assert(io_callback_func[fd].flags & IOFLG_IMMED);
+    struct io_fd_s *f = get_io_fd(fd);
+
+    assert(f->cb.flags & IOFLG_IMMED);
     pthread_mutex_lock(&blk_mtx);
-    FD_SET(fd, &fds_masked);
+    f->masked = 1;
+    io_poll_update(f, fd);
     pthread_mutex_unlock(&blk_mtx);
 }
 
 void ioselect_unblock(int fd)
 {
-    assert(io_callback_func[fd].flags & IOFLG_IMMED);
+    assert(get_io_fd(fd)->cb.flags & IOFLG_IMMED);
     do_unmask(fd);
 }
 
@@ -321,29 +524,28 @@ static void *ioselect_thread(void *arg)
     return NULL;
 }
 
-static void do_syncpipe(int fd, void *arg)
-{
-    char buf[4096];
-    read(fd, buf, sizeof(buf));
-}
-
 void ioselect_init(void)
 {
-    struct io_callback_s *f;
     struct sched_param parm = { .sched_priority = 1 };
 
-    FD_ZERO(&fds_sigio);
-    FD_ZERO(&fds_masked);
+#ifdef HAVE_EPOLL_CREATE1
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epfd == -1 || wakefd == -1) {
+	error("epoll_create1: %s\n", strerror(errno));
+	leavedos(76);
+	return;
+    }
+    ev.data.fd = wakefd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+#else
+    FD_ZERO(&fds_armed);
     pipe(syncpipe);
     assert(syncpipe[0] < MAX_FD);
-    f = &io_callback_func[syncpipe[0]];
-    f->func = do_syncpipe;
-    f->arg = NULL;
-    f->name = "syncpipe";
-    f->fd = syncpipe[0];
-    f->flags = IOFLG_IMMED;
     max_fd = syncpipe[0];
-    FD_SET(syncpipe[0], &fds_sigio);
+#endif
     pthread_create(&io_thr, NULL, ioselect_thread, NULL);
     pthread_setschedparam(io_thr, SCHED_FIFO, &parm);
 #if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
@@ -355,5 +557,13 @@ void ioselect_done(void)
 {
     pthread_cancel(io_thr);
     pthread_join(io_thr, NULL);
+#ifdef HAVE_EPOLL_CREATE1
+    close(wakefd);
+    close(epfd);
+    free(always_fds);
+    always_fds = NULL;
+    num_always = 0;
+#else
     close(syncpipe[1]);
+#endif
 }
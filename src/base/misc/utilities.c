@@ -100,9 +100,7 @@ int log_printf(const char *fmt, ...)
 	int ret;
 
 	va_start(args, fmt);
-	pthread_mutex_lock(&log_mtx);
 	ret = vlog_printf(fmt, args);
-	pthread_mutex_unlock(&log_mtx);
 	va_end(args);
 	return ret;
 }
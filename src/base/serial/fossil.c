@@ -345,6 +345,7 @@ void fossil_int14(int num)
         break;
       write_char(num, p[n]);
     }
+    tx_buffer_flush(num);
     LWORD(eax) = n;
     #if SER_DEBUG_FOSSIL_RW
       s_printf("SER%d: FOSSIL 0x19: Block write, %d/%d bytes\n", num, n, len);
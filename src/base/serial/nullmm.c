@@ -34,17 +34,12 @@ static int add_buf(com_t *c, const char *buf, int len)
     return 0;
   }
 
-  /* Slide the buffer contents to the bottom */
-  rx_buffer_slide(c->num);
-
-  memcpy(&c->rx_buf[c->rx_buf_end], buf, len);
   if (debug_level('s') >= 9) {
     int i;
     for (i = 0; i < len; i++)
-      s_printf("SER%d: Got mouse data byte: %#x\n", c->num,
-          c->rx_buf[c->rx_buf_end + i]);
+      s_printf("SER%d: Got mouse data byte: %#x\n", c->num, buf[i] & 0xff);
   }
-  c->rx_buf_end += len;
+  rx_buffer_put(c->num, buf, len);
   receive_engine(c->num);
   return len;
 }
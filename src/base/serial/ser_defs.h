@@ -23,6 +23,7 @@
 #ifndef SER_DEFS_H
 #define SER_DEFS_H
 
+#include <sys/uio.h>
 #include "serial.h"
 
 /* DANG_BEGIN_REMARK
@@ -284,8 +285,13 @@
  * purposes.  (Although this may be configurable eventually)
  *
  * DANG_FIXTHIS Why does a RX_BUFFER_SIZE of 256 cause slower performance than a size of 128?
+ *
+ * The receive buffer is a ring, RX_BUFFER_SIZE must be a power of 2.
+ * The transmit buffer collects the bytes written to THR so that they
+ * go to the device with one write(), it is as large as the 16550 FIFO.
  */
 #define RX_BUFFER_SIZE            128
+#define TX_BUFFER_SIZE            16
 
 /* how many bytes left in output queue when signalling interrupt to DOS */
 #define TX_QUEUE_THRESHOLD 14
@@ -373,10 +379,16 @@ typedef struct {
    * is still emulated using a counter, to improve compatibility.
    */
   u_char rx_buf[RX_BUFFER_SIZE];	/* Receive Buffer */
-  u_char rx_buf_start;			/* Receive Buffer queue start */
-  u_char rx_buf_end;			/* Receive Buffer queue end */
+  unsigned rx_buf_start;		/* Receive Buffer queue start */
+  unsigned rx_buf_end;			/* Receive Buffer queue end */
 
+  u_char tx_buf[TX_BUFFER_SIZE];	/* Transmit Buffer */
+  int tx_buf_len;			/* Bytes not yet written */
   int tx_cnt;
+
+  /* Throughput counters, reported when the port is closed */
+  unsigned long long rx_bytes, rx_reads;
+  unsigned long long tx_bytes, tx_writes;
   int fossil_blkrd_tid;
 
   struct termios oldset;		/* Original termios settings */
@@ -389,7 +401,9 @@ extern com_t com[MAX_SER];
 
 extern boolean fossil_initialised;
 
-#define RX_BUF_BYTES(num) (com[num].rx_buf_end - com[num].rx_buf_start)
+/* rx_buf_start and rx_buf_end run freely, RX_BUF_IDX() wraps them */
+#define RX_BUF_BYTES(num) ((int)(com[num].rx_buf_end - com[num].rx_buf_start))
+#define RX_BUF_IDX(pos) ((pos) & (RX_BUFFER_SIZE - 1))
 //#define RX_FIFO_BYTES(num) min(RX_BUF_BYTES(num), com[num].rx_fifo_size)
 #define INT_REQUEST(num)  (com[num].int_condition & com[num].IER)
 #define INT_ENAB(num)  (com[num].MCR & UART_MCR_OUT2)
@@ -412,8 +426,9 @@ int msr_compute_delta_bits(int oldmsr, int newmsr);
 void receive_engine(int num);
 void receive_timeouts(int num);
 void transmit_engine(int num);
-void rx_buffer_slide(int num);
-void tx_buffer_slide(int num);
+int rx_buffer_put(int num, const void *buf, int len);
+int rx_buffer_iov(int num, struct iovec *iov);
+void tx_buffer_flush(int num);
 int serial_get_tx_queued(int num);
 void serial_update(int num);
 
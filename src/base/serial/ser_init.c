@@ -412,6 +412,10 @@ void serial_close(void)
     if (com_cfg[i].vmodem)
       modemu_done(i);
 #endif
+    tx_buffer_flush(i);
+    s_printf("SER%d: sent %llu bytes in %llu writes, received %llu bytes "
+        "in %llu reads\n", i, com[i].tx_bytes, com[i].tx_writes,
+        com[i].rx_bytes, com[i].rx_reads);
     ser_close(i);
   }
 }
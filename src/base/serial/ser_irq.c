@@ -128,6 +128,7 @@ static void update_tx_cnt(int num)
   int queued = serial_get_tx_queued(num);
   if (queued < 0)
     queued = 0;
+  queued += com[num].tx_buf_len;	/* not yet written by us */
   if (queued > com[num].tx_cnt)
     s_printf("SER%d: ERROR: queued=%i tx_cnt=%i\n", num, queued, com[num].tx_cnt);
   com[num].tx_cnt = queued;
@@ -168,8 +169,10 @@ void transmit_engine(int num) /* Internal 16550 Transmission emulation */
       return;		/* Return if CTS is low */
   }
 
-  if (com[num].tx_cnt > TX_QUEUE_THRESHOLD)
+  if (com[num].tx_cnt > TX_QUEUE_THRESHOLD) {
+    tx_buffer_flush(num);
     update_tx_cnt(num);
+  }
   if (debug_level('s') > 5)
     s_printf("SER%d: queued=%i\n", num, com[num].tx_cnt);
   if (com[num].tx_cnt > TX_QUEUE_THRESHOLD)
@@ -307,6 +310,7 @@ void serial_update(int num)
   }
   if (RX_BUF_BYTES(num))
     receive_timeouts(num);	/* Handle timeouts */
+  tx_buffer_flush(num);		/* Write out what THR collected */
   transmit_engine(num);		/* Transmit operations */
   modstat_engine(num);  	/* Modem Status operations */
 }
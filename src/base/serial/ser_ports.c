@@ -24,6 +24,7 @@
 #include <errno.h>
 
 #include "emu.h"
+#include "utilities.h"
 #include "ser_defs.h"
 #include "tty_io.h"
 
@@ -45,22 +46,64 @@ inline int convert_bit(int testval, int inbit, int outbit)
 }
 
 
-/* This function slides the contents of the receive buffer to the
- * bottom of the buffer.  A sliding buffer is used instead of
- * a circular buffer because this way, a single read() can easily
- * put data straight into our internal receive buffer!
+/* This function appends up to len bytes to the receive ring and
+ * returns how many of them fitted.   [num = port]
  */
-void rx_buffer_slide(int num)
+int rx_buffer_put(int num, const void *buf, int len)
 {
-  if (com[num].rx_buf_start == 0)
-    return;
-  /* Move existing chars in receive buffer to the start of buffer */
-  memmove(com[num].rx_buf, com[num].rx_buf + com[num].rx_buf_start,
-    RX_BUF_BYTES(num));
+  unsigned pos = RX_BUF_IDX(com[num].rx_buf_end);
+  int n;
+
+  len = _min(len, RX_BUFFER_SIZE - RX_BUF_BYTES(num));
+  n = _min(len, RX_BUFFER_SIZE - pos);
+  memcpy(com[num].rx_buf + pos, buf, n);
+  memcpy(com[num].rx_buf, (const u_char *)buf + n, len - n);
+  com[num].rx_buf_end += len;
+  com[num].rx_bytes += len;
+  return len;
+}
+
+/* This function describes the free part of the receive ring in iov[2],
+ * so that a single readv() can put data straight into it.  The caller
+ * advances rx_buf_end.  Returns the number of iov entries used.
+ */
+int rx_buffer_iov(int num, struct iovec *iov)
+{
+  unsigned pos = RX_BUF_IDX(com[num].rx_buf_end);
+  int room = RX_BUFFER_SIZE - RX_BUF_BYTES(num);
+
+  iov[0].iov_base = com[num].rx_buf + pos;
+  iov[0].iov_len = _min(room, RX_BUFFER_SIZE - pos);
+  iov[1].iov_base = com[num].rx_buf;
+  iov[1].iov_len = room - iov[0].iov_len;
+  return iov[1].iov_len ? 2 : 1;
+}
+
+/* This function writes out the bytes collected in the transmit buffer
+ * by put_tx.  It is called when the buffer is over the FIFO threshold,
+ * from serial_update and before the line settings change, so that a
+ * write() moves a FIFO load rather than a single byte.   [num = port]
+ */
+void tx_buffer_flush(int num)
+{
+  ssize_t rtrn;
 
-  /* Update start and end pointers in buffer */
-  com[num].rx_buf_end -= com[num].rx_buf_start;
-  com[num].rx_buf_start = 0;
+  if (!com[num].tx_buf_len)
+    return;
+  rtrn = serial_write(num, (char *)com[num].tx_buf, com[num].tx_buf_len);
+  com[num].tx_writes++;
+  if (rtrn <= 0) {
+    if (rtrn < 0 && errno == EAGAIN)
+      return;				/* Retry on the next flush */
+    s_printf("SER%d: write of %i bytes failed! %s\n", num,
+        com[num].tx_buf_len, rtrn ? strerror(errno) : "");
+    rtrn = com[num].tx_buf_len;		/* Drop them */
+    com[num].tx_cnt -= _min(com[num].tx_cnt, rtrn);
+  } else {
+    com[num].tx_bytes += rtrn;
+  }
+  com[num].tx_buf_len -= rtrn;
+  memmove(com[num].tx_buf, com[num].tx_buf + rtrn, com[num].tx_buf_len);
 }
 
 static void clear_int_cond(int num, u_char val)
@@ -142,6 +185,7 @@ void uart_clear_fifo(int num, int fifo)
     /* Preserve recv data ready bit and error bits, and set THR empty */
     com[num].LSR |= UART_LSR_TEMT | UART_LSR_THRE;
     clear_int_cond(num, TX_INTR);	/* Clear TX int condition */
+    com[num].tx_buf_len = 0;		/* Drop the bytes not yet written */
     tx_buffer_dump(num);		/* Clear transmit buffer */
   }
 }
@@ -179,7 +223,7 @@ static int get_rx(int num)
   }
 
   /* Get byte from internal receive queue */
-  val = com[num].rx_buf[com[num].rx_buf_start++];
+  val = com[num].rx_buf[RX_BUF_IDX(com[num].rx_buf_start++)];
   /* Clear data waiting status and interrupt condition flag */
   clear_int_cond(num, RX_INTR);
   /* and see if more to read */
@@ -270,7 +314,6 @@ get_lsr(int num)
  */
 static void put_tx(int num, char val)
 {
-  int rtrn;
 #if 0
   /* Update the transmit timer */
   com[num].tx_timer += com[num].tx_char_time;
@@ -298,11 +341,7 @@ static void put_tx(int num, char val)
       }
       else { /* FIFO not full */
         /* Put char into recv FIFO */
-        com[num].rx_buf[com[num].rx_buf_end] = val;
-        com[num].rx_buf_end++;
-
-	/* If the buffer touches the top, slide chars to bottom of buffer */
-        if ((com[num].rx_buf_end - 1) >= RX_BUFFER_SIZE) rx_buffer_slide(num);
+        rx_buffer_put(num, &val, 1);
         /* Is it the past the receive FIFO trigger level? */
         if (RX_BUF_BYTES(num) >= com[num].rx_fifo_trigger) {
           com[num].rx_timeout = 0;
@@ -313,8 +352,7 @@ static void put_tx(int num, char val)
       com[num].LSR |= UART_LSR_DR;	/* Flag Data Ready bit */
     }
     else {				/* FIFOs not enabled */
-      com[num].rx_buf[com[num].rx_buf_end] = val;  /* Overwrite old byte */
-      com[num].rx_buf_end++;
+      rx_buffer_put(num, &val, 1);
       if (com[num].LSR & UART_LSR_DR) {		/* Was data waiting? */
         com[num].LSR |= UART_LSR_OE;		/* Indicate overrun error */
         if(s3_printf) s_printf("SER%d: Func put_tx loopback overrun requesting LS_INTR\n",num);
@@ -337,10 +375,13 @@ static void put_tx(int num, char val)
     return;
   }
 
-  rtrn = serial_write(num, &val, 1);
-  if (rtrn != 1) {				/* Did transmit fail? */
-    s_printf("SER%d: write failed! %s\n", num, strerror(errno)); 		/* Set overflow flag */
+  /* Queue the byte, it is written out by tx_buffer_flush */
+  if (com[num].tx_buf_len == TX_BUFFER_SIZE)
+    tx_buffer_flush(num);
+  if (com[num].tx_buf_len == TX_BUFFER_SIZE) {	/* Did transmit fail? */
+    s_printf("SER%d: transmit buffer full, byte dropped\n", num);
   } else {
+    com[num].tx_buf[com[num].tx_buf_len++] = val;
     com[num].LSR &= ~(UART_LSR_THRE | UART_LSR_TEMT);		/* THR full */
     com[num].tx_cnt++;
   }
@@ -410,6 +451,10 @@ put_lcr(int num, int val)
 
   com[num].LCR = val;                  /* Set new LCR value */
 
+  /* the queued bytes go out with the old line settings */
+  if (changed & ~UART_LCR_DLAB)
+    tx_buffer_flush(num);
+
   if (val & UART_LCR_DLAB) {		/* Is Baudrate Divisor Latch set? */
     s_printf("SER%d: LCR = 0x%x, DLAB high.\n", num, val);
   }
@@ -439,6 +484,8 @@ put_mcr(int num, int val)
   int newmsr, delta;
   int changed;
   changed = com[num].MCR ^ val;			/* Bitmask of changed bits */
+  if (changed)
+    tx_buffer_flush(num);		/* Before DTR/RTS or loopback change */
   com[num].MCR = val & UART_MCR_VALID;		/* Set valid bits for MCR */
 
   if (val & UART_MCR_LOOP) {		/* Is Loopback Mode set? */
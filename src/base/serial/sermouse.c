@@ -74,17 +74,12 @@ static int add_buf(com_t *c, const char *buf, int len)
     return 0;
   }
 
-  /* Slide the buffer contents to the bottom */
-  rx_buffer_slide(c->num);
-
-  memcpy(&c->rx_buf[c->rx_buf_end], buf, len);
   if (debug_level('s') >= 9) {
     int i;
     for (i = 0; i < len; i++)
-      s_printf("SER%d: Got mouse data byte: %#x\n", c->num,
-          c->rx_buf[c->rx_buf_end + i]);
+      s_printf("SER%d: Got mouse data byte: %#x\n", c->num, buf[i] & 0xff);
   }
-  c->rx_buf_end += len;
+  rx_buffer_put(c->num, buf, len);
   receive_engine(c->num);
   return len;
 }
@@ -269,12 +264,11 @@ static int serm_rts(com_t *c, int flag)
      */
     c->LSR |= UART_LSR_FE; 		/* Set framing error */
     if(s3_printf) s_printf("SERM: framing error\n");
-    rx_buffer_slide(c->num);
-    if (c->rx_buf_end >= c->rx_fifo_size) {
+    if (RX_BUF_BYTES(c->num) >= c->rx_fifo_size) {
       error("SERM: fifo overflow\n");
       return 0;
     }
-    c->rx_buf[c->rx_buf_end++] = 0;
+    rx_buffer_put(c->num, "", 1);
     serial_int_engine(c->num, LS_INTR);		/* Update interrupt status */
     add_buf(c, id, strlen(id));
   }
@@ -447,14 +447,14 @@ static void drop_iosel(com_t *c)
 /* This function checks for newly received data and fills the UART
  * FIFO (16550 mode) or receive register (16450 mode).
  *
- * Note: The receive buffer is now a sliding buffer instead of
- * a queue.  This has been found to be more efficient here.
+ * Note: The receive buffer is a ring, filled with one readv().
  *
  * [num = port]
  */
 static int tty_uart_fill(com_t *c)
 {
-  int size = 0;
+  struct iovec iov[2];
+  int size = 0, iovcnt;
 
   if (c->fd < 0)
     return 0;
@@ -469,7 +469,6 @@ static int tty_uart_fill(com_t *c)
    * The rx_timer is used to prevent system load caused by empty read()'s
    * It also skip the following code block if the receive buffer
    * contains enough data for a full FIFO (at least 16 bytes).
-   * The receive buffer is a sliding buffer.
    */
   if (RX_BUF_BYTES(c->num) >= RX_BUFFER_SIZE) {
     if(s3_printf) s_printf("SER%d: Too many bytes (%i) in buffer\n", c->num,
@@ -478,15 +477,10 @@ static int tty_uart_fill(com_t *c)
     return 0;
   }
 
-  /* Slide the buffer contents to the bottom */
-  rx_buffer_slide(c->num);
-
-  /* Do a block read of data.
-   * Guaranteed minimum requested read size of (RX_BUFFER_SIZE - 16)!
-   */
-  size = RPT_SYSCALL(read(c->fd,
-                              &c->rx_buf[c->rx_buf_end],
-                              RX_BUFFER_SIZE - c->rx_buf_end));
+  /* Do a block read of data into the free part of the ring */
+  iovcnt = rx_buffer_iov(c->num, iov);
+  size = RPT_SYSCALL(readv(c->fd, iov, iovcnt));
+  c->rx_reads++;
   if (size <= 0) {
     if (c->is_closed)
       return 0;
@@ -507,9 +501,10 @@ static int tty_uart_fill(com_t *c)
     int i;
     for (i = 0; i < size; i++)
       s_printf("SER%d: Got data byte: %#x\n", c->num,
-          c->rx_buf[c->rx_buf_end + i]);
+          c->rx_buf[RX_BUF_IDX(c->rx_buf_end + i)]);
   }
   c->rx_buf_end += size;
+  c->rx_bytes += size;
   return size;
 }
 
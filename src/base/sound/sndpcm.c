@@ -37,7 +37,6 @@
 #include <assert.h>
 #include "emu.h"
 #include "utilities.h"
-#include "ringbuf.h"
 #include "timers.h"
 #include "sound/sound.h"
 
@@ -91,21 +90,64 @@ enum {
     SNDBUF_STATE_STALLED,
 };
 
-struct sample {
-    int format;
-    double tstamp;
-    unsigned char data[2];
+/* Samples are kept as planar S16 in blocks of frames with contiguous
+ * timestamps, so only the first frame of a block carries a tstamp.
+ * A new block is started when the writer skips or changes the rate.
+ * The data lives in slots of BLOCK_FRAMES frames. A new block takes the
+ * rest of the last slot, so a writer with many short runs packs them
+ * together, and only a full slot makes a new one. That way the buffer
+ * is limited by the frames it holds, not by the number of runs: there
+ * are enough slots and block descriptors for SND_BUFFER_SIZE samples
+ * in runs of one frame. In front of every slot there is room for
+ * BLOCK_HIST frames; if a block at the start of a slot continues the
+ * previous one, its last frames are copied there, so the resampler can
+ * look back across the block boundary. */
+#define BLOCK_FRAMES 256
+#define BLOCK_HIST SINC_MAX_TAPS
+
+struct pcm_block {
+    double tstamp;		/* time of the first frame */
+    double stop;		/* time of the frame after the last one */
+    double frame_per;
+    int start;			/* first frame that is not yet removed */
+    int nframes;
+    int size;			/* room for frames, the rest of its slot */
+    int slot;
+    int linked;			/* data[][-BLOCK_HIST..-1] are valid */
+    short *data[SNDBUF_CHANS];
+};
+
+/* Windowed sinc filter, one row of taps per phase. The extra row
+ * lets the coefficients be interpolated between the phases. */
+#define SINC_MAX_TAPS 32
+#define SINC_PHASES 256
+#define SINC_SHIFT 14
+
+struct sinc_table {
+    int taps;
+    double fc;			/* cutoff relative to the stream's nyquist */
+    short *coef;		/* (SINC_PHASES + 1) * taps */
 };
 
 struct stream {
     int channels;
-    struct rng_s buffer;
-    /* buf_cnt is a flat counter, never decrements. We have to use
+    struct pcm_block *blocks;	/* ring of max_blocks */
+    short *blk_data;		/* max_slots slots */
+    int max_blocks;
+    int max_slots;
+    int blk_head;
+    int num_blocks;
+    int slot_head;
+    int num_slots;
+    int slot_fill;		/* frames used in the last slot */
+    int nframes;		/* frames in all blocks */
+    /* buf_cnt counts the removed frames and never decrements. We have to use
      * something really "long" for it, because "int" can overflow in
      * about 6.7 hours of playing stereo sound at rate 44100.
      * Surprisingly @runderwoo have actually hit such overflow when
      * buf_cnt was "int". Lets use "long long". */
     long long buf_cnt;
+    struct sinc_table sinc;
     int state;
     int flags;
     unsigned int stretch:1;
@@ -137,9 +179,8 @@ struct efp_link {
 
 struct pcm_player_wr {
     double time;
-    long long last_cnt[MAX_STREAMS];
-    int last_idx[MAX_STREAMS];
-    double last_tstamp[MAX_STREAMS];
+    /* flat index of the first frame not yet consumed, see buf_cnt */
+    long long last_pos[MAX_STREAMS];
     struct efp_link efpl[MAX_EFP_LINKS];
     int num_efp_links;
 };
@@ -271,10 +312,25 @@ int pcm_init(void)
     return 1;
 }
 
+static struct pcm_block *strm_block(struct stream *s, int n)
+{
+    return &s->blocks[(s->blk_head + n) % s->max_blocks];
+}
+
+static double frame_tstamp(const struct pcm_block *b, int i)
+{
+    return b->tstamp + i * b->frame_per;
+}
+
 static void pcm_clear_stream(int strm_idx)
 {
-    pcm.stream[strm_idx].buf_cnt += rng_count(&pcm.stream[strm_idx].buffer);
-    rng_clear(&pcm.stream[strm_idx].buffer);
+    struct stream *s = &pcm.stream[strm_idx];
+    s->buf_cnt += s->nframes;
+    s->nframes = 0;
+    s->num_blocks = 0;
+    s->blk_head = 0;
+    s->num_slots = 0;
+    s->slot_head = 0;
 }
 
 static void pcm_reset_stream(int strm_idx)
@@ -289,17 +345,26 @@ static void pcm_reset_stream(int strm_idx)
 
 int pcm_allocate_stream(int channels, const char *name, void *vol_arg)
 {
-    int index;
+    int index, max_frames;
     if (pcm.num_streams >= MAX_STREAMS) {
 	error("PCM: stream pool exhausted, max=%i\n", MAX_STREAMS);
 	abort();
 	return -1;
     }
     index = pcm.num_streams;
-    rng_init(&pcm.stream[index].buffer, SND_BUFFER_SIZE,
-	     sizeof(struct sample));
-    /* to keep timestamps contiguous, we disable overwrites */
-    rng_allow_ovw(&pcm.stream[index].buffer, 0);
+    assert(channels <= SNDBUF_CHANS);
+    /* every block has a frame, every slot but the first and the last
+     * one is full */
+    max_frames = SND_BUFFER_SIZE / channels;
+    pcm.stream[index].max_blocks = max_frames;
+    pcm.stream[index].max_slots = max_frames / BLOCK_FRAMES + 2;
+    pcm.stream[index].blocks = malloc(max_frames * sizeof(struct pcm_block));
+    pcm.stream[index].blk_data = malloc(pcm.stream[index].max_slots *
+	    channels * (BLOCK_HIST + BLOCK_FRAMES) * sizeof(short));
+    assert(pcm.stream[index].blocks && pcm.stream[index].blk_data);
+    memset(&pcm.stream[index].sinc, 0, sizeof(struct sinc_table));
+    pcm.stream[index].num_blocks = 0;
+    pcm.stream[index].nframes = 0;
     pcm.stream[index].channels = channels;
     pcm.stream[index].name = name;
     pcm.stream[index].buf_cnt = 0;
@@ -463,14 +528,6 @@ int pcm_frag_size(double period, struct player_params *params)
     return nsamps * pcm_format_size(params->format);
 }
 
-static int peek_last_sample(int strm_idx, struct sample *samp)
-{
-    int idx = rng_count(&pcm.stream[strm_idx].buffer);
-    if (!idx)
-	return 0;
-    return rng_peek(&pcm.stream[strm_idx].buffer, idx - 1, samp);
-}
-
 void pcm_prepare_stream(int strm_idx)
 {
     long long now = GETusTIME(0);
@@ -630,8 +687,7 @@ static void pcm_handle_get(int strm_idx, double time)
     case SNDBUF_STATE_PLAYING:
 	if (pcm.stream[strm_idx].flags & PCM_FLAG_RAW)
 	    handle_raw_adj(strm_idx, fillup, stop_time);
-	if (rng_count(&pcm.stream[strm_idx].buffer) <
-	    pcm.stream[strm_idx].channels * 2 && fillup == 0) {
+	if (pcm.stream[strm_idx].nframes < 2 && fillup == 0) {
 	    pcm_printf("PCM: ERROR: buffer on stream %i exhausted (%s)\n",
 		      strm_idx, pcm.stream[strm_idx].name);
 	    /* ditch the last sample here, if it is the only remaining */
@@ -648,13 +704,12 @@ static void pcm_handle_get(int strm_idx, double time)
 		fillup < WR_BUFFER_LW) {
 	    pcm_printf("PCM: buffer fillup %f is too low, %s %i %f\n",
 		    fillup, pcm.stream[strm_idx].name,
-		    rng_count(&pcm.stream[strm_idx].buffer), stop_time);
+		    pcm.stream[strm_idx].nframes, stop_time);
 	}
 	break;
 
     case SNDBUF_STATE_FLUSHING:
-	if (rng_count(&pcm.stream[strm_idx].buffer) <
-		pcm.stream[strm_idx].channels * 2 && fillup == 0) {
+	if (pcm.stream[strm_idx].nframes < 2 && fillup == 0) {
 	    pcm_reset_stream(strm_idx);
 	    pcm_printf("PCM: stream %s stopped\n", pcm.stream[strm_idx].name);
 	} else if (fillup == 0 && !pcm.stream[strm_idx].stretch) {
@@ -818,12 +873,64 @@ static double pcm_calc_tstamp(int strm_idx)
     return tstamp;
 }
 
+/* append a frame, returns 0 if the buffer is full */
+static int strm_put_frame(struct stream *s, double tstamp, double frame_per,
+	sndbuf_t frame[SNDBUF_CHANS], int nchans, int format)
+{
+    struct pcm_block *b = NULL, *pb = NULL;
+    int j;
+
+    if (s->nframes >= SND_BUFFER_SIZE / s->channels)
+	return 0;
+    if (s->num_blocks) {
+	b = pb = strm_block(s, s->num_blocks - 1);
+	if (b->nframes == b->size || b->frame_per != frame_per ||
+		b->stop != tstamp)
+	    b = NULL;
+    }
+    if (!b) {
+	assert(s->num_blocks < s->max_blocks);
+	if (!s->num_slots || s->slot_fill == BLOCK_FRAMES) {
+	    assert(s->num_slots < s->max_slots);
+	    s->num_slots++;
+	    s->slot_fill = 0;
+	}
+	b = strm_block(s, s->num_blocks++);
+	b->tstamp = b->stop = tstamp;
+	b->frame_per = frame_per;
+	b->start = b->nframes = 0;
+	b->slot = (s->slot_head + s->num_slots - 1) % s->max_slots;
+	b->size = BLOCK_FRAMES - s->slot_fill;
+	for (j = 0; j < s->channels; j++)
+	    b->data[j] = s->blk_data + (b->slot * s->channels + j) *
+		    (BLOCK_HIST + BLOCK_FRAMES) + BLOCK_HIST + s->slot_fill;
+	/* only a block that fills its slot is continued, so the new one
+	 * is at the start of a slot */
+	b->linked = pb && pb->nframes == pb->size &&
+		pb->nframes >= BLOCK_HIST &&
+		pb->frame_per == frame_per && pb->stop == tstamp;
+	if (b->linked) {
+	    for (j = 0; j < s->channels; j++)
+		memcpy(b->data[j] - BLOCK_HIST,
+			pb->data[j] + pb->nframes - BLOCK_HIST,
+			BLOCK_HIST * sizeof(short));
+	}
+    }
+    for (j = 0; j < s->channels; j++)
+	b->data[j][b->nframes] = sample_to_S16(&frame[j % nchans], format);
+    b->nframes++;
+    b->stop += frame_per;
+    s->nframes++;
+    s->slot_fill++;
+    return 1;
+}
+
+
 void pcm_write_interleaved(sndbuf_t ptr[][SNDBUF_CHANS], int frames,
 	int rate, int format, int nchans, int strm_idx)
 {
-    int i, j;
-    struct sample samp;
-    double frame_per;
+    int i;
+    double tstamp, frame_per;
     struct stream *strm;
 
     strm = &pcm.stream[strm_idx];
@@ -831,37 +938,30 @@ void pcm_write_interleaved(sndbuf_t ptr[][SNDBUF_CHANS], int frames,
     if (strm->flags & PCM_FLAG_RAW)
 	rate /= strm->raw_speed_adj;
 
-    samp.format = format;
-    samp.tstamp = 0;
     frame_per = pcm_frame_period_us(rate);
     pthread_mutex_lock(&pcm.strm_mtx);
     for (i = 0; i < frames; i++) {
-	int l;
-	struct sample s2;
 retry:
-	samp.tstamp = pcm_calc_tstamp(strm_idx);
-	l = peek_last_sample(strm_idx, &s2);
-	assert(!(l && samp.tstamp < s2.tstamp));
-	for (j = 0; j < strm->channels; j++) {
-	    int ch = j % nchans;
-	    memcpy(samp.data, &ptr[i][ch], pcm_format_size(format));
-	    l = rng_put(&strm->buffer, &samp);
-	    if (!l) {
-		if (!(strm->flags & PCM_FLAG_RAW)) {
-		    error("Sound buffer %i overflowed (%s)\n", strm_idx,
-			    strm->name);
-		    pcm_reset_stream(strm_idx);
-		    goto retry;
-		} else {
-		    pcm_printf("Sound buffer %i overflowed (%s)\n", strm_idx,
-			    strm->name);
-		    strm->adj_time_delay = 0;
-		    goto cont;
-		}
+	tstamp = pcm_calc_tstamp(strm_idx);
+	if (strm->num_blocks) {
+	    struct pcm_block *b = strm_block(strm, strm->num_blocks - 1);
+	    assert(tstamp >= frame_tstamp(b, b->nframes - 1));
+	}
+	if (!strm_put_frame(strm, tstamp, frame_per, ptr[i], nchans, format)) {
+	    if (!(strm->flags & PCM_FLAG_RAW)) {
+		error("Sound buffer %i overflowed (%s)\n", strm_idx,
+			strm->name);
+		pcm_reset_stream(strm_idx);
+		goto retry;
+	    } else {
+		pcm_printf("Sound buffer %i overflowed (%s)\n", strm_idx,
+			strm->name);
+		strm->adj_time_delay = 0;
+		goto cont;
 	    }
 	}
-	pcm_handle_write(strm_idx, samp.tstamp);
-	strm->stop_time = samp.tstamp + frame_per;
+	pcm_handle_write(strm_idx, tstamp);
+	strm->stop_time = tstamp + frame_per;
     }
 
 cont:
@@ -875,147 +975,397 @@ cont:
     pthread_mutex_unlock(&pcm.strm_mtx);
 }
 
+static void strm_remove_frames(struct stream *s, int cnt)
+{
+    struct pcm_block *b = strm_block(s, 0);
+    b->start += cnt;
+    s->nframes -= cnt;
+    s->buf_cnt += cnt;
+    if (b->start == b->nframes) {
+	s->blk_head = (s->blk_head + 1) % s->max_blocks;
+	s->num_blocks--;
+	/* blocks follow each other in the slots */
+	if (!s->num_blocks) {
+	    s->num_slots = 0;
+	    s->slot_head = 0;
+	} else if (strm_block(s, 0)->slot != b->slot) {
+	    s->slot_head = (s->slot_head + 1) % s->max_slots;
+	    s->num_slots--;
+	}
+    }
+}
+
 static void pcm_remove_samples(double time)
 {
-    #define GUARD_SAMPS 1
-    int i;
-    struct sample s;
+    int i, n;
+    struct stream *s;
+    struct pcm_block *b;
     for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	s = &pcm.stream[i];
+	if (s->state == SNDBUF_STATE_INACTIVE)
 	    continue;
-	while (rng_count(&pcm.stream[i].buffer) >= pcm.stream[i].channels *
-		(GUARD_SAMPS + 1)) {
-	    /* we leave GUARD_SAMPS samples below the timestamp untouched */
-	    rng_peek(&pcm.stream[i].buffer, pcm.stream[i].channels *
-		    GUARD_SAMPS, &s);
-	    if (s.tstamp > time)
+	/* we leave the last frame below the timestamp untouched */
+	while (s->num_blocks) {
+	    b = strm_block(s, 0);
+	    n = b->start;
+	    if (time > b->tstamp)
+		n = _max(n, (int)_min((time - b->tstamp) / b->frame_per,
+			b->nframes - 1.0));
+	    while (n > b->start && frame_tstamp(b, n) > time)
+		n--;
+	    while (n + 1 < b->nframes && frame_tstamp(b, n + 1) <= time)
+		n++;
+	    if (n > b->start)
+		strm_remove_frames(s, n - b->start);
+	    /* the last frame of a block goes if the next one is due */
+	    if (n < b->nframes - 1 || s->num_blocks == 1 ||
+		    strm_block(s, 1)->tstamp > time)
 		break;
-	    pcm.stream[i].buf_cnt += pcm.stream[i].channels;
-	    rng_remove(&pcm.stream[i].buffer, pcm.stream[i].channels, NULL);
+	    strm_remove_frames(s, 1);
 	}
     }
 }
 
-static sndbuf_t pcm_interpolate(struct sample s1, struct sample s2,
-		double time)
+/* output frames are mixed in chunks of that many */
+#define MIX_CHUNK 256
+
+/* read position of a player in a stream */
+struct rd_cursor {
+    int blk;		/* block of the next frame, num_blocks if none */
+    int idx;		/* next frame, the first one past the output time */
+    int have_prev;
+};
+
+static void cursor_init(struct stream *s, long long pos, struct rd_cursor *c)
 {
-    sndbuf_t v1 = sample_to_S16(s1.data, s1.format);
-    sndbuf_t v2 = sample_to_S16(s2.data, s2.format);
-    if (s2.tstamp <= s1.tstamp)
-	return v1;
-    /* simple linear interpolation for now */
-    return (v1 + (time - s1.tstamp) * (v2 - v1) / (s2.tstamp - s1.tstamp));
+    int rel = pos > s->buf_cnt ? pos - s->buf_cnt : 0;
+    struct pcm_block *b;
+
+    assert(rel <= s->nframes);
+    c->have_prev = rel > 0;
+    c->idx = 0;
+    for (c->blk = 0; c->blk < s->num_blocks; c->blk++) {
+	b = strm_block(s, c->blk);
+	if (rel < b->nframes - b->start) {
+	    c->idx = b->start + rel;
+	    break;
+	}
+	rel -= b->nframes - b->start;
+    }
 }
 
-static void pcm_get_samples(double time,
-		sndbuf_t samp[MAX_STREAMS][SNDBUF_CHANS], int *idxs,
-		int out_channels, int id)
+static long long cursor_pos(struct stream *s, const struct rd_cursor *c)
 {
-    int i, j;
-    int started;
-    int have_prev;
-    struct sample s[SNDBUF_CHANS], prev_s[SNDBUF_CHANS];
+    long long pos = s->buf_cnt;
+    struct pcm_block *b;
+    int i;
 
-    for (i = 0; i < pcm.num_streams; i++) {
-	for (j = 0; j < SNDBUF_CHANS; j++)
-	    samp[i][j] = 0;
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE ||
-		!pcm.is_connected(id, pcm.stream[i].vol_arg))
-	    continue;
+    for (i = 0; i < c->blk; i++) {
+	b = strm_block(s, i);
+	pos += b->nframes - b->start;
+    }
+    if (c->blk < s->num_blocks)
+	pos += c->idx - strm_block(s, c->blk)->start;
+    return pos;
+}
+
+/* linear interpolation of n points, starting at d[pos] with the step */
+static void interp_run(float *out, const short *d, double pos, double step,
+	int n)
+{
+    int i, k;
+    double p;
+
+    for (k = 0; k < n; k++) {
+	p = pos + k * step;
+	i = p;
+	out[k] = d[i] + (float)(p - i) * (d[i + 1] - d[i]);
+    }
+}
 
-	have_prev = 0;
-	started = 0;
-	if (idxs[i] >= pcm.stream[i].channels) {
-	    idxs[i] -= pcm.stream[i].channels;
-	    have_prev = 1;
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for (k = 1; k < 100 && term > sum * 1e-12; k++) {
+	term *= (x / (2 * k)) * (x / (2 * k));
+	sum += term;
+    }
+    return sum;
+}
+
+/*
+ * Kaiser windowed sinc with the given cutoff (1 is the nyquist of the
+ * stream). Row p holds the taps for an output point p/SINC_PHASES
+ * after frame i, tap k applies to frame i - taps/2 + 1 + k.
+ * Every row is normalized to the unity gain.
+ */
+static void sinc_build(struct sinc_table *st, int taps, double beta,
+	double fc)
+{
+    int p, k, half = taps / 2;
+    double h[SINC_MAX_TAPS], x, w, sum;
+
+    st->coef = realloc(st->coef, (SINC_PHASES + 1) * taps * sizeof(short));
+    assert(st->coef);
+    st->taps = taps;
+    st->fc = fc;
+    for (p = 0; p <= SINC_PHASES; p++) {
+	sum = 0;
+	for (k = 0; k < taps; k++) {
+	    x = k - (half - 1) - (double)p / SINC_PHASES;
+	    w = _min(fabs(x) / half, 1.0);
+	    h[k] = bessel_i0(beta * sqrt(1 - w * w)) / bessel_i0(beta);
+	    if (x != 0)
+		h[k] *= sin(M_PI * fc * x) / (M_PI * fc * x);
+	    sum += h[k];
 	}
-	while (rng_count(&pcm.stream[i].buffer) - idxs[i] >=
-	       pcm.stream[i].channels) {
-	    for (j = 0; j < pcm.stream[i].channels; j++)
-		rng_peek(&pcm.stream[i].buffer, idxs[i] + j, &s[j]);
-	    if (out_channels == 2 && pcm.stream[i].channels == 1)
-		s[1] = s[0];
-	    if (s[0].tstamp > time) {
-		if (!started) {
-		    /* assert on idxs in sync with time */
-		    assert(!have_prev);
-		    break;
-		}
-		for (j = 0; j < out_channels; j++)
-		    samp[i][j] = pcm_interpolate(prev_s[j], s[j], time);
-		break;
-	    }
-	    memcpy(prev_s, s, sizeof(struct sample) * out_channels);
-	    idxs[i] += pcm.stream[i].channels;
-	    started = 1;
+	for (k = 0; k < taps; k++)
+	    st->coef[p * taps + k] = lrint(h[k] / sum * (1 << SINC_SHIFT));
+    }
+}
+
+/* $_pcm_resample: linear, low, medium, high */
+static const struct {
+    int taps;
+    double beta;
+    double rolloff;
+} sinc_quality[] = {
+    { 0 },
+    { 8, 5.0, 0.85 },
+    { 16, 7.0, 0.90 },
+    { 32, 9.0, 0.95 },
+};
+
+/* get the filter for the step, NULL means linear interpolation */
+static const struct sinc_table *sinc_get(struct stream *s, double step)
+{
+    int q = config.pcm_resample;
+    double fc;
+
+    if (q <= 0 || q >= ARRAY_SIZE(sinc_quality))
+	return NULL;
+    /* when downsampling the cutoff goes down to the output's nyquist */
+    fc = sinc_quality[q].rolloff * (step > 1 ? 1 / step : 1);
+    /* the rate of raw streams wobbles a bit, don't rebuild for that */
+    if (s->sinc.taps != sinc_quality[q].taps ||
+	    fabs(fc - s->sinc.fc) > s->sinc.fc * 0.01)
+	sinc_build(&s->sinc, sinc_quality[q].taps, sinc_quality[q].beta, fc);
+    return &s->sinc;
+}
+
+/* taps is a constant in the callers, so the dot products get vectorized */
+static inline __attribute__((always_inline)) void sinc_run_n(float *out,
+	const short *d, double pos, double step, int n, const short *coef,
+	const int taps)
+{
+    int i, j, k, q, s0, s1;
+    double p, ph;
+    const short *x, *h0, *h1;
+
+    for (k = 0; k < n; k++) {
+	p = pos + k * step;
+	i = p;
+	ph = (p - i) * SINC_PHASES;
+	q = ph;
+	x = d + i - taps / 2 + 1;
+	h0 = coef + q * taps;
+	h1 = h0 + taps;
+	s0 = s1 = 0;
+	for (j = 0; j < taps; j++) {
+	    s0 += x[j] * h0[j];
+	    s1 += x[j] * h1[j];
 	}
+	out[k] = (s0 + (float)(ph - q) * (s1 - s0)) *
+		(1.0f / (1 << SINC_SHIFT));
     }
 }
 
-static void pcm_mix_samples(sndbuf_t in[][SNDBUF_CHANS],
-	sndbuf_t out[SNDBUF_CHANS], int channels, int format,
-	double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
+/* same as interp_run(), but d[pos - taps/2 + 1 .. pos + taps/2] are used */
+static void sinc_run(float *out, const short *d, double pos, double step,
+	int n, const struct sinc_table *st)
 {
-    int i, j, k;
-    int value[SNDBUF_CHANS] = { 0 };
+    switch (st->taps) {
+    case 8:
+	sinc_run_n(out, d, pos, step, n, st->coef, 8);
+	break;
+    case 16:
+	sinc_run_n(out, d, pos, step, n, st->coef, 16);
+	break;
+    case 32:
+	sinc_run_n(out, d, pos, step, n, st->coef, 32);
+	break;
+    }
+}
 
-    for (j = 0; j < SNDBUF_CHANS; j++) {
-	for (i = 0; i < pcm.num_streams; i++) {
-	    if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+/*
+ * Interpolate a run of output frames from the frames of one block.
+ * Returns the number of output frames, 0 if the first one needs
+ * frames outside of the block.
+ */
+static int pcm_block_run(struct stream *s, struct pcm_block *b, int sinc,
+	double t, double out_per, int cnt, int out_channels,
+	float *in[SNDBUF_CHANS], double *last)
+{
+    double pos = (t - b->tstamp) / b->frame_per;
+    double step = out_per / b->frame_per;
+    const struct sinc_table *st = sinc ? sinc_get(s, step) : NULL;
+    int lo = b->linked ? -BLOCK_HIST : 0;
+    int left = st ? st->taps / 2 - 1 : 0, right = st ? st->taps / 2 : 1;
+    int i = floor(pos), j, m, src;
+
+    if (i - left < lo || i + right >= b->nframes)
+	return 0;
+    /* floor(pos + k * step) + right < nframes */
+    m = ceil((b->nframes - right - pos) / step);
+    m = _max(_min(m, cnt), 1);
+    while (m > 1 && (int)(pos + (m - 1) * step) + right >= b->nframes)
+	m--;
+    for (j = 0; j < out_channels; j++) {
+	src = s->channels == 1 ? 0 : j;
+	/* the kernels truncate, so keep their positions positive */
+	if (st)
+	    sinc_run(in[j], b->data[src] + lo, pos - lo, step, m, st);
+	else
+	    interp_run(in[j], b->data[src] + lo, pos - lo, step, m);
+    }
+    *last = pos + (m - 1) * step;
+    return m;
+}
+
+/*
+ * Resample cnt output frames of the stream, starting at time t0.
+ * Output frames with no stream frame on both sides are silent.
+ * Where all the frames needed are in one block, whole runs of output
+ * frames are filtered at once, with the sinc filter if it is enabled.
+ * Elsewhere the output is interpolated linearly.
+ */
+static void pcm_resample_stream(struct stream *s, struct rd_cursor *c,
+	double t0, double out_per, int cnt, int out_channels,
+	float in[SNDBUF_CHANS][MIX_CHUNK])
+{
+    int n = 0, j, m, src;
+    double t, t1, t2, last;
+    struct pcm_block *b, *pb;
+    int sinc = config.pcm_resample > 0;
+    float *out[SNDBUF_CHANS];
+
+    for (j = out_channels; j < SNDBUF_CHANS; j++)
+	memset(in[j], 0, cnt * sizeof(in[j][0]));
+    while (n < cnt) {
+	t = t0 + n * out_per;
+	/* skip the frames at or before t */
+	while (c->blk < s->num_blocks) {
+	    b = strm_block(s, c->blk);
+	    if (c->idx == b->nframes) {
+		if (++c->blk < s->num_blocks)
+		    c->idx = strm_block(s, c->blk)->start;
 		continue;
-	    for (k = 0; k < SNDBUF_CHANS; k++) {
-		if (volume[i][j][k] == 0)
-		    continue;
-		value[j] += in[i][k] * volume[i][j][k];
 	    }
+	    if (frame_tstamp(b, c->idx) > t)
+		break;
+	    c->idx++;
+	    c->have_prev = 1;
 	}
-    }
-    for (i = channels; i < SNDBUF_CHANS; i++)
-	value[0] += value[i];
-    for (i = 0; i < channels; i++) {
-	S16_to_sample(pcm_samp_cutoff(value[i], PCM_FORMAT_S16_LE),
-		&out[i], format);
+	if (c->blk == s->num_blocks) {
+	    /* buffer exhausted */
+	    for (j = 0; j < out_channels; j++)
+		memset(&in[j][n], 0, (cnt - n) * sizeof(in[j][0]));
+	    break;
+	}
+	b = strm_block(s, c->blk);
+	if (!c->have_prev || (c->idx == b->start && c->blk == 0)) {
+	    for (j = 0; j < out_channels; j++)
+		in[j][n] = 0;
+	    n++;
+	    continue;
+	}
+	if (c->idx > b->start || b->linked) {
+	    for (j = 0; j < out_channels; j++)
+		out[j] = &in[j][n];
+	    m = 0;
+	    if (sinc) {
+		m = pcm_block_run(s, b, 1, t, out_per, cnt - n,
+			out_channels, out, &last);
+		/* the right taps may be in the next block */
+		if (!m && c->blk + 1 < s->num_blocks &&
+			strm_block(s, c->blk + 1)->linked) {
+		    m = pcm_block_run(s, strm_block(s, c->blk + 1), 1, t,
+			    out_per, cnt - n, out_channels, out, &last);
+		    if (m) {
+			n += m;
+			continue;
+		    }
+		}
+	    }
+	    if (!m)
+		m = pcm_block_run(s, b, 0, t, out_per, cnt - n,
+			out_channels, out, &last);
+	    if (m) {
+		n += m;
+		/* the skip loop above fixes up the rounding */
+		c->idx = _max(c->idx, (int)floor(last) + 1);
+		continue;
+	    }
+	}
+	/* the neighbours are in different blocks */
+	if (c->idx > b->start) {
+	    pb = b;
+	    m = c->idx - 1;
+	} else {
+	    pb = strm_block(s, c->blk - 1);
+	    m = pb->nframes - 1;
+	}
+	t1 = frame_tstamp(pb, m);
+	t2 = frame_tstamp(b, c->idx);
+	for (j = 0; j < out_channels; j++) {
+	    float v1, v2;
+	    src = s->channels == 1 ? 0 : j;
+	    v1 = pb->data[src][m];
+	    v2 = b->data[src][c->idx];
+	    in[j][n] = t2 <= t1 ? v1 : v1 + (t - t1) * (v2 - v1) / (t2 - t1);
+	}
+	n++;
     }
 }
 
-static void calc_idxs(struct pcm_player_wr *pl, int idxs[MAX_STREAMS])
+static void pcm_mix_chunk(float acc[SNDBUF_CHANS][MIX_CHUNK],
+	float in[SNDBUF_CHANS][MIX_CHUNK], int cnt,
+	float volume[SNDBUF_CHANS][SNDBUF_CHANS])
 {
-    int i;
-    for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
-	    continue;
-	assert(pcm.stream[i].buf_cnt >= pl->last_cnt[i]);
-	if (pl->last_idx[i] > pcm.stream[i].buf_cnt - pl->last_cnt[i]) {
-	    struct sample s;
-	    idxs[i] = pl->last_idx[i] - (pcm.stream[i].buf_cnt -
-		    pl->last_cnt[i]);
-	    assert(idxs[i] <= rng_count(&pcm.stream[i].buffer));
-	    rng_peek(&pcm.stream[i].buffer, idxs[i] - 1, &s);
-	    assert(pl->last_tstamp[i] == s.tstamp);
-	} else {
-	    idxs[i] = 0;
+    int j, k, n;
+
+    for (j = 0; j < SNDBUF_CHANS; j++) {
+	for (k = 0; k < SNDBUF_CHANS; k++) {
+	    float v = volume[j][k];
+	    if (v == 0)
+		continue;
+	    for (n = 0; n < cnt; n++)
+		acc[j][n] += in[k][n] * v;
 	}
     }
 }
 
-static void save_idxs(struct pcm_player_wr *pl, int idxs[MAX_STREAMS])
+static void pcm_output_chunk(sndbuf_t out[][SNDBUF_CHANS],
+	float acc[SNDBUF_CHANS][MIX_CHUNK], int cnt, int channels, int format)
 {
-    int i;
-    for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
-	    continue;
-	assert(idxs[i] <= rng_count(&pcm.stream[i].buffer));
-	if (idxs[i] > 0) {
-	    struct sample s;
-	    rng_peek(&pcm.stream[i].buffer, idxs[i] - 1, &s);
-	    pl->last_tstamp[i] = s.tstamp;
+    int i, n;
+
+    for (i = channels; i < SNDBUF_CHANS; i++) {
+	for (n = 0; n < cnt; n++)
+	    acc[0][n] += acc[i][n];
+    }
+    for (n = 0; n < cnt; n++) {
+	for (i = 0; i < channels; i++) {
+	    float v = acc[i][n];
+	    v = v < SHRT_MIN ? SHRT_MIN : v > SHRT_MAX ? SHRT_MAX : v;
+	    S16_to_sample(v, &out[n][i], format);
 	}
-	pl->last_cnt[i] = pcm.stream[i].buf_cnt;
-	pl->last_idx[i] = idxs[i];
     }
 }
 
-static void get_volumes(int id, double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
+static void get_volumes(int id, float volume[][SNDBUF_CHANS][SNDBUF_CHANS])
 {
     int i, j, k;
     for (i = 0; i < pcm.num_streams; i++) {
@@ -1031,13 +1381,15 @@ static void get_volumes(int id, double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
 int pcm_data_get_interleaved(sndbuf_t buf[][SNDBUF_CHANS], int nframes,
 			   struct player_params *params)
 {
-    int idxs[MAX_STREAMS], out_idx, handle, i;
+    int out_idx, handle, i, cnt;
     long long now;
     double start_time, stop_time, frame_period, frag_period, time;
-    sndbuf_t samp[MAX_STREAMS][SNDBUF_CHANS];
-    double volume[MAX_STREAMS][SNDBUF_CHANS][SNDBUF_CHANS];
+    float volume[MAX_STREAMS][SNDBUF_CHANS][SNDBUF_CHANS];
+    float in[SNDBUF_CHANS][MIX_CHUNK], acc[SNDBUF_CHANS][MIX_CHUNK];
+    struct rd_cursor cur[MAX_STREAMS];
+    int mix[MAX_STREAMS];
     struct pcm_holder *p;
-
+    struct pcm_player_wr *pl;
     now = GETusTIME(0);
     handle = params->handle;
     p = &pcm.players[handle];
@@ -1082,24 +1434,42 @@ int pcm_data_get_interleaved(sndbuf_t buf[][SNDBUF_CHANS], int nframes,
 	return 0;
     }
     frame_period = pcm_frame_period_us(params->rate);
-    time = start_time;
-    calc_idxs(PL_PRIV(p), idxs);
+    pl = PL_PRIV(p);
     get_volumes(PLAYER(p)->id, volume);
-    for (out_idx = 0; out_idx < nframes; out_idx++) {
-	pcm_get_samples(time, samp, idxs, params->channels, PLAYER(p)->id);
-	pcm_mix_samples(samp, buf[out_idx], params->channels, params->format,
-		volume);
-	time += frame_period;
+    for (i = 0; i < pcm.num_streams; i++) {
+	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	    continue;
+	cursor_init(&pcm.stream[i], pl->last_pos[i], &cur[i]);
+	mix[i] = pcm.is_connected(PLAYER(p)->id, pcm.stream[i].vol_arg);
+    }
+    for (out_idx = 0; out_idx < nframes; out_idx += cnt) {
+	cnt = _min(nframes - out_idx, MIX_CHUNK);
+	time = start_time + out_idx * frame_period;
+	memset(acc, 0, sizeof(acc));
+	for (i = 0; i < pcm.num_streams; i++) {
+	    if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE || !mix[i])
+		continue;
+	    pcm_resample_stream(&pcm.stream[i], &cur[i], time, frame_period,
+		    cnt, params->channels, in);
+	    pcm_mix_chunk(acc, in, cnt, volume[i]);
+	}
+	pcm_output_chunk(&buf[out_idx], acc, cnt, params->channels,
+		params->format);
     }
+    time = start_time + nframes * frame_period;
     if (fabs(time - stop_time) > frame_period)
 	error("PCM: time=%f stop_time=%f p=%f\n",
 		    time, stop_time, frame_period);
-    PL_PRIV(p)->time = stop_time;
-    save_idxs(PL_PRIV(p), idxs);
+    pl->time = stop_time;
+    for (i = 0; i < pcm.num_streams; i++) {
+	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	    continue;
+	pl->last_pos[i] = cursor_pos(&pcm.stream[i], &cur[i]);
+    }
     pthread_mutex_unlock(&pcm.strm_mtx);
 
-    for (i = 0; i < PL_PRIV(p)->num_efp_links; i++) {
-	struct efp_link *l = &PL_PRIV(p)->efpl[i];
+    for (i = 0; i < pl->num_efp_links; i++) {
+	struct efp_link *l = &pl->efpl[i];
 	EFPR(l->efp)->process(l->handle, buf, nframes,
 		params->channels, params->format, params->rate);
     }
@@ -1140,7 +1510,7 @@ static void pcm_advance_time(double time)
 	    continue;
 	if (debug_level('S') >= 9)
 	    pcm_printf("PCM: stream %i fillup2: %i\n", i,
-		 rng_count(&pcm.stream[i].buffer));
+		 pcm.stream[i].nframes);
 	pcm_handle_get(i, time);
     }
 
@@ -1204,8 +1574,7 @@ void pcm_reset_player(int handle)
     struct pcm_holder *p = &pcm.players[handle];
     struct pcm_player_wr *pl = PL_PRIV(p);
     pl->time = now - INIT_BUFFER_DELAY;
-    memset(pl->last_idx, 0, sizeof(pl->last_idx));
-    memset(pl->last_cnt, 0, sizeof(pl->last_cnt));
+    memset(pl->last_pos, 0, sizeof(pl->last_pos));
 }
 
 void pcm_timer(void)
@@ -1242,8 +1611,11 @@ void pcm_done(void)
     pcm_deinit_plugins(pcm.players, pcm.num_players);
     pcm_deinit_plugins(pcm.efps, pcm.num_efps);
 
-    for (i = 0; i < pcm.num_streams; i++)
-	rng_destroy(&pcm.stream[i].buffer);
+    for (i = 0; i < pcm.num_streams; i++) {
+	free(pcm.stream[i].blocks);
+	free(pcm.stream[i].blk_data);
+	free(pcm.stream[i].sinc.coef);
+    }
     pthread_mutex_destroy(&pcm.strm_mtx);
     pthread_mutex_destroy(&pcm.time_mtx);
 
@@ -54,6 +54,7 @@ RemapFuncDesc *remap_gen(void);
 
 RemapFuncDesc *(*remap_list_funcs[])(void) = {
   remap_gen,
+  remap_simd,
 #if 0
 #if defined(__i386__) && !defined(__clang__)
   remap_opt,
@@ -101,6 +101,13 @@ void gamma_correct(RemapObject *, RGBColor *, unsigned *);
 /* remap_pent.c */
 RemapFuncDesc *remap_opt(void);
 
+/* remap.c, the generic functions remap_simd.c falls back to */
+void gen_15to32_1(RemapObject *);
+void gen_16to32_1(RemapObject *);
+
+/* remap_simd.c */
+RemapFuncDesc *remap_simd(void);
+
 #else /* __ASSEMBLER__ */
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 		.macro RO_Struct _str_
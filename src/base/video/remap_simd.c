@@ -0,0 +1,624 @@
+/*
+ * DANG_BEGIN_MODULE
+ *
+ * REMARK
+ * Vectorized versions of the palette based remap functions.
+ *
+ * The generic functions in remap.c look up every destination pixel
+ * on its own, walking the bre_x table again for every line. Here the
+ * source offsets of a line are computed once per call, source lines
+ * that are only repeated by vertical scaling are copied from the
+ * previous destination line, and on CPUs with AVX2 the palette
+ * lookups are done 8 pixels at a time with gathers.
+ * If a line is scaled by an integer factor, every source pixel is
+ * looked up once and replicated with SSE2 shuffles, no gather needed.
+ * The unscaled 15/16 bit to 32 bit remappers shift the color fields
+ * into place 8 pixels at a time with SSE2.
+ *
+ * /REMARK
+ * DANG_END_MODULE
+ */
+
+#include "emu.h"
+#include <string.h>
+#include "vgaemu.h"
+#include "render.h"
+#include "remap_priv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SIMD_KERNELS
+#endif
+
+/*
+ * source offsets of the destination pixels of a line
+ *
+ * The gather kernels read 4 bytes at src + ofs[i], which stays in the
+ * source line if (ofs[i] & mask) <= lim. In mode X the plane is in
+ * bits 16-17 of the offsets, so they are not ascending and every lane
+ * is checked on its own.
+ * If ofs[i] == i / rep for all i, the line is scaled by rep.
+ */
+struct line_ofs {
+  const int *ofs;
+  int mask, lim;
+  int rep;
+};
+
+/*
+ * 15/16 bit BGR --> 32 bit true color: every field is taken from
+ * 'in', cut to 'mask', and moved into place with 'down' and 'up'
+ */
+struct rgb_shift {
+  int in[3], mask[3], down[3], up[3];
+};
+
+typedef void (*line_8to32_t)(unsigned *, const unsigned char *,
+    const struct line_ofs *, int, const unsigned *);
+typedef void (*line_8to16_t)(unsigned short *, const unsigned char *,
+    const struct line_ofs *, int, const unsigned *);
+typedef void (*line_8to32_1_t)(unsigned *, const unsigned char *, int,
+    const unsigned *);
+typedef void (*line_8to32_rep_t)(unsigned *, const unsigned char *, int,
+    int, const unsigned *);
+typedef void (*line_8to16_rep_t)(unsigned short *, const unsigned char *,
+    int, int, const unsigned *);
+typedef void (*line_16to32_t)(unsigned *, const unsigned short *, int,
+    const struct rgb_shift *);
+
+/*
+ * dst[i] = lut[src[ofs[i]]]
+ */
+static void line_8to32_c(unsigned *dst, const unsigned char *src,
+    const struct line_ofs *xo, int n, const unsigned *lut)
+{
+  int i;
+
+  for(i = 0; i < n; i++) dst[i] = lut[src[xo->ofs[i]]];
+}
+
+static void line_8to16_c(unsigned short *dst, const unsigned char *src,
+    const struct line_ofs *xo, int n, const unsigned *lut)
+{
+  int i;
+
+  for(i = 0; i < n; i++) dst[i] = lut[src[xo->ofs[i]]];
+}
+
+static void line_8to32_1_c(unsigned *dst, const unsigned char *src, int n,
+    const unsigned *lut)
+{
+  int i;
+
+  for(i = 0; i < n; i++) dst[i] = lut[src[i]];
+}
+
+/*
+ * n source pixels, each one written rep times
+ */
+static void line_8to32_rep_c(unsigned *dst, const unsigned char *src, int n,
+    int rep, const unsigned *lut)
+{
+  unsigned u;
+  int i, j;
+
+  for(i = 0; i < n; i++) {
+    u = lut[src[i]];
+    for(j = 0; j < rep; j++) *dst++ = u;
+  }
+}
+
+static void line_8to16_rep_c(unsigned short *dst, const unsigned char *src,
+    int n, int rep, const unsigned *lut)
+{
+  unsigned short u;
+  int i, j;
+
+  for(i = 0; i < n; i++) {
+    u = lut[src[i]];
+    for(j = 0; j < rep; j++) *dst++ = u;
+  }
+}
+
+static void line_16to32_c(unsigned *dst, const unsigned short *src, int n,
+    const struct rgb_shift *sh)
+{
+  unsigned u;
+  int i, c;
+
+  for(i = 0; i < n; i++) {
+    for(u = c = 0; c < 3; c++)
+      u |= ((src[i] >> sh->in[c]) & sh->mask[c]) >> sh->down[c] << sh->up[c];
+    dst[i] = u;
+  }
+}
+
+#ifdef HAVE_SIMD_KERNELS
+__attribute__((target("sse2")))
+static void line_8to32_rep_sse2(unsigned *dst, const unsigned char *src,
+    int n, int rep, const unsigned *lut)
+{
+  __m128i v;
+  int i;
+
+  if(rep != 2 && rep != 4) {
+    line_8to32_rep_c(dst, src, n, rep, lut);
+    return;
+  }
+  for(i = 0; i + 4 <= n; i += 4, dst += 4 * rep) {
+    v = _mm_set_epi32(lut[src[i + 3]], lut[src[i + 2]],
+		      lut[src[i + 1]], lut[src[i]]);
+    if(rep == 2) {
+      _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi32(v, v));
+      _mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi32(v, v));
+    }
+    else {
+      _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi32(v, 0x00));
+      _mm_storeu_si128((__m128i *) (dst + 4), _mm_shuffle_epi32(v, 0x55));
+      _mm_storeu_si128((__m128i *) (dst + 8), _mm_shuffle_epi32(v, 0xaa));
+      _mm_storeu_si128((__m128i *) (dst + 12), _mm_shuffle_epi32(v, 0xff));
+    }
+  }
+  line_8to32_rep_c(dst, src + i, n - i, rep, lut);
+}
+
+__attribute__((target("sse2")))
+static void line_8to16_rep_sse2(unsigned short *dst, const unsigned char *src,
+    int n, int rep, const unsigned *lut)
+{
+  __m128i v, lo, hi;
+  int i;
+
+  if(rep != 2 && rep != 4) {
+    line_8to16_rep_c(dst, src, n, rep, lut);
+    return;
+  }
+  for(i = 0; i + 8 <= n; i += 8, dst += 8 * rep) {
+    v = _mm_set_epi16(lut[src[i + 7]], lut[src[i + 6]],
+		      lut[src[i + 5]], lut[src[i + 4]],
+		      lut[src[i + 3]], lut[src[i + 2]],
+		      lut[src[i + 1]], lut[src[i]]);
+    lo = _mm_unpacklo_epi16(v, v);
+    hi = _mm_unpackhi_epi16(v, v);
+    if(rep == 2) {
+      _mm_storeu_si128((__m128i *) dst, lo);
+      _mm_storeu_si128((__m128i *) (dst + 8), hi);
+    }
+    else {
+      _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi32(lo, lo));
+      _mm_storeu_si128((__m128i *) (dst + 8), _mm_unpackhi_epi32(lo, lo));
+      _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpacklo_epi32(hi, hi));
+      _mm_storeu_si128((__m128i *) (dst + 24), _mm_unpackhi_epi32(hi, hi));
+    }
+  }
+  line_8to16_rep_c(dst, src + i, n - i, rep, lut);
+}
+
+__attribute__((target("sse2")))
+static void line_16to32_sse2(unsigned *dst, const unsigned short *src, int n,
+    const struct rgb_shift *sh)
+{
+  const __m128i z = _mm_setzero_si128();
+  __m128i in[3], mask[3], down[3], up[3];
+  __m128i v, lo, hi, r0, r1;
+  int i, c;
+
+  for(c = 0; c < 3; c++) {
+    in[c] = _mm_cvtsi32_si128(sh->in[c]);
+    mask[c] = _mm_set1_epi32(sh->mask[c]);
+    down[c] = _mm_cvtsi32_si128(sh->down[c]);
+    up[c] = _mm_cvtsi32_si128(sh->up[c]);
+  }
+  for(i = 0; i + 8 <= n; i += 8) {
+    v = _mm_loadu_si128((const __m128i *) (src + i));
+    lo = _mm_unpacklo_epi16(v, z);
+    hi = _mm_unpackhi_epi16(v, z);
+    r0 = r1 = z;
+    for(c = 0; c < 3; c++) {
+      v = _mm_and_si128(_mm_srl_epi32(lo, in[c]), mask[c]);
+      r0 = _mm_or_si128(r0, _mm_sll_epi32(_mm_srl_epi32(v, down[c]), up[c]));
+      v = _mm_and_si128(_mm_srl_epi32(hi, in[c]), mask[c]);
+      r1 = _mm_or_si128(r1, _mm_sll_epi32(_mm_srl_epi32(v, down[c]), up[c]));
+    }
+    _mm_storeu_si128((__m128i *) (dst + i), r0);
+    _mm_storeu_si128((__m128i *) (dst + i + 4), r1);
+  }
+  line_16to32_c(dst + i, src + i, n - i, sh);
+}
+
+__attribute__((target("avx2")))
+static void line_8to32_avx2(unsigned *dst, const unsigned char *src,
+    const struct line_ofs *xo, int n, const unsigned *lut)
+{
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m256i mask = _mm256_set1_epi32(xo->mask);
+  const __m256i lim = _mm256_set1_epi32(xo->lim);
+  const int *xofs = xo->ofs;
+  __m256i v;
+  int i, j;
+
+  for(i = 0; i + 8 <= n; i += 8) {
+    v = _mm256_loadu_si256((const __m256i *) (xofs + i));
+    if(_mm256_movemask_epi8(_mm256_cmpgt_epi32(_mm256_and_si256(v, mask),
+					       lim))) {
+      for(j = i; j < i + 8; j++) dst[j] = lut[src[xofs[j]]];
+      continue;
+    }
+    v = _mm256_i32gather_epi32((const int *) src, v, 1);
+    v = _mm256_and_si256(v, ff);
+    v = _mm256_i32gather_epi32((const int *) lut, v, 4);
+    _mm256_storeu_si256((__m256i *) (dst + i), v);
+  }
+  for(; i < n; i++) dst[i] = lut[src[xofs[i]]];
+}
+
+__attribute__((target("avx2")))
+static void line_8to16_avx2(unsigned short *dst, const unsigned char *src,
+    const struct line_ofs *xo, int n, const unsigned *lut)
+{
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m256i ffff = _mm256_set1_epi32(0xffff);
+  const __m256i mask = _mm256_set1_epi32(xo->mask);
+  const __m256i lim = _mm256_set1_epi32(xo->lim);
+  const int *xofs = xo->ofs;
+  __m256i v;
+  int i, j;
+
+  for(i = 0; i + 8 <= n; i += 8) {
+    v = _mm256_loadu_si256((const __m256i *) (xofs + i));
+    if(_mm256_movemask_epi8(_mm256_cmpgt_epi32(_mm256_and_si256(v, mask),
+					       lim))) {
+      for(j = i; j < i + 8; j++) dst[j] = lut[src[xofs[j]]];
+      continue;
+    }
+    v = _mm256_i32gather_epi32((const int *) src, v, 1);
+    v = _mm256_and_si256(v, ff);
+    v = _mm256_i32gather_epi32((const int *) lut, v, 4);
+    /* the lut has the pixel in both halves, keep the low one so that
+     * the pack does not saturate */
+    v = _mm256_and_si256(v, ffff);
+    v = _mm256_packus_epi32(v, v);
+    v = _mm256_permute4x64_epi64(v, 0x08);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm256_castsi256_si128(v));
+  }
+  for(; i < n; i++) dst[i] = lut[src[xofs[i]]];
+}
+
+__attribute__((target("avx2")))
+static void line_8to32_1_avx2(unsigned *dst, const unsigned char *src, int n,
+    const unsigned *lut)
+{
+  __m256i v;
+  int i;
+
+  for(i = 0; i + 8 <= n; i += 8) {
+    v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)));
+    v = _mm256_i32gather_epi32((const int *) lut, v, 4);
+    _mm256_storeu_si256((__m256i *) (dst + i), v);
+  }
+  for(; i < n; i++) dst[i] = lut[src[i]];
+}
+#endif
+
+static line_8to32_t line_8to32 = line_8to32_c;
+static line_8to16_t line_8to16 = line_8to16_c;
+static line_8to32_1_t line_8to32_1 = line_8to32_1_c;
+static line_8to32_rep_t line_8to32_rep = line_8to32_rep_c;
+static line_8to16_rep_t line_8to16_rep = line_8to16_rep_c;
+static line_16to32_t line_16to32 = line_16to32_c;
+
+/*
+ * source offsets of the destination pixels of a line;
+ * src_len is the length of a source line (of a plane in mode X)
+ */
+static void line_offsets(RemapObject *ro, struct line_ofs *xo, int *xofs,
+    int src_len)
+{
+  int d_x, s_x, k;
+  int *bre_x = ro->bre_x;
+
+  for(s_x = d_x = 0; d_x < ro->dst_width; d_x++) {
+    xofs[d_x] = s_x;
+    s_x += *(bre_x++);
+  }
+
+  xo->ofs = xofs;
+  xo->mask = ro->src_mode == MODE_VGA_X ? 0xffff : -1;
+  xo->lim = src_len - 4;
+  xo->rep = 0;
+  if(ro->src_width && ro->dst_width % ro->src_width == 0) {
+    k = ro->dst_width / ro->src_width;
+    for(d_x = 0; d_x < ro->dst_width && xofs[d_x] == d_x / k; d_x++);
+    if(d_x == ro->dst_width) xo->rep = k;
+  }
+}
+
+static void remap_8to32_line(unsigned *dst, const unsigned char *src,
+    const struct line_ofs *xo, int n, const unsigned *lut)
+{
+  if(xo->rep == 1)
+    line_8to32_1(dst, src, n, lut);
+  else if(xo->rep)
+    line_8to32_rep(dst, src, n / xo->rep, xo->rep, lut);
+  else
+    line_8to32(dst, src, xo, n, lut);
+}
+
+/*
+ * 8 bit pseudo color --> 32 bit true color
+ * supports arbitrary scaling
+ */
+static void simd_8to32_all(RemapObject *ro)
+{
+  int d_x_len = ro->dst_width;
+  int d_y;
+  int d_scan_len = ro->dst_scan_len >> 2;
+  int *bre_y = ro->bre_y;
+  int xofs[d_x_len];
+  struct line_ofs xo;
+
+  const unsigned char *src, *src0, *src_last;
+  unsigned *dst;
+
+  src0 = ro->src_image + ro->src_start;
+  dst = (unsigned *) (ro->dst_image + ro->dst_start + ro->dst_offset);
+  src_last = NULL;
+  line_offsets(ro, &xo, xofs, ro->src_mode == MODE_VGA_X ?
+	       ro->src_width >> 2 : ro->src_width);
+
+  for(d_y = ro->dst_y0; d_y < ro->dst_y1; dst += d_scan_len) {
+    src = src0 + bre_y[d_y++];
+    if(src == src_last)
+      memcpy(dst, dst - d_scan_len, d_x_len * sizeof(*dst));
+    else
+      remap_8to32_line(dst, src, &xo, d_x_len, ro->true_color_lut);
+    src_last = src;
+  }
+}
+
+/*
+ * 8 bit pseudo color --> 32 bit true color
+ */
+static void simd_8to32_1(RemapObject *ro)
+{
+  int j, l;
+  const unsigned char *src;
+  unsigned *dst;
+
+  src = ro->src_image + ro->src_start + ro->src_offset;
+  dst = (unsigned *) (ro->dst_image + ro->dst_start + ro->dst_offset);
+  l = (ro->src_x1 - ro->src_x0);
+
+  for(j = ro->src_y0; j < ro->src_y1; j++) {
+    line_8to32_1(dst, src, l, ro->true_color_lut);
+    dst += ro->dst_scan_len >> 2;
+    src += ro->src_scan_len;
+  }
+}
+
+/*
+ * 8 bit pseudo color --> 15/16 bit true color
+ * supports arbitrary scaling
+ */
+static void simd_8to16_all(RemapObject *ro)
+{
+  int d_x_len = ro->dst_width;
+  int d_y;
+  int d_scan_len = ro->dst_scan_len >> 1;
+  int *bre_y = ro->bre_y;
+  int xofs[d_x_len];
+  struct line_ofs xo;
+
+  const unsigned char *src, *src0, *src_last;
+  unsigned short *dst;
+
+  src0 = ro->src_image + ro->src_start;
+  dst = (unsigned short *) (ro->dst_image + ro->dst_start + ro->dst_offset);
+  src_last = NULL;
+  line_offsets(ro, &xo, xofs, ro->src_mode == MODE_VGA_X ?
+	       ro->src_width >> 2 : ro->src_width);
+
+  for(d_y = ro->dst_y0; d_y < ro->dst_y1; dst += d_scan_len) {
+    src = src0 + bre_y[d_y++];
+    if(src == src_last)
+      memcpy(dst, dst - d_scan_len, d_x_len * sizeof(*dst));
+    else if(xo.rep > 1)
+      line_8to16_rep(dst, src, d_x_len / xo.rep, xo.rep, ro->true_color_lut);
+    else
+      line_8to16(dst, src, &xo, d_x_len, ro->true_color_lut);
+    src_last = src;
+  }
+}
+
+/*
+ * 4 bit pseudo color --> 32 bit true color
+ * supports arbitrary scaling
+ */
+static void simd_4to32_all(RemapObject *ro)
+{
+  int d_x_len = ro->dst_width;
+  int s_x_len, s_x, d_x, d_y;
+  int d_scan_len = ro->dst_scan_len >> 2;
+  int *bre_y = ro->bre_y;
+  int xofs[d_x_len];
+  struct line_ofs xo;
+
+  unsigned *dst1, *lut;
+  const unsigned char *src, *src0, *src_last;
+  unsigned char *src1;
+  unsigned *dst;
+
+  src0 = ro->src_image + ro->src_start;
+  dst = (unsigned *) (ro->dst_image + ro->dst_start + ro->dst_offset);
+  s_x_len = ro->src_width >> 3;
+  src1 = ro->src_tmp_line;
+  dst1 = (unsigned *) src1;
+  lut = ro->bit_lut;
+  src_last = NULL;
+  line_offsets(ro, &xo, xofs, s_x_len << 3);
+
+  for(d_y = ro->dst_y0; d_y < ro->dst_y1; dst += d_scan_len) {
+    src = src0 + bre_y[d_y++];
+    if(src == src_last) {
+      memcpy(dst, dst - d_scan_len, d_x_len * sizeof(*dst));
+      continue;
+    }
+    src_last = src;
+    for(s_x = d_x = 0; s_x < s_x_len; s_x++, d_x += 2) {
+      dst1[d_x    ]  = lut[2 * src[s_x          ]            ] |
+                       lut[2 * src[s_x + 0x10000]     + 0x200] |
+                       lut[2 * src[s_x + 0x20000]     + 0x400] |
+                       lut[2 * src[s_x + 0x30000]     + 0x600];
+      dst1[d_x + 1]  = lut[2 * src[s_x          ] + 1        ] |
+                       lut[2 * src[s_x + 0x10000] + 1 + 0x200] |
+                       lut[2 * src[s_x + 0x20000] + 1 + 0x400] |
+                       lut[2 * src[s_x + 0x30000] + 1 + 0x600];
+    }
+    remap_8to32_line(dst, src1, &xo, d_x_len, ro->true_color_lut);
+  }
+}
+
+/*
+ * where the fields of a BGR pixel go in the destination color space,
+ * as rgb_color_reduce() and rgb_color_reduced_2int() put them;
+ * 0 if the color space has no masks, so colors are dithered
+ */
+static int rgb_shifts(const ColorSpaceDesc *csd, int rbits, int gbits,
+    int bbits, struct rgb_shift *sh)
+{
+  const int bits[3] = { rbits, gbits, bbits };
+  const int in[3] = { gbits + bbits, bbits, 0 };
+  const int d_bits[3] = { csd->r_bits, csd->g_bits, csd->b_bits };
+  const int d_shift[3] = { csd->r_shift, csd->g_shift, csd->b_shift };
+  int c;
+
+  if(!csd->r_mask && !csd->g_mask && !csd->b_mask) return 0;
+
+  for(c = 0; c < 3; c++) {
+    sh->in[c] = in[c];
+    sh->mask[c] = (1 << bits[c]) - 1;
+    sh->down[c] = d_bits[c] < bits[c] ? bits[c] - d_bits[c] : 0;
+    sh->up[c] = d_shift[c] + (d_bits[c] > bits[c] ? d_bits[c] - bits[c] : 0);
+  }
+
+  return 1;
+}
+
+static void remap_16to32_1(RemapObject *ro, int rbits, int gbits,
+    void (*gen_func)(RemapObject *))
+{
+  int i;
+  const unsigned char *src;
+  unsigned char *dst;
+  struct rgb_shift sh;
+
+  if(!rgb_shifts(ro->dst_color_space, rbits, gbits, 5, &sh)) {
+    gen_func(ro);
+    return;
+  }
+
+  src = ro->src_image + ro->src_start + ro->src_offset;
+  dst = ro->dst_image + ro->dst_start + ro->dst_offset;
+
+  for(i = ro->src_y0; i < ro->src_y1; i++) {
+    line_16to32((unsigned *) dst, (const unsigned short *) src,
+		ro->dst_width, &sh);
+    src += ro->src_scan_len;
+    dst += ro->dst_scan_len;
+  }
+}
+
+/*
+ * 15 bit true color --> 32 bit true color
+ */
+static void simd_15to32_1(RemapObject *ro)
+{
+  remap_16to32_1(ro, 5, 5, gen_15to32_1);
+}
+
+/*
+ * 16 bit true color --> 32 bit true color
+ */
+static void simd_16to32_1(RemapObject *ro)
+{
+  remap_16to32_1(ro, 5, 6, gen_16to32_1);
+}
+
+static RemapFuncDesc remap_simd_list[] = {
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_VGA_4,
+    MODE_TRUE_32,
+    simd_4to32_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_VGA_X | MODE_PSEUDO_8,
+    MODE_TRUE_15 | MODE_TRUE_16,
+    simd_8to16_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_VGA_X | MODE_PSEUDO_8,
+    MODE_TRUE_32,
+    simd_8to32_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_RECT | RFF_OPT_PENTIUM,
+    MODE_PSEUDO_8,
+    MODE_TRUE_32,
+    simd_8to32_1,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_15,
+    MODE_TRUE_32,
+    simd_15to32_1,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_16,
+    MODE_TRUE_32,
+    simd_16to32_1,
+    NULL
+  ),
+
+};
+
+/*
+ * returns chained list of modes; picks the line kernels for this CPU
+ */
+RemapFuncDesc *remap_simd(void)
+{
+  int i;
+
+#ifdef HAVE_SIMD_KERNELS
+  if(__builtin_cpu_supports("sse2")) {
+    line_8to32_rep = line_8to32_rep_sse2;
+    line_8to16_rep = line_8to16_rep_sse2;
+    line_16to32 = line_16to32_sse2;
+  }
+  if(__builtin_cpu_supports("avx2")) {
+    line_8to32 = line_8to32_avx2;
+    line_8to16 = line_8to16_avx2;
+    line_8to32_1 = line_8to32_1_avx2;
+  }
+#endif
+
+  for(i = 0; i < sizeof(remap_simd_list) / sizeof(*remap_simd_list) - 1; i++) {
+    remap_simd_list[i].next = remap_simd_list + i + 1;
+  }
+
+  return remap_simd_list;
+}
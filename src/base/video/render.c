@@ -5,12 +5,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <assert.h>
 #include "emu.h"
 #include "utilities.h"
+#include "timers.h"
 #include "vgaemu.h"
 #include "vgatext.h"
 #include "render.h"
@@ -20,6 +25,10 @@
 
 #define RENDER_THREADED 1
 #define TEXT_THREADED 1
+/* max number of horizontal bands a graphics frame is split into */
+#define MAX_BANDS 8
+/* updates smaller than that are not worth splitting */
+#define BAND_MIN_LEN 0x8000
 
 struct rmcalls_wrp {
   struct remap_calls *calls;
@@ -40,6 +49,7 @@ static pthread_mutex_t render_mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_rwlock_t mode_mtx = PTHREAD_RWLOCK_INITIALIZER;
 static sem_t render_sem;
 static void do_rend_gfx(void);
+static void render_band(int band);
 static void do_rend_text(void);
 static int remap_mode(void);
 static void bitmap_refresh_pal(void *opaque, DAC_entry *col, int index);
@@ -55,7 +65,8 @@ struct render_wrp {
     int render_locked;
     int render_text;
     int text_locked;
-    struct remap_object *gfx_remap;
+    struct remap_object *gfx_remap[MAX_BANDS];
+    int num_bands;
     struct remap_object *text_remap;
     struct bitmap_desc dst_image[MAX_RENDERS];
 };
@@ -63,6 +74,43 @@ static struct render_wrp Render;
 static int initialized;
 static int cur_mode_class;
 
+/* dirty areas of the current frame, collected from vga_emu_update() */
+struct upd_range {
+  unsigned display_start;
+  int src_offset;
+  int offset;
+  int len;
+};
+static struct upd_range *upd_ranges;
+static int num_upd_ranges, max_upd_ranges;
+static int upd_mode;
+
+/*
+ * Content hashes of the source lines as they were last remapped, so
+ * that lines in dirty pages whose content did not change are skipped.
+ * 0 means unknown. They are only valid for the frame geometry in
+ * line_hash_key and are dropped whenever the whole screen is redrawn.
+ */
+static uint64_t *line_hash;
+static struct {
+  unsigned gen;
+  unsigned display_start;
+  int scan_len, width, height, mode;
+} line_hash_key;
+static int line_hash_lines;
+
+#if RENDER_THREADED
+/* band 0 is done by the render thread itself, the others by these */
+static pthread_t band_thr[MAX_BANDS];
+static sem_t band_start[MAX_BANDS];
+static sem_t band_done;
+static int num_band_thr;
+#endif
+
+/* frame time statistics, in us */
+static int gfx_frames;
+static hitimer_t gfx_time, gfx_time_max;
+
 __attribute__((warn_unused_result))
 static int render_lock(void)
 {
@@ -199,6 +247,17 @@ static struct text_system Text_bitmap =
   TEXTF_BMAP_FONT,
 };
 
+static int render_bands(void)
+{
+  int n = config.X_render_threads;
+
+  if (n < 1)
+    n = 1;
+  if (n > MAX_BANDS)
+    n = MAX_BANDS;
+  return n;
+}
+
 int register_render_system(struct render_system *render_system)
 {
   assert(Render.num_renders < MAX_RENDERS);
@@ -213,7 +272,7 @@ int register_render_system(struct render_system *render_system)
 int remapper_init(int have_true_color, int have_shmap, int features,
     ColorSpaceDesc *csd)
 {
-  int remap_src_modes, ximage_mode;
+  int remap_src_modes, ximage_mode, i;
 
   remapper_register();
 
@@ -235,7 +294,10 @@ int remapper_init(int have_true_color, int have_shmap, int features,
   }
 
   remap_src_modes = find_supported_modes(ximage_mode);
-  Render.gfx_remap = remap_init(ximage_mode, features, csd);
+  /* every band has its own remapper, as they keep per-call state */
+  Render.num_bands = render_bands();
+  for (i = 0; i < Render.num_bands; i++)
+    Render.gfx_remap[i] = remap_init(ximage_mode, features, csd);
   /* linear 1 byte per pixel */
   Render.text_remap = remap_init(ximage_mode, features, csd);
   register_text_system(&Text_bitmap);
@@ -264,6 +326,20 @@ static void *render_thread(void *arg)
   }
   return NULL;
 }
+
+static void *band_thread(void *arg)
+{
+  int band = (long)arg;
+
+  while (1) {
+    sem_wait(&band_start[band]);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    render_band(band);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    sem_post(&band_done);
+  }
+  return NULL;
+}
 #endif
 
 int render_init(void)
@@ -277,6 +353,18 @@ int render_init(void)
   pthread_setname_np(render_thr, "dosemu: render");
 #endif
   assert(!err);
+  err = sem_init(&band_done, 0, 0);
+  assert(!err);
+  for (num_band_thr = 1; num_band_thr < render_bands(); num_band_thr++) {
+    long i = num_band_thr;
+    err = sem_init(&band_start[i], 0, 0);
+    assert(!err);
+    err = pthread_create(&band_thr[i], NULL, band_thread, (void *)i);
+    assert(!err);
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+    pthread_setname_np(band_thr[i], "dosemu: band");
+#endif
+  }
 #endif
   initialized++;
   return err;
@@ -287,6 +375,8 @@ int render_init(void)
  */
 void render_done(void)
 {
+  int i;
+
   if (!initialized)
     return;
   initialized--;
@@ -294,16 +384,38 @@ void render_done(void)
   pthread_cancel(render_thr);
   pthread_join(render_thr, NULL);
   sem_destroy(&render_sem);
+  for (i = 1; i < num_band_thr; i++) {
+    pthread_cancel(band_thr[i]);
+    pthread_join(band_thr[i], NULL);
+    sem_destroy(&band_start[i]);
+  }
+  sem_destroy(&band_done);
+  num_band_thr = 0;
 #endif
+  if (gfx_frames)
+    v_printf("render: %i frames in %i bands, avg %llu us, max %llu us\n",
+        gfx_frames, Render.num_bands,
+        (unsigned long long)(gfx_time / gfx_frames),
+        (unsigned long long)gfx_time_max);
+  free(upd_ranges);
+  upd_ranges = NULL;
+  num_upd_ranges = max_upd_ranges = 0;
+  free(line_hash);
+  line_hash = NULL;
+  line_hash_lines = 0;
 }
 
 void remapper_done(void)
 {
+  int i;
+
   done_text_mapper();
   if (Render.text_remap)
     remap_done(Render.text_remap);
-  if (Render.gfx_remap)
-    remap_done(Render.gfx_remap);
+  for (i = 0; i < Render.num_bands; i++) {
+    if (Render.gfx_remap[i])
+      remap_done(Render.gfx_remap[i]);
+  }
 }
 
 /*
@@ -322,11 +434,12 @@ static void refresh_truecolor(DAC_entry *col, int index, void *udata)
   remap_palette_update(ro, index, vga.dac.bits, col->r, col->g, col->b);
 }
 
-/* returns True if the screen needs to be redrawn */
-static Boolean refresh_palette(void *opaque)
+static void refresh_truecolor_bands(DAC_entry *col, int index, void *udata)
 {
-  struct remap_object **obj = opaque;
-  return changed_vga_colors(refresh_truecolor, *obj);
+  int i;
+
+  for (i = 0; i < Render.num_bands; i++)
+    refresh_truecolor(col, index, Render.gfx_remap[i]);
 }
 
 /*
@@ -334,7 +447,7 @@ static Boolean refresh_palette(void *opaque)
  */
 static void refresh_graphics_palette(void)
 {
-  if (refresh_palette(&Render.gfx_remap))
+  if (changed_vga_colors(refresh_truecolor_bands, NULL))
     dirty_all_video_pages();
 }
 
@@ -390,7 +503,7 @@ struct vid_mode_params get_mode_parameters(void)
     w_y_res = (w_x_res * 3) >> 2;
   }
 #if 0
-  cap = remap_get_cap(Render.gfx_remap);
+  cap = remap_get_cap(Render.gfx_remap[0]);
   if(!(cap & (ROS_SCALE_ALL | ROS_SCALE_1 | ROS_SCALE_2))) {
     error("setmode: video mode 0x%02x not supported on this screen\n", vga.mode);
     /* why do we need a blank screen? */
@@ -452,20 +565,223 @@ static void modify_mode(void)
 }
 
 
+static struct upd_range *add_upd_range(void)
+{
+  if (num_upd_ranges == max_upd_ranges) {
+    max_upd_ranges = max_upd_ranges ? max_upd_ranges * 2 : 64;
+    upd_ranges = realloc(upd_ranges, max_upd_ranges * sizeof(*upd_ranges));
+    assert(upd_ranges);
+  }
+  return &upd_ranges[num_upd_ranges++];
+}
+
 static void update_graphics_loop(unsigned display_start,
 	unsigned display_end, int src_offset,
 	int update_offset, vga_emu_update_type *veut)
 {
   int i = -1;
+  struct upd_range *r;
 
   while ((i = vga_emu_update(veut, display_start + src_offset + update_offset,
       display_end, i)) != -1) {
-    remap_remap_mem(Render.gfx_remap, BMP(vga.mem.base + display_start,
+    r = add_upd_range();
+    r->display_start = display_start;
+    r->src_offset = src_offset;
+    r->offset = update_offset + veut->update_start - display_start;
+    r->len = veut->update_len;
+  }
+}
+
+/*
+ * Remap without holding render_mtx: used for the bands > 0, whose
+ * remappers are not shared with anyone else.
+ */
+static void remap_mem_band(struct remap_object *ro,
+	const struct bitmap_desc src_img, int src_mode,
+	int src_start, int offset, int len)
+{
+  RectArea r;
+  int i;
+
+  for (i = 0; i < Render.num_renders; i++) {
+    if (!Render.wrp[i].locked)
+      continue;
+    r = ro->calls->remap_mem(ro->priv, src_img, src_mode, src_start,
+        offset, len, Render.dst_image[i]);
+    if (r.width) {
+      pthread_mutex_lock(&render_mtx);
+      render_rect_add(i, r);
+      pthread_mutex_unlock(&render_mtx);
+    }
+  }
+}
+
+/*
+ * Remap the parts of the collected dirty areas that fall into the
+ * given band of source lines. The bands are line aligned, so the
+ * remappers write disjoint destination lines.
+ */
+static void render_band(int band)
+{
+  int n = Render.num_bands;
+  int lo = band ? vga.scan_len * (vga.height * band / n) : INT_MIN;
+  int hi = band < n - 1 ? vga.scan_len * (vga.height * (band + 1) / n) :
+      INT_MAX;
+  int i, start, end;
+
+  for (i = 0; i < num_upd_ranges; i++) {
+    struct upd_range *r = &upd_ranges[i];
+    struct bitmap_desc bmp = BMP(vga.mem.base + r->display_start,
+        vga.width, vga.height, vga.scan_len);
+    start = _max(r->offset, lo);
+    end = _min(r->offset + r->len, hi);
+    if (end <= start)
+      continue;
+    if (band)
+      remap_mem_band(Render.gfx_remap[band], bmp, upd_mode, r->src_offset,
+          start, end - start);
+    else
+      remap_remap_mem(Render.gfx_remap[0], bmp, upd_mode, r->src_offset,
+          start, end - start);
+  }
+}
+
+static uint64_t hash_line(const unsigned char *p, int len)
+{
+  uint64_t h = 0, w;
+  int i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+  }
+  for (; i < len; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  /* 0 is reserved for unknown */
+  return h | 1;
+}
+
+static void line_hash_reset(unsigned display_start, int lines)
+{
+  if (lines > line_hash_lines) {
+    free(line_hash);
+    line_hash = malloc(lines * sizeof(*line_hash));
+    assert(line_hash);
+    line_hash_lines = lines;
+  }
+  memset(line_hash, 0, line_hash_lines * sizeof(*line_hash));
+  line_hash_key.gen = vga.mem.redraw_gen;
+  line_hash_key.display_start = display_start;
+  line_hash_key.scan_len = vga.scan_len;
+  line_hash_key.width = vga.width;
+  line_hash_key.height = vga.height;
+  line_hash_key.mode = upd_mode;
+}
+
+static void emit_lines(unsigned display_start, int first, int last)
+{
+  struct upd_range *r = add_upd_range();
+
+  r->display_start = display_start;
+  r->src_offset = 0;
+  r->offset = first * vga.scan_len;
+  r->len = (last - first) * vga.scan_len;
+}
+
+/*
+ * Replace the collected dirty ranges by runs of whole lines whose
+ * content hash changed. Dirty tracking is per page, and a game that
+ * redraws the whole frame every time dirties all of them even if only
+ * a sprite moved. Only linear modes and unwrapped frames are handled,
+ * lines past `wrap' and partial lines are passed on as they are.
+ */
+static void filter_unchanged_lines(unsigned display_start, unsigned wrap)
+{
+  const int linear = MODE_PSEUDO_8 | MODE_TRUE_15 | MODE_TRUE_16 |
+      MODE_TRUE_24 | MODE_TRUE_32;
+  int lines, n, i, l, first, last, run;
+  struct upd_range *old;
+  unsigned char *base = vga.mem.base + display_start;
+
+  if (!num_upd_ranges || vga.scan_len <= 0)
+    return;
+  lines = wrap > display_start ? (wrap - display_start) / vga.scan_len : 0;
+  lines = _min(lines, vga.height);
+  for (i = 0; i < num_upd_ranges; i++) {
+    if (upd_ranges[i].src_offset)
+      lines = 0;
+  }
+  if (!(upd_mode & linear) || lines <= 0) {
+    /* the lines get remapped unchecked, forget what we knew */
+    line_hash_key.scan_len = 0;
+    return;
+  }
+  if (line_hash_key.gen != vga.mem.redraw_gen ||
+      line_hash_key.display_start != display_start ||
+      line_hash_key.scan_len != vga.scan_len ||
+      line_hash_key.width != vga.width ||
+      line_hash_key.height != vga.height ||
+      line_hash_key.mode != upd_mode)
+    line_hash_reset(display_start, vga.height);
+
+  n = num_upd_ranges;
+  old = malloc(n * sizeof(*old));
+  assert(old);
+  memcpy(old, upd_ranges, n * sizeof(*old));
+  num_upd_ranges = 0;
+  for (i = 0; i < n; i++) {
+    first = old[i].offset / vga.scan_len;
+    last = (old[i].offset + old[i].len - 1) / vga.scan_len + 1;
+    run = -1;
+    for (l = first; l < _min(last, lines); l++) {
+      uint64_t h = hash_line(base + l * vga.scan_len, vga.scan_len);
+      if (h == line_hash[l]) {
+        if (run >= 0)
+          emit_lines(display_start, run, l);
+        run = -1;
+        continue;
+      }
+      line_hash[l] = h;
+      if (run < 0)
+        run = l;
+    }
+    if (run >= 0)
+      emit_lines(display_start, run, l);
+    if (last > lines) {
+      /* past the last complete line */
+      struct upd_range *r = add_upd_range();
+      int start = _max(old[i].offset, lines * vga.scan_len);
+      *r = old[i];
+      r->offset = start;
+      r->len = old[i].offset + old[i].len - start;
+    }
+  }
+  free(old);
+}
+
+static void render_ranges(void)
+{
+  int i, len = 0;
+
+  for (i = 0; i < num_upd_ranges; i++)
+    len += upd_ranges[i].len;
+#if RENDER_THREADED
+  if (Render.num_bands > 1 && num_band_thr == Render.num_bands &&
+      len >= BAND_MIN_LEN && vga.height >= Render.num_bands) {
+    for (i = 1; i < Render.num_bands; i++)
+      sem_post(&band_start[i]);
+    render_band(0);
+    for (i = 1; i < Render.num_bands; i++)
+      sem_wait(&band_done);
+    return;
+  }
+#endif
+  for (i = 0; i < num_upd_ranges; i++) {
+    struct upd_range *r = &upd_ranges[i];
+    remap_remap_mem(Render.gfx_remap[0], BMP(vga.mem.base + r->display_start,
                              vga.width, vga.height, vga.scan_len),
-                             remap_mode(),
-                             src_offset, update_offset +
-                             veut->update_start - display_start,
-                             veut->update_len);
+                             upd_mode, r->src_offset, r->offset, r->len);
   }
 }
 
@@ -486,6 +802,8 @@ static void update_graphics_screen(void)
     wrap = _min(__atomic_load_n(&vga.mem.wrap, __ATOMIC_RELAXED), display_end);
   }
 
+  num_upd_ranges = 0;
+  upd_mode = remap_mode();
   update_graphics_loop(display_start, wrap, 0, 0, &veut);
 
   if (display_end > wrap) {
@@ -509,6 +827,8 @@ static void update_graphics_screen(void)
       align = vga.scan_len - rem;
     update_graphics_loop(0, display_end - wrap, -len, len + align, &veut);
   }
+  filter_unchanged_lines(display_start, wrap);
+  render_ranges();
 }
 
 int render_is_updating(void)
@@ -531,10 +851,17 @@ static void do_rend_gfx(void)
       break;
     case GRAPH:
       if (vgaemu_is_dirty()) {
+        hitimer_t t0;
         int err = render_lock();
         if (err)
           break;
+        t0 = GETusTIME(0);
         update_graphics_screen();
+        t0 = GETusTIME(0) - t0;
+        gfx_frames++;
+        gfx_time += t0;
+        if (t0 > gfx_time_max)
+          gfx_time_max = t0;
         render_unlock();
       }
       break;
@@ -735,7 +1062,7 @@ void render_blit(int x, int y, int width, int height)
      * have artifacts. Don't use this blit too much... SDL plugin
      * doesn't use it but an X plugin does. Wrap should really be
      * handled by remapper. */
-    remap_remap_rect_dst(Render.gfx_remap, BMP(vga.mem.base + display_start,
+    remap_remap_rect_dst(Render.gfx_remap[0], BMP(vga.mem.base + display_start,
 	vga.width, vga.height, vga.scan_len), remap_mode(),
 	x, y, width, height);
   }
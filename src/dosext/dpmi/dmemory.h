@@ -9,6 +9,8 @@
 
 typedef struct dpmi_pm_block_stuct {
   struct   dpmi_pm_block_stuct *next;
+  struct   dpmi_pm_block_stuct *prev;
+  struct   dpmi_pm_block_stuct *hnext;	/* handle hash chain */
   unsigned int handle;
   unsigned int size;
   dosaddr_t base;
@@ -16,6 +18,8 @@ typedef struct dpmi_pm_block_stuct {
   unsigned int linear:1;
   unsigned int hwram:1;
   unsigned int shm:1;
+  unsigned int hashed:1;
+  unsigned int indexed:1;		/* in the address tree */
   char *shmname;
   char *rshmname;
   char *shm_dir;
@@ -31,6 +35,11 @@ typedef struct dpmi_pm_block_stuct {
 
 typedef struct dpmi_pm_block_root_struc {
   dpmi_pm_block *first_pm_block;
+  dpmi_pm_block **hash;			/* by handle */
+  unsigned int hash_size;
+  unsigned int hash_count;
+  void *addr_tree;			/* tsearch() tree of the mapped blocks */
+  int unindexed;			/* mapped blocks overlapping others */
 } dpmi_pm_block_root;
 
 dpmi_pm_block *lookup_pm_block(dpmi_pm_block_root *root, unsigned long h);
@@ -30,6 +30,7 @@
 #include <limits.h>
 #include <sys/mman.h>		/* for MREMAP_MAYMOVE */
 #include <errno.h>
+#include <search.h>
 #include "utilities.h"
 #include "shlock.h"
 #include "fslib.h"
@@ -53,12 +54,85 @@ static const int dpmi_reserved_space = 4 * 1024 * 1024; // reserve 4Mb
 
 /* utility routines */
 
-/* I don\'t think these function will ever become bottleneck, so just */
-/* keep it simple, --dong */
+/*
+ * The blocks are kept on a list, and indexed by handle in a hash table
+ * and by address in a tsearch() tree, as some clients make tens of
+ * thousands of small allocations. The handles are sequential, so the
+ * low bits make a good hash. The tree only holds the mapped blocks;
+ * the ones overlapping an indexed block (hwram mapped twice) are
+ * counted in root->unindexed and the lookup by address then falls
+ * back to the list.
+ */
+static int hash_grow(dpmi_pm_block_root *root)
+{
+    unsigned int i, size = root->hash_size ? root->hash_size * 2 : 64;
+    dpmi_pm_block **hash = calloc(size, sizeof(*hash));
+    dpmi_pm_block *p, *next;
+
+    if (!hash)
+	return -1;
+    for (i = 0; i < root->hash_size; i++) {
+	for (p = root->hash[i]; p; p = next) {
+	    next = p->hnext;
+	    p->hnext = hash[p->handle & (size - 1)];
+	    hash[p->handle & (size - 1)] = p;
+	}
+    }
+    free(root->hash);
+    root->hash = hash;
+    root->hash_size = size;
+    return 0;
+}
+
+static void hash_del(dpmi_pm_block_root *root, dpmi_pm_block *p)
+{
+    dpmi_pm_block **pp = &root->hash[p->handle & (root->hash_size - 1)];
+
+    while (*pp != p)
+	pp = &(*pp)->hnext;
+    *pp = p->hnext;
+    root->hash_count--;
+    p->hashed = 0;
+}
+
+static int addr_cmp(const void *a, const void *b)
+{
+    const dpmi_pm_block *x = a, *y = b;
+
+    if ((uint64_t)x->base + x->size <= y->base)
+	return -1;
+    if (x->base >= (uint64_t)y->base + y->size)
+	return 1;
+    return 0;
+}
+
+static void addr_add(dpmi_pm_block_root *root, dpmi_pm_block *p)
+{
+    dpmi_pm_block **node = tsearch(p, &root->addr_tree, addr_cmp);
+
+    if (node && *node == p)
+	p->indexed = 1;
+    else
+	root->unindexed++;
+}
+
+static void addr_del(dpmi_pm_block_root *root, dpmi_pm_block *p)
+{
+    if (p->indexed)
+	tdelete(p, &root->addr_tree, addr_cmp);
+    else if (p->mapped)
+	root->unindexed--;
+    p->indexed = 0;
+}
+
 /* alloc_pm_block: allocate a dpmi_pm_block struct and add it to the list */
 static dpmi_pm_block * alloc_pm_block(dpmi_pm_block_root *root, unsigned long size)
 {
-    dpmi_pm_block *p = malloc(sizeof(dpmi_pm_block));
+    dpmi_pm_block *p;
+
+    if (root->hash_count >= root->hash_size && hash_grow(root))
+	return NULL;
+    p = malloc(sizeof(dpmi_pm_block));
     if(!p)
 	return NULL;
     memset(p, 0, sizeof(*p));
@@ -69,11 +143,29 @@ static dpmi_pm_block * alloc_pm_block(dpmi_pm_block_root *root, unsigned long si
 	return NULL;
     }
     p->next = root->first_pm_block;	/* add it to list */
+    if (p->next)
+	p->next->prev = p;
     root->first_pm_block = p;
-    p->mapped = 1;
     return p;
 }
 
+/* register_pm_block: give the block its handle and index it, once its
+ * base and size are set */
+static void register_pm_block(dpmi_pm_block_root *root, dpmi_pm_block *p)
+{
+    dpmi_pm_block **bucket;
+
+    p->handle = pm_block_handle_used++;
+    /* the newest block comes first, as on the list */
+    bucket = &root->hash[p->handle & (root->hash_size - 1)];
+    p->hnext = *bucket;
+    *bucket = p;
+    root->hash_count++;
+    p->hashed = 1;
+    p->mapped = 1;
+    addr_add(root, p);
+}
+
 static void * realloc_pm_block(dpmi_pm_block *block, unsigned long newsize)
 {
     u_short *new_addr = realloc(block->attrs, (newsize / HOST_PAGE_SIZE) * sizeof(u_short));
@@ -87,25 +179,26 @@ static void * realloc_pm_block(dpmi_pm_block *block, unsigned long newsize)
 /* free_pm_block free a dpmi_pm_block struct and delete it from list */
 static int free_pm_block(dpmi_pm_block_root *root, dpmi_pm_block *p)
 {
-    dpmi_pm_block *tmp = NULL;
-    dpmi_pm_block *next;
     if (!p) return -1;
-    if (p != root->first_pm_block) {
-	for(tmp = root->first_pm_block; tmp; tmp = tmp->next)
-	    if (tmp -> next == p)
-		break;
-	if (!tmp) return -1;
-    }
-    next = p->next;
+    if (p->hashed)
+	hash_del(root, p);
+    addr_del(root, p);
+    if (p->prev)
+	p->prev->next = p->next;
+    else
+	root->first_pm_block = p->next;
+    if (p->next)
+	p->next->prev = p->prev;
     free(p->attrs);
     free(p->shmname);
     free(p->rshmname);
     free(p->shm_dir);
     free(p);
-    if (tmp)
-	tmp->next = next;
-    else
-	root->first_pm_block = next;
+    if (!root->first_pm_block) {
+	free(root->hash);
+	root->hash = NULL;
+	root->hash_size = 0;
+    }
     return 0;
 }
 
@@ -113,7 +206,9 @@ static int free_pm_block(dpmi_pm_block_root *root, dpmi_pm_block *p)
 dpmi_pm_block *lookup_pm_block(dpmi_pm_block_root *root, unsigned long h)
 {
     dpmi_pm_block *tmp;
-    for(tmp = root->first_pm_block; tmp; tmp = tmp->next) {
+    if (!root->hash)
+	return NULL;
+    for(tmp = root->hash[h & (root->hash_size - 1)]; tmp; tmp = tmp->hnext) {
 	if (tmp -> handle == h)
 	    return tmp;
     }
@@ -123,12 +218,20 @@ dpmi_pm_block *lookup_pm_block(dpmi_pm_block_root *root, unsigned long h)
 dpmi_pm_block *lookup_pm_block_by_addr(dpmi_pm_block_root *root,
 	dosaddr_t addr)
 {
-    dpmi_pm_block *tmp;
-    for(tmp = root->first_pm_block; tmp; tmp = tmp->next) {
-	if (tmp->mapped && addr >= tmp->base && addr < tmp->base + tmp->size)
-	    return tmp;
+    dpmi_pm_block *tmp, key;
+    dpmi_pm_block **node;
+
+    if (root->unindexed) {
+	for(tmp = root->first_pm_block; tmp; tmp = tmp->next) {
+	    if (tmp->mapped && addr >= tmp->base && addr < tmp->base + tmp->size)
+		return tmp;
+	}
+	return NULL;
     }
-    return NULL;
+    key.base = addr;
+    key.size = 1;
+    node = tfind(&key, &root->addr_tree, addr_cmp);
+    return node ? *node : NULL;
 }
 
 dpmi_pm_block *lookup_pm_block_by_shmname(dpmi_pm_block_root *root,
@@ -407,8 +510,8 @@ dpmi_pm_block * DPMI_malloc(dpmi_pm_block_root *root, unsigned int size)
     for (i = 0; i < size / HOST_PAGE_SIZE; i++)
 	block->attrs[i] = 9;
     mem_allocd += size;
-    block->handle = pm_block_handle_used++;
     block->size = size;
+    register_pm_block(root, block);
     return block;
 }
 
@@ -462,8 +565,8 @@ dpmi_pm_block * DPMI_mallocLinear(dpmi_pm_block_root *root,
 	block->attrs[i] = committed ? 9 : 8;
     if (committed)
 	mem_allocd += size;
-    block->handle = pm_block_handle_used++;
     block->size = size;
+    register_pm_block(root, block);
     return block;
 }
 
@@ -484,8 +587,8 @@ dpmi_pm_block * DPMI_mapHWRam(dpmi_pm_block_root *root,
     block->hwram = 1;
     for (i = 0; i < size / HOST_PAGE_SIZE; i++)
 	block->attrs[i] = 9;
-    block->handle = pm_block_handle_used++;
     block->size = size;
+    register_pm_block(root, block);
     return block;
 }
 
@@ -495,13 +598,14 @@ static void do_unmap_hwram(dpmi_pm_block_root *root, dpmi_pm_block *block)
     free_pm_block(root, block);
 }
 
-static void do_unmap_shm(dpmi_pm_block *block)
+static void do_unmap_shm(dpmi_pm_block_root *root, dpmi_pm_block *block)
 {
     int err = restore_mapping(MAPPING_DPMI, block->base, block->size);
     if (err)
         error("restore_mapping() failed\n");
     smfree(&mem_pool, MEM_BASE32(block->base));
     unregister_hardware_ram_virtual(block->base);
+    addr_del(root, block);
     block->mapped = 0;
 }
 
@@ -514,7 +618,7 @@ int DPMI_unmapHWRam(dpmi_pm_block_root *root, dosaddr_t vbase)
         do_unmap_hwram(root, block);
     } else if (block->shm) {
         /* extension: allow unmap shared block as hwram */
-        do_unmap_shm(block);
+        do_unmap_shm(root, block);
         if (!block->shmname)
             free_pm_block(root, block);
     } else {
@@ -542,7 +646,7 @@ int DPMI_free(dpmi_pm_block_root *root, unsigned int handle)
     e_invalidate_full(block->base, block->size);
     if (block->shm) {
 	if (block->mapped)
-	    do_unmap_shm(block);
+	    do_unmap_shm(root, block);
     } else if (block->linear) {
 	for (i = 0; i < block->size / HOST_PAGE_SIZE; i++) {
 	    if ((block->attrs[i] & 3) == 2)   // mapped
@@ -663,7 +767,7 @@ dpmi_pm_block *DPMI_mallocShared(dpmi_pm_block_root *root,
     ptr->size = size;
     ptr->shm = 1;
     ptr->linear = 1;
-    ptr->handle = pm_block_handle_used++;
+    register_pm_block(root, ptr);
     ptr->shmname = strdup(name);
     ptr->rshmname = shmname;
     ptr->shlock = shlock;
@@ -747,7 +851,7 @@ static dpmi_pm_block *DPMI_mallocSharedNS_common(dpmi_pm_block_root *root,
     ptr->size = size;
     ptr->shm = 1;
     ptr->linear = 1;
-    ptr->handle = pm_block_handle_used++;
+    register_pm_block(root, ptr);
     ptr->shmname = strdup(name);
     ptr->shm_dir = strdup(dname);
     ptr->shlock = shlock;
@@ -845,7 +949,7 @@ int DPMI_freeShared(dpmi_pm_block_root *root, uint32_t handle)
     if (!ptr || !ptr->shmname)
         return -1;
     if (ptr->mapped)
-        do_unmap_shm(ptr);
+        do_unmap_shm(root, ptr);
 
     exlock = shlock_open(EXLOCK_DIR, ptr->shmname, 1, 1);
     assert(exlock);
@@ -868,7 +972,7 @@ int DPMI_freeSharedNS(dpmi_pm_block_root *root, uint32_t handle)
     if (!ptr || !ptr->shmname)
         return -1;
     if (ptr->mapped)
-        do_unmap_shm(ptr);
+        do_unmap_shm(root, ptr);
 
     rc = shlock_close(ptr->shlock);
     ptr->shlock = NULL;
@@ -979,8 +1083,10 @@ dpmi_pm_block * DPMI_realloc(dpmi_pm_block_root *root,
 	return NULL;
 
     finish_realloc(block, newsize, 1);
+    addr_del(root, block);
     block->base = DOSADDR_REL(ptr);
     block->size = newsize;
+    addr_add(root, block);
     restore_page_protection(block);
     return block;
 }
@@ -1025,8 +1131,10 @@ dpmi_pm_block * DPMI_reallocLinear(dpmi_pm_block_root *root,
     }
 
     finish_realloc(block, newsize, committed);
+    addr_del(root, block);
     block->base = DOSADDR_REL(ptr);
     block->size = newsize;
+    addr_add(root, block);
     /* restore_page_protection() will set proper prots */
     mprotect_mapping(MAPPING_DPMI, block->base, block->size,
 		DPMI_PROT_RWX);
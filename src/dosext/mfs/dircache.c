@@ -0,0 +1,469 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: cache of the directory listings for the name lookups.
+ *
+ * scan_dir() has to read the whole directory and convert every name
+ * to find the host name of a DOS path component. Here the converted
+ * names of the recently scanned directories are kept in a hash, keyed
+ * the same way scan_dir() compares them.
+ * The cache of a directory is dropped when inotify reports a change
+ * in it. Where there is no inotify, or on network filesystems where
+ * it only sees the local changes, the mtime of the directory is
+ * checked instead.
+ * With inotify the writes and attribute changes of the files are
+ * tracked as well, so the callers can also keep the stat data of the
+ * files while the directory is unchanged.
+ *
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <linux/magic.h>
+#endif
+#include "emu.h"
+#include "dos2linux.h"
+#include "mangle.h"
+#include "mfs.h"
+#include "dircache.h"
+
+#define DC_MAX_DIRS 64
+/* how often the hit counters are logged */
+#define DC_STAT_PERIOD 4096
+
+/* see scan_dir() for the matching rules */
+enum { KEY_LONG, KEY_83, KEY_MANGLED };
+
+struct dc_key {
+  int next;
+  int ent;
+  int kind;
+  unsigned hash;
+  char *key;		/* uppercased */
+  char *src;		/* name before mangling, for the mangled stack */
+};
+
+struct dircache {
+  char *path;
+  int drive;
+  int wd;		/* inotify watch, -1 if the mtime is checked */
+  int valid;
+  unsigned serial;	/* changes with every reading of the directory */
+  unsigned attr_gen;	/* changes when the files may have changed */
+  unsigned lru;
+  struct stat st;
+  int nents;
+  int ents_size;
+  char **names;		/* host names, in readdir order */
+  int nkeys;
+  int keys_size;
+  struct dc_key *keys;
+  int *hash;
+  unsigned mask;
+};
+
+static struct dircache dirs[DC_MAX_DIRS];
+static unsigned lru_clock;
+static unsigned serial_clock;
+static int ino_fd = -1;
+static int ino_failed;
+static struct {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long uncached;
+} stats;
+
+static unsigned dc_hash(int kind, const char *s)
+{
+  unsigned h = 2166136261u ^ kind;
+
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  return h;
+}
+
+static void dc_free(struct dircache *dc)
+{
+  int i;
+
+  for (i = 0; i < dc->nents; i++)
+    free(dc->names[i]);
+  for (i = 0; i < dc->nkeys; i++) {
+    free(dc->keys[i].key);
+    free(dc->keys[i].src);
+  }
+  free(dc->hash);
+  dc->hash = NULL;
+  dc->nents = dc->nkeys = 0;
+  dc->valid = 0;
+}
+
+#ifdef __linux__
+#define DC_NAME_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+    IN_DELETE_SELF | IN_MOVE_SELF)
+#define DC_ATTR_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE)
+
+static void dc_unwatch(struct dircache *dc)
+{
+  int i, wd = dc->wd;
+
+  if (wd == -1)
+    return;
+  dc->wd = -1;
+  /* the same directory under another path has the same watch */
+  for (i = 0; i < DC_MAX_DIRS; i++) {
+    if (dirs[i].path && dirs[i].wd == wd)
+      return;
+  }
+  inotify_rm_watch(ino_fd, wd);
+}
+
+/* inotify only sees the changes made on this host */
+static int is_remote_fs(const char *path)
+{
+  struct statfs sfs;
+
+  if (statfs(path, &sfs) == -1)
+    return 1;
+  switch (sfs.f_type) {
+  case NFS_SUPER_MAGIC:
+  case SMB_SUPER_MAGIC:
+  case 0xff534d42:	/* cifs */
+  case 0xfe534d42:	/* smb2 */
+  case 0x65735546:	/* fuse */
+  case V9FS_MAGIC:
+  case CEPH_SUPER_MAGIC:
+  case CODA_SUPER_MAGIC:
+  case AFS_SUPER_MAGIC:
+    return 1;
+  }
+  return 0;
+}
+
+static void dc_watch(struct dircache *dc)
+{
+  if (ino_fd == -1 && !ino_failed) {
+    ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ino_fd == -1) {
+      Debug0(("dircache: inotify not available: %s\n", strerror(errno)));
+      ino_failed = 1;
+    }
+  }
+  if (ino_fd == -1 || is_remote_fs(dc->path))
+    return;
+  dc->wd = inotify_add_watch(ino_fd, dc->path, DC_NAME_EVENTS |
+      DC_ATTR_EVENTS | IN_ONLYDIR);
+}
+
+static void dc_drain(void)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ev;
+  ssize_t len;
+  char *p;
+  int i;
+
+  if (ino_fd == -1)
+    return;
+  while ((len = read(ino_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+      ev = (const struct inotify_event *)p;
+      for (i = 0; i < DC_MAX_DIRS; i++) {
+        if (!dirs[i].path)
+          continue;
+        if (ev->mask & IN_Q_OVERFLOW) {
+          dirs[i].valid = 0;
+          dirs[i].attr_gen = ++serial_clock;
+        } else if (dirs[i].wd == ev->wd) {
+          if (ev->mask & (DC_NAME_EVENTS | IN_IGNORED))
+            dirs[i].valid = 0;
+          /* the names are still good */
+          if (ev->mask & DC_ATTR_EVENTS)
+            dirs[i].attr_gen = ++serial_clock;
+          /* the kernel removed the watch */
+          if (ev->mask & IN_IGNORED)
+            dirs[i].wd = -1;
+        }
+      }
+    }
+  }
+}
+#else
+static void dc_unwatch(struct dircache *dc) {}
+static void dc_watch(struct dircache *dc) {}
+static void dc_drain(void) {}
+#endif
+
+static void dc_drop(struct dircache *dc)
+{
+  dc_free(dc);
+  free(dc->path);
+  dc->path = NULL;
+  dc_unwatch(dc);
+  free(dc->names);
+  free(dc->keys);
+  dc->names = NULL;
+  dc->keys = NULL;
+  dc->ents_size = dc->keys_size = 0;
+}
+
+static void dc_add_key(struct dircache *dc, int kind, const char *key,
+    const char *src)
+{
+  struct dc_key *k;
+
+  if (dc->nkeys == dc->keys_size) {
+    dc->keys_size = dc->keys_size ? dc->keys_size * 2 : 64;
+    dc->keys = realloc(dc->keys, dc->keys_size * sizeof(*dc->keys));
+  }
+  k = &dc->keys[dc->nkeys++];
+  k->ent = dc->nents - 1;
+  k->kind = kind;
+  k->key = strupperDOS(strdup(key));
+  k->src = src ? strdup(src) : NULL;
+  k->hash = dc_hash(kind, k->key);
+}
+
+/* entries whose mtime is this close to the scan may miss a change */
+#define DC_RACY_SECS 2
+
+static int dc_fill(struct dircache *dc)
+{
+  struct mfs_dir *dir;
+  struct mfs_dirent *de;
+  char dosname[NAME_MAX + 1];
+  char name83[NAME_MAX + 1];
+  int i, ok;
+  unsigned h;
+
+  if (dc->wd == -1)
+    dc_watch(dc);
+  if (dc->wd == -1 && mfs_stat(dc->path, &dc->st, dc->drive) == -1)
+    return -1;
+  if ((dir = dos_opendir(dc->path, dc->drive)) == NULL)
+    return -1;
+  while ((de = dos_readdir(dir))) {
+    if (dc->nents == dc->ents_size) {
+      dc->ents_size = dc->ents_size ? dc->ents_size * 2 : 32;
+      dc->names = realloc(dc->names, dc->ents_size * sizeof(char *));
+    }
+    dc->names[dc->nents++] = strdup(de->d_name);
+
+    ok = name_ufs_to_dos(dosname, de->d_long_name);
+    if (ok)
+      dc_add_key(dc, KEY_LONG, dosname, NULL);
+    strcpy(name83, dosname);
+    if (name_convert(name83, 0)) {
+      dc_add_key(dc, KEY_83, name83, NULL);
+    } else {
+      name_mangle_83(name83);
+      dc_add_key(dc, KEY_MANGLED, name83, dosname);
+    }
+  }
+  dos_closedir(dir);
+
+  for (dc->mask = 15; dc->mask < dc->nkeys * 2; dc->mask = dc->mask * 2 + 1);
+  dc->hash = malloc((dc->mask + 1) * sizeof(int));
+  memset(dc->hash, 0xff, (dc->mask + 1) * sizeof(int));
+  /* insert backwards, so the chains are in readdir order */
+  for (i = dc->nkeys - 1; i >= 0; i--) {
+    h = dc->keys[i].hash & dc->mask;
+    dc->keys[i].next = dc->hash[h];
+    dc->hash[h] = i;
+  }
+  /* the mtime may not change again for a change right after the scan */
+  dc->valid = dc->wd != -1 ||
+      dc->st.st_mtime + DC_RACY_SECS < time(NULL);
+  dc->serial = dc->attr_gen = ++serial_clock;
+  return 0;
+}
+
+static int dc_check(struct dircache *dc)
+{
+  struct stat st;
+
+  if (!dc->valid)
+    return 0;
+  if (dc->wd != -1)
+    return 1;
+  if (mfs_stat(dc->path, &st, dc->drive) == -1)
+    return 0;
+  return st.st_ino == dc->st.st_ino && st.st_dev == dc->st.st_dev &&
+      st.st_mtim.tv_sec == dc->st.st_mtim.tv_sec &&
+      st.st_mtim.tv_nsec == dc->st.st_mtim.tv_nsec;
+}
+
+static void dc_stats(void)
+{
+  unsigned long total = stats.hits + stats.misses;
+
+  Debug0(("dircache: %lu lookups, %lu hits (%lu%%), %lu misses, %lu uncached\n",
+      total, stats.hits, total ? stats.hits * 100 / total : 0,
+      stats.misses, stats.uncached));
+}
+
+/*
+ * Get the cached listing of the directory, reading it if needed.
+ * Returns NULL if the directory can't be read.
+ */
+struct dircache *dircache_get(const char *path, int drive)
+{
+  struct dircache *dc = NULL, *victim = NULL;
+  int i;
+
+  dc_drain();
+  for (i = 0; i < DC_MAX_DIRS; i++) {
+    if (!dirs[i].path) {
+      if (!victim || victim->path)
+        victim = &dirs[i];
+      continue;
+    }
+    if (dirs[i].drive == drive && strcmp(dirs[i].path, path) == 0) {
+      dc = &dirs[i];
+      break;
+    }
+    if (!victim || (victim->path && dirs[i].lru < victim->lru))
+      victim = &dirs[i];
+  }
+  if ((stats.hits + stats.misses + 1) % DC_STAT_PERIOD == 0)
+    dc_stats();
+
+  if (dc && dc_check(dc)) {
+    stats.hits++;
+  } else {
+    stats.misses++;
+    if (dc) {
+      dc_free(dc);
+    } else {
+      /* a free slot, or the least recently used one */
+      dc = victim;
+      if (dc->path)
+        dc_drop(dc);
+      dc->path = strdup(path);
+      dc->drive = drive;
+      dc->wd = -1;
+    }
+    if (dc_fill(dc) == -1) {
+      dc_drop(dc);
+      stats.uncached++;
+      return NULL;
+    }
+  }
+  dc->lru = ++lru_clock;
+  return dc;
+}
+
+/*
+ * Find the first entry at or after from that matches the uppercased
+ * DOS name, the same way as scan_dir() would. Returns -1 if none.
+ */
+int dircache_match(struct dircache *dc, const char *dosname, int is_8_3,
+    int maybe_mangled, int from)
+{
+  int kinds[2], nkinds = 0, i, j, best = -1;
+  struct dc_key *k, *found = NULL;
+
+  if (!is_8_3) {
+    kinds[nkinds++] = KEY_LONG;
+  } else {
+    kinds[nkinds++] = KEY_83;
+    if (maybe_mangled)
+      kinds[nkinds++] = KEY_MANGLED;
+  }
+  for (j = 0; j < nkinds; j++) {
+    unsigned h = dc_hash(kinds[j], dosname);
+
+    for (i = dc->hash[h & dc->mask]; i != -1; i = k->next) {
+      k = &dc->keys[i];
+      if (k->ent < from || (best != -1 && k->ent >= best))
+        continue;
+      if (k->hash == h && k->kind == kinds[j] && strcmp(k->key, dosname) == 0) {
+        best = k->ent;
+        found = k;
+      }
+    }
+  }
+  if (found && found->kind == KEY_MANGLED) {
+    char tmp[NAME_MAX + 1];
+
+    /* scan_dir() leaves the names it mangles on the mangled stack */
+    strcpy(tmp, found->src);
+    name_convert(tmp, MANGLE);
+  }
+  return best;
+}
+
+const char *dircache_name(struct dircache *dc, int idx)
+{
+  return dc->names[idx];
+}
+
+int dircache_count(struct dircache *dc)
+{
+  return dc->nents;
+}
+
+/* the listing is the same as long as this is */
+unsigned dircache_serial(struct dircache *dc)
+{
+  return dc->serial;
+}
+
+/*
+ * Returns a number that changes whenever a file in the directory
+ * may have been written or had its attributes changed, or 0 if that
+ * isn't tracked. The directory is not read if it isn't cached.
+ */
+unsigned dircache_attr_gen(const char *path, int drive)
+{
+  int i;
+
+  dc_drain();
+  for (i = 0; i < DC_MAX_DIRS; i++) {
+    struct dircache *dc = &dirs[i];
+
+    if (dc->path && dc->drive == drive && strcmp(dc->path, path) == 0)
+      return dc->valid && dc->wd != -1 ? dc->attr_gen : 0;
+  }
+  return 0;
+}
+
+void dircache_done(void)
+{
+  int i;
+
+  if (stats.hits + stats.misses)
+    dc_stats();
+  for (i = 0; i < DC_MAX_DIRS; i++) {
+    if (dirs[i].path)
+      dc_drop(&dirs[i]);
+  }
+#ifdef __linux__
+  if (ino_fd != -1)
+    close(ino_fd);
+#endif
+  ino_fd = -1;
+  ino_failed = 0;
+  memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,30 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+struct dircache;
+
+struct dircache *dircache_get(const char *path, int drive);
+int dircache_match(struct dircache *dc, const char *dosname, int is_8_3,
+    int maybe_mangled, int from);
+const char *dircache_name(struct dircache *dc, int idx);
+int dircache_count(struct dircache *dc);
+unsigned dircache_serial(struct dircache *dc);
+unsigned dircache_attr_gen(const char *path, int drive);
+void dircache_done(void);
+
+#endif
@@ -538,6 +538,16 @@ BOOL name_convert(char *Name, BOOL mangle)
   return(True);
 }
 
+/****************************************************************************
+same as name_convert(Name, True), but doesn't push the name on the
+mangled stack
+****************************************************************************/
+void name_mangle_83(char *Name)
+{
+  if (!is_8_3(Name))
+    mangle_name_83(Name, NULL);
+}
+
 #ifndef DOSEMU
 static char *mangled_match(char *s, /* This is null terminated */
                            char *pattern, /* This isn't. */
@@ -176,6 +176,7 @@ TODO:
 #include "xattr.h"
 #include "rlocks.h"
 #include "fslib.h"
+#include "dircache.h"
 #include "mfs.h"
 
 #ifdef __linux__
@@ -264,6 +265,7 @@ static void RemoveRedirection(int drive, cds_t cds);
 static int mfs_statvfs(const char *path, struct statvfs *sb, int drive);
 static int path_list_contains(const char *clist, const char *path);
 static void clear_sfn_bl(void);
+static void ff_cache_clear(void);
 
 static int drives_initialized = FALSE;
 struct file_fd open_files[MAX_OPENED_FILES];
@@ -895,6 +897,8 @@ void mfs_done(void)
 {
   mfs_close_all();
   clear_sfn_bl();
+  ff_cache_clear();
+  dircache_done();
   fslib_done();
 }
 
@@ -903,6 +907,8 @@ void mfs_reset(void)
   lfn_reset();
   mfs_close_all();
   clear_sfn_bl();
+  ff_cache_clear();
+  dircache_done();
 
   emufs_loaded = FALSE;
   mfs_enabled = FALSE;
@@ -1046,10 +1052,19 @@ static struct dir_list *make_dir_list(int n)
   struct dir_list *dir_list = malloc(sizeof(*dir_list));
   dir_list->size = n;
   dir_list->nr_entries = 0;
+  dir_list->refcnt = 1;
   dir_list->de = malloc(n * sizeof(dir_list->de[0]));
   return dir_list;
 }
 
+static void put_dir_list(struct dir_list *dir_list)
+{
+  if (--dir_list->refcnt)
+    return;
+  free(dir_list->de);
+  free(dir_list);
+}
+
 static void enlarge_dir_list(struct dir_list *dir_list, int n)
 {
   dir_list->size = n;
@@ -1078,6 +1093,7 @@ static struct dir_ent *make_entry(struct dir_list *dir_list)
   entry = &dir_list->de[dir_list->nr_entries];
   dir_list->nr_entries++;
   entry->long_path = FALSE;
+  entry->attr_gen = 0;
   return entry;
 }
 
@@ -1218,6 +1234,57 @@ static void clear_sfn_bl(void)
   sfn_bl_size = 0;
 }
 
+/* the dircache key of a directory name with or without the trailing slash */
+static void dir_cache_path(char *path, const char *name)
+{
+  size_t len;
+
+  strlcpy(path, name, PATH_MAX);
+  len = strlen(path);
+  if (len > 1 && path[len - 1] == '/')
+    path[len - 1] = '\0';
+}
+
+/* reads the names of a directory, or takes them from the dircache */
+struct dir_iter {
+  struct dircache *dc;
+  struct mfs_dir *dir;
+  int idx;
+};
+
+static int dir_iter_open(struct dir_iter *it, const char *name, int drive)
+{
+  char path[PATH_MAX];
+
+  dir_cache_path(path, name);
+  it->idx = 0;
+  it->dir = NULL;
+  it->dc = dircache_get(path, drive);
+  if (it->dc)
+    return 0;
+  it->dir = dos_opendir(name, drive);
+  return it->dir ? 0 : -1;
+}
+
+static const char *dir_iter_next(struct dir_iter *it)
+{
+  struct mfs_dirent *cur_ent;
+
+  if (it->dc) {
+    if (it->idx == dircache_count(it->dc))
+      return NULL;
+    return dircache_name(it->dc, it->idx++);
+  }
+  cur_ent = dos_readdir(it->dir);
+  return cur_ent ? cur_ent->d_name : NULL;
+}
+
+static void dir_iter_close(struct dir_iter *it)
+{
+  if (it->dir)
+    dos_closedir(it->dir);
+}
+
 /* get directory;
    name = UNIX directory name
    mname = DOS (uppercase) name to match (can have wildcards)
@@ -1227,15 +1294,15 @@ static void clear_sfn_bl(void)
 static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
 	int drive)
 {
-  struct mfs_dir *cur_dir;
-  struct mfs_dirent *cur_ent;
+  struct dir_iter it;
+  const char *d_name;
   struct dir_list *dir_list;
   struct dir_ent *entry;
   char buf[256];
   char fname[8];
   char fext[3];
 
-  if ((cur_dir = dos_opendir(name, drive)) == NULL) {
+  if (dir_iter_open(&it, name, drive) == -1) {
     Debug0(("get_dir(): couldn't open '%s' errno = %s\n", name, strerror(errno)));
     return (NULL);
   }
@@ -1263,7 +1330,7 @@ static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
     entry->time = time(NULL);
     entry->attr = REGULAR_FILE;
 
-    dos_closedir(cur_dir);
+    dir_iter_close(&it);
     return (dir_list);
   }
   /* for efficiency we don't read everything if there are no wildcards */
@@ -1287,18 +1354,18 @@ static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
       entry->time = sbuf.st_mtime;
       entry->attr = get_dos_attr(buf2, entry->mode, drive);
     }
-    dos_closedir(cur_dir);
+    dir_iter_close(&it);
     return (dir_list);
   }
   else {
     int is_root = (strlen(name) == drives[drive].root_len);
-    while ((cur_ent = dos_readdir(cur_dir))) {
-      Debug0(("get_dir(): `%s' \n", cur_ent->d_name));
-      if (!convert_compare(cur_ent->d_name, fname, fext, mname, mext, is_root))
+    while ((d_name = dir_iter_next(&it))) {
+      Debug0(("get_dir(): `%s' \n", d_name));
+      if (!convert_compare(d_name, fname, fext, mname, mext, is_root))
 	continue;
-      if (dir_list && (entry = find_dupe(cur_ent->d_name, dir_list))) {
+      if (dir_list && (entry = find_dupe(d_name, dir_list))) {
         char buf[PATH_MAX];
-        snprintf(buf, sizeof(buf), "%s%s", name, cur_ent->d_name);
+        snprintf(buf, sizeof(buf), "%s%s", name, d_name);
         error("mfs: duplicate SFN entry %s %s\n", buf, entry->d_name);
         add_to_sfn_bl(buf);
         continue;
@@ -1306,12 +1373,12 @@ static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
       if (dir_list == NULL)
 	dir_list = make_dir_list(20);
       entry = make_entry(dir_list);
-      strcpy(entry->d_name, cur_ent->d_name);
+      strcpy(entry->d_name, d_name);
       memcpy(entry->name, fname, 8);
       memcpy(entry->ext, fext, 3);
     }
   }
-  dos_closedir(cur_dir);
+  dir_iter_close(&it);
   return (dir_list);
 }
 
@@ -1881,7 +1948,8 @@ scan_dir(const char *path, char *name, int root_len, int drive)
 {
   struct mfs_dir *cur_dir;
   struct mfs_dirent *cur_ent;
-  int maybe_mangled, is_8_3;
+  struct dircache *dc;
+  int maybe_mangled, is_8_3, i;
   char dosname[strlen(name)+1];
 
   /* handle null paths */
@@ -1907,14 +1975,32 @@ scan_dir(const char *path, char *name, int root_len, int drive)
       (dosname[1] == '\0' || strcmp(dosname, "..") == 0))
     return (FALSE);
 
+  strupperDOS(dosname);
+
+  /* look the name up in the cached listing, if there is one */
+  dc = dircache_get(path, drive);
+  if (dc) {
+    for (i = dircache_match(dc, dosname, is_8_3, maybe_mangled, 0); i != -1;
+	i = dircache_match(dc, dosname, is_8_3, maybe_mangled, i + 1)) {
+      char buf[PATH_MAX];
+
+      snprintf(buf, sizeof(buf), "%s/%s", path, dircache_name(dc, i));
+      if (in_sfn_bl(buf))
+	continue;
+
+      Debug0(("scan_dir found %s in cache\n", dircache_name(dc, i)));
+      strcpy(name, dircache_name(dc, i));
+      return (TRUE);
+    }
+    goto not_found;
+  }
+
   /* open the directory */
   if ((cur_dir = dos_opendir(path, drive)) == NULL) {
     Debug0(("scan_dir(): failed to open dir: %s\n", path));
     return (FALSE);
   }
 
-  strupperDOS(dosname);
-
   /* now scan for matching names */
   while ((cur_ent = dos_readdir(cur_dir))) {
     char tmpname[NAME_MAX + 1];
@@ -1955,6 +2041,7 @@ scan_dir(const char *path, char *name, int root_len, int drive)
 
   dos_closedir(cur_dir);
 
+not_found:
   if (MANGLE && is_mangled(name))
     check_mangled_stack(name,NULL);
 
@@ -2095,18 +2182,17 @@ compare(char *fname, char *fext, char *mname, char *mext)
   return (TRUE);
 }
 
-/* Set the long_path flag for every directory on a dir_ent list.
+/* Set the long_path flag for every entry on a dir_ent list.
    Called on FIND_FIRST when we are in a directory with a long
-   pathname. The potentially dangerous subdirectories can then be
-   handled properly.*/
+   pathname. The entries are not stat()ed yet, find_again() only
+   looks at the flag of the directories. The potentially dangerous
+   subdirectories can then be handled properly.*/
 static void set_long_path_on_dirs(struct dir_list *dir_list)
 {
   int i;
   struct dir_ent *list = &dir_list->de[0];
   for (i = 0; i < dir_list->nr_entries; i++) {
-    if (S_ISDIR(list->mode)) {
-      list->long_path = TRUE;
-    }
+    list->long_path = TRUE;
     list++;
   }
 }
@@ -2154,11 +2240,101 @@ static void free_list(struct stack_entry *se, int force)
   if (list == NULL)
     return;
 
-  free(list->de);
-  free(list);
+  put_dir_list(list);
   se->hlist = NULL;
 }
 
+/*
+ * The FindFirst listings are kept and shared between the searches
+ * with the same pattern, until the dircache reads the directory
+ * again. The stat data of the entries is filled in by find_again()
+ * and stays valid while dircache_attr_gen() doesn't change.
+ */
+#define FF_CACHE_SIZE 16
+
+static struct ff_snapshot {
+  char *path;
+  int drive;
+  char mname[8];
+  char mext[3];
+  int long_path;
+  unsigned serial;
+  unsigned lru;
+  struct dir_list *list;
+} ff_cache[FF_CACHE_SIZE];
+static unsigned ff_lru;
+
+static void ff_drop(struct ff_snapshot *ss)
+{
+  put_dir_list(ss->list);
+  ss->list = NULL;
+  free(ss->path);
+  ss->path = NULL;
+}
+
+static void ff_cache_clear(void)
+{
+  struct ff_snapshot *ss;
+
+  for (ss = ff_cache; ss < ff_cache + FF_CACHE_SIZE; ss++) {
+    if (ss->list)
+      ff_drop(ss);
+  }
+}
+
+static struct dir_list *get_dir_shared(char *name, char *mname, char *mext,
+	int drive, int long_path)
+{
+  char path[PATH_MAX];
+  struct dircache *dc = NULL;
+  struct ff_snapshot *ss, *victim = ff_cache;
+  struct dir_list *list;
+  unsigned serial = 0;
+
+  /* only the wildcard searches read the whole directory */
+  if (!is_dos_device8(mname) &&
+      (memchr(mname, '?', 8) || memchr(mext, '?', 3))) {
+    dir_cache_path(path, name);
+    dc = dircache_get(path, drive);
+  }
+  if (dc) {
+    serial = dircache_serial(dc);
+    for (ss = ff_cache; ss < ff_cache + FF_CACHE_SIZE; ss++) {
+      if (ss->list && ss->serial == serial && ss->drive == drive &&
+          ss->long_path == long_path && memcmp(ss->mname, mname, 8) == 0 &&
+          memcmp(ss->mext, mext, 3) == 0 && strcmp(ss->path, path) == 0) {
+        Debug0(("get_dir(): shared listing of '%s'\n", name));
+        ss->lru = ++ff_lru;
+        ss->list->refcnt++;
+        return ss->list;
+      }
+      if (!ss->list || (victim->list && ss->lru < victim->lru))
+        victim = ss;
+    }
+  }
+
+  list = get_dir_ff(name, mname, mext, drive);
+  if (!list)
+    return NULL;
+  if (long_path)
+    set_long_path_on_dirs(list);
+  if (dc) {
+    ss = victim;
+    if (ss->list)
+      ff_drop(ss);
+    ss->path = strdup(path);
+    ss->drive = drive;
+    memcpy(ss->mname, mname, 8);
+    memcpy(ss->mext, mext, 3);
+    ss->long_path = long_path;
+    ss->serial = serial;
+    ss->lru = ++ff_lru;
+    ss->list = list;
+    list->refcnt++;
+  }
+  return list;
+}
+
 static inline int hlist_push(struct dir_list *hlist, unsigned psp, const char *fpath)
 {
   struct stack_entry *se;
@@ -2975,15 +3151,25 @@ static int find_again(int firstfind, int drive, char *fpath,
   u_char attr;
   int hlist_index = sdb_p_cluster(sdb);
   struct dir_ent *de;
+  char path[PATH_MAX];
+  unsigned attr_gen;
+  uint64_t size;
 
   attr = sdb_attribute(sdb);
+  dir_cache_path(path, fpath);
+  attr_gen = dircache_attr_gen(path, drive);
 
   while (sdb_dir_entry(sdb) < hlist->nr_entries) {
     de = &hlist->de[sdb_dir_entry(sdb)];
     _sdb_dir_entry(sdb)++;
     Debug0(("find_again entered with %.8s.%.3s\n", de->name, de->ext));
-    fill_entry(de, fpath, drive);
+    /* the list may be shared, and filled by another search already */
+    if (!attr_gen || de->attr_gen != attr_gen) {
+      fill_entry(de, fpath, drive);
+      de->attr_gen = attr_gen;
+    }
     _sdb_file_attr(sdb) = de->attr;
+    size = de->size;
 
     if (de->mode & S_IFDIR) {
       Debug0(("Directory ---> YES 0x%x\n", de->mode));
@@ -2997,13 +3183,13 @@ static int find_again(int firstfind, int drive, char *fpath,
 	   here. Instead return the entry as a regular file.
 	*/
 	_sdb_file_attr(sdb) &= ~DIRECTORY;
-	de->size = 0; /* fake empty file */
+	size = 0; /* fake empty file */
       }
     }
     time_to_dos(de->time,
 		&_sdb_file_date(sdb),
 		&_sdb_file_time(sdb));
-    set_32bit_size_or_position(&_sdb_file_size(sdb), de->size);
+    set_32bit_size_or_position(&_sdb_file_size(sdb), size);
     strncpy(sdb_file_name(sdb), de->name, 8);
     strncpy(sdb_file_ext(sdb), de->ext, 3);
 
@@ -4204,19 +4390,17 @@ do_create_truncate:
         SETWORD(&state->eax, PATH_NOT_FOUND);
         return FALSE;
       }
-      hlist = get_dir_ff(fpath, sdb_template_name(sdb), sdb_template_ext(sdb), drive);
+      hlist = get_dir_shared(fpath, sdb_template_name(sdb),
+          sdb_template_ext(sdb), drive, long_path);
       if (hlist == NULL) {
         SETWORD(&state->eax, NO_MORE_FILES);
         return FALSE;
       }
 
-      if (long_path) {
-        set_long_path_on_dirs(hlist);
-      }
-
       hlist_index = hlist_push(hlist, sda_cur_psp(sda), fpath);
       if (hlist_index == -1) {
         /* stack exceeded */
+        put_dir_list(hlist);
         SETWORD(&state->eax, NO_MORE_FILES);
         return FALSE;
       }
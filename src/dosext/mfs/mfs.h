@@ -242,11 +242,13 @@ struct dir_ent {
   uint64_t size;		/* size of file */
   time_t time;			/* st_mtime */
   int attr;
+  unsigned attr_gen;		/* dircache_attr_gen() of the above */
 };
 
 struct dir_list {
   int nr_entries;
   int size;
+  int refcnt;
   struct dir_ent *de;
 };
 
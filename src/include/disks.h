@@ -179,6 +179,9 @@ struct disk {
   int timeout;			/* seconds between floppy timeouts */
   struct partition part_info;	/* neato partition info */
   fatfs_t *fatfs;		/* for FAT file system emulation */
+  struct disk_cache *cache;	/* block cache, see diskcache.c */
+  char *overlay;		/* COW delta of an image, see cowdisk.c */
+  struct cow_disk *cow;
   int mfs_idx;
   int part_image;               /* partition image */
 };
@@ -262,6 +265,19 @@ int read_mbr(const struct disk *dp, unsigned buffer);
 int read_sectors(const struct disk *, unsigned, uint64_t, long);
 int write_sectors(struct disk *, unsigned, uint64_t, long);
 
+void disk_cache_init(struct disk *dp);
+void disk_cache_done(struct disk *dp);
+int disk_cache_read(const struct disk *dp, unsigned buffer, off_t pos, int len);
+int disk_cache_write(struct disk *dp, unsigned buffer, off_t pos, int len);
+int disk_cache_flush(struct disk *dp);
+
+struct cow_disk *cow_open(struct disk *dp);
+void cow_close(struct cow_disk *c);
+void cow_sync(struct cow_disk *c, int wait);
+ssize_t cow_pread(struct cow_disk *c, void *buf, size_t len, off_t pos);
+int cow_read(struct cow_disk *c, unsigned buffer, off_t pos, int len);
+int cow_write(struct cow_disk *c, unsigned buffer, off_t pos, int len);
+
 void disk_open(struct disk *dp);
 int disk_is_bootable(const struct disk *dp);
 int disk_root_contains(const struct disk *dp, int file_idx);
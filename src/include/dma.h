@@ -6,5 +6,6 @@ void dma_reset(void);
 
 enum { DMA_NO_DACK, DMA_DACK };
 int dma_pulse_DRQ(int ch, Bit8u *buf);
+int dma_burst_DRQ(int ch, Bit8u *buf, int count);
 
 #endif /* DMA_H */
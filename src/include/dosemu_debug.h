@@ -52,6 +52,11 @@ int vlog_get_fd(void);
 int log_printf(const char *, ...) FORMAT(printf, 1, 2);
 int vlog_printf(const char *, va_list);
 int vlog_write(const char *buf, size_t size);
+/* formats a vlog_record(), returns the length of the text like snprintf() */
+typedef int (*vlog_decode_t)(char *buf, size_t size, const void *rec,
+    size_t len);
+int vlog_record(vlog_decode_t decode, const void *rec, size_t len);
+void vlog_flush(void);
 
 int p_dos_str(const char *, ...) FORMAT(printf, 1, 2);
 int p_dos_vstr(const char *fmt, va_list args);
@@ -157,6 +157,8 @@ typedef struct config_info {
        #define EMU_FULL() (EMU_V86() && EMU_DPMI())
        #define IS_EMU() (EMU_V86() || EMU_DPMI())
        boolean cpusim;
+       char *jit_cache;		/* file for translated code, or NULL */
+       int jit_code_size;	/* KB of translated code kept in memory */
 #endif
        int cpu_vm;
        int cpu_vm_dpmi;
@@ -200,9 +202,11 @@ typedef struct config_info {
        int     X_bilin_filt;            /* dto, bilinear */
        int     X_winsize_x;             /* initial window width */
        int     X_mode13fact;            /* initial size factor for mode 0x13 */
+       int     X_render_threads;        /* threads remapping a gfx frame */
        int     X_winsize_y;             /* initial window height */
        unsigned X_gamma;		/* gamma correction value */
        u_long vgaemu_memsize;		/* for VGA emulation */
+       char    *X_vga_dirty;		/* VGA dirty tracking backend */
        vesamode_type *vesamode_list;	/* chained list of VESA modes */
        int     X_lfb;			/* support VESA LFB modes */
        int     X_pm_interface;		/* support protected mode interface */
@@ -248,6 +252,7 @@ typedef struct config_info {
        boolean vbios_post;
 
        int  fastfloppy;
+       int  disk_cache;		/* Kb, 0 = off */
        char *emusys;		/* map CONFIG.SYS to CONFIG.EMU */
 
        u_short speaker;		/* 0 off, 1 native, 2 emulated */
@@ -340,6 +345,7 @@ typedef struct config_info {
        char *munt_roms_dir;
        char *snd_plugin_params;
        boolean pcm_hpf;
+       int pcm_resample;
        char *midi_file;
        char *wav_file;
 
@@ -25,6 +25,13 @@ typedef struct {
   void          (* write_portw)(ioport_t port, Bit16u word, void *arg);
   Bit32u        (* read_portd)(ioport_t port, void *arg);
   void          (* write_portd)(ioport_t port, Bit32u word, void *arg);
+  /* optional, for REP INS/OUTS: move up to count items of size bytes
+     at once and return how many were moved; the rest goes through the
+     handlers above */
+  Bit32u        (* read_port_rep)(ioport_t port, void *dest, int size,
+                                  Bit32u count, void *arg);
+  Bit32u        (* write_port_rep)(ioport_t port, const void *src, int size,
+                                   Bit32u count, void *arg);
   const char   *handler_name;
   ioport_t      start_addr;
   ioport_t      end_addr;
@@ -281,6 +281,7 @@ typedef struct {
   unsigned bank;			/* selected bank */
   unsigned char *dirty_map;		/* 1 == dirty */
   unsigned char *dirty_bitmap;		/* filled in by KVM */
+  unsigned redraw_gen;			/* bumped by dirty_all_video_pages() */
   unsigned char *prot_map0, *prot_map1;	/* prot flags per page */
   int planes;				/* 4 for PL4 and ModeX, 1 otherwise */
   int plane_pages;			/* pages per plane  */
@@ -544,6 +545,24 @@ void vga_emu_prot_unlock(void);
 
 void vgaemu_register_dirty_hook(int (*hook)(int, unsigned char *));
 
+/*
+ * A dirty tracker sees the guest writes by itself, so the video memory
+ * is not write-protected while one is registered.
+ * get_dirty_map() fills the bitmap of the given mapping, remapped()
+ * is called after the mapping was moved to other VGA pages.
+ */
+struct vga_dirty_tracker {
+  const char *name;
+  int (*get_dirty_map)(int mapping, unsigned char *bitmap);
+  void (*remapped)(int mapping);
+};
+void vgaemu_register_dirty_tracker(const struct vga_dirty_tracker *tracker);
+
+/*
+ * Functions defined in env/video/vgadirty.c.
+ */
+void vga_dirty_init(void);
+
 /*
  * Functions defined in env/video/vesa.c.
  */
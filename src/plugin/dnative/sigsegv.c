@@ -282,6 +282,7 @@ static void dosemu_fault1(int signum, sigcontext_t *scp, const siginfo_t *si)
       signum, _scp_trapno);
     if (!in_vm86 && !DPMIValidSelector(_scp_cs)) {
       siginfo_debug(si);
+      vlog_flush();
       _exit(43);
     } else {
       error("BUG: Fault handler re-entered not within dosemu code! in_vm86=%i\n",
@@ -352,6 +353,7 @@ static void dosemu_fault0(int signum, sigcontext_t *scp, const siginfo_t *si)
     dosemu_error("thread got signal %i, cr2=%llx\n", signum,
 	(unsigned long long)_scp_cr2);
 #endif
+    vlog_flush();
     signal(signum, SIG_DFL);
     pthread_kill(tid, signum);  // dump core
     _exit(23);
@@ -497,7 +497,8 @@ class BaseTestCase(object):
 
         return ret
 
-    def runDosemuCmdline(self, xargs, cwd=None, config=None, timeout=30):
+    def runDosemuCmdline(self, xargs, cwd=None, config=None, timeout=30,
+                         stdin=None):
         args = [str(self.dosemu),
                 "--Fimagedir", str(self.imagedir),
                 "-f", str(self.imagedir / "dosemu.conf"),
@@ -513,7 +514,8 @@ class BaseTestCase(object):
         self.logfiles['xpt'][1] = "output.log"
         ret = 'No output'
         try:
-            ret = check_output(args, cwd=cwd, timeout=timeout, stderr=STDOUT).decode('ASCII')
+            ret = check_output(args, cwd=cwd, timeout=timeout, stderr=STDOUT,
+                               stdin=stdin).decode('ASCII')
         except CalledProcessError as e:
             if e.output is not None:
                 ret = e.output.decode('ASCII')
@@ -2331,11 +2331,41 @@ asm(
 #endif
     );
 
+/* the same with data written around the code, so that the emulator
+   may check the code instead of write-protecting its page */
+asm(
+#ifdef __ELF__
+    ".section \".data\"\n"
+#endif
+    ".fill 4096, 1, 0\n"
+    "smc_data3a:\n"
+    ".fill 256, 1, 0\n"
+    "smc_code3:\n"
+    "movl 4(%esp), %eax\n"
+    "movl %eax, smc_patch_addr3 + 1\n"
+    "nop\n"
+    "nop\n"
+    "nop\n"
+    "nop\n"
+    "smc_patch_addr3:\n"
+    "movl $1, %eax\n"
+    "ret\n"
+    "smc_data3b:\n"
+    ".fill 256, 1, 0\n"
+    ".fill 4096, 1, 0\n"
+#ifdef __ELF__
+    ".previous\n"
+#endif
+    );
+
 typedef int FuncType(void);
 extern int smc_code2(int) asm("smc_code2");
+extern int smc_code3(int) asm("smc_code3");
+extern uint8_t smc_data3a[256] asm("smc_data3a");
+extern uint8_t smc_data3b[256] asm("smc_data3b");
 void test_self_modifying_code(void)
 {
-    int i;
+    int i, err;
     printf("self modifying code:\n");
     printf("func1 = 0x%x\n", ((FuncType *)code)());
     for(i = 2; i <= 4; i++) {
@@ -2349,6 +2379,17 @@ void test_self_modifying_code(void)
     for(i = 2; i <= 4; i++) {
         printf("smc_code2(%d) = %d\n", i, smc_code2(i));
     }
+
+    /* the code is patched ahead of itself many times while its page
+       is written to as data */
+    err = 0;
+    for(i = 0; i < 1000; i++) {
+        memset(smc_data3a, i, sizeof(smc_data3a));
+        memset(smc_data3b, i, sizeof(smc_data3b));
+        if (smc_code3(i) != i)
+            err++;
+    }
+    printf("smc_code3 errors = %d\n", err);
 }
 #endif
 
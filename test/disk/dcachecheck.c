@@ -0,0 +1,368 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: checks of the disk block cache in diskcache.c, on an image
+ * file with a header.
+ * - Random and sequential reads and writes of 1 to 127 sectors go
+ *   against a model of the disk, with caches of 256K, 1M and 8M. Every
+ *   read must return the model's data, and after disk_cache_done() the
+ *   image must match the model.
+ * - Sequential 4K reads, as DOS does them, with a simulated latency on
+ *   every host read. The hit rate and the use of the blocks read ahead
+ *   are taken from the cache's own statistics, and the time is compared
+ *   with plain reads from the image.
+ * - Single sector writes must not reach the image before
+ *   disk_cache_flush(), which disk_sync() and the floppy tick call,
+ *   then go out in a few large writes. disk_cache_done() must write the
+ *   rest on close.
+ *
+ * Usage: dcachecheck [latency in us]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "emu.h"
+#include "disks.h"
+#include "timers.h"
+#include "dos2linux.h"
+
+#define IMAGE_NAME "dcachecheck.img"
+#define HEADER 128		/* not a multiple of the sector size */
+#define SECS 20000
+#define SIZE (SECS * SECTOR_SIZE)
+
+static char image_name[] = IMAGE_NAME;
+static unsigned char dosmem[128 * SECTOR_SIZE];
+static unsigned char *model;
+static int latency = 100;
+static int slow;		/* add the latency to the host reads */
+static int host_reads, host_writes;
+static struct {
+    uint64_t hits, misses, ra_used, ra_blocks;
+} st;
+
+/* what diskcache.c needs from the rest of dosemu */
+hitimer_t GETusTIME(int sc)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static void delay(void)
+{
+    struct timespec t = { 0, latency * 1000 };
+
+    if (slow)
+	nanosleep(&t, NULL);
+}
+
+/* the host side, counted, and as slow as a cold disk if asked to */
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    host_reads++;
+    delay();
+    return syscall(SYS_pread64, fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    host_writes++;
+    return syscall(SYS_pwrite64, fd, buf, count, offset);
+}
+
+int dos_read(int fd, unsigned data, int cnt)
+{
+    host_reads++;
+    delay();
+    return read(fd, dosmem + data, cnt);
+}
+
+int dos_write(int fd, unsigned data, int cnt)
+{
+    host_writes++;
+    return write(fd, dosmem + data, cnt);
+}
+
+void memcpy_2dos(dosaddr_t dest, const void *src, size_t n)
+{
+    memcpy(dosmem + dest, src, n);
+}
+
+void memcpy_2unix(void *dest, dosaddr_t src, size_t n)
+{
+    memcpy(dest, dosmem + src, n);
+}
+
+void ___error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+/* adds up the statistics the cache logs under -D+d */
+int log_printf(const char *fmt, ...)
+{
+    uint64_t h, m, u, b;
+    char line[512];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (sscanf(line, "DISK: cache " IMAGE_NAME ": %" SCNu64 " hits, %" SCNu64
+	    " misses (%*u%% hit), %" SCNu64 " of %" SCNu64, &h, &m, &u, &b) == 4) {
+	st.hits += h;
+	st.misses += m;
+	st.ra_used += u;
+	st.ra_blocks += b;
+    }
+    return 0;
+}
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+
+static int open_disk(struct disk *dp, int kb)
+{
+    memset(dp, 0, sizeof(*dp));
+    dp->dev_name = image_name;
+    dp->type = IMAGE;
+    dp->header = HEADER;
+    dp->num_secs = SECS;
+    dp->fdesc = open(IMAGE_NAME, O_RDWR);
+    config.disk_cache = kb;
+    disk_cache_init(dp);
+    if (kb && !dp->cache) {
+	printf("FAIL: no cache for %s\n", IMAGE_NAME);
+	return -1;
+    }
+    memset(&st, 0, sizeof(st));
+    host_reads = host_writes = 0;
+    return 0;
+}
+
+static void close_disk(struct disk *dp)
+{
+    disk_cache_done(dp);
+    close(dp->fdesc);
+}
+
+static int image_matches(void)
+{
+    unsigned char *buf = malloc(SIZE);
+    int fd = open(IMAGE_NAME, O_RDONLY), ret;
+
+    ret = syscall(SYS_pread64, fd, buf, SIZE, HEADER) == SIZE &&
+	    memcmp(buf, model, SIZE) == 0;
+    close(fd);
+    free(buf);
+    return ret;
+}
+
+static int check_model(int kb)
+{
+    struct disk d;
+    int i, it, s, n, r, seq = 0, bad = 0;
+
+    if (open_disk(&d, kb))
+	return 1;
+    for (it = 0; it < 50000 && !bad; it++) {
+	s = rand() % SECS;
+	n = 1 + rand() % 127;
+	if (rand() % 4 == 0) {
+	    s = seq;
+	    seq = (seq + n) % (SECS - 128);
+	}
+	if (s + n > SECS)
+	    n = SECS - s;
+	if (rand() % 3 == 0) {
+	    for (i = 0; i < n * SECTOR_SIZE; i++)
+		dosmem[i] = rand();
+	    r = disk_cache_write(&d, 0, HEADER + s * (off_t)SECTOR_SIZE,
+		    n * SECTOR_SIZE);
+	    memcpy(model + s * SECTOR_SIZE, dosmem, n * SECTOR_SIZE);
+	} else {
+	    r = disk_cache_read(&d, 0, HEADER + s * (off_t)SECTOR_SIZE,
+		    n * SECTOR_SIZE);
+	    if (r == n * SECTOR_SIZE &&
+		    memcmp(dosmem, model + s * SECTOR_SIZE, r) != 0)
+		r = -1;
+	}
+	if (r != n * SECTOR_SIZE) {
+	    printf("FAIL: %iK cache, request %i at sector %i, %i sectors\n",
+		    kb, it, s, n);
+	    bad++;
+	}
+	if (rand() % 500 == 0)
+	    disk_cache_flush(&d);
+    }
+    close_disk(&d);
+    if (!image_matches()) {
+	printf("FAIL: %iK cache, the image differs after the close\n", kb);
+	bad++;
+    }
+    printf("%4iK cache: %i requests, %" PRIu64 "%% hit\n", kb, it,
+	    st.hits * 100 / (st.hits + st.misses ?: 1));
+    return bad;
+}
+
+/* two passes of 4K reads over the disk, returns the time in ms */
+static double seq_reads(int kb)
+{
+    struct disk d;
+    hitimer_t t0;
+    off_t pos;
+    int pass, s;
+
+    open_disk(&d, kb);
+    slow = 1;
+    t0 = GETusTIME(0);
+    for (pass = 0; pass < 2; pass++) {
+	for (s = 0; s + 8 <= SECS; s += 8) {
+	    pos = HEADER + s * (off_t)SECTOR_SIZE;
+	    if (d.cache) {
+		disk_cache_read(&d, 0, pos, 8 * SECTOR_SIZE);
+	    } else {
+		lseek(d.fdesc, pos, SEEK_SET);
+		dos_read(d.fdesc, 0, 8 * SECTOR_SIZE);
+	    }
+	}
+    }
+    t0 = GETusTIME(0) - t0;
+    slow = 0;
+    close_disk(&d);
+    return t0 / 1000.0;
+}
+
+static int check_read_ahead(void)
+{
+    double plain, cached;
+    int plain_reads, bad = 0;
+
+    plain = seq_reads(0);
+    plain_reads = host_reads;
+    /* a cache smaller than the disk, so the second pass misses too */
+    cached = seq_reads(1024);
+    printf("sequential 4K reads, %ius a host read: %.1f ms in %i reads "
+	    "plain, %.1f ms in %i reads cached\n", latency, plain,
+	    plain_reads, cached, host_reads);
+    printf("  %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " of %" PRIu64
+	    " blocks read ahead used\n", st.hits, st.misses, st.ra_used,
+	    st.ra_blocks);
+    if (st.hits < st.misses * 8 || st.ra_used < st.ra_blocks * 9 / 10) {
+	printf("FAIL: read-ahead does not keep up\n");
+	bad++;
+    }
+    if (host_reads * 4 > plain_reads) {
+	printf("FAIL: the cache does not merge the host reads\n");
+	bad++;
+    }
+    return bad;
+}
+
+static int check_write_behind(void)
+{
+    struct disk d;
+    int s, writes, bad = 0;
+
+    if (open_disk(&d, 8192))
+	return 1;
+    /* one sector at a time over 1M */
+    for (s = 0; s < 2048; s++) {
+	memset(dosmem, s, SECTOR_SIZE);
+	disk_cache_write(&d, 0, HEADER + s * (off_t)SECTOR_SIZE, SECTOR_SIZE);
+	memcpy(model + s * SECTOR_SIZE, dosmem, SECTOR_SIZE);
+    }
+    if (host_writes || image_matches()) {
+	printf("FAIL: %i writes reached the image before the flush\n",
+		host_writes);
+	bad++;
+    }
+    disk_cache_flush(&d);
+    writes = host_writes;
+    if (!image_matches()) {
+	printf("FAIL: the image differs after disk_cache_flush()\n");
+	bad++;
+    }
+
+    /* every other sector, left for the close */
+    for (s = 4096; s < 6144; s += 2) {
+	memset(dosmem, ~s, SECTOR_SIZE);
+	disk_cache_write(&d, 0, HEADER + s * (off_t)SECTOR_SIZE, SECTOR_SIZE);
+	memcpy(model + s * SECTOR_SIZE, dosmem, SECTOR_SIZE);
+    }
+    close_disk(&d);
+    if (!image_matches()) {
+	printf("FAIL: the image differs after disk_cache_done()\n");
+	bad++;
+    }
+    printf("2048 sector writes flushed in %i host writes, "
+	    "1024 scattered ones written on close in %i\n", writes,
+	    host_writes - writes);
+    if (writes > 2048 / 128) {
+	printf("FAIL: the flush is not merged\n");
+	bad++;
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = { 256, 1024, 8192 };
+    int i, fd, bad = 0;
+
+    if (argc > 1)
+	latency = atoi(argv[1]);
+    debug_levels['d'] = 1;
+    model = malloc(SIZE);
+    for (i = 0; i < SIZE; i++)
+	model[i] = rand();
+    fd = open(IMAGE_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+	perror(IMAGE_NAME);
+	return 1;
+    }
+    if (write(fd, "header", 6) != 6 ||
+	    syscall(SYS_pwrite64, fd, model, SIZE, HEADER) != SIZE) {
+	perror(IMAGE_NAME);
+	return 1;
+    }
+    close(fd);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	bad += check_model(sizes[i]);
+    fflush(stdout);
+    bad += check_read_ahead();
+    fflush(stdout);
+    bad += check_write_behind();
+
+    unlink(IMAGE_NAME);
+    printf("%s: %i errors\n", bad ? "FAIL" : "OK", bad);
+    return !!bad;
+}
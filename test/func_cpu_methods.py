@@ -3,7 +3,7 @@ from shutil import copy
 from difflib import unified_diff
 
 
-def _dotest(self, cpu_vm, cpu_vm_dpmi):
+def _dotest(self, cpu_vm, cpu_vm_dpmi, extra=""):
 
     if (('jit' in cpu_vm and 'sim' in cpu_vm_dpmi) or
             ('sim' in cpu_vm and 'jit' in cpu_vm_dpmi)):
@@ -56,7 +56,7 @@ $_cpu_vm = "%s"
 $_cpu_vm_dpmi = "%s"
 $_cpuemu = (%i)
 $_ignore_djgpp_null_derefs = (off)
-"""%(cpu_vm, cpu_vm_dpmi, cpu_emu))
+%s"""%(cpu_vm, cpu_vm_dpmi, cpu_emu, extra))
 
     try:
         with dosfile.open("r") as f:
@@ -111,6 +111,12 @@ def create_test(test):
     return do_test
 
 
+def cpu_jit_eviction(self):
+    # 64K of translated code does not hold the test, so the code is
+    # evicted and translated again all the time
+    _dotest(self, 'jit', 'jit', extra="$_jit_code_size = (64)\n")
+
+
 def cpu_create_items(testcase):
     # Insert each test into the testcase
     for test in TESTS:
@@ -0,0 +1,57 @@
+from fcntl import flock, LOCK_EX, LOCK_UN
+from hashlib import sha256
+
+
+def disk_overlay(self):
+
+    testdir = self.mkworkdir('d')
+    (testdir / "base.txt").write_text("base data\r\n")
+    name = self.mkimage("12", cwd=testdir)
+    image = self.imagedir / name
+    before = sha256(image.read_bytes()).hexdigest()
+    ovldir = self.mkworkdir('ovl')
+
+    config = """\
+$_hdimage = "dXXXXs/c:hdtype1 %s +1"
+$_floppy_a = ""
+$_hdimage_overlay = "%s"
+""" % (name, ovldir)
+
+# First session writes through the overlay and reads it back
+    self.mkfile("testit.bat", """\
+d:
+echo overlay data>new.txt
+echo more data>>base.txt
+type new.txt
+type base.txt
+rem end
+""", newline="\r\n")
+
+    results = self.runDosemu("testit.bat", config=config)
+    self.assertIn("overlay data", results)
+    self.assertRegex(results, r"base data[\r\n]+more data")
+    self.assertEqual(sha256(image.read_bytes()).hexdigest(), before,
+                     "image written through the overlay")
+    deltas = list(ovldir.glob(name + ".*.cow"))
+    self.assertEqual(len(deltas), 1, deltas)
+
+# Second session finds the writes of the first in the delta
+    self.mkfile("testit.bat", """\
+d:
+type new.txt
+type base.txt
+rem end
+""", newline="\r\n")
+
+    results = self.runDosemu("testit.bat", config=config)
+    self.assertIn("overlay data", results)
+    self.assertRegex(results, r"base data[\r\n]+more data")
+
+# A delta in use by another session is refused
+    with open(deltas[0], "rb") as f:
+        flock(f, LOCK_EX)
+        self.runDosemu("testit.bat", config=config, eofisok=True)
+        flock(f, LOCK_UN)
+    log = self.logfiles['log'][0].read_text()
+    self.assertIn("is used by another dosemu", log)
+    self.assertEqual(sha256(image.read_bytes()).hexdigest(), before)
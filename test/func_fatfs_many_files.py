@@ -0,0 +1,176 @@
+
+def fatfs_many_files(self, count):
+
+    testdir = self.mkworkdir('d')
+    (testdir / "many").mkdir()
+    for i in range(count):
+        (testdir / "many" / ("f%05d.txt" % i)).write_text("file %05d\r\n" % i)
+
+    self.mkfile("testit.bat", """\
+c:\\fatmany %d
+rem end
+""" % count, newline="\r\n")
+
+# Walk the FAT of the directory drive through int13, the way a DOS
+# reading the disk itself does, instead of through the MFS redirection
+    self.mkexe_with_djgpp("fatmany", r"""
+#include <dpmi.h>
+#include <go32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/movedata.h>
+
+#define DRIVE 0x81
+
+static unsigned char sect[512];
+static unsigned char *fat;
+static unsigned part, fat_start, root_start, data_start;
+static unsigned spc, root_ents, fat_size, fat12;
+
+static int read_sect(unsigned lba, void *buf)
+{
+  __dpmi_regs r;
+  unsigned char dap[16] = { 16, 0, 1, 0 };
+
+  *(unsigned short *)(dap + 4) = (__tb & 15) + 16;
+  *(unsigned short *)(dap + 6) = __tb >> 4;
+  *(unsigned *)(dap + 8) = lba;
+  *(unsigned *)(dap + 12) = 0;
+  dosmemput(dap, sizeof(dap), __tb);
+  memset(&r, 0, sizeof(r));
+  r.h.ah = 0x42;
+  r.h.dl = DRIVE;
+  r.x.ds = __tb >> 4;
+  r.x.si = __tb & 15;
+  __dpmi_int(0x13, &r);
+  if (r.x.flags & 1)
+    return -1;
+  dosmemget(__tb + 16, 512, buf);
+  return 0;
+}
+
+static unsigned next_cluster(unsigned c)
+{
+  unsigned v;
+
+  if (!fat12)
+    return *(unsigned short *)(fat + c * 2);
+  v = *(unsigned short *)(fat + c * 3 / 2);
+  return (c & 1) ? v >> 4 : v & 0xfff;
+}
+
+static int is_eoc(unsigned c)
+{
+  return c < 2 || c >= (fat12 ? 0xff8 : 0xfff8);
+}
+
+static unsigned clu_lba(unsigned c)
+{
+  return data_start + (c - 2) * spc;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char dent[32];
+  unsigned i, j, c, lba, many = 0, entries = 0, bad = 0, tot;
+  int count = atoi(argv[1]);
+  int seen[3] = { -1, -1, -1 };
+  unsigned clu[3], size[3];
+  char want[3][12];
+  clock_t t0 = clock();
+
+  if (read_sect(0, sect)) {
+    printf("FAIL: MBR not read\n");
+    return 1;
+  }
+  part = *(unsigned *)(sect + 0x1be + 8);
+  if (read_sect(part, sect)) {
+    printf("FAIL: boot sector not read\n");
+    return 1;
+  }
+  spc = sect[13];
+  fat_start = part + *(unsigned short *)(sect + 14);
+  root_ents = *(unsigned short *)(sect + 17);
+  fat_size = *(unsigned short *)(sect + 22);
+  tot = *(unsigned short *)(sect + 19);
+  if (!tot)
+    tot = *(unsigned *)(sect + 32);
+  root_start = fat_start + sect[16] * fat_size;
+  data_start = root_start + root_ents * 32 / 512;
+  fat12 = (tot - (data_start - part)) / spc < 4085;
+
+  fat = malloc(fat_size * 512 + 1);
+  for (i = 0; i < fat_size; i++) {
+    if (read_sect(fat_start + i, fat + i * 512)) {
+      printf("FAIL: FAT sector %u not read\n", i);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < root_ents * 32 / 512 && !many; i++) {
+    read_sect(root_start + i, sect);
+    for (j = 0; j < 512; j += 32) {
+      if (memcmp(sect + j, "MANY       ", 11) == 0 && (sect[j + 11] & 0x10))
+        many = *(unsigned short *)(sect + j + 26);
+    }
+  }
+  if (!many) {
+    printf("FAIL: MANY not in the root directory\n");
+    return 1;
+  }
+
+  sprintf(want[0], "F%05d  TXT", 0);
+  sprintf(want[1], "F%05d  TXT", count / 2);
+  sprintf(want[2], "F%05d  TXT", count - 1);
+  for (c = many; !is_eoc(c); c = next_cluster(c)) {
+    for (lba = clu_lba(c); lba < clu_lba(c) + spc; lba++) {
+      read_sect(lba, sect);
+      for (j = 0; j < 512; j += 32) {
+        memcpy(dent, sect + j, 32);
+        if (dent[0] == 0 || dent[0] == 0xe5 || dent[0] == '.' ||
+            dent[11] == 0x0f || (dent[11] & 0x18))
+          continue;
+        entries++;
+        for (i = 0; i < 3; i++) {
+          if (memcmp(dent, want[i], 11) == 0) {
+            seen[i] = entries;
+            clu[i] = *(unsigned short *)(dent + 26);
+            size[i] = *(unsigned *)(dent + 28);
+          }
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < 3; i++) {
+    char expect[32];
+    int num = (i == 0 ? 0 : i == 1 ? count / 2 : count - 1);
+
+    sprintf(expect, "file %05d\r\n", num);
+    if (seen[i] == -1) {
+      printf("FAIL: %.11s not found\n", want[i]);
+      bad++;
+      continue;
+    }
+    if (size[i] != strlen(expect) || read_sect(clu_lba(clu[i]), sect) ||
+        memcmp(sect, expect, strlen(expect)) != 0) {
+      printf("FAIL: %.11s has wrong contents\n", want[i]);
+      bad++;
+    }
+  }
+
+  printf("FAT%d, %u entries, %u errors, %.2f s\n", fat12 ? 12 : 16,
+         entries, bad, (double)(clock() - t0) / CLOCKS_PER_SEC);
+  return 0;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d +1"
+$_floppy_a = ""
+""")
+
+    self.assertNotIn("FAIL", results)
+    self.assertRegex(results, r"FAT\d+, %d entries, 0 errors" % count)
@@ -0,0 +1,127 @@
+import re
+
+
+def memory_dpmi_many_blocks(self, calls, live):
+
+    self.mkfile("testit.bat", """\
+c:\\dpmimany %d %d
+rem end
+""" % (calls, live), newline="\r\n")
+
+    self.mkexe_with_djgpp("dpmimany", r"""
+#include <dpmi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/farptr.h>
+
+#define BLKSIZE 4096
+
+static unsigned long *handle, *addr;
+static unsigned seed = 12345;
+
+static unsigned rnd(unsigned n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+/* 0x50a: get memory block size and base, looks the block up by handle */
+static int get_block(unsigned long h, unsigned long *base, unsigned long *size)
+{
+  unsigned int ax = 0x050a, bx, cx, si = h >> 16, di = h & 0xffff;
+
+  asm volatile("int $0x31\n"
+               "sbbl %%eax, %%eax\n"
+               : "+a"(ax), "=b"(bx), "=c"(cx), "+S"(si), "+D"(di)
+               :
+               : "cc", "memory");
+  *base = ((bx & 0xffff) << 16) | (cx & 0xffff);
+  *size = ((si & 0xffff) << 16) | (di & 0xffff);
+  return ax ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  __dpmi_meminfo info;
+  unsigned long base, size;
+  unsigned calls = atoi(argv[1]), live = atoi(argv[2]);
+  unsigned i, n, allocs = 0, frees = 0, lookups = 0, errors = 0;
+  int flat;
+  clock_t t0;
+
+  handle = calloc(live, sizeof(*handle));
+  addr = calloc(live, sizeof(*addr));
+  flat = __dpmi_allocate_ldt_descriptors(1);
+  if (flat == -1 || __dpmi_set_segment_base_address(flat, 0) == -1 ||
+      __dpmi_set_segment_limit(flat, 0xffffffff) == -1) {
+    printf("FAIL: no flat selector\n");
+    return 1;
+  }
+
+  t0 = clock();
+  for (n = 0; allocs + frees < calls; n++) {
+    i = (n < live ? n : rnd(live));
+    if (handle[i]) {
+      if (_farpeekl(flat, addr[i]) != handle[i]) {
+        printf("FAIL: block %lx lost its data\n", handle[i]);
+        errors++;
+      }
+      if (__dpmi_free_memory(handle[i]) == -1) {
+        printf("FAIL: free of %lx\n", handle[i]);
+        errors++;
+      }
+      frees++;
+    }
+    info.size = BLKSIZE;
+    if (__dpmi_allocate_memory(&info) == -1) {
+      printf("FAIL: allocation %u\n", allocs);
+      return 1;
+    }
+    allocs++;
+    handle[i] = info.handle;
+    addr[i] = info.address;
+    _farpokel(flat, addr[i], handle[i]);
+
+    /* look up another live block by its handle */
+    i = rnd(n < live ? n + 1 : live);
+    if (get_block(handle[i], &base, &size) == -1 || base != addr[i] ||
+        size != BLKSIZE) {
+      printf("FAIL: lookup of %lx\n", handle[i]);
+      errors++;
+    }
+    lookups++;
+  }
+
+  for (n = 0; n < live; n++) {
+    i = (n * 7919) % live;
+    if (!handle[i])
+      continue;
+    if (_farpeekl(flat, addr[i]) != handle[i])
+      errors++;
+    if (__dpmi_free_memory(handle[i]) == -1)
+      errors++;
+    frees++;
+    if (get_block(handle[i], &base, &size) != -1) {
+      printf("FAIL: freed block %lx still found\n", handle[i]);
+      errors++;
+    }
+    handle[i] = 0;
+  }
+
+  printf("%u allocs, %u frees, %u lookups, %u errors in %.2f s\n",
+         allocs, frees, lookups, errors,
+         (double)(clock() - t0) / CLOCKS_PER_SEC);
+  return 0;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 +1"
+$_floppy_a = ""
+""", timeout=120)
+
+    self.assertNotIn("FAIL", results)
+    m = re.search(r'(\d+) allocs, (\d+) frees, (\d+) lookups, 0 errors', results)
+    self.assertIsNotNone(m, results)
+    self.assertEqual(m.group(1), m.group(2))
@@ -95,3 +95,116 @@ int main(void) {
     for name in names:
         with self.subTest(t=name):
             self.assertIn(name, results)
+
+
+def mfs_findfile_cached(self, nametype, longname):
+
+    if nametype == "LFN":
+        disablelfn = ""
+    elif nametype == "SFN":
+        disablelfn = "set LFN=n"
+    else:
+        raise ValueError("Incorrect argument")
+
+    testdir = self.mkworkdir('d')
+    (testdir / "first.txt").write_text("Some data")
+    (testdir / "verylongfilename.txt").write_text("Some data")
+
+    self.mkfile("testit.bat", """\
+%s
+d:
+c:\\mfscache %s
+rem end
+""" % (disablelfn, longname), newline="\r\n")
+
+# Repeated searches and case-insensitive opens are served from the
+# listing and directory caches, changes in between must show up
+    self.mkexe_with_djgpp("mfscache", r"""
+#include <dir.h>
+#include <stdio.h>
+#include <string.h>
+
+static int fails;
+
+static int listed(const char *name, long *size)
+{
+  struct ffblk f;
+  int found = 0;
+
+  int done = findfirst("*.TXT", &f, 0);
+  while (!done) {
+    if (strcasecmp(f.ff_name, name) == 0) {
+      found = 1;
+      if (size)
+        *size = f.ff_fsize;
+    }
+    done = findnext(&f);
+  }
+  return found;
+}
+
+static int can_open(const char *name)
+{
+  FILE *f = fopen(name, "rb");
+
+  if (!f)
+    return 0;
+  fclose(f);
+  return 1;
+}
+
+static void check(int cond, const char *what)
+{
+  printf("%s %s\n", cond ? "OK" : "FAIL", what);
+  if (!cond)
+    fails++;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *f;
+  long size = 0;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    check(listed("first.txt", NULL), "initial listing");
+  check(listed(argv[1], NULL), "long name listed");
+  check(can_open("FIRST.TXT"), "case insensitive open");
+  check(can_open(argv[1]), "long name opens");
+  check(!listed("new.txt", NULL), "new file not listed before create");
+  check(!can_open("NEW.TXT"), "new file does not open before create");
+
+  f = fopen("new.txt", "wb");
+  fputs("x", f);
+  fclose(f);
+  check(listed("new.txt", NULL), "created file listed");
+  check(can_open("NEW.TXT"), "created file opens");
+
+  check(rename("new.txt", "renamed.txt") == 0, "rename");
+  check(!listed("new.txt", NULL), "old name not listed after rename");
+  check(listed("renamed.txt", NULL), "new name listed after rename");
+  check(!can_open("NEW.TXT"), "old name does not open after rename");
+  check(can_open("RENAMED.TXT"), "new name opens after rename");
+
+  f = fopen("first.txt", "ab");
+  fputs("more data", f);
+  fclose(f);
+  check(listed("first.txt", &size) && size == 18, "size updated after write");
+
+  check(remove("renamed.txt") == 0, "delete");
+  check(!listed("renamed.txt", NULL), "deleted file not listed");
+  check(!can_open("RENAMED.TXT"), "deleted file does not open");
+
+  printf("%d failures\n", fails);
+  return 0;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d:hdtype1 +1"
+$_floppy_a = ""
+""")
+
+    self.assertNotIn("FAIL", results)
+    self.assertIn("0 failures", results)
+    self.assertFalse((testdir / "renamed.txt").exists())
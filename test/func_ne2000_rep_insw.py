@@ -0,0 +1,296 @@
+import re
+from sys import stderr
+
+from common_framework import setup_tap_interface, teardown_tap_interface
+
+
+def ne2000_rep_insw(self, bench):
+    setup_tap_interface(self)
+    self.addCleanup(teardown_tap_interface, self)
+
+    self.mkfile("testit.bat", """\
+c:\\nerepin%s
+rem end
+""" % (" bench" if bench else ""), newline="\r\n")
+
+# Drive the remote DMA of the card directly, the receiver stays stopped
+# so that no incoming packet lands in the ring while it is checked
+    self.mkcom_with_ia16("nerepin", r"""
+#include <dos.h>
+#include <stdio.h>
+#include <string.h>
+#include <conio.h>
+
+#define BASE 0x310
+#define CMD (BASE + 0x00)
+#define PSTART (BASE + 0x01)
+#define PSTOP (BASE + 0x02)
+#define ISR (BASE + 0x07)
+#define RSARLO (BASE + 0x08)
+#define RSARHI (BASE + 0x09)
+#define RCNTLO (BASE + 0x0a)
+#define RCNTHI (BASE + 0x0b)
+#define DCFG (BASE + 0x0e)
+#define IMR (BASE + 0x0f)
+#define DATA (BASE + 0x10)
+#define RESET (BASE + 0x1f)
+
+#define CMD_STOP 0x01
+#define CMD_RREAD 0x08
+#define CMD_RWRITE 0x10
+#define CMD_NODMA 0x20
+#define ISR_RDC 0x40
+
+#define RING_START 0x4000
+#define RING_STOP 0x8000
+#define CHUNK 4096              /* words */
+
+#define IRQ_VEC 0x72            /* IRQ 10 */
+
+static unsigned short buf[CHUNK];
+
+void __far __interrupt (*oldvec)(void);
+
+volatile unsigned int irq_count;
+volatile unsigned char irq_isr;
+
+void __far __interrupt __attribute__ ((near_section)) ne_irq(void); /* Prototype */
+__asm (
+  "ne_irq:\n"
+  "  pushw %ax\n"
+  "  pushw %dx\n"
+  "  pushw %ds\n"
+  "  pushw %cs\n"
+  "  popw  %ds\n"
+  "  incw  irq_count\n"
+  "  movw  $0x317, %dx\n"       /* ISR */
+  "  inb   %dx, %al\n"
+  "  movb  %al, irq_isr\n"
+  "  movw  $0x31f, %dx\n"       /* IMR, no more interrupts */
+  "  xorb  %al, %al\n"
+  "  outb  %al, %dx\n"
+  "  movb  $0x20, %al\n"
+  "  outb  %al, $0xa0\n"
+  "  outb  %al, $0x20\n"
+  "  popw  %ds\n"
+  "  popw  %dx\n"
+  "  popw  %ax\n"
+  "  iretw\n"
+);
+
+static void rep_insw(unsigned short *dst, unsigned int count)
+{
+  asm volatile("cld\n"
+               "rep insw\n"
+               : "+D"(dst), "+c"(count)
+               : "d"(DATA)
+               : "memory");
+}
+
+static void rep_outsw(const unsigned short *src, unsigned int count)
+{
+  asm volatile("cld\n"
+               "rep outsw\n"
+               : "+S"(src), "+c"(count)
+               : "d"(DATA)
+               : "memory");
+}
+
+/* one port access per word, the path without the bulk transfer */
+static void loop_insw(unsigned short *dst, unsigned int count)
+{
+  while (count--)
+    *dst++ = inpw(DATA);
+}
+
+static unsigned long ticks(void)
+{
+  unsigned int cx, dx;
+
+  asm volatile("int $0x1a\n"
+               : "=c"(cx), "=d"(dx)
+               : "a"(0)
+               : "cc");
+  return ((unsigned long)cx << 16) | dx;
+}
+
+static unsigned short pattern(unsigned int addr)
+{
+  return (addr >> 1) ^ 0xa55a;
+}
+
+static void remote_dma(unsigned int addr, unsigned int len, unsigned char op)
+{
+  outp(CMD, CMD_STOP | CMD_NODMA);
+  outp(RSARLO, addr & 0xff);
+  outp(RSARHI, addr >> 8);
+  outp(RCNTLO, len & 0xff);
+  outp(RCNTHI, len >> 8);
+  outp(ISR, ISR_RDC);
+  outp(CMD, CMD_STOP | op);
+}
+
+static void wait_irq(void)
+{
+  unsigned long t0 = ticks();
+
+  while (!irq_count && ticks() - t0 < 18)
+    ;
+}
+
+static int check_wrap(void)
+{
+  unsigned int i, addr, bad = 0;
+  unsigned char isr;
+
+  /* start 256 bytes before the ring stop, 256 more come from the start */
+  remote_dma(RING_STOP - 256, 512, CMD_RREAD);
+  irq_count = 0;
+  outp(IMR, ISR_RDC);
+  rep_insw(buf, 255);
+  isr = inp(ISR);
+  if (isr & ISR_RDC) {
+    printf("FAIL: RDC before the last word (ISR %02x)\n", isr);
+    bad++;
+  }
+  if (irq_count) {
+    printf("FAIL: IRQ before the last word\n");
+    bad++;
+  }
+  rep_insw(buf + 255, 1);
+  isr = inp(ISR);
+  if (!(isr & ISR_RDC)) {
+    printf("FAIL: no RDC after the last word (ISR %02x)\n", isr);
+    bad++;
+  }
+  wait_irq();
+  if (irq_count != 1 || !(irq_isr & ISR_RDC)) {
+    printf("FAIL: %u IRQs after the last word (ISR %02x)\n",
+           irq_count, irq_isr);
+    bad++;
+  }
+  outp(IMR, 0);
+
+  for (i = 0; i < 256; i++) {
+    addr = (i < 128 ? RING_STOP - 256 : RING_START - 256) + i * 2;
+    if (buf[i] != pattern(addr)) {
+      printf("FAIL: word %u is %04x, expected %04x\n",
+             i, buf[i], pattern(addr));
+      bad++;
+      break;
+    }
+  }
+  outp(CMD, CMD_STOP | CMD_NODMA);
+  i = inp(RSARLO) | (inp(RSARHI) << 8);
+  if (i != RING_START + 256) {
+    printf("FAIL: remote address %04x after the wrap\n", i);
+    bad++;
+  }
+  return bad;
+}
+
+static int check_bulk(void)
+{
+  unsigned int i, j, bad = 0;
+
+  /* the whole ring in one go, as the drivers read a packet */
+  remote_dma(RING_START, RING_STOP - RING_START, CMD_RREAD);
+  for (i = 0; i < (RING_STOP - RING_START) / 2; i += CHUNK) {
+    rep_insw(buf, CHUNK);
+    for (j = 0; j < CHUNK; j++) {
+      if (buf[j] != pattern(RING_START + (i + j) * 2)) {
+        printf("FAIL: bulk word %u is %04x\n", i + j, buf[j]);
+        return 1;
+      }
+    }
+    if ((inp(ISR) & ISR_RDC) != (i + CHUNK < (RING_STOP - RING_START) / 2 ?
+                                  0 : ISR_RDC)) {
+      printf("FAIL: RDC wrong after %u words\n", i + CHUNK);
+      bad++;
+    }
+  }
+  return bad;
+}
+
+static void bench(const char *name, void (*fn)(unsigned short *, unsigned int))
+{
+  unsigned long t0, t, kb = 0;
+
+  t0 = ticks();
+  while ((t = ticks()) == t0)
+    ;
+  t0 = t;
+  do {
+    remote_dma(RING_START, CHUNK * 2, CMD_RREAD);
+    fn(buf, CHUNK);
+    kb += CHUNK * 2 / 1024;
+  } while (ticks() - t0 < 36);
+  t = ticks() - t0;
+  printf("%s: %lu KiB in %lu ticks, %lu KiB/s\n", name, kb, t,
+         kb * 182 / (t * 10));
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int i, j, bad = 0;
+
+  inp(RESET);
+  outp(RESET, 0);
+  outp(CMD, CMD_STOP | CMD_NODMA);
+  outp(DCFG, 0x49);             /* word transfers */
+  outp(PSTART, RING_START >> 8);
+  outp(PSTOP, RING_STOP >> 8);
+  outp(IMR, 0);
+  outp(ISR, 0xff);
+
+  oldvec = _dos_getvect(IRQ_VEC);
+  _dos_setvect(IRQ_VEC, ne_irq);
+  outp(0xa1, inp(0xa1) & ~0x04);
+  outp(0x21, inp(0x21) & ~0x04);
+
+  remote_dma(RING_START, RING_STOP - RING_START, CMD_RWRITE);
+  for (i = 0; i < (RING_STOP - RING_START) / 2; i += CHUNK) {
+    for (j = 0; j < CHUNK; j++)
+      buf[j] = pattern(RING_START + (i + j) * 2);
+    rep_outsw(buf, CHUNK);
+  }
+  if (!(inp(ISR) & ISR_RDC)) {
+    printf("FAIL: no RDC after the remote write\n");
+    bad++;
+  }
+
+  bad += check_bulk();
+  bad += check_wrap();
+
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    bench("rep insw", rep_insw);
+    bench("insw loop", loop_insw);
+  }
+
+  outp(IMR, 0);
+  outp(ISR, 0xff);
+  outp(0xa1, inp(0xa1) | 0x04);
+  _dos_setvect(IRQ_VEC, oldvec);
+
+  printf("%s: %u errors\n", bad ? "FAIL" : "OK", bad);
+  return bad;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 +1"
+$_floppy_a = ""
+$_ne2k = (on)
+$_vnet = "tap"
+$_tapdev = "tap0"
+""", timeout=60)
+
+    self.assertNotIn("FAIL", results)
+    self.assertIn("OK: 0 errors", results)
+    if bench:
+        self.assertRegex(results, r"rep insw: \d+ KiB in \d+ ticks")
+        self.assertRegex(results, r"insw loop: \d+ KiB in \d+ ticks")
+        for m in re.finditer(r"(.*): (\d+) KiB in (\d+) ticks, (\d+) KiB/s",
+                             results):
+            stderr.write("\n%s: %s KiB/s " % (m.group(1), m.group(4)))
+        stderr.flush()
@@ -0,0 +1,174 @@
+import re
+
+
+def serial_loopback(self, count):
+
+    self.mkfile("testit.bat", """\
+c:\\serloop %d
+rem end
+""" % count, newline="\r\n")
+
+# COM1 and COM2 are joined by a null modem cable. The UART loopback of
+# COM1 is checked first, then a stream goes from COM1 to COM2 through
+# the transmit buffer and the receive ring.
+    self.mkcom_with_ia16("serloop", r"""
+#include <stdio.h>
+#include <stdlib.h>
+#include <conio.h>
+
+#define COM1 0x3f8
+#define COM2 0x2f8
+
+#define THR 0
+#define RBR 0
+#define DLL 0
+#define IER 1
+#define DLM 1
+#define FCR 2
+#define LCR 3
+#define MCR 4
+#define LSR 5
+
+#define LSR_DR 0x01
+#define LSR_OE 0x02
+#define LSR_THRE 0x20
+#define MCR_DTR 0x01
+#define MCR_RTS 0x02
+#define MCR_LOOP 0x10
+
+static unsigned long ticks(void)
+{
+  unsigned int cx, dx;
+
+  asm volatile("int $0x1a\n"
+               : "=c"(cx), "=d"(dx)
+               : "a"(0)
+               : "cc");
+  return ((unsigned long)cx << 16) | dx;
+}
+
+static void port_init(unsigned int base)
+{
+  outp(base + IER, 0);
+  outp(base + LCR, 0x80);
+  outp(base + DLL, 1);          /* 115200 */
+  outp(base + DLM, 0);
+  outp(base + LCR, 0x03);       /* 8N1 */
+  outp(base + FCR, 0xc7);       /* FIFO on and cleared, trigger at 14 */
+  outp(base + MCR, MCR_DTR | MCR_RTS);
+  inp(base + LSR);
+  while (inp(base + LSR) & LSR_DR)
+    inp(base + RBR);
+}
+
+static unsigned char pattern(unsigned long i)
+{
+  return (i * 7) ^ (i >> 8) ^ (i >> 16);
+}
+
+static int check_loop(void)
+{
+  unsigned int i, j, bad = 0;
+  unsigned long t0;
+  unsigned char c;
+
+  outp(COM1 + MCR, MCR_LOOP);
+  for (i = 0; i < 4096 && !bad; i += 8) {
+    for (j = 0; j < 8; j++) {
+      t0 = ticks();
+      while (!(inp(COM1 + LSR) & LSR_THRE))
+        if (ticks() - t0 > 18) {
+          printf("FAIL: loopback THR stuck at %u\n", i + j);
+          return 1;
+        }
+      outp(COM1 + THR, pattern(i + j));
+    }
+    for (j = 0; j < 8; j++) {
+      t0 = ticks();
+      while (!(inp(COM1 + LSR) & LSR_DR))
+        if (ticks() - t0 > 18) {
+          printf("FAIL: loopback byte %u missing\n", i + j);
+          return 1;
+        }
+      c = inp(COM1 + RBR);
+      if (c != pattern(i + j)) {
+        printf("FAIL: loopback byte %u is %02x\n", i + j, c);
+        bad++;
+        break;
+      }
+    }
+  }
+  if (inp(COM1 + LSR) & (LSR_DR | LSR_OE)) {
+    printf("FAIL: loopback left data or overrun\n");
+    bad++;
+  }
+  outp(COM1 + MCR, MCR_DTR | MCR_RTS);
+  return bad;
+}
+
+static int check_nullmodem(unsigned long count)
+{
+  unsigned long sent = 0, recv = 0, t0 = ticks(), last = t0;
+  unsigned int j, bad = 0;
+  unsigned char lsr, c;
+
+  while (recv < count) {
+    if (sent < count && (inp(COM1 + LSR) & LSR_THRE)) {
+      for (j = 0; j < 16 && sent < count; j++)
+        outp(COM1 + THR, pattern(sent++));
+    }
+    while ((lsr = inp(COM2 + LSR)) & LSR_DR) {
+      if (lsr & LSR_OE) {
+        printf("FAIL: overrun at byte %lu\n", recv);
+        return bad + 1;
+      }
+      c = inp(COM2 + RBR);
+      if (c != pattern(recv)) {
+        printf("FAIL: byte %lu is %02x, expected %02x\n",
+               recv, c, pattern(recv));
+        return bad + 1;
+      }
+      recv++;
+      last = ticks();
+    }
+    if (ticks() - last > 36) {
+      printf("FAIL: stalled after %lu of %lu bytes\n", recv, count);
+      return bad + 1;
+    }
+  }
+  printf("null modem: %lu bytes in %lu ticks\n", recv, ticks() - t0);
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long count = atol(argv[1]);
+  unsigned int bad = 0;
+
+  port_init(COM1);
+  port_init(COM2);
+  bad += check_loop();
+  bad += check_nullmodem(count);
+
+  printf("%s: %u errors\n", bad ? "FAIL" : "OK", bad);
+  return bad;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 +1"
+$_floppy_a = ""
+$_com1 = "nullmodem 2"
+$_com2 = "nullmodem 1"
+$_debug = "-D+s"
+""", timeout=60)
+
+    self.assertNotIn("FAIL", results)
+    self.assertIn("OK: 0 errors", results)
+
+# The stream went out in FIFO loads, not a write() per byte
+    log = self.logfiles['log'][0].read_text()
+    m = re.search(r"SER0: sent (\d+) bytes in (\d+) writes", log)
+    self.assertIsNotNone(m, "no serial statistics in the log")
+    self.assertEqual(int(m.group(1)), count)
+    self.assertLess(int(m.group(2)), count // 4)
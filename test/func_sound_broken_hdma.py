@@ -0,0 +1,157 @@
+
+def sound_broken_hdma(self):
+
+    self.mkfile("testit.bat", """\
+c:\\sbhdma
+rem end
+""", newline="\r\n")
+
+# With no HDMA the 16bit samples go over the 8bit channel. The DMA is
+# first programmed one byte short of the block, so TC comes between the
+# two bytes of the last sample, then for the byte that is missing. The
+# block only completes if the first byte of that sample was kept.
+    self.mkcom_with_ia16("sbhdma", r"""
+#include <stdio.h>
+#include <conio.h>
+
+#define SB 0x220
+#define SB_RESET (SB + 0x06)
+#define SB_READ (SB + 0x0a)
+#define SB_WRITE (SB + 0x0c)
+#define SB_STATUS (SB + 0x0e)
+#define SB_ACK16 (SB + 0x0f)
+#define MIXER_ADDR (SB + 0x04)
+#define MIXER_DATA (SB + 0x05)
+
+#define DMA_ADDR1 0x02
+#define DMA_CNT1 0x03
+#define DMA_STAT 0x08
+#define DMA_MASK 0x0a
+#define DMA_MODE 0x0b
+#define DMA_FF 0x0c
+#define DMA_PAGE1 0x83
+
+#define SAMPLES 256
+
+static unsigned char buf[SAMPLES * 4];
+
+static unsigned long ticks(void)
+{
+  unsigned int cx, dx;
+
+  asm volatile("int $0x1a\n"
+               : "=c"(cx), "=d"(dx)
+               : "a"(0)
+               : "cc");
+  return ((unsigned long)cx << 16) | dx;
+}
+
+static int dsp_write(unsigned char val)
+{
+  unsigned long t0 = ticks();
+
+  while (inp(SB_WRITE) & 0x80)
+    if (ticks() - t0 > 18)
+      return -1;
+  outp(SB_WRITE, val);
+  return 0;
+}
+
+static int dsp_reset(void)
+{
+  unsigned long t0;
+
+  outp(SB_RESET, 1);
+  t0 = ticks();
+  while (ticks() == t0)
+    ;
+  outp(SB_RESET, 0);
+  t0 = ticks();
+  while (!(inp(SB_STATUS) & 0x80))
+    if (ticks() - t0 > 18)
+      return -1;
+  return inp(SB_READ) == 0xaa ? 0 : -1;
+}
+
+static void dma_program(unsigned long phys, unsigned int len)
+{
+  outp(DMA_MASK, 0x04 | 1);
+  outp(DMA_FF, 0);
+  outp(DMA_MODE, 0x48 | 1);     /* single, memory to device, channel 1 */
+  outp(DMA_ADDR1, phys & 0xff);
+  outp(DMA_ADDR1, (phys >> 8) & 0xff);
+  outp(DMA_CNT1, (len - 1) & 0xff);
+  outp(DMA_CNT1, (len - 1) >> 8);
+  outp(DMA_PAGE1, phys >> 16);
+  outp(DMA_MASK, 1);
+}
+
+static int irq16_pending(void)
+{
+  outp(MIXER_ADDR, 0x82);
+  return inp(MIXER_DATA) & 0x02;
+}
+
+int main(void)
+{
+  unsigned long phys, t0;
+  unsigned int ds, bad = 0;
+
+  asm volatile("movw %%ds, %0" : "=r"(ds));
+  phys = ((unsigned long)ds << 4) + (unsigned int)buf;
+  if ((phys & 0xffff) + SAMPLES * 2 > 0x10000)
+    phys += SAMPLES * 2;
+
+  if (dsp_reset()) {
+    printf("FAIL: DSP reset\n");
+    return 1;
+  }
+  outp(0x21, inp(0x21) | 0x20);         /* keep IRQ 5 away from the BIOS */
+  inp(DMA_STAT);
+
+  dma_program(phys, SAMPLES * 2 - 1);
+  dsp_write(0x41);                      /* output rate 22050 */
+  dsp_write(22050 >> 8);
+  dsp_write(22050 & 0xff);
+  dsp_write(0xb0);                      /* 16bit single cycle output */
+  dsp_write(0x10);                      /* mono signed */
+  dsp_write((SAMPLES - 1) & 0xff);
+  dsp_write((SAMPLES - 1) >> 8);
+
+  t0 = ticks();
+  while (!(inp(DMA_STAT) & 0x02))
+    if (ticks() - t0 > 36) {
+      printf("FAIL: no TC\n");
+      return 1;
+    }
+  if (irq16_pending()) {
+    printf("FAIL: block ended one byte short\n");
+    bad++;
+  }
+
+  dma_program(phys + SAMPLES * 2 - 1, 1);
+  t0 = ticks();
+  while (!irq16_pending() && ticks() - t0 < 18)
+    ;
+  if (!irq16_pending()) {
+    printf("FAIL: block did not end with its last byte\n");
+    bad++;
+  }
+  inp(SB_ACK16);
+  dsp_reset();
+  outp(0x21, inp(0x21) & ~0x20);
+
+  printf("%s: %u errors\n", bad ? "FAIL" : "OK", bad);
+  return bad;
+}
+""")
+
+    results = self.runDosemu("testit.bat", config="""\
+$_hdimage = "dXXXXs/c:hdtype1 +1"
+$_floppy_a = ""
+$_sound = (on)
+$_sb_hdma = (0)
+""")
+
+    self.assertNotIn("FAIL", results)
+    self.assertIn("OK: 0 errors", results)
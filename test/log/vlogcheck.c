@@ -0,0 +1,277 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: checks of the log writer in vlog.c. Several threads log at
+ * once and every line must be in the file, in the order of its thread.
+ * A signal handler logs into the middle of the log calls of its thread.
+ * The thread's lines must all be there in order, the handler's lines
+ * all be there once, not garbled and without a deadlock. The handler
+ * may write past the lines being drained, so its order is not checked.
+ * Then a child logs from a second thread and leaves with _exit(), the
+ * way the fatal paths do, and the message must still be in the file.
+ *
+ * Usage: vlogcheck [lines per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "dosemu_debug.h"
+
+#define NUM_THREADS 4
+#define LOG_MAIN "vlogcheck.log"
+#define LOG_FATAL "vlogcheck-fatal.log"
+
+static int lines = 250000;
+static volatile int sig_lines, sig_done;
+
+/* what vlog.c needs from the rest of dosemu */
+int log_printf(const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, fmt);
+    ret = vlog_printf(fmt, args);
+    va_end(args);
+    return ret;
+}
+
+void ___error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static void *logger(void *arg)
+{
+    int id = (long)arg, i;
+
+    for (i = 0; i < lines; i++)
+	log_printf("thread %i line %i\n", id, i);
+    return NULL;
+}
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	    (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+static int check_threads(void)
+{
+    pthread_t thr[NUM_THREADS];
+    int next[NUM_THREADS] = {};
+    struct timespec t0;
+    char line[128];
+    int i, id, n, bad = 0;
+    FILE *f;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < NUM_THREADS; i++)
+	pthread_create(&thr[i], NULL, logger, (void *)(long)i);
+    for (i = 0; i < NUM_THREADS; i++)
+	pthread_join(thr[i], NULL);
+    vlog_flush();
+    printf("%i threads x %i lines in %.1f ms\n", NUM_THREADS, lines,
+	    elapsed_ms(&t0));
+
+    f = fopen(LOG_MAIN, "r");
+    if (!f) {
+	perror(LOG_MAIN);
+	return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+	if (sscanf(line, "thread %i line %i", &id, &n) != 2)
+	    continue;
+	if (id < 0 || id >= NUM_THREADS || n != next[id]) {
+	    if (!bad++)
+		printf("FAIL: got \"thread %i line %i\", expected line %i\n",
+			id, n, id >= 0 && id < NUM_THREADS ? next[id] : -1);
+	    continue;
+	}
+	next[id]++;
+    }
+    fclose(f);
+    for (i = 0; i < NUM_THREADS; i++) {
+	if (next[i] != lines) {
+	    printf("FAIL: thread %i has %i of %i lines\n", i, next[i], lines);
+	    bad++;
+	}
+    }
+    return bad;
+}
+
+static void *fatal_thread(void *arg)
+{
+    log_printf("thread got signal 11, cr2=0\n");
+    /* what dosemu_fault1() does before it kills the process */
+    vlog_flush();
+    _exit(23);
+}
+
+static void deadlock(int sig)
+{
+    static const char msg[] = "FAIL: deadlock in the signal check\n";
+
+    write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+    _exit(1);
+}
+
+static void sig_logger(int sig)
+{
+    log_printf("signal line %i\n", sig_lines++);
+}
+
+static void *sig_target(void *arg)
+{
+    int i;
+
+    for (i = 0; i < lines; i++)
+	log_printf("thread %i line %i with some more text to fill the ring\n",
+		NUM_THREADS, i);
+    sig_done = 1;
+    return NULL;
+}
+
+static int check_signals(void)
+{
+    struct sigaction sa = { .sa_handler = sig_logger };
+    int next = 0, seen_sig = 0, id, n, bad = 0, sent = 0;
+    char line[128], *seen;
+    pthread_t thr;
+    FILE *f;
+
+    sigaction(SIGUSR1, &sa, NULL);
+    pthread_create(&thr, NULL, sig_target, NULL);
+    while (!sig_done) {
+	pthread_kill(thr, SIGUSR1);
+	sent++;
+	usleep(10);
+    }
+    pthread_join(thr, NULL);
+    vlog_flush();
+    printf("%i signals logged into %i lines\n", sig_lines, lines);
+    seen = calloc(sig_lines, 1);
+
+    f = fopen(LOG_MAIN, "r");
+    if (!f) {
+	perror(LOG_MAIN);
+	return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+	if (sscanf(line, "thread %i line %i", &id, &n) == 2) {
+	    if (id != NUM_THREADS)
+		continue;
+	    if (n != next++ && !bad++)
+		printf("FAIL: got \"thread %i line %i\", expected line %i\n",
+			id, n, next - 1);
+	} else if (sscanf(line, "signal line %i", &n) == 1) {
+	    if (n < 0 || n >= sig_lines || seen[n]++) {
+		if (!bad++)
+		    printf("FAIL: signal line %i is unexpected\n", n);
+		continue;
+	    }
+	    seen_sig++;
+	} else if (strncmp(line, "thread ", 7) != 0 && !bad++) {
+	    printf("FAIL: garbled line \"%.40s\"\n", line);
+	}
+    }
+    fclose(f);
+    free(seen);
+    if (next != lines || seen_sig != sig_lines) {
+	printf("FAIL: %i of %i thread lines, %i of %i signal lines\n",
+		next, lines, seen_sig, sig_lines);
+	bad++;
+    }
+    if (!sent)
+	bad++;
+    return bad;
+}
+
+static int check_fatal(void)
+{
+    char line[128];
+    int status, found = 0;
+    pthread_t thr;
+    pid_t pid;
+    FILE *f;
+
+    pid = fork();
+    if (pid == 0) {
+	if (vlog_init(LOG_FATAL) == -1)
+	    _exit(1);
+	log_printf("child started\n");
+	pthread_create(&thr, NULL, fatal_thread, NULL);
+	pthread_join(thr, NULL);
+	_exit(0);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 23) {
+	printf("FAIL: the child did not leave with _exit(23)\n");
+	return 1;
+    }
+
+    f = fopen(LOG_FATAL, "r");
+    if (!f) {
+	perror(LOG_FATAL);
+	return 1;
+    }
+    while (fgets(line, sizeof(line), f))
+	if (strcmp(line, "thread got signal 11, cr2=0\n") == 0)
+	    found = 1;
+    fclose(f);
+    if (!found) {
+	printf("FAIL: the message before _exit() is not in the log\n");
+	return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int bad = 0;
+
+    if (argc > 1)
+	lines = atoi(argv[1]);
+    /* the child opens its own log, before the parent starts any thread */
+    bad += check_fatal();
+    if (vlog_init(LOG_MAIN) == -1) {
+	perror(LOG_MAIN);
+	return 1;
+    }
+    bad += check_threads();
+    fflush(stdout);
+    signal(SIGALRM, deadlock);
+    alarm(60);
+    bad += check_signals();
+
+    printf("%s: %i errors\n", bad ? "FAIL" : "OK", bad);
+    return !!bad;
+}
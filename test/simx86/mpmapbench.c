@@ -0,0 +1,232 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: benchmark of the code page map in simx86/memory.c. Code
+ * sequences are protected and marked in every megabyte of a footprint
+ * of 1 to 1024 MB, as the JIT does for every translated sequence. Then
+ * e_querymark() is timed on random addresses in the footprint, with
+ * len 1 as FindTree() and the interpreter call it, and with 64 bytes
+ * as the write fault handler and Cpatch do. Every answer is checked
+ * against a bitmap of the marked bytes, and e_unmarkpage() must leave
+ * no mark behind.
+ *
+ * Usage: mpmapbench [queries per footprint]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "emu.h"
+#include "mapping.h"
+#include "dosemu_debug.h"
+#include "emu86.h"
+#include "trees.h"
+#include "codegen.h"
+#include "emudpmi.h"
+
+#define BASE 0x00400000		/* where the DPMI memory starts */
+#define MEGA 0x100000
+#define SEQS 16			/* code sequences per megabyte */
+#define MAX_SEQ 256
+
+static const int footprints[] = { 1, 4, 16, 64, 256, 1024 };
+static const int lens[] = { 1, 64 };
+
+static struct {
+    unsigned addr;
+    int len;
+} *seqs;
+static unsigned char *marked;
+static int queries = 2000000;
+
+/* what memory.c needs from the rest of dosemu */
+int mprotect_mapping(int cap, dosaddr_t targ, size_t mapsize, int protect)
+{
+    return 0;
+}
+
+void *dosaddr_to_unixaddr(dosaddr_t addr)
+{
+    return NULL;
+}
+
+unsigned char *_jit_base(void)
+{
+    return NULL;
+}
+
+int InvalidateNodeRange(int addr, int len, unsigned char *eip)
+{
+    return 0;
+}
+
+int Cpatch(sigcontext_t *scp)
+{
+    return 0;
+}
+
+unsigned int GetSegmentBase(unsigned short sel)
+{
+    return 0;
+}
+
+int dpmi_read_access(dosaddr_t addr)
+{
+    return 1;
+}
+
+int DPMIValidSelector(unsigned short selector)
+{
+    return 0;
+}
+
+void ___error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+int log_printf(const char *fmt, ...)
+{
+    return 0;
+}
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+volatile int InCompiledCode;
+volatile int in_vm86;
+volatile int fault_cnt;
+union _SynCPU TheCPU_union;
+__TLS union vm86_union vm86u;
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	    (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+static int is_marked(unsigned addr, int len)
+{
+    unsigned a;
+
+    for (a = addr - BASE; a < addr - BASE + len; a++)
+	if (marked[a >> 3] & (1 << (a & 7)))
+	    return 1;
+    return 0;
+}
+
+/* SEQS sequences per megabyte, one in every 64k so they never overlap */
+static void mark_all(int megs)
+{
+    int i, n = megs * SEQS;
+
+    for (i = 0; i < n; i++) {
+	unsigned a;
+
+	seqs[i].addr = BASE + i * (MEGA / SEQS) + rand() % (MEGA / SEQS - MAX_SEQ);
+	seqs[i].len = 1 + rand() % MAX_SEQ;
+	/* protected first, so that every megabyte has its map */
+	e_mprotect(seqs[i].addr, seqs[i].len);
+	e_markpage(seqs[i].addr, seqs[i].len);
+	for (a = seqs[i].addr - BASE; a < seqs[i].addr - BASE + seqs[i].len; a++)
+	    marked[a >> 3] |= 1 << (a & 7);
+    }
+}
+
+static int unmark_all(int megs)
+{
+    int i, n = megs * SEQS, bad = 0;
+
+    for (i = 0; i < n; i++)
+	e_unmarkpage(seqs[i].addr, seqs[i].len);
+    for (i = 0; i < n; i++) {
+	if (e_querymark(seqs[i].addr, seqs[i].len)) {
+	    if (!bad++)
+		printf("FAIL: %08x still marked after e_unmarkpage()\n",
+			seqs[i].addr);
+	}
+    }
+    memset(marked, 0, megs * (MEGA / 8));
+    return bad;
+}
+
+static int run(int megs, int len)
+{
+    unsigned span = megs * MEGA - len;
+    unsigned *addr = malloc(queries * sizeof(*addr));
+    struct timespec t0;
+    int i, hits = 0, bad = 0;
+    double t;
+
+    for (i = 0; i < queries; i++) {
+	/* half of the queries hit a sequence */
+	if (i & 1) {
+	    int s = rand() % (megs * SEQS);
+	    addr[i] = seqs[s].addr + rand() % seqs[s].len;
+	} else {
+	    addr[i] = BASE + (unsigned)rand() % span;
+	}
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < queries; i++)
+	hits += !!e_querymark(addr[i], len);
+    t = elapsed_ms(&t0);
+
+    for (i = 0; i < queries; i++) {
+	if (!!e_querymark(addr[i], len) != is_marked(addr[i], len)) {
+	    if (!bad++)
+		printf("FAIL: e_querymark(%08x, %i) is wrong\n", addr[i], len);
+	}
+    }
+    printf("%5i MB, len %2i: %6.1f ns/query, %i%% marked\n", megs, len,
+	    t * 1000000 / queries, (int)(hits * 100LL / queries));
+    free(addr);
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    int max = footprints[sizeof(footprints) / sizeof(footprints[0]) - 1];
+    int f, l, bad = 0;
+
+    if (argc > 1)
+	queries = atoi(argv[1]);
+    seqs = malloc(max * SEQS * sizeof(*seqs));
+    marked = calloc(max, MEGA / 8);
+
+    for (f = 0; f < sizeof(footprints) / sizeof(footprints[0]); f++) {
+	mprot_init();
+	mark_all(footprints[f]);
+	for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+	    bad += run(footprints[f], lens[l]);
+	bad += unmark_all(footprints[f]);
+	mprot_end();
+	fflush(stdout);
+    }
+
+    printf("%s: %i errors\n", bad ? "FAIL" : "OK", bad);
+    return !!bad;
+}
@@ -0,0 +1,512 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: benchmark of the simulated CPU ($_cpu_emu = "fullsim"). The
+ * whole of simx86 is linked against a flat 1M of guest memory, and
+ * e_vm86() runs CPU-bound real mode loops in it until they stop at an
+ * int3: a sieve, a bitwise CRC-32 with 32-bit operands, and an
+ * insertion sort that calls a compare subroutine, and a loop that
+ * patches an instruction following the store. Their results must be
+ * the same as those of the C versions here.
+ *
+ * Usage: simbench [passes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <fenv.h>
+#include "emu.h"
+#include "cpu.h"
+#include "memory.h"
+#include "dos2linux.h"
+#include "cpu-emu.h"
+#include "port.h"
+#include "vgaemu.h"
+#include "mapping.h"
+#include "emudpmi.h"
+#include "msdoshlp.h"
+#include "dis8086.h"
+#include "kvm.h"
+#include "utilities.h"
+#include "emu86.h"
+#include "codegen-sim.h"
+
+#define CODE_SEG 0x1000
+#define DATA_SEG 0x2000
+#define STACK_SEG 0x3000
+#define MEM_SIZE 0x110000
+
+static const unsigned char guest[] = {
+/* sieve: CX passes over the 8K at DS:0, primes in AX */
+    0x51,			/* 00: push cx */
+    0x31, 0xff,			/* 01: xor di,di */
+    0xb0, 0x01,			/* 03: mov al,1 */
+    0x88, 0x05,			/* 05: mov [di],al */
+    0x47,			/* 07: inc di */
+    0x81, 0xff, 0x00, 0x20,	/* 08: cmp di,0x2000 */
+    0x72, 0xf7,			/* 0c: jb 05 */
+    0x31, 0xdb,			/* 0e: xor bx,bx */
+    0xbe, 0x02, 0x00,		/* 10: mov si,2 */
+    0x80, 0x3c, 0x00,		/* 13: cmp byte [si],0 */
+    0x74, 0x12,			/* 16: je 2a */
+    0x43,			/* 18: inc bx */
+    0x8d, 0x3c,			/* 19: lea di,[si] */
+    0x01, 0xf7,			/* 1b: add di,si */
+    0x81, 0xff, 0x00, 0x20,	/* 1d: cmp di,0x2000 */
+    0x73, 0x07,			/* 21: jae 2a */
+    0xc6, 0x05, 0x00,		/* 23: mov byte [di],0 */
+    0x01, 0xf7,			/* 26: add di,si */
+    0xeb, 0xf3,			/* 28: jmp 1d */
+    0x46,			/* 2a: inc si */
+    0x81, 0xfe, 0x00, 0x20,	/* 2b: cmp si,0x2000 */
+    0x72, 0xe2,			/* 2f: jb 13 */
+    0x59,			/* 31: pop cx */
+    0xe2, 0xcc,			/* 32: loop 00 */
+    0x89, 0xd8,			/* 34: mov ax,bx */
+    0xcc,			/* 36: int3 */
+/* crc: CX passes of a bitwise CRC-32 over the 4K at DS:0, in EDX */
+    0x66, 0xba, 0xff, 0xff, 0xff, 0xff,	/* 37: mov edx,0xffffffff */
+    0x51,			/* 3d: push cx */
+    0x31, 0xf6,			/* 3e: xor si,si */
+    0x32, 0x14,			/* 40: xor dl,[si] */
+    0xb9, 0x08, 0x00,		/* 42: mov cx,8 */
+    0x66, 0xd1, 0xea,		/* 45: shr edx,1 */
+    0x73, 0x07,			/* 48: jae 51 */
+    0x66, 0x81, 0xf2, 0x20, 0x83, 0xb8, 0xed,	/* 4a: xor edx,0xedb88320 */
+    0xe2, 0xf2,			/* 51: loop 45 */
+    0x46,			/* 53: inc si */
+    0x81, 0xfe, 0x00, 0x10,	/* 54: cmp si,0x1000 */
+    0x72, 0xe6,			/* 58: jb 40 */
+    0x59,			/* 5a: pop cx */
+    0xe2, 0xe0,			/* 5b: loop 3d */
+    0xcc,			/* 5d: int3 */
+/* sort: CX passes of an insertion sort of the 1K words at DS:0 into
+ * DS:0x1000, the sum of the first 16 in AX */
+    0x51,			/* 5e: push cx */
+    0x31, 0xf6,			/* 5f: xor si,si */
+    0x8b, 0x04,			/* 61: mov ax,[si] */
+    0x89, 0x84, 0x00, 0x10,	/* 63: mov [si+0x1000],ax */
+    0x83, 0xc6, 0x02,		/* 67: add si,2 */
+    0x81, 0xfe, 0x00, 0x08,	/* 6a: cmp si,0x800 */
+    0x72, 0xf1,			/* 6e: jb 61 */
+    0xbe, 0x02, 0x00,		/* 70: mov si,2 */
+    0x8b, 0x84, 0x00, 0x10,	/* 73: mov ax,[si+0x1000] */
+    0x89, 0xf7,			/* 77: mov di,si */
+    0x09, 0xff,			/* 79: or di,di */
+    0x74, 0x12,			/* 7b: je 8f */
+    0x8b, 0x95, 0xfe, 0x0f,	/* 7d: mov dx,[di+0xffe] */
+    0xe8, 0x2c, 0x00,		/* 81: call b0 */
+    0x76, 0x09,			/* 84: jbe 8f */
+    0x89, 0x95, 0x00, 0x10,	/* 86: mov [di+0x1000],dx */
+    0x83, 0xef, 0x02,		/* 8a: sub di,2 */
+    0xeb, 0xea,			/* 8d: jmp 79 */
+    0x89, 0x85, 0x00, 0x10,	/* 8f: mov [di+0x1000],ax */
+    0x83, 0xc6, 0x02,		/* 93: add si,2 */
+    0x81, 0xfe, 0x00, 0x08,	/* 96: cmp si,0x800 */
+    0x72, 0xd7,			/* 9a: jb 73 */
+    0x59,			/* 9c: pop cx */
+    0xe2, 0xbf,			/* 9d: loop 5e */
+    0x31, 0xc0,			/* 9f: xor ax,ax */
+    0x31, 0xf6,			/* a1: xor si,si */
+    0x03, 0x84, 0x00, 0x10,	/* a3: add ax,[si+0x1000] */
+    0x83, 0xc6, 0x02,		/* a7: add si,2 */
+    0x83, 0xfe, 0x20,		/* aa: cmp si,0x20 */
+    0x72, 0xf4,			/* ad: jb a3 */
+    0xcc,			/* af: int3 */
+    0x39, 0xc2,			/* b0: cmp dx,ax */
+    0xc3,			/* b2: ret */
+/* smc: CX passes of a loop that adds CL to AX through the immediate of
+ * the add it patches */
+    0x31, 0xc0,			/* b3: xor ax,ax */
+    0x2e, 0x88, 0x0e, 0xbc, 0x00,	/* b5: mov cs:[bc],cl */
+    0x83, 0xc0, 0x00,		/* ba: add ax,0 */
+    0xe2, 0xf6,			/* bd: loop b5 */
+    0xcc,			/* bf: int3 */
+};
+
+static unsigned char *mem;
+static int passes = 40;
+
+static unsigned sieve(void)
+{
+    unsigned char flags[8192];
+    unsigned i, j, n = 0;
+
+    memset(flags, 1, sizeof(flags));
+    for (i = 2; i < sizeof(flags); i++) {
+	if (!flags[i])
+	    continue;
+	n++;
+	for (j = i + i; j < sizeof(flags); j += i)
+	    flags[j] = 0;
+    }
+    return n;
+}
+
+static unsigned crc(const unsigned char *p, int n)
+{
+    unsigned c = 0xffffffff;
+    int i, k, pass;
+
+    for (pass = 0; pass < n; pass++) {
+	for (i = 0; i < 4096; i++) {
+	    c ^= p[i];
+	    for (k = 0; k < 8; k++)
+		c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+	}
+    }
+    return c;
+}
+
+static int cmp_word(const void *p1, const void *p2)
+{
+    return *(const unsigned short *)p1 - *(const unsigned short *)p2;
+}
+
+static unsigned sort(const unsigned char *p)
+{
+    unsigned short w[1024];
+    unsigned sum = 0;
+    int i;
+
+    memcpy(w, p, sizeof(w));
+    qsort(w, 1024, 2, cmp_word);
+    for (i = 0; i < 16; i++)
+	sum += w[i];
+    return sum & 0xffff;
+}
+
+static unsigned smc(int n)
+{
+    unsigned sum = 0;
+
+    for (; n; n--)
+	sum += (signed char)n;
+    return sum & 0xffff;
+}
+
+static const struct {
+    const char *name;
+    int start, div;		/* CX = passes / div */
+} progs[] = {
+    { "sieve", 0x00, 1 },
+    { "crc", 0x37, 1 },
+    { "sort", 0x5e, 10 },
+    { "smc", 0xb3, 1 },
+};
+
+/* what simx86 needs from the rest of dosemu */
+uint8_t do_read_byte(dosaddr_t addr, sim_pagefault_handler_t handler)
+{
+    return mem[addr];
+}
+
+uint16_t do_read_word(dosaddr_t addr, sim_pagefault_handler_t handler)
+{
+    uint16_t v;
+
+    memcpy(&v, mem + addr, 2);
+    return v;
+}
+
+uint32_t do_read_dword(dosaddr_t addr, sim_pagefault_handler_t handler)
+{
+    uint32_t v;
+
+    memcpy(&v, mem + addr, 4);
+    return v;
+}
+
+uint64_t do_read_qword(dosaddr_t addr, sim_pagefault_handler_t handler)
+{
+    uint64_t v;
+
+    memcpy(&v, mem + addr, 8);
+    return v;
+}
+
+void do_write_byte(dosaddr_t addr, uint8_t byte, sim_pagefault_handler_t handler)
+{
+    mem[addr] = byte;
+}
+
+void do_write_word(dosaddr_t addr, uint16_t word, sim_pagefault_handler_t handler)
+{
+    memcpy(mem + addr, &word, 2);
+}
+
+void do_write_dword(dosaddr_t addr, uint32_t dword, sim_pagefault_handler_t handler)
+{
+    memcpy(mem + addr, &dword, 4);
+}
+
+void do_write_qword(dosaddr_t addr, uint64_t qword, sim_pagefault_handler_t handler)
+{
+    memcpy(mem + addr, &qword, 8);
+}
+
+void default_sim_pagefault_handler(dosaddr_t addr, int err, uint32_t op, int len)
+{
+}
+
+void *dosaddr_to_unixaddr(dosaddr_t addr)
+{
+    return mem + addr;
+}
+
+dosaddr_t physaddr_to_dosaddr(unsigned addr, int len)
+{
+    return addr;
+}
+
+unsigned char *_jit_base(void)
+{
+    return mem;
+}
+
+unsigned char *_mem_base(void)
+{
+    return mem;
+}
+
+int mprotect_mapping(int cap, dosaddr_t targ, size_t mapsize, int protect)
+{
+    return 0;
+}
+
+/* the guests stay out of the VGA memory */
+int vga_read_access(dosaddr_t m) { return 0; }
+int vga_write_access(dosaddr_t m) { return 0; }
+int vga_access(dosaddr_t r, dosaddr_t w) { return 0; }
+unsigned char vga_read(unsigned addr) { return 0xff; }
+unsigned short vga_read_word(unsigned addr) { return 0xffff; }
+unsigned vga_read_dword(unsigned addr) { return 0xffffffff; }
+void vga_write(unsigned addr, unsigned char val) {}
+void vga_write_word(unsigned addr, unsigned short val) {}
+void vga_write_dword(dosaddr_t addr, unsigned val) {}
+void vga_memset(unsigned dst, unsigned char val, size_t len) {}
+void vga_memsetw(unsigned dst, unsigned short val, size_t len) {}
+void vga_memsetl(unsigned dst, unsigned val, size_t len) {}
+
+int vga_emu_protect_page(unsigned page, int prot, int mode)
+{
+    return 0;
+}
+
+int vm86_fault(unsigned trapno, unsigned err, dosaddr_t cr2)
+{
+    return 0;
+}
+
+int memcheck_is_rom(dosaddr_t addr)
+{
+    return 0;
+}
+
+/* the guests run in vm86 mode */
+int dpmi_is_valid_range(dosaddr_t addr, int len) { return 0; }
+int dpmi_read_access(dosaddr_t addr) { return 0; }
+int DPMIValidSelector(unsigned short selector) { return 0; }
+unsigned int GetSegmentBase(unsigned short sel) { return 0; }
+void *SEL_ADR(unsigned short sel, unsigned int reg) { return NULL; }
+
+uint8_t *dpmi_get_ldt_buffer(void)
+{
+    static uint8_t ldt[LDT_ENTRIES * LDT_ENTRY_SIZE];
+
+    return ldt;
+}
+
+int msdos_ldt_access(dosaddr_t cr2)
+{
+    return 0;
+}
+
+void msdos_ldt_write(cpuctx_t *scp, uint32_t op, int len, dosaddr_t cr2)
+{
+}
+
+void fsave_to_fxsave(const struct emu_fsave *fptr,
+    struct emu_fpxstate *fxsave)
+{
+}
+
+void fxsave_to_fsave(const struct emu_fpxstate *fxsave,
+    struct emu_fsave *fptr)
+{
+}
+
+void kvm_enter(int pm)
+{
+}
+
+void kvm_leave(int pm)
+{
+}
+
+int dis_8086(unsigned int org, char *buf, int seg, unsigned int *ret,
+    unsigned int refseg)
+{
+    return 0;
+}
+
+/* the guests do no I/O */
+Bit8u port_inb(ioport_t port) { return 0xff; }
+Bit16u port_inw(ioport_t port) { return 0xffff; }
+Bit32u port_ind(ioport_t port) { return 0xffffffff; }
+void port_outb(ioport_t port, Bit8u byte) {}
+void port_outw(ioport_t port, Bit16u word) {}
+void port_outd(ioport_t port, Bit32u word) {}
+int VGA_emulate_inb(ioport_t port, void *arg) { return 0xff; }
+int VGA_emulate_outb(ioport_t port, Bit8u value, void *arg) { return 0; }
+
+void dosemu_error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void ___error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+int log_printf(const char *fmt, ...)
+{
+    return 0;
+}
+
+void leavedos_from_sig(int sig)
+{
+    printf("FAIL: leavedos_from_sig(%i)\n", sig);
+    exit(1);
+}
+
+void __leavedos_main_wrp(int code, int sig, const char *s, int num)
+{
+    printf("FAIL: leavedos(%i) from %s:%i\n", code, s, num);
+    exit(1);
+}
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+volatile int fault_cnt;
+volatile int in_vm86;
+unsigned char emu_io_bitmap[0x10000 / 8];
+emu_fpstate vm86_fpu_state;
+fenv_t dosemu_fenv;
+vga_type vga;
+__TLS union vm86_union vm86u;
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	    (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+/* runs the program at start with CX = n, returns the time in ms */
+static double run(int start, int n)
+{
+    struct timespec t0;
+    int ret;
+
+    memset(&REGS, 0, sizeof(REGS));
+    SREG(cs) = CODE_SEG;
+    SREG(ds) = SREG(es) = DATA_SEG;
+    SREG(ss) = STACK_SEG;
+    REG(eip) = start;
+    REG(esp) = 0xfffe;
+    REG(ecx) = n;
+    REG(eflags) = 0x202;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = e_vm86();
+    if (ret != VM86_TRAP + (3 << 8))
+	printf("FAIL: e_vm86() returned %#x at %04x:%04x\n", ret, SREG(cs),
+		LWORD(eip));
+    return elapsed_ms(&t0);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char data[8192];
+    unsigned got, want;
+    double t;
+    int i, n, bad = 0;
+
+    if (argc > 1)
+	passes = atoi(argv[1]);
+    mem = calloc(1, MEM_SIZE);
+    memcpy(mem + CODE_SEG * 16, guest, sizeof(guest));
+    for (i = 0; i < sizeof(data); i++)
+	data[i] = rand();
+
+    config.cpusim = 1;
+    config.cpu_vm = CPUVM_EMU;
+    vm86s.cpu_type = CPU_586;
+    init_emu_cpu();
+    reset_emu_cpu();
+
+    for (i = 0; i < sizeof(progs) / sizeof(progs[0]); i++) {
+	memcpy(mem + DATA_SEG * 16, data, sizeof(data));
+	n = passes / progs[i].div ? : 1;
+	SimHits = SimMisses = 0;
+	t = run(progs[i].start, n);
+	switch (i) {
+	case 0:
+	    got = LWORD(eax);
+	    want = sieve();
+	    break;
+	case 1:
+	    got = REG(edx);
+	    want = crc(data, n);
+	    break;
+	case 2:
+	    got = LWORD(eax);
+	    want = sort(data);
+	    break;
+	default:
+	    got = LWORD(eax);
+	    want = smc(n);
+	    break;
+	}
+	printf("%-6s %3i passes: %8.1f ms, result %08x", progs[i].name, n,
+		t, got);
+	if (got != want) {
+	    printf(" FAIL: expected %08x", want);
+	    bad++;
+	}
+	printf(", sequences run %i missed %i\n", SimHits, SimMisses);
+	fflush(stdout);
+    }
+
+    printf("%s: %i errors\n", bad ? "FAIL" : "OK", bad);
+    return !!bad;
+}
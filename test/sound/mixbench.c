@@ -0,0 +1,189 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: mixer benchmark. Feeds 9 streams at the rates the emulated
+ * devices use into sndpcm.c and mixes them to 48 kHz stereo, driven by
+ * a simulated clock, so only the CPU time of the mixer is measured.
+ * The last stream is written in runs of 2 frames whose rate changes
+ * every run, as a DAC driven by a jittery timer does, so every run is
+ * a block of its own. A buffer overflow on any stream is an error.
+ *
+ * Usage: mixbench [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "emu.h"
+#include "timers.h"
+#include "utilities.h"
+#include "sound/sound.h"
+
+#define OUT_RATE 48000
+#define TICK 10000		/* us of audio per timer tick */
+#define NUM_STREAMS 9
+
+static const struct {
+    int rate;
+    int channels;
+    int is_16;
+    int run;			/* frames per write, 0 for a tick's worth */
+} streams[NUM_STREAMS] = {
+    { 44100, 2, 1 },		/* SB16 */
+    { 22050, 1, 0 },		/* SB Pro */
+    { 11025, 1, 0 },		/* SB 8bit */
+    { 48000, 2, 1 },		/* raw PCM */
+    { 49716, 2, 1 },		/* OPL3 */
+    { 44100, 2, 1 },		/* MIDI synth */
+    { 44100, 1, 1 },		/* PC speaker */
+    { 32000, 2, 1 },		/* odd rate */
+    { 44100, 1, 1, 1 },		/* direct DAC */
+};
+
+static hitimer_t now;
+static int player_handle;
+static int errors;
+
+/* what sndpcm.c needs from the rest of dosemu */
+hitimer_t GETusTIME(int sc)
+{
+    return now;
+}
+
+void ___error(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    errors++;
+}
+
+int log_printf(const char *fmt, ...)
+{
+    return 0;
+}
+
+void *load_plugin(const char *plugin_name)
+{
+    return NULL;
+}
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+
+static int bench_open(void *arg)
+{
+    return 1;
+}
+
+static void bench_start(void *arg)
+{
+}
+
+static void bench_stop(void *arg)
+{
+}
+
+static const struct pcm_player bench_player = {
+    .name = "bench",
+    .longname = "mixer benchmark",
+    .open = bench_open,
+    .start = bench_start,
+    .stop = bench_stop,
+    .id = PCM_ID_P,
+};
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	    (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct player_params params = {
+	.rate = OUT_RATE,
+	.format = PCM_FORMAT_S16_LE,
+	.channels = 2,
+    };
+    static sndbuf_t in[OUT_RATE][SNDBUF_CHANS];
+    static sndbuf_t out[OUT_RATE][SNDBUF_CHANS];
+    double phase[NUM_STREAMS] = {}, carry[NUM_STREAMS] = {};
+    int strm[NUM_STREAMS];
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    int ticks = seconds * (1000000 / TICK);
+    int i, j, k, n, mixed = 0;
+    double ms, peak = 0;
+    struct timespec t0;
+
+    now = 1000000;
+    player_handle = pcm_register_player(&bench_player, NULL);
+    pcm_init();
+    params.handle = player_handle;
+    for (i = 0; i < NUM_STREAMS; i++)
+	strm[i] = pcm_allocate_stream(streams[i].channels, "bench", NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (k = 0; k < ticks; k++) {
+	now += TICK;
+	for (i = 0; i < NUM_STREAMS; i++) {
+	    int fmt = pcm_get_format(streams[i].is_16, 1);
+	    double step = 2 * M_PI * (220.0 * (i + 1)) / streams[i].rate;
+	    int amp = streams[i].is_16 ? 3000 : 24;
+
+	    carry[i] += (double)streams[i].rate * TICK / 1000000;
+	    n = carry[i];
+	    carry[i] -= n;
+	    for (j = 0; j < n; j++) {
+		in[j][0] = in[j][1] = amp * sin(phase[i]);
+		phase[i] += step;
+	    }
+	    phase[i] = fmod(phase[i], 2 * M_PI);
+	    if (!streams[i].run) {
+		pcm_write_interleaved(in, n, streams[i].rate, fmt,
+			streams[i].channels, strm[i]);
+		continue;
+	    }
+	    for (j = 0; j < n; j += streams[i].run)
+		pcm_write_interleaved(in + j, _min(streams[i].run, n - j),
+			streams[i].rate + (j / streams[i].run) % 2, fmt,
+			streams[i].channels, strm[i]);
+	}
+	n = pcm_data_get_interleaved(out, OUT_RATE * TICK / 1000000,
+		&params);
+	for (j = 0; j < n; j++)
+	    peak = _max(peak, abs(out[j][0]));
+	mixed += n;
+	pcm_timer();
+    }
+    ms = elapsed_ms(&t0);
+
+    printf("mixed %i streams: %i frames at %i Hz in %.1f ms, "
+	    "%.2f us per 1k frames, %.0fx realtime, peak %.0f, %i errors\n",
+	    NUM_STREAMS, mixed, OUT_RATE, ms, ms * 1000000 / mixed,
+	    mixed * 1000.0 / OUT_RATE / ms, peak, errors);
+    pcm_done();
+    return mixed && !errors ? 0 : 1;
+}
@@ -18,7 +18,8 @@ from common_framework import (BaseTestCase, get_test_binaries, main, mkstring,
                               IPROMPT, KNOWNFAIL, UNSUPPORTED)
 
 from func_cpu_trap_flag import cpu_trap_flag
-from func_cpu_methods import cpu_create_items
+from func_cpu_methods import cpu_create_items, cpu_jit_eviction
+from func_disk_overlay import disk_overlay
 from func_ds2_file_seek_tell import ds2_file_seek_tell
 from func_ds2_file_seek_read import ds2_file_seek_read
 from func_ds2_set_fattrs import ds2_set_fattrs
@@ -31,6 +32,7 @@ from func_ds3_lock_twice import ds3_lock_twice
 from func_ds3_lock_writable import ds3_lock_writable
 from func_ds3_share_open_access import ds3_share_open_access
 from func_ds3_share_open_twice import ds3_share_open_twice
+from func_fatfs_many_files import fatfs_many_files
 from func_lfn_voln_info import lfn_voln_info
 from func_lfs_disk_info import lfs_disk_info
 from func_label_create import (label_create, label_create_on_lfns,
@@ -43,15 +45,19 @@ from func_memory_dpmi_dpmi10_ldt import memory_dpmi_dpmi10_ldt
 from func_memory_dpmi_japheth import memory_dpmi_japheth
 from func_memory_dpmi_leak_check import memory_dpmi_leak_check
 from func_memory_dpmi_leak_check_dos import memory_dpmi_leak_check_dos
+from func_memory_dpmi_many_blocks import memory_dpmi_many_blocks
 from func_memory_ems_borland import memory_ems_borland
 from func_memory_hma import (memory_hma_freespace, memory_hma_alloc, memory_hma_a20,
                              memory_hma_alloc3, memory_hma_chain)
 from func_memory_uma import memory_uma_strategy
 from func_memory_xms import memory_xms
-from func_mfs_findfile import mfs_findfile
+from func_mfs_findfile import mfs_findfile, mfs_findfile_cached
 from func_mfs_truename import mfs_truename
+from func_ne2000_rep_insw import ne2000_rep_insw
 from func_network import network_pktdriver_mtcp
 from func_pit_mode_2 import pit_mode_2
+from func_serial_loopback import serial_loopback
+from func_sound_broken_hdma import sound_broken_hdma
 
 SYSTYPE_DRDOS_ENHANCED = "Enhanced DR-DOS"
 SYSTYPE_DRDOS_ORIGINAL = "Original DR-DOS"
@@ -3412,6 +3418,11 @@ $_floppy_a = ""
         memory_dpmi_leak_check(self, 'normal')
     test_memory_dpmi_leak_check_normal.dpmitest = True
 
+    def test_memory_dpmi_many_blocks(self):
+        """Memory DPMI many blocks in scattered order"""
+        memory_dpmi_many_blocks(self, 100000, 4096)
+    test_memory_dpmi_many_blocks.dpmitest = True
+
     def test_memory_dpmi_leak_check_dos_nofree(self):
         """Memory DPMI Leak Check DOS No Free"""
         memory_dpmi_leak_check_dos(self, 'nofree')
@@ -3625,6 +3636,22 @@ $_floppy_a = ""
         )
         mfs_findfile(self, "UFS", "SFN", tests)
 
+    def test_mfs_findfile_cached_ufs_lfn(self):
+        """MFS findfile UFS LFN cached listing and lookups stay current"""
+        mfs_findfile_cached(self, "LFN", "verylongfilename.txt")
+
+    def test_mfs_findfile_cached_ufs_sfn(self):
+        """MFS findfile UFS SFN cached listing and lookups stay current"""
+        mfs_findfile_cached(self, "SFN", "VERYL~3G.TXT")
+
+    def test_disk_overlay(self):
+        """Disk image overlay keeps the image unchanged"""
+        disk_overlay(self)
+
+    def test_fatfs_many_files(self):
+        """FATFS directory drive with many files"""
+        fatfs_many_files(self, 2000)
+
     def test_mfs_findfile_vfat_linux_mounted_lfn(self):
         """MFS findfile VFAT Linux mounted LFN"""
         tests = (
@@ -4745,6 +4772,26 @@ $_floppy_a = ""
         network_pktdriver_mtcp(self, 'ne2000')
     test_network_pktdriver_mtcp_ne2000.nettest = True
 
+    def test_ne2000_rep_insw(self):
+        """NE2000 REP INSW on the data port"""
+        ne2000_rep_insw(self, False)
+    test_ne2000_rep_insw.nettest = True
+
+    def test_ne2000_rep_insw_throughput(self):
+        """NE2000 REP INSW throughput"""
+        if environ.get("SKIP_EXPENSIVE"):
+            self.skipTest("expensive test")
+        ne2000_rep_insw(self, True)
+    test_ne2000_rep_insw_throughput.nettest = True
+
+    def test_sound_broken_hdma(self):
+        """Sound 16bit DMA over an 8bit channel with TC mid sample"""
+        sound_broken_hdma(self)
+
+    def test_serial_loopback(self):
+        """Serial UART loopback and null modem stream"""
+        serial_loopback(self, 65536)
+
     def test_cpu_trap_flag_emulated(self):
         """CPU Trap Flag emulated"""
         cpu_trap_flag(self, 'emulated')
@@ -4755,6 +4802,11 @@ $_floppy_a = ""
         cpu_trap_flag(self, 'kvm')
     test_cpu_trap_flag_kvm.cputest = True
 
+    def test_cpu_jit_eviction(self):
+        """CPU JIT with a small code cache"""
+        cpu_jit_eviction(self)
+    test_cpu_jit_eviction.cputest = True
+
     def test_freecom_build(self):
         """FreeCOM build script"""
         if environ.get("SKIP_EXPENSIVE"):
@@ -4901,6 +4953,40 @@ $_floppy_a = ""
         self.assertNotIn('Timeout', results)
         self.assertIn('NonZeroReturn:53', results)
 
+    def test_stdin_from_file(self):
+        """Keyboard input from a redirected stdin file"""
+
+        self.mkcom_with_ia16("readln", r"""
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+  char buf[80];
+
+  if (fgets(buf, sizeof(buf), stdin))
+    printf("got: %s\n", buf);
+  return 0;
+}
+""")
+
+        self.mkfile("testit.bat", """\
+readln
+rem end
+""", newline="\r\n")
+
+        # a regular file can't be polled, it must still be read
+        stdin = self.workdir / "stdin.txt"
+        stdin.write_bytes(b"piped line\r")
+        with open(stdin, "rb") as f:
+            results = self.runDosemuCmdline(["-E", "testit.bat"], stdin=f,
+                                            config="""\
+$_hdimage = "dXXXXs/c:hdtype1 +1"
+$_floppy_a = ""
+""")
+
+        self.assertNotIn('Timeout', results)
+        self.assertIn("got: piped line", results)
+
     def test_pit_mode_2(self):
         """PIT Mode 2"""
         if environ.get("SKIP_EXPENSIVE"):
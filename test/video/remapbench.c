@@ -0,0 +1,281 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: remapper benchmark. Times every registered RemapFuncDesc of
+ * remap.c and remap_simd.c on a frame of random data, for every source
+ * and destination mode it takes, at 1x and, if it scales, at 2x and
+ * 2.5x. The source ends at a guard page, so a kernel that reads past
+ * it crashes. The output of an optimized function must be the same as
+ * the one of the generic function it replaces.
+ *
+ * Usage: remapbench [ms per case] [function name]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "emu.h"
+#include "vgaemu.h"
+#include "render.h"
+#include "remap_priv.h"
+#include "render_priv.h"
+
+#define RO(p) (*(RemapObject **)p)
+
+static const struct {
+  int mode;
+  const char *name;
+  int width, height, scan_len, size;
+} src_modes[] = {
+  { MODE_PSEUDO_8, "pseudo8", 320, 200, 320, 320 * 200 },
+  { MODE_VGA_X, "vga_x", 320, 240, 80, 0x40000 },
+  { MODE_VGA_1, "vga1", 640, 480, 80, 0x40000 },
+  { MODE_VGA_2, "vga2", 640, 480, 80, 0x40000 },
+  { MODE_VGA_4, "vga4", 640, 480, 80, 0x40000 },
+  { MODE_CGA_1, "cga1", 640, 200, 80, 0x4000 },
+  { MODE_CGA_2, "cga2", 320, 200, 80, 0x4000 },
+  { MODE_HERC, "herc", 720, 348, 90, 0x8000 },
+  { MODE_TRUE_15, "true15", 640, 480, 1280, 1280 * 480 },
+  { MODE_TRUE_16, "true16", 640, 480, 1280, 1280 * 480 },
+  { MODE_TRUE_24, "true24", 640, 480, 1920, 1920 * 480 },
+  { MODE_TRUE_32, "true32", 640, 480, 2560, 2560 * 480 },
+};
+
+static const struct {
+  int mode;
+  const char *name;
+  int bytes;
+  ColorSpaceDesc csd;
+} dst_modes[] = {
+  { MODE_PSEUDO_8, "pseudo8", 1, { 8, 0, 0, 0, 36, 6, 1, 6, 6, 6 } },
+  { MODE_TRUE_8, "true8", 1, { 8, 0, 0, 0, 36, 6, 1, 6, 6, 6 } },
+  { MODE_TRUE_15, "true15", 2,
+    { 16, 0x7c00, 0x3e0, 0x1f, 10, 5, 0, 5, 5, 5 } },
+  { MODE_TRUE_16, "true16", 2,
+    { 16, 0xf800, 0x7e0, 0x1f, 11, 5, 0, 5, 6, 5 } },
+  { MODE_TRUE_24, "true24", 3,
+    { 24, 0xff0000, 0xff00, 0xff, 16, 8, 0, 8, 8, 8 } },
+  { MODE_TRUE_32, "true32", 4,
+    { 32, 0xff0000, 0xff00, 0xff, 16, 8, 0, 8, 8, 8 } },
+};
+
+/* scale factors as num / 2 */
+static const int scales[] = { 2, 4, 5 };
+
+static struct remap_calls *rm;
+static unsigned char *src_buf[sizeof(src_modes) / sizeof(src_modes[0])];
+static int ms = 20;
+
+/* what remap.c needs from the rest of dosemu */
+int register_remapper(struct remap_calls *calls, int prio)
+{
+  rm = calls;
+  return 0;
+}
+
+void dirty_all_vga_colors(void)
+{
+}
+
+int find_supported_modes(unsigned dst_mode)
+{
+  return 0;
+}
+
+void ___error(const char *fmt, ...)
+{
+  va_list args;
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+int log_printf(const char *fmt, ...)
+{
+  return 0;
+}
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+
+static double elapsed_ms(const struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) * 1000.0 +
+	  (t1.tv_nsec - t0->tv_nsec) / 1000000.0;
+}
+
+/* random source data that ends right at a PROT_NONE page */
+static unsigned char *guarded_alloc(int size)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  long len = (size + page - 1) / page * page;
+  unsigned char *p;
+  int i;
+
+  p = mmap(NULL, len + page, PROT_READ | PROT_WRITE,
+	   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  mprotect(p + len, page, PROT_NONE);
+  p += len - size;
+  for(i = 0; i < size; i++) p[i] = rand();
+  return p;
+}
+
+/*
+ * Remaps frames with rfd until ms have passed, returns the us per
+ * frame or -1 if remap.c does not pick rfd for it. *hash is that of
+ * the last frame.
+ */
+static double run_case(RemapFuncDesc *rfd, int s, int d, int scale,
+    unsigned *hash)
+{
+  int w = src_modes[s].width * scale / 2, h = src_modes[s].height * scale / 2;
+  int scan = w * dst_modes[d].bytes;
+  struct bitmap_desc src = BMP(src_buf[s], src_modes[s].width,
+      src_modes[s].height, src_modes[s].scan_len);
+  struct bitmap_desc dst;
+  struct timespec t0;
+  RemapObject *ro;
+  void *p;
+  int i, frames = 0;
+  double t;
+
+  dst = BMP(calloc(h, scan), w, h, scan);
+  p = rm->init(dst_modes[d].mode, rfd->flags & (RFF_LIN_FILT | RFF_BILIN_FILT),
+      &dst_modes[d].csd, 0);
+  rm->remap_mem(p, src, src_modes[s].mode, 0, 0, src_modes[s].size, dst);
+  for(i = 0; i < 256; i++)
+    rm->palette_update(p, i, 6, i & 63, (i * 7) & 63, (i * 13) & 63);
+
+  /* make remap.c choose rfd on the next resize */
+  ro = RO(p);
+  ro->func_all = ro->func_1 = ro->func_2 = rfd;
+  ro->state &= ~(ROS_SCALE_ALL | ROS_SCALE_1 | ROS_SCALE_2);
+  ro->state |= rfd->flags & RFF_SCALE_1 ? ROS_SCALE_1 : ROS_SCALE_ALL;
+  ro->dst_width = 0;
+  rm->remap_mem(p, src, src_modes[s].mode, 0, 0, src_modes[s].size, dst);
+  ro = RO(p);
+  if(ro->remap_func != rfd->func) {
+    rm->done(p);
+    free(dst.img);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  do {
+    rm->remap_mem(p, src, src_modes[s].mode, 0, 0, src_modes[s].size, dst);
+    frames++;
+  } while((t = elapsed_ms(&t0)) < ms);
+
+  for(*hash = 2166136261u, i = 0; i < h * scan; i++)
+    *hash = (*hash ^ dst.img[i]) * 16777619;
+  rm->done(p);
+  free(dst.img);
+  return t * 1000 / frames;
+}
+
+/* the generic function that rfd replaces, one that scales if none */
+static RemapFuncDesc *generic_func(RemapFuncDesc *list, RemapFuncDesc *rfd,
+    int s, int d)
+{
+  const unsigned filt = RFF_LIN_FILT | RFF_BILIN_FILT;
+  RemapFuncDesc *gen, *any = NULL;
+
+  for(gen = list; gen; gen = gen->next) {
+    if(!(gen->flags & RFF_OPT_PENTIUM) &&
+       (gen->flags & filt) == (rfd->flags & filt) &&
+       (gen->src_mode & src_modes[s].mode) &&
+       (gen->dst_mode & dst_modes[d].mode)) {
+      if((gen->flags ^ rfd->flags) & (RFF_SCALE_ALL | RFF_SCALE_1)) {
+	if(!any && (gen->flags & RFF_SCALE_ALL)) any = gen;
+	continue;
+      }
+      return gen;
+    }
+  }
+  return any;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *only = argc > 2 ? argv[2] : NULL;
+  RemapFuncDesc *list, *rfd, *gen;
+  unsigned hash, gen_hash, pixel;
+  void *p;
+  int s, d, k, cases = 0, bad = 0;
+  double us, gen_us;
+
+  if(argc > 1)
+    ms = atoi(argv[1]);
+  remapper_register();
+  for(s = 0; s < sizeof(src_modes) / sizeof(src_modes[0]); s++)
+    src_buf[s] = guarded_alloc(src_modes[s].size);
+  /* the first remap chains the lists of all remappers */
+  p = rm->init(MODE_TRUE_32, 0, &dst_modes[5].csd, 0);
+  rm->remap_mem(p, BMP(src_buf[0], 1, 1, 1), MODE_PSEUDO_8, 0, 0, 1,
+		BMP((unsigned char *) &pixel, 1, 1, 4));
+  rm->done(p);
+  list = remap_simd();
+
+  for(rfd = list; rfd; rfd = rfd->next) {
+    if(only && strcmp(rfd->func_name, only))
+      continue;
+    for(s = 0; s < sizeof(src_modes) / sizeof(src_modes[0]); s++) {
+      if(!(rfd->src_mode & src_modes[s].mode))
+	continue;
+      for(d = 0; d < sizeof(dst_modes) / sizeof(dst_modes[0]); d++) {
+	if(!(rfd->dst_mode & dst_modes[d].mode))
+	  continue;
+	for(k = 0; k < sizeof(scales) / sizeof(scales[0]); k++) {
+	  if(scales[k] != 2 && !(rfd->flags & RFF_SCALE_ALL))
+	    continue;
+	  us = run_case(rfd, s, d, scales[k], &hash);
+	  if(us < 0)
+	    continue;
+	  cases++;
+	  printf("%-22s %-7s -> %-7s %3.1fx %9.1f us/frame", rfd->func_name,
+		 src_modes[s].name, dst_modes[d].name, scales[k] / 2.0, us);
+	  gen = rfd->flags & RFF_OPT_PENTIUM ?
+	    generic_func(list, rfd, s, d) : NULL;
+	  if(gen && (gen_us = run_case(gen, s, d, scales[k], &gen_hash)) > 0) {
+	    printf(", %.2fx %s", gen_us / us, gen->func_name);
+	    if(hash != gen_hash) {
+	      printf(" FAIL: output differs");
+	      bad++;
+	    }
+	  }
+	  printf("\n");
+	  fflush(stdout);
+	}
+      }
+    }
+  }
+
+  printf("%s: %i cases, %i errors\n", bad ? "FAIL" : "OK", cases, bad);
+  return bad || !cases;
+}